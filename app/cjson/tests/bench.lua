@@ -7,11 +7,25 @@
 --
 -- Mark Pulford <mark@kyne.com.au>
 
-local json_module = os.getenv("JSON_MODULE") or "cjson"
-
-require "socket"
-local json = require(json_module)
-local util = require "cjson.util"
+-- On the NodeMCU host build (tools/host) the built-in cjson module is
+-- measured with host.clock():
+--
+--   tools/host/nodemcu app/cjson/tests/bench.lua app/cjson/tests/*.json
+
+local json_module, json, gettime, file_load
+
+if host then
+    json_module = "cjson"
+    json = cjson
+    gettime = host.clock
+    file_load = host.readfile
+else
+    json_module = os.getenv("JSON_MODULE") or "cjson"
+    require "socket"
+    json = require(json_module)
+    gettime = socket.gettime
+    file_load = require("cjson.util").file_load
+end
 
 local function find_func(mod, funcnames)
     for _, v in ipairs(funcnames) do
@@ -36,13 +50,13 @@ end
 
 function benchmark(tests, seconds, rep)
     local function bench(func, iter)
-        -- Use socket.gettime() to measure microsecond resolution
+        -- Use socket.gettime() or host.clock() to measure microsecond resolution
         -- wall clock time.
-        local t = socket.gettime()
+        local t = gettime()
         for i = 1, iter do
             func(i)
         end
-        t = socket.gettime() - t
+        t = gettime() - t
 
         -- Don't trust any results when the run lasted for less than a
         -- millisecond - return nil.
@@ -97,7 +111,7 @@ function benchmark(tests, seconds, rep)
 end
 
 function bench_file(filename)
-    local data_json = util.file_load(filename)
+    local data_json = file_load(filename)
     local data_obj = json_decode(data_json)
 
     local function test_encode()
@@ -111,14 +125,26 @@ function bench_file(filename)
     if json_encode then tests.encode = test_encode end
     if json_decode then tests.decode = test_decode end
 
+    -- NodeMCU: decode with the document as template, into fresh tables
+    -- and into the same tables again
+    if json.compile and type(data_obj) == "table" then
+        local schema = json.compile(data_obj)
+        local target = schema:decode(data_json)
+        tests.decode_compiled = function () schema:decode(data_json) end
+        tests.decode_reuse = function () schema:decode(data_json, target) end
+    end
+
     return benchmark(tests, 0.1, 5)
 end
 
 -- Optionally load any custom configuration required for this module
-local success, data = pcall(util.file_load, ("bench-%s.lua"):format(json_module))
-if success then
-    util.run_script(data, _G)
-    configure(json)
+if not host then
+    local util = require "cjson.util"
+    local success, data = pcall(util.file_load, ("bench-%s.lua"):format(json_module))
+    if success then
+        util.run_script(data, _G)
+        configure(json)
+    end
 end
 
 for i = 1, #arg do
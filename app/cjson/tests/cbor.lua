@@ -0,0 +1,199 @@
+-- Tests for the cbor module
+--
+-- Encodings are checked against the examples of RFC 7049 appendix A, and
+-- the JSON test documents must survive a CBOR round trip unchanged.
+--
+--   dofile("cbor.lua")
+--
+-- On the host build, run from this directory:
+--
+--   ../../../tools/host/nodemcu cbor.lua
+
+local function compare_values(a, b)
+    if type(a) ~= type(b) then return false end
+    if type(a) ~= "table" then return a == b or (a ~= a and b ~= b) end
+    for k, v in pairs(a) do
+        if not compare_values(v, b[k]) then return false end
+    end
+    for k in pairs(b) do
+        if a[k] == nil then return false end
+    end
+    return true
+end
+
+local function errmsg(f, ...)
+    local ok, err = pcall(f, ...)
+    if ok then return "no error" end
+    return (tostring(err):gsub("^.-:%d+: ", ""))
+end
+
+local function hex(s)
+    return (s:gsub(".", function (c) return ("%02x"):format(c:byte()) end))
+end
+
+local function unhex(h)
+    return (h:gsub("..", function (x) return string.char(tonumber(x, 16)) end))
+end
+
+-- A -0.0 literal would be folded into the constant 0
+local zero = 0
+
+-- Value, preferred encoding; integral floats go out as integers
+local rfc = {
+    { 0, "00" }, { 1, "01" }, { 10, "0a" }, { 23, "17" }, { 24, "1818" },
+    { 25, "1819" }, { 100, "1864" }, { 1000, "1903e8" },
+    { 1000000, "1a000f4240" }, { 1000000000000, "1b000000e8d4a51000" },
+    { -1, "20" }, { -10, "29" }, { -100, "3863" }, { -1000, "3903e7" },
+    { 0.5, "f93800" }, { -zero, "f98000" }, { 1.5, "f93e00" },
+    { 65504.0, "19ffe0" }, { 100000.5, "fa47c35040" },
+    { 3.4028234663852886e+38, "fa7f7fffff" }, { 1.1, "fb3ff199999999999a" },
+    { 5.960464477539063e-8, "f90001" }, { 0.00006103515625, "f90400" },
+    { -4.1, "fbc010666666666666" }, { 1/0, "f97c00" }, { -1/0, "f9fc00" },
+    { false, "f4" }, { true, "f5" }, { cbor.null, "f6" },
+    { "", "60" }, { "a", "6161" }, { "IETF", "6449455446" },
+    { "\"\\", "62225c" }, { "\195\188", "62c3bc" },
+    { "\230\176\180", "63e6b0b4" }, { "\240\144\133\145", "64f0908591" },
+    { "\255\1\2\3", "44ff010203" },
+    { { 1, 2, 3 }, "83010203" },
+    { { 1, { 2, 3 }, { 4, 5 } }, "8301820203820405" },
+    { { a = 1 }, "a1616101" },
+}
+
+local tests = {
+    { "RFC 7049 examples encode", function ()
+        for _, v in ipairs(rfc) do
+            if hex(cbor.encode(v[1])) ~= v[2] then
+                return false, v[2] .. " got " .. hex(cbor.encode(v[1]))
+            end
+        end
+        return true
+    end },
+    { "RFC 7049 examples decode", function ()
+        for _, v in ipairs(rfc) do
+            local value, pos = cbor.decode(unhex(v[2]))
+            if not compare_values(value, v[1]) or pos ~= #v[2] / 2 + 1 then
+                return false, v[2]
+            end
+        end
+        return true
+    end },
+    { "Other encodings decode", function ()
+        local cases = {
+            { "1b0000000000000000", 0 }, { "f97e00", 0/0 },
+            { "fa7fc00000", 0/0 }, { "f97bff", 65504 }, { "f7", cbor.null },
+            { "c11a514b67b0", 1363896240 },       -- tags are skipped
+            { "5f42010243030405ff", "\1\2\3\4\5" },
+            { "7f657374726561646d696e67ff", "streaming" },
+            { "9fff", {} }, { "9f018202039f0405ffff", { 1, { 2, 3 }, { 4, 5 } } },
+            { "bf61610161629f0203ffff", { a = 1, b = { 2, 3 } } },
+            { "a201020304", { [1] = 2, [3] = 4 } },
+        }
+        for _, v in ipairs(cases) do
+            if not compare_values(cbor.decode(unhex(v[1])), v[2]) then
+                return false, v[1]
+            end
+        end
+        return true
+    end },
+    { "Binary strings", function ()
+        local s = ""
+        for i = 0, 255 do s = s .. string.char(i) end
+        return hex(cbor.encode(s):sub(1, 3)) == "590100"
+            and cbor.decode(cbor.encode(s)) == s
+            and hex(cbor.encode("\237\160\128")) == "43eda080"   -- surrogate
+            and hex(cbor.encode("\192\128")) == "42c080"         -- overlong
+    end },
+    { "Sparse arrays", function ()
+        local ok = hex(cbor.encode({ [1] = 1, [3] = 3 })) == "8301f603"
+        local t = { [1] = 1, [40] = 40 }
+        ok = ok and errmsg(cbor.encode, t) ==
+            "Cannot serialise table: excessively sparse array"
+        cbor.encode_sparse_array(true)
+        ok = ok and compare_values(cbor.decode(cbor.encode(t)), t)
+        cbor.encode_sparse_array(false)
+        return ok
+    end },
+    { "Nesting limits [throw error]", function ()
+        local t = {} t[1] = t
+        local ok = errmsg(cbor.encode, t) == "Cannot serialise, excessive nesting (1001)"
+        cbor.encode_max_depth(3)
+        ok = ok and hex(cbor.encode({ { { 1 } } })) == "81818101"
+            and errmsg(cbor.encode, { { { { 1 } } } }) ==
+                "Cannot serialise, excessive nesting (4)"
+        cbor.encode_max_depth(1000)
+        cbor.decode_max_depth(2)
+        ok = ok and errmsg(cbor.decode, unhex("81818101")) ==
+            "Found too many nested data structures (3) at byte 3"
+        cbor.decode_max_depth(1000)
+        return ok
+    end },
+    { "Bad input [throw error]", function ()
+        return errmsg(cbor.decode, unhex("1a0001")) == "Truncated CBOR data at byte 2"
+            and errmsg(cbor.decode, unhex("830102")) == "Truncated CBOR data at byte 4"
+            and errmsg(cbor.decode, unhex("ff")) == "Unexpected break in CBOR data at byte 1"
+            and errmsg(cbor.decode, unhex("1c")) == "Invalid CBOR data at byte 1"
+            and errmsg(cbor.decode, unhex("5f6161ff")) == "Invalid CBOR data at byte 2"
+            and errmsg(cbor.decode, "") == "Truncated CBOR data at byte 1"
+            and errmsg(cbor.encode, { f = function () end }) ==
+                "Cannot serialise function: type not supported"
+    end },
+    { "Sequences", function ()
+        local s = cbor.encode(1) .. cbor.encode("two") .. cbor.encode({ 3 })
+        local a, pos = cbor.decode(s)
+        local b, pos2 = cbor.decode(s, pos)
+        local c, pos3 = cbor.decode(s, pos2)
+        return a == 1 and b == "two" and c[1] == 3 and pos3 == #s + 1
+    end },
+    { "Sinks", function ()
+        local t = { name = ("x"):rep(100), list = { 1, 2.5, "three", { true } } }
+        local whole = cbor.encode(t)
+        local parts, obj = {}, { parts = {} }
+        cbor.encode(t, function (s) parts[#parts + 1] = s end, 16)
+        function obj:write(s) self.parts[#self.parts + 1] = s end
+        cbor.encode(t, obj)
+        for _, s in ipairs(parts) do
+            if #s > 16 then return false end
+        end
+        return table.concat(parts) == whole and table.concat(obj.parts) == whole
+            and #parts == math.ceil(#whole / 16)
+            and errmsg(cbor.encode, t, function () return false end) ==
+                "CBOR sink failed"
+    end },
+    { "JSON documents round trip", function ()
+        local read = host and host.readfile or function (name)
+            file.open(name, "r")
+            local s, data = {}, file.read()
+            while data do s[#s + 1] = data data = file.read() end
+            file.close()
+            return table.concat(s)
+        end
+        for _, name in ipairs({ "example1.json", "example2.json", "example3.json",
+                                "example4.json", "example5.json", "numbers.json",
+                                "rfc-example1.json", "rfc-example2.json",
+                                "types.json" }) do
+            local v = cjson.decode(read(name))
+            if not compare_values(cbor.decode(cbor.encode(v)), v) then
+                return false, name
+            end
+        end
+        return true
+    end },
+}
+
+local pass = 0
+for i, t in ipairs(tests) do
+    local ok, res, info = pcall(t[2])
+    if ok and res then
+        pass = pass + 1
+    else
+        print(("==> Test [%d] %s: FAIL %s"):format(i, t[1], tostring(info or res)))
+    end
+end
+
+if pass == #tests then
+    print("==> Summary: all tests succeeded")
+else
+    print(("==> Summary: %d/%d tests failed"):format(#tests - pass, #tests))
+end
+
+-- vi:ai et sw=4 ts=4:
@@ -0,0 +1,72 @@
+-- Size and speed of cbor against cjson on the JSON test documents
+--
+-- Every document is decoded with cjson once, then the value is encoded and
+-- decoded again with both modules. Rates are operations per second.
+--
+-- On the host build (tools/host), from this directory:
+--
+--   ../../../tools/host/nodemcu cbor_bench.lua *.json
+--
+-- On the device, with the documents uploaded:
+--
+--   arg = { "example1.json", "example2.json" } dofile("cbor_bench.lua")
+
+local gettime, file_load
+
+if host then
+    gettime = host.clock
+    file_load = host.readfile
+else
+    gettime = function () return tmr.now() / 1e6 end
+    file_load = function (name)
+        local parts = {}
+        file.open(name, "r")
+        local s = file.read()
+        while s do
+            parts[#parts + 1] = s
+            s = file.read()
+        end
+        file.close()
+        return table.concat(parts)
+    end
+end
+
+-- Runs of at least `seconds`, as many as needed to measure
+local function rate(func, seconds)
+    local iter = 1
+    func()
+    while true do
+        local t = gettime()
+        for _ = 1, iter do func() end
+        t = gettime() - t
+        if t >= seconds then
+            return iter / t
+        end
+        iter = iter * (t > 0.01 and math.ceil(seconds / t) or 10)
+    end
+end
+
+local seconds = host and 0.2 or 1
+
+print(("%-20s %8s %8s %5s %10s %10s %10s %10s"):format("document",
+    "json", "cbor", "size", "json enc", "cbor enc", "json dec", "cbor dec"))
+
+for _, name in ipairs(arg) do
+    local text = file_load(name)
+    local ok, value = pcall(cjson.decode, text)
+    if ok and type(value) == "table" then
+        local json = cjson.encode(value)
+        local bin = cbor.encode(value)
+        local r = {
+            rate(function () cjson.encode(value) end, seconds),
+            rate(function () cbor.encode(value) end, seconds),
+            rate(function () cjson.decode(json) end, seconds),
+            rate(function () cbor.decode(bin) end, seconds),
+        }
+        print(("%-20s %8d %8d %4d%% %10.0f %10.0f %10.0f %10.0f"):format(
+            name:match("[^/]*$"), #json, #bin, math.floor(100 * #bin / #json + 0.5),
+            r[1], r[2], r[3], r[4]))
+    end
+end
+
+-- vi:ai et sw=4 ts=4:
@@ -0,0 +1,119 @@
+-- Tests for decoding with compiled templates, cjson.compile()
+--
+-- Every document must decode to the same value as with cjson.decode(),
+-- whether it matches the template or not, and reused tables must end up
+-- equal to a fresh decode.
+--
+--   dofile("compile.lua")
+
+local json = cjson
+
+local function compare_values(a, b)
+    if type(a) ~= type(b) then return false end
+    if type(a) ~= "table" then return a == b end
+    for k, v in pairs(a) do
+        if not compare_values(v, b[k]) then return false end
+    end
+    for k in pairs(b) do
+        if a[k] == nil then return false end
+    end
+    return true
+end
+
+local function errmsg(f, ...)
+    local ok, err = pcall(f, ...)
+    if ok then return "no error" end
+    return (tostring(err):gsub("^.-:%d+: ", ""))
+end
+
+local reading = {
+    id = 0, name = "", tags = { "" },
+    main = { temp = 0, humidity = 0 },
+    list = { { t = 0, v = 0 } }
+}
+
+local docs = {
+    '{"id":1,"name":"a","tags":["x","y"],"main":{"temp":21.5,"humidity":40},' ..
+        '"list":[{"t":1,"v":2},{"t":3,"v":4}]}',
+    -- other key order, extra and missing keys
+    '{"main":{"humidity":41,"wind":3},"name":"b","extra":[1,{"id":2}],"id":2,' ..
+        '"list":[{"v":5}]}',
+    -- values of other types than in the template
+    '{"id":"three","tags":{"a":1},"main":[1,2],"list":null}',
+    '{"id":4,"list":[],"main":{},"tags":["z"]}',
+    '{"name":"\\u00e9\\n","main":{"temp":-1}}',
+    '[1,2,{"id":3}]',
+    '"just a string"',
+    '{}',
+}
+
+local tests = {
+    { "Same result as cjson.decode()", function ()
+        for _, template in ipairs({ reading, {}, { 0 }, { a = { b = { c = 0 } } } }) do
+            local schema = json.compile(template)
+            for i, doc in ipairs(docs) do
+                if not compare_values(schema:decode(doc), json.decode(doc)) then
+                    return false, "document " .. i
+                end
+            end
+        end
+        return true
+    end },
+    { "Decode into a reused table", function ()
+        local schema = json.compile(reading)
+        local target = {}
+        for round = 1, 2 do
+            for i, doc in ipairs(docs) do
+                local res = schema:decode(doc, target)
+                if not compare_values(res, json.decode(doc)) then
+                    return false, "round " .. round .. " document " .. i
+                end
+                if type(res) == "table" and doc:sub(1, 1) == "{" then
+                    if res ~= target then return false, "not reused " .. i end
+                    target = res
+                end
+            end
+        end
+        return true
+    end },
+    { "Nested tables are reused", function ()
+        local schema = json.compile(reading)
+        local t = schema:decode(docs[1])
+        local main, list, item = t.main, t.list, t.list[1]
+        schema:decode(docs[2], t)
+        return t.main == main and t.list == list and t.list[1] == item
+            and t.list[2] == nil and t.tags == nil and t.extra ~= nil
+    end },
+    { "Template given as JSON", function ()
+        local schema = json.compile('{"id":0,"main":{"temp":0}}')
+        return compare_values(schema:decode(docs[1]), json.decode(docs[1]))
+    end },
+    { "Syntax error [throw error]", function ()
+        return errmsg(json.compile(reading).decode, json.compile(reading),
+            '{"id":1,"main":{"temp" 2}}')
+            == "Expected colon but found T_NUMBER at character 24"
+    end },
+    { "Bad template [throw error]", function ()
+        local t = {} t.self = t
+        return errmsg(json.compile, 5):find("table expected") ~= nil
+            and errmsg(json.compile, t) == "template nested too deeply"
+    end },
+}
+
+local pass = 0
+for i, t in ipairs(tests) do
+    local ok, res, info = pcall(t[2])
+    if ok and res then
+        pass = pass + 1
+    else
+        print(("==> Test [%d] %s: FAIL %s"):format(i, t[1], tostring(info or res)))
+    end
+end
+
+if pass == #tests then
+    print("==> Summary: all tests succeeded")
+else
+    print(("==> Summary: %d/%d tests failed"):format(#tests - pass, #tests))
+end
+
+-- vi:ai et sw=4 ts=4:
@@ -0,0 +1,221 @@
+-- Tests for the streaming decoder and encoder, cjson.decoder(),
+-- cjson.encoder() and cjson.encode() with a sink
+--
+-- Every document is fed in all possible two-chunk splits and one byte at a
+-- time; the events must not depend on where the chunk boundaries fall.
+-- Encoded output must not depend on the chunk size.
+-- Runs on the device (upload the *.json files next to it) or on any Lua
+-- with the NodeMCU file API:
+--
+--   dofile("stream.lua")
+
+local json = cjson
+
+local function file_load(name)
+    assert(file.open(name, "r"), "cannot open " .. name)
+    local parts = {}
+    while true do
+        local s = file.read()
+        if not s then break end
+        parts[#parts + 1] = s
+    end
+    file.close()
+    return table.concat(parts)
+end
+
+local function compare_values(a, b)
+    if type(a) ~= type(b) then return false end
+    if type(a) ~= "table" then return a == b end
+    for k, v in pairs(a) do
+        if not compare_values(v, b[k]) then return false end
+    end
+    for k in pairs(b) do
+        if a[k] == nil then return false end
+    end
+    return true
+end
+
+-- Feed doc to a new decoder in pieces of the given sizes (the last piece
+-- takes the rest), return the list of events
+local function run(doc, sizes, select)
+    local events = {}
+    local d = json.decoder(function(path, value)
+        events[#events + 1] = { path, value }
+    end, select)
+    local pos = 1
+    for _, n in ipairs(sizes) do
+        d:write(doc:sub(pos, pos + n - 1))
+        pos = pos + n
+    end
+    d:finish(doc:sub(pos))
+    return events
+end
+
+local function bytewise(doc)
+    local sizes = {}
+    for i = 1, #doc do sizes[i] = 1 end
+    return sizes
+end
+
+-- Compare the events for every split of doc against one chunk
+local function check_splits(doc, select)
+    local ref = run(doc, {}, select)
+    for i = 1, #doc - 1 do
+        if not compare_values(ref, run(doc, { i }, select)) then
+            return false, "split at " .. i
+        end
+    end
+    if not compare_values(ref, run(doc, bytewise(doc), select)) then
+        return false, "bytewise"
+    end
+    return true
+end
+
+-- Subtrees selected with "*" must equal what cjson.decode() builds
+local function check_subtrees(doc)
+    local ref = json.decode(doc)
+    local ok, err = check_splits(doc, "*")
+    if not ok then return ok, err end
+    local got = {}
+    for _, ev in ipairs(run(doc, {}, "*")) do
+        local k = ev[1]
+        if ref[k] == nil then k = tonumber(k) end
+        got[k] = ev[2]
+    end
+    if type(ref) ~= "table" then
+        return #run(doc, {}, "*") == 0
+    end
+    return compare_values(ref, got), "subtree mismatch"
+end
+
+-- Chunked output must join up to what cjson.encode() returns
+local function check_encode(doc)
+    local value = json.decode(doc)
+    local ref = json.encode(value)
+    for _, size in ipairs({ 1, 2, 7, 64, 1024 }) do
+        local parts = {}
+        json.encode(value, function (s) parts[#parts + 1] = s end, size)
+        for i = 1, #parts - 1 do
+            if #parts[i] ~= size then return false, "chunk size " .. size end
+        end
+        if table.concat(parts) ~= ref then return false, "sink " .. size end
+
+        local enc = json.encoder(value, size)
+        parts = {}
+        while true do
+            local s = enc:read()
+            if not s then break end
+            parts[#parts + 1] = s
+        end
+        if table.concat(parts) ~= ref then return false, "encoder " .. size end
+    end
+    return true
+end
+
+local function errmsg(f, ...)
+    local ok, err = pcall(f, ...)
+    if ok then return "no error" end
+    return (tostring(err):gsub("^.-:%d+: ", ""))
+end
+
+local fixtures = {
+    "example1.json", "example2.json", "example3.json", "example4.json",
+    "example5.json", "numbers.json", "rfc-example1.json", "rfc-example2.json",
+    "types.json"
+}
+
+local tests = {
+    { "Scalar events with paths", function ()
+        return compare_values(run('{"a":[1,{"b":"x"}],"c":true}', {}), {
+            { "a.1", 1 }, { "a.2.b", "x" }, { "c", true } })
+    end },
+    { "Top level scalar", function ()
+        return compare_values(run(' 12.5 ', { 3 }), { { "", 12.5 } })
+    end },
+    { "Number split across chunks", function ()
+        return compare_values(run('[1234]', { 3 }), { { "1", 1234 } })
+    end },
+    { "Literal split across chunks", function ()
+        return compare_values(run('{"k":false}', { 7 }), { { "k", false } })
+    end },
+    { "Surrogate pair split across chunks", function ()
+        return check_splits('["\\uD834\\uDD1E \\" \\\\"]')
+    end },
+    { "Selected subtrees", function ()
+        return compare_values(
+            run('{"list":[{"id":1,"v":[1,2]},{"id":2}],"n":3}', { 5 }, "list.*.v"),
+            { { "list.1.v", { 1, 2 } } })
+    end },
+    { "Selected scalars with wildcards", function ()
+        return compare_values(
+            run('{"list":[{"id":1},{"id":2}],"id":3}', { 9 }, { "list.*.id", "id" }),
+            { { "list.1.id", 1 }, { "list.2.id", 2 }, { "id", 3 } })
+    end },
+    { "Empty containers", function ()
+        return compare_values(run('{"a":{},"b":[]}', {}, { "a", "b" }),
+            { { "a", {} }, { "b", {} } })
+    end },
+    { "Incomplete document [throw error]", function ()
+        return errmsg(run, '{ "unexpected eof": ', {})
+            == "Expected value but found T_END at character 21"
+    end },
+    { "Unterminated string [throw error]", function ()
+        return errmsg(run, '["abc', { 2 })
+            == "Expected value but found unexpected end of string at character 6"
+    end },
+    { "Extra data [throw error]", function ()
+        return errmsg(run, '{ "extra data": true }, false', { 10 })
+            == "Expected the end but found T_COMMA at character 23"
+    end },
+    { "Error position across chunks [throw error]", function ()
+        return errmsg(run, '[1, 2,, 3]', { 4, 2 })
+            == "Expected value but found T_COMMA at character 7"
+    end },
+    { "Decoder unusable after an error", function ()
+        local d = json.decoder(function () end)
+        pcall(d.write, d, '[1,,')
+        return errmsg(d.write, d, '2]') == "decoder busy or failed"
+    end },
+    { "Encode to an object with a write method", function ()
+        local sink = { n = 0 }
+        function sink:write(s) self.n = self.n + #s return true end
+        json.encode({ "a", { b = 1 } }, sink, 3)
+        return sink.n == #json.encode({ "a", { b = 1 } })
+    end },
+    { "Encode to a failing sink [throw error]", function ()
+        return errmsg(json.encode, { 1, 2 }, function () return false end)
+            == "JSON sink failed"
+    end },
+    { "Encoder error surfaces on read [throw error]", function ()
+        local enc = json.encoder({ 1, { function () end } }, 1)
+        local err
+        repeat err = errmsg(enc.read, enc) until err ~= "no error"
+        return err == "Cannot serialise function: type not supported"
+            and errmsg(enc.read, enc) == "encoder busy or failed"
+    end },
+}
+
+for _, name in ipairs(fixtures) do
+    local doc = file_load(name)
+    tests[#tests + 1] = { "Chunk boundaries " .. name, check_splits, doc }
+    tests[#tests + 1] = { "Subtrees " .. name, check_subtrees, doc }
+    tests[#tests + 1] = { "Chunked encode " .. name, check_encode, doc }
+end
+
+local pass = 0
+for i, t in ipairs(tests) do
+    local ok, res, info = pcall(t[2], t[3])
+    if ok and res then
+        pass = pass + 1
+    else
+        print(("==> Test [%d] %s: FAIL %s"):format(i, t[1], tostring(info or res)))
+    end
+end
+
+if pass == #tests then
+    print("==> Summary: all tests succeeded")
+else
+    print(("==> Summary: %d/%d tests failed"):format(#tests - pass, #tests))
+end
+
+-- vi:ai et sw=4 ts=4:
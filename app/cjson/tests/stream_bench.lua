@@ -0,0 +1,101 @@
+-- Peak memory of cjson.decode() versus the streaming decoder
+--
+-- A response of `records` objects arrives in `chunk` byte pieces, like a
+-- HTTP body from a socket. cjson.decode() needs the pieces joined and builds
+-- the whole tree; cjson.decoder() takes each piece as it comes and either
+-- reports every value or builds only the selected fields.
+--
+--   dofile("stream_bench.lua")
+--
+-- Peaks are sampled from node.heap() on the device and the host build (Lua
+-- heap plus C buffers), or from collectgarbage("count") elsewhere.
+
+local records, chunk = 60, 256
+
+local function make_doc()
+    local parts = {}
+    for i = 1, records do
+        parts[i] = ('{"id":%d,"name":"sensor-%d","tags":["a","b","c"],' ..
+            '"main":{"temp":%d.5,"humidity":%d,"pressure":1013},' ..
+            '"note":"%s"}'):format(i, i, i % 30, i % 100, ("x"):rep(40))
+    end
+    return '{"count":' .. records .. ',"list":[' .. table.concat(parts, ",") .. ']}'
+end
+
+local used
+if node and node.heap then
+    used = function () return -node.heap() end
+else
+    used = function () return collectgarbage("count") * 1024 end
+end
+
+local base, peak
+local function reset()
+    collectgarbage("collect")
+    base = used()
+    peak = base
+end
+local function sample()
+    local u = used()
+    if u > peak then peak = u end
+end
+
+-- The document only exists in pieces, as if it was being received
+local doc = make_doc()
+local pieces = {}
+for i = 1, #doc, chunk do
+    pieces[#pieces + 1] = doc:sub(i, i + chunk - 1)
+end
+doc = nil
+
+local function bench_decode()
+    local buf = {}
+    for i, s in ipairs(pieces) do
+        buf[i] = s
+        sample()
+    end
+    local t = cjson.decode(table.concat(buf))
+    sample()
+    return #t.list
+end
+
+local function bench_events()
+    local n = 0
+    local d = cjson.decoder(function (path, value)
+        n = n + 1
+        sample()
+    end)
+    for _, s in ipairs(pieces) do
+        d:write(s)
+        sample()
+    end
+    d:finish()
+    return n
+end
+
+local function bench_select()
+    local temps = {}
+    local d = cjson.decoder(function (path, value)
+        temps[#temps + 1] = value
+        sample()
+    end, "list.*.main.temp")
+    for _, s in ipairs(pieces) do
+        d:write(s)
+        sample()
+    end
+    d:finish()
+    return #temps
+end
+
+print(("==> %d records, %d bytes in %d byte chunks"):format(
+    records, #table.concat(pieces), chunk))
+
+for _, b in ipairs({ { "cjson.decode()", bench_decode },
+                     { "decoder events", bench_events },
+                     { "decoder select", bench_select } }) do
+    reset()
+    local n = b[2]()
+    print(("%-16s %6d bytes peak (%d values)"):format(b[1], peak - base, n))
+end
+
+-- vi:ai et sw=4 ts=4:
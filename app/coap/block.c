@@ -0,0 +1,207 @@
+#include "c_string.h"
+#include "c_stdlib.h"
+#include "block.h"
+#include "hash.h"
+
+typedef struct
+{
+    uint32_t ip;
+    uint16_t port;
+    coap_key_t path;            /* hash of the Uri-Path options */
+    uint8_t *data;
+    size_t len;
+    size_t size;
+    uint32_t used;              /* for replacing the least recently used slot */
+} block1_slot_t;
+
+static block1_slot_t block1_slots[COAP_BLOCK1_SLOTS];
+static uint32_t block1_clock = 0;
+
+int coap_get_block(const coap_packet_t *pkt, uint8_t num, coap_block_t *block)
+{
+    const coap_option_t *opt;
+    uint8_t count;
+    uint32_t v;
+
+    if (NULL == (opt = coap_findOptions(pkt, num, &count)))
+        return 0;
+    if (opt->buf.len > 3)
+        return 0;
+    v = coap_decode_var_bytes(opt->buf.p, opt->buf.len);
+    block->num = v >> 4;
+    block->more = (v >> 3) & 1;
+    block->szx = v & 7;
+    if (block->szx > COAP_BLOCK_SZX_MAX)  // 7 is reserved (BERT, CoAP over TCP only)
+        return 0;
+    return 1;
+}
+
+int coap_add_block(coap_packet_t *pkt, uint8_t num, const coap_block_t *block, uint8_t *buf)
+{
+    uint32_t v = (block->num << 4) | (block->more ? 0x08 : 0) | block->szx;
+    return coap_add_option(pkt, num, buf, coap_encode_var_bytes(buf, v));
+}
+
+int coap_block2_slice(coap_packet_t *pkt, const coap_block_t *req, uint8_t szx, uint8_t *buf)
+{
+    coap_block_t b;
+    size_t size, offset, total = pkt->payload.len;
+
+    if (req) {
+        b = *req;
+        if (b.szx > szx) {
+            // a smaller block size than asked for, renumber to the same offset
+            b.num <<= b.szx - szx;
+            b.szx = szx;
+        }
+    } else {
+        if (total <= COAP_BLOCK_SIZE(szx))
+            return 0;
+        b.num = 0;
+        b.szx = szx;
+    }
+
+    size = COAP_BLOCK_SIZE(b.szx);
+    offset = b.num * size;
+    if (offset > 0 && offset >= total)
+        return COAP_ERR_UNSUPPORTED;
+
+    b.more = (total - offset > size);
+    pkt->payload.p += offset;
+    pkt->payload.len = b.more ? size : total - offset;
+
+    coap_add_block(pkt, COAP_OPTION_BLOCK2, &b, buf);
+    if (b.num == 0) {
+        buf += COAP_BLOCK_OPT_SIZE;
+        coap_add_option(pkt, COAP_OPTION_SIZE2, buf, coap_encode_var_bytes(buf, total));
+    }
+    return 0;
+}
+
+static void block1_release(block1_slot_t *s)
+{
+    if (s->data)
+        c_free(s->data);
+    c_memset(s, 0, sizeof(*s));
+}
+
+static block1_slot_t *block1_slot(uint32_t ip, uint16_t port, const coap_key_t path, int create)
+{
+    block1_slot_t *s, *lru = block1_slots;
+    int i;
+
+    for (i = 0; i < COAP_BLOCK1_SLOTS; i++) {
+        s = &block1_slots[i];
+        if (s->port == port && s->ip == ip && 0 == c_memcmp(s->path, path, sizeof(coap_key_t)))
+            return s;
+        if (s->used < lru->used)
+            lru = s;
+    }
+    if (!create)
+        return NULL;
+
+    block1_release(lru);
+    lru->ip = ip;
+    lru->port = port;
+    c_memcpy(lru->path, path, sizeof(coap_key_t));
+    return lru;
+}
+
+static int block1_error(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, block1_slot_t *s, coap_responsecode_t code)
+{
+    if (s)
+        block1_release(s);
+    coap_make_response(scratch, outpkt, NULL, 0, inpkt->hdr.id[0], inpkt->hdr.id[1], &inpkt->tok, code, COAP_CONTENTTYPE_NONE);
+    return COAP_BLOCK1_ANSWERED;
+}
+
+int coap_block1_receive(coap_rw_buffer_t *scratch, coap_packet_t *inpkt, coap_packet_t *outpkt, uint32_t ip, uint16_t port, coap_block_t *block, uint8_t *buf)
+{
+    const coap_option_t *opt;
+    uint8_t count, i;
+    coap_key_t path;
+    coap_block_t b;
+    block1_slot_t *s;
+    size_t need;
+
+    if (!coap_get_block(inpkt, COAP_OPTION_BLOCK1, &b))
+        return COAP_BLOCK1_NONE;
+
+    c_memset(path, 0, sizeof(path));
+    if (NULL != (opt = coap_findOptions(inpkt, COAP_OPTION_URI_PATH, &count))) {
+        for (i = 0; i < count; i++) {
+            uint8_t len = opt[i].buf.len;
+            coap_hash(&len, 1, path);
+            coap_hash(opt[i].buf.p, opt[i].buf.len, path);
+        }
+    }
+
+    s = block1_slot(ip, port, path, b.num == 0);
+    if (b.num == 0) {
+        s->len = 0;
+        opt = coap_findOptions(inpkt, COAP_OPTION_SIZE1, &count);
+        if (opt && coap_decode_var_bytes(opt->buf.p, opt->buf.len) > COAP_BLOCK1_MAX)
+            goto too_large;
+    } else if (!s || (b.num << (b.szx + 4)) != s->len) {
+        NODE_DBG("block1: block %d out of sequence\n", b.num);
+        return block1_error(scratch, inpkt, outpkt, s, COAP_RSPCODE_REQUEST_ENTITY_INCOMPLETE);
+    }
+
+    if (b.more && inpkt->payload.len != COAP_BLOCK_SIZE(b.szx))
+        return block1_error(scratch, inpkt, outpkt, s, COAP_RSPCODE_BAD_REQUEST);
+
+    need = s->len + inpkt->payload.len;
+    if (need > COAP_BLOCK1_MAX)
+        goto too_large;
+    if (need > s->size) {
+        size_t size = s->size ? s->size : COAP_BLOCK_SIZE(b.szx);
+        uint8_t *data;
+        while (size < need)
+            size <<= 1;
+        if (size > COAP_BLOCK1_MAX)
+            size = COAP_BLOCK1_MAX;
+        if (NULL == (data = (uint8_t *)c_realloc(s->data, size))) {
+            NODE_DBG("not enough memory\n");
+            goto too_large;
+        }
+        s->data = data;
+        s->size = size;
+    }
+    if (inpkt->payload.len)
+        c_memcpy(s->data + s->len, inpkt->payload.p, inpkt->payload.len);
+    s->len = need;
+    s->used = ++block1_clock;
+
+    if (b.more) {
+        coap_make_response(scratch, outpkt, NULL, 0, inpkt->hdr.id[0], inpkt->hdr.id[1], &inpkt->tok, COAP_RSPCODE_CONTINUE, COAP_CONTENTTYPE_NONE);
+        coap_add_block(outpkt, COAP_OPTION_BLOCK1, &b, buf);
+        return COAP_BLOCK1_ANSWERED;
+    }
+
+    inpkt->payload.p = s->data;
+    inpkt->payload.len = s->len;
+    *block = b;
+    return COAP_BLOCK1_COMPLETE;
+
+too_large:
+    block1_error(scratch, inpkt, outpkt, s, COAP_RSPCODE_REQUEST_ENTITY_TOO_LARGE);
+    buf += COAP_BLOCK_OPT_SIZE;
+    coap_add_option(outpkt, COAP_OPTION_SIZE1, buf, coap_encode_var_bytes(buf, COAP_BLOCK1_MAX));
+    return COAP_BLOCK1_ANSWERED;
+}
+
+void coap_block1_done(const coap_packet_t *inpkt)
+{
+    int i;
+    for (i = 0; i < COAP_BLOCK1_SLOTS; i++) {
+        if (block1_slots[i].data && block1_slots[i].data == inpkt->payload.p)
+            block1_release(&block1_slots[i]);
+    }
+}
+
+void coap_block1_clear(void)
+{
+    int i;
+    for (i = 0; i < COAP_BLOCK1_SLOTS; i++)
+        block1_release(&block1_slots[i]);
+}
@@ -0,0 +1,72 @@
+#ifndef _BLOCK_H
+#define _BLOCK_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "coap.h"
+
+/*
+ * Block-wise transfers, http://tools.ietf.org/html/rfc7959
+ *
+ * Block2 splits a response that doesn't fit into one datagram, Block1 does
+ * the same for a request payload. A block option carries the block number,
+ * a "more" flag and the block size as szx, where size = 1 << (szx + 4).
+ */
+#define COAP_BLOCK_SZX_MAX      6       /* 1024 bytes, == MAX_PAYLOAD_SIZE */
+#define COAP_BLOCK_SIZE(szx)    (1U << ((szx) + 4))
+#define COAP_BLOCK_OPT_SIZE     3       /* max. bytes of an encoded block option */
+
+#define COAP_BLOCK1_SLOTS       2       /* uploads reassembled in parallel */
+#ifndef COAP_BLOCK1_MAX
+#define COAP_BLOCK1_MAX         4096    /* largest request payload accepted */
+#endif
+
+typedef struct
+{
+    uint32_t num;
+    uint8_t more;
+    uint8_t szx;
+} coap_block_t;
+
+/** Decodes block option num of pkt. Returns 1 if present and valid, 0 otherwise. */
+int coap_get_block(const coap_packet_t *pkt, uint8_t num, coap_block_t *block);
+
+/** Adds block option num to pkt, buf must hold COAP_BLOCK_OPT_SIZE bytes and stay valid until pkt is built. */
+int coap_add_block(coap_packet_t *pkt, uint8_t num, const coap_block_t *block, uint8_t *buf);
+
+/**
+ * Reduces the payload of a response to the block asked for in req, or to the
+ * first block of size 1 << (szx + 4) if req is NULL, and adds the Block2 (and
+ * for the first block, Size2) options. Payloads that fit need no Block2 unless
+ * the client asked for it. buf must hold COAP_BLOCK_OPT_SIZE + 4 bytes.
+ * Returns 0, or COAP_ERR_UNSUPPORTED if the block lies beyond the payload.
+ */
+int coap_block2_slice(coap_packet_t *pkt, const coap_block_t *req, uint8_t szx, uint8_t *buf);
+
+#define COAP_BLOCK1_NONE        0       /* not a block-wise request */
+#define COAP_BLOCK1_ANSWERED    1
+#define COAP_BLOCK1_COMPLETE    2
+
+/**
+ * Collects the blocks of a Block1 request sent from ip:port to the same
+ * Uri-Path. Returns COAP_BLOCK1_ANSWERED if the request was answered in
+ * outpkt (2.31 Continue or an error). On COAP_BLOCK1_COMPLETE
+ * inpkt->payload points at the whole body, which stays valid until
+ * coap_block1_done() is called, and block holds the Block1 option to echo in
+ * the final response. buf must hold COAP_BLOCK_OPT_SIZE + 4 bytes.
+ */
+int coap_block1_receive(coap_rw_buffer_t *scratch, coap_packet_t *inpkt, coap_packet_t *outpkt, uint32_t ip, uint16_t port, coap_block_t *block, uint8_t *buf);
+
+/** Releases the body coap_block1_receive() placed in inpkt->payload. */
+void coap_block1_done(const coap_packet_t *inpkt);
+
+/** Drops all partially received uploads. */
+void coap_block1_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
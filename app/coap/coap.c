@@ -413,6 +413,14 @@ int coap_make_response(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint
         pkt->tok = *tok;
     }
 
+    pkt->payload.p = content;
+    pkt->payload.len = content_len;
+
+    if (content_type == COAP_CONTENTTYPE_NONE) {
+        pkt->numopts = 0;
+        return 0;
+    }
+
     // safe because 1 < MAXOPT
     pkt->opts[0].num = COAP_OPTION_CONTENT_FORMAT;
     pkt->opts[0].buf.p = scratch->p;
@@ -421,8 +429,6 @@ int coap_make_response(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint
     scratch->p[0] = ((uint16_t)content_type & 0xFF00) >> 8;
     scratch->p[1] = ((uint16_t)content_type & 0x00FF);
     pkt->opts[0].buf.len = 2;
-    pkt->payload.p = content;
-    pkt->payload.len = content_len;
     return 0;
 }
 
@@ -442,10 +448,42 @@ unsigned int coap_encode_var_bytes(unsigned char *buf, unsigned int val) {
   return n;
 }
 
+unsigned int coap_decode_var_bytes(const unsigned char *buf, unsigned int len) {
+  unsigned int i, n = 0;
+
+  for (i = 0; i < len; ++i)
+    n = (n << 8) + buf[i];
+
+  return n;
+}
+
+// keeps the options sorted by number, as coap_build() expects
+int coap_add_option(coap_packet_t *pkt, uint8_t num, const uint8_t *value, size_t len)
+{
+    int i;
+
+    if (pkt->numopts >= MAXOPT)
+        return COAP_ERR_BUFFER_TOO_SMALL;
+
+    for (i = pkt->numopts; i > 0 && pkt->opts[i-1].num > num; i--)
+        pkt->opts[i] = pkt->opts[i-1];
+
+    pkt->opts[i].num = num;
+    pkt->opts[i].buf.p = value;
+    pkt->opts[i].buf.len = len;
+    pkt->numopts++;
+    return 0;
+}
+
 static uint8_t _token_data[4] = {'n','o','d','e'};
 coap_buffer_t the_token = { _token_data, 4 };
 static unsigned short message_id;
 
+uint16_t coap_next_message_id(void)
+{
+    return message_id++;
+}
+
 int coap_make_request(coap_rw_buffer_t *scratch, coap_packet_t *pkt, coap_msgtype_t t, coap_method_t m, coap_uri_t *uri, const uint8_t *payload, size_t payload_len)
 {
     int res;
@@ -453,10 +491,10 @@ int coap_make_request(coap_rw_buffer_t *scratch, coap_packet_t *pkt, coap_msgtyp
     pkt->hdr.t = t;
     pkt->hdr.tkl = 0;
     pkt->hdr.code = m;
-    pkt->hdr.id[0] = (message_id >> 8) & 0xFF;  //msgid_hi;
-    pkt->hdr.id[1] = message_id & 0xFF; //msgid_lo;
-    message_id++;
-    NODE_DBG("message_id: %d.\n", message_id);
+    uint16_t mid = coap_next_message_id();
+    pkt->hdr.id[0] = (mid >> 8) & 0xFF;  //msgid_hi;
+    pkt->hdr.id[1] = mid & 0xFF; //msgid_lo;
+    NODE_DBG("message_id: %d.\n", mid);
     pkt->numopts = 0;
 
     if (the_token.len) {
@@ -77,8 +77,12 @@ typedef enum
     COAP_OPTION_URI_QUERY = 15,
     COAP_OPTION_ACCEPT = 17,
     COAP_OPTION_LOCATION_QUERY = 20,
+    COAP_OPTION_BLOCK2 = 23,    /* http://tools.ietf.org/html/rfc7959#section-2.1 */
+    COAP_OPTION_BLOCK1 = 27,
+    COAP_OPTION_SIZE2 = 28,
     COAP_OPTION_PROXY_URI = 35,
-    COAP_OPTION_PROXY_SCHEME = 39
+    COAP_OPTION_PROXY_SCHEME = 39,
+    COAP_OPTION_SIZE1 = 60
 } coap_option_num_t;
 
 //http://tools.ietf.org/html/rfc7252#section-12.1.1
@@ -107,7 +111,11 @@ typedef enum
     COAP_RSPCODE_CONTENT = MAKE_RSPCODE(2, 5),
     COAP_RSPCODE_NOT_FOUND = MAKE_RSPCODE(4, 4),
     COAP_RSPCODE_BAD_REQUEST = MAKE_RSPCODE(4, 0),
-    COAP_RSPCODE_CHANGED = MAKE_RSPCODE(2, 4)
+    COAP_RSPCODE_CHANGED = MAKE_RSPCODE(2, 4),
+    COAP_RSPCODE_CONTINUE = MAKE_RSPCODE(2, 31),                  /* rfc7959 */
+    COAP_RSPCODE_BAD_OPTION = MAKE_RSPCODE(4, 2),
+    COAP_RSPCODE_REQUEST_ENTITY_INCOMPLETE = MAKE_RSPCODE(4, 8),  /* rfc7959 */
+    COAP_RSPCODE_REQUEST_ENTITY_TOO_LARGE = MAKE_RSPCODE(4, 13)
 } coap_responsecode_t;
 
 //http://tools.ietf.org/html/rfc7252#section-12.3
@@ -189,10 +197,17 @@ int coap_handle_req(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_
 void coap_option_nibble(uint32_t value, uint8_t *nibble);
 void coap_setup(void);
 void endpoint_setup(void);
+coap_luser_entry *coap_find_variable(const coap_packet_t *inpkt);
+int coap_make_variable_response(coap_rw_buffer_t *scratch, coap_packet_t *outpkt, const coap_luser_entry *h, const coap_buffer_t *tok, uint8_t id_hi, uint8_t id_lo);
 
 int coap_buildOptionHeader(uint32_t optDelta, size_t length, uint8_t *buf, size_t buflen);
 int check_token(coap_packet_t *pkt);
 
+unsigned int coap_encode_var_bytes(unsigned char *buf, unsigned int val);
+unsigned int coap_decode_var_bytes(const unsigned char *buf, unsigned int len);
+int coap_add_option(coap_packet_t *pkt, uint8_t num, const uint8_t *value, size_t len);
+uint16_t coap_next_message_id(void);
+
 #include "uri.h"
 int coap_make_request(coap_rw_buffer_t *scratch, coap_packet_t *pkt, coap_msgtype_t t, coap_method_t m, coap_uri_t *uri, const uint8_t *payload, size_t payload_len);
 
@@ -4,8 +4,9 @@
 #include "coap.h"
 #include "hash.h"
 #include "node.h"
+#include "coap_timer.h"
 
-extern coap_queue_t *gQueue;
+extern coap_wheel_t gQueue;
 
 void coap_client_response_handler(char *data, unsigned short len, unsigned short size, const uint32_t ip, const uint32_t port)
 {
@@ -41,12 +42,7 @@ void coap_client_response_handler(char *data, unsigned short len, unsigned short
     coap_tid_t id = COAP_INVALID_TID;
     coap_transaction_id(ip, port, &pkt, &id);
     /* transaction done, remove the node from queue */
-    // stop timer
-    coap_timer_stop();
-    // remove the node
     coap_remove_node(&gQueue, id);
-    // calculate time elapsed
-    coap_timer_update(&gQueue);
     coap_timer_start(&gQueue);
 
     if (COAP_RESPONSE_CLASS(pkt.hdr.code) == 2)
@@ -63,7 +59,7 @@ void coap_client_response_handler(char *data, unsigned short len, unsigned short
   }
 
 end:
-  if(!gQueue){ // if there is no node pending in the queue, disconnect from host.
+  if(!gQueue.count){ // if there is no node pending in the queue, disconnect from host.
 
   }
 }
@@ -3,8 +3,9 @@
 #include "node.h"
 #include "espconn.h"
 #include "coap_timer.h"
+#include "rom.h"
 
-extern coap_queue_t *gQueue;
+extern coap_wheel_t gQueue;
 
 /* releases space allocated by PDU if free_pdu is set */
 coap_tid_t coap_send(struct espconn *pesp_conn, coap_pdu_t *pdu) {
@@ -53,19 +54,18 @@ coap_tid_t coap_send_confirmed(struct espconn *pesp_conn, coap_pdu_t *pdu) {
 
   node->pconn = pesp_conn;
   node->pdu = pdu;
+  if (pesp_conn->type == ESPCONN_UDP) {
+    c_memcpy(&node->remote_ip, pesp_conn->proto.udp->remote_ip, sizeof(node->remote_ip));
+    node->remote_port = pesp_conn->proto.udp->remote_port;
+  }
 
-  /* Set timer for pdu retransmission. If this is the first element in
-   * the retransmission queue, the base time is set to the current
-   * time and the retransmission time is node->timeout. If there is
-   * already an entry in the sendqueue, we must check if this node is
-   * to be retransmitted earlier. Therefore, node->timeout is first
-   * normalized to the timeout and then inserted into the queue with
-   * an adjusted relative time.
+  /* Set timer for pdu retransmission. The wheel keeps absolute expiry
+   * times, so the node goes straight into its slot and the timer only
+   * has to be re-armed in case it is now the first one to expire.
    */
-  coap_timer_stop();
-  coap_timer_update(&gQueue);
-  node->t = node->timeout;  
-  coap_insert_node(&gQueue, node);
+  coap_tick_t now = coap_timer_now();
+  node->t = now + node->timeout;
+  coap_insert_node(&gQueue, node, now);
   coap_timer_start(&gQueue);
   return node->id;
 }
@@ -3,8 +3,15 @@
 #include "c_stdlib.h"
 
 #include "coap.h"
+#include "block.h"
+#include "observe.h"
+#include "dedup.h"
+#include "node.h"
+#include "coap_timer.h"
 
-size_t coap_server_respond(char *req, unsigned short reqlen, char *rsp, unsigned short rsplen)
+extern coap_wheel_t gQueue;
+
+size_t coap_server_respond(char *req, unsigned short reqlen, char *rsp, unsigned short rsplen, uint32_t ip, uint16_t port)
 {
   NODE_DBG("coap_server_respond is called.\n");
   size_t rlen = rsplen;
@@ -13,7 +20,11 @@ size_t coap_server_respond(char *req, unsigned short reqlen, char *rsp, unsigned
   pkt.content.len = 0;
   uint8_t scratch_raw[4];
   coap_rw_buffer_t scratch_buf = {scratch_raw, sizeof(scratch_raw)};
-  int rc;
+  uint8_t block1_raw[COAP_BLOCK_OPT_SIZE + 4];
+  uint8_t block2_raw[COAP_BLOCK_OPT_SIZE + 4];
+  uint8_t observe_raw[COAP_OBSERVE_OPT_SIZE];
+  coap_block_t block1, block2;
+  int rc, b1;
 
 #ifdef COAP_DEBUG
   NODE_DBG("Received: ");
@@ -25,6 +36,16 @@ size_t coap_server_respond(char *req, unsigned short reqlen, char *rsp, unsigned
     NODE_DBG("Bad packet rc=%d\n", rc);
     return 0;
   }
+  else if (pkt.hdr.t == COAP_TYPE_ACK || pkt.hdr.t == COAP_TYPE_RESET)
+  {
+    /* answer to a notification we sent */
+    coap_tid_t id = COAP_INVALID_TID;
+    coap_transaction_id(ip, port, &pkt, &id);
+    coap_remove_node(&gQueue, id);
+    coap_timer_start(&gQueue);
+    coap_observe_ack(id, pkt.hdr.t == COAP_TYPE_RESET);
+    return 0;
+  }
   else
   {
     coap_packet_t rsppkt;
@@ -33,7 +54,25 @@ size_t coap_server_respond(char *req, unsigned short reqlen, char *rsp, unsigned
 #ifdef COAP_DEBUG
     coap_dumpPacket(&pkt);
 #endif
-    coap_handle_req(&scratch_buf, &pkt, &rsppkt);
+    /* a retransmitted request gets the same response again */
+    coap_tick_t now = coap_timer_now();
+    if (COAP_DEDUP_MISS != (rc = coap_dedup_lookup(ip, port, &pkt, rsp, rsplen, now)))
+      return rc;
+
+    b1 = coap_block1_receive(&scratch_buf, &pkt, &rsppkt, ip, port, &block1, block1_raw);
+    if (b1 != COAP_BLOCK1_ANSWERED)
+      coap_handle_req(&scratch_buf, &pkt, &rsppkt);
+    if (b1 == COAP_BLOCK1_COMPLETE)
+      coap_add_block(&rsppkt, COAP_OPTION_BLOCK1, &block1, block1_raw);
+
+    if (pkt.hdr.code == COAP_METHOD_GET && rsppkt.hdr.code == COAP_RSPCODE_CONTENT)
+    {
+      coap_observe_request(&pkt, &rsppkt, coap_find_variable(&pkt), ip, port, observe_raw);
+      rc = coap_get_block(&pkt, COAP_OPTION_BLOCK2, &block2);
+      if (0 != coap_block2_slice(&rsppkt, rc ? &block2 : NULL, COAP_BLOCK_SZX_MAX, block2_raw))
+        coap_make_response(&scratch_buf, &rsppkt, NULL, 0, pkt.hdr.id[0], pkt.hdr.id[1], &pkt.tok, COAP_RSPCODE_BAD_OPTION, COAP_CONTENTTYPE_NONE);
+    }
+
     if (0 != (rc = coap_build(rsp, &rlen, &rsppkt))){
       NODE_DBG("coap_build failed rc=%d\n", rc);
       // return 0;
@@ -50,6 +89,9 @@ size_t coap_server_respond(char *req, unsigned short reqlen, char *rsp, unsigned
       coap_dumpPacket(&rsppkt);
 #endif
     }
+    coap_dedup_store(ip, port, &pkt, rsp, rlen, now);
+    if (b1 == COAP_BLOCK1_COMPLETE)
+      coap_block1_done(&pkt);
     if(rsppkt.content.p){
       c_free(rsppkt.content.p);
       rsppkt.content.p = NULL;
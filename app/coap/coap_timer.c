@@ -1,78 +1,74 @@
+#include "c_string.h"
 #include "node.h"
 #include "coap_timer.h"
+#include "coap_io.h"
+#include "observe.h"
 #include "os_type.h"
+#include "user_interface.h"
 
 static os_timer_t coap_timer;
-static coap_tick_t basetime = 0;
+static uint32_t last_us = 0;
+static coap_tick_t now_ms = 0;
 
-void coap_timer_elapsed(coap_tick_t *diff){
-  coap_tick_t now = system_get_time() / 1000;   // coap_tick_t is in ms. also sys_timer
-  if(now>=basetime){
-    *diff = now-basetime;
-  } else {
-    *diff = now + SYS_TIME_MAX -basetime;
-  }
-  basetime = now;
+coap_tick_t coap_timer_now(void){
+  uint32_t us = system_get_time();  // wraps after 71 minutes, carry the remainder over
+  uint32_t diff = (us - last_us) / 1000;
+  now_ms += diff;
+  last_us += diff * 1000;
+  return now_ms;
 }
 
-void coap_timer_tick(void *arg){
-  if( !arg )
-    return;
-  coap_queue_t **queue = (coap_queue_t **)arg;
-  if( !(*queue) )
-    return;
-
-  coap_queue_t *node = coap_pop_next( queue );
+static void coap_retransmit(coap_wheel_t *wheel, coap_queue_t *node, coap_tick_t now){
   /* re-initialize timeout when maximum number of retransmissions are not reached yet */
   if (node->retransmit_cnt < COAP_DEFAULT_MAX_RETRANSMIT) {
     node->retransmit_cnt++;
-    node->t = node->timeout << node->retransmit_cnt;
+    node->t = now + (node->timeout << node->retransmit_cnt);
 
     NODE_DBG("** retransmission #%d of transaction %d\n", 
         node->retransmit_cnt, (((uint16_t)(node->pdu->pkt->hdr.id[0]))<<8)+node->pdu->pkt->hdr.id[1]);
-    node->id = coap_send(node->pconn, node->pdu);
-    if (COAP_INVALID_TID == node->id) {
+    if (node->pconn->type == ESPCONN_UDP) {
+      c_memcpy(node->pconn->proto.udp->remote_ip, &node->remote_ip, sizeof(node->remote_ip));
+      node->pconn->proto.udp->remote_port = node->remote_port;
+    }
+    if (COAP_INVALID_TID == coap_send(node->pconn, node->pdu)) {
       NODE_DBG("retransmission: error sending pdu\n");
+      coap_observe_timeout(node->id);
       coap_delete_node(node);
     } else {
-      coap_insert_node(queue, node);    
+      coap_insert_node(wheel, node, now);
     }
   } else {
     /* And finally delete the node */
+    coap_observe_timeout(node->id);
     coap_delete_node( node );
   }
-
-  coap_timer_start(queue);
 }
 
-void coap_timer_setup(coap_queue_t ** queue, coap_tick_t t){
-  os_timer_disarm(&coap_timer);
-  os_timer_setfn(&coap_timer, (os_timer_func_t *)coap_timer_tick, queue);
-  os_timer_arm(&coap_timer, t, 0);   // no repeat
+void coap_timer_tick(void *arg){
+  if( !arg )
+    return;
+  coap_wheel_t *wheel = (coap_wheel_t *)arg;
+  coap_tick_t now = coap_timer_now();
+  coap_queue_t *node, *next;
+
+  for (node = coap_expired(wheel, now); node; node = next) {
+    next = node->next;
+    node->next = NULL;
+    coap_retransmit(wheel, node, now);
+  }
+
+  coap_timer_start(wheel);
 }
 
 void coap_timer_stop(void){
   os_timer_disarm(&coap_timer);
 }
 
-void coap_timer_update(coap_queue_t ** queue){
-  if (!queue)
-    return;
-  coap_tick_t diff = 0;
-  coap_queue_t *first = *queue;
-  coap_timer_elapsed(&diff); // update: basetime = now, diff = now - oldbase, means time elapsed
-  if (first) {
-    // diff ms time is elapsed, re-calculate the first node->t
-    if (first->t >= diff){
-      first->t -= diff;
-    } else {
-      first->t = 0;  // when timer enabled, time out almost immediately
-    }
-  }
-}
-
-void coap_timer_start(coap_queue_t ** queue){
-  if(*queue){ // if there is node in the queue, set timeout to its ->t.
-    coap_timer_setup(queue, (*queue)->t);
+void coap_timer_start(coap_wheel_t *wheel){
+  coap_tick_t ms;
+  os_timer_disarm(&coap_timer);
+  if (coap_next_timeout(wheel, coap_timer_now(), &ms)) { // one shot, for the next slot that holds nodes
+    os_timer_setfn(&coap_timer, (os_timer_func_t *)coap_timer_tick, wheel);
+    os_timer_arm(&coap_timer, ms, 0);
   }
 }
@@ -0,0 +1,123 @@
+#include "c_string.h"
+#include "c_stdlib.h"
+#include "dedup.h"
+
+typedef struct
+{
+    uint32_t ip;
+    uint16_t port;
+    uint16_t mid;
+    coap_tick_t expires;
+    uint32_t used;          /* for dropping the least recently used entry */
+    uint8_t *rsp;
+    uint16_t len;
+    uint8_t valid;
+} dedup_entry_t;
+
+static dedup_entry_t dedup_cache[COAP_DEDUP_ENTRIES];
+static size_t dedup_memory = 0;
+static uint32_t dedup_clock = 0;
+
+static void dedup_drop(dedup_entry_t *e)
+{
+    if (e->rsp) {
+        c_free(e->rsp);
+        dedup_memory -= e->len;
+    }
+    c_memset(e, 0, sizeof(*e));
+}
+
+static dedup_entry_t *dedup_find(uint32_t ip, uint16_t port, uint16_t mid, coap_tick_t now)
+{
+    int i;
+    for (i = 0; i < COAP_DEDUP_ENTRIES; i++) {
+        dedup_entry_t *e = &dedup_cache[i];
+        if (!e->valid)
+            continue;
+        if ((int32_t)(e->expires - now) <= 0) {
+            dedup_drop(e);
+            continue;
+        }
+        if (e->mid == mid && e->port == port && e->ip == ip)
+            return e;
+    }
+    return NULL;
+}
+
+/* the least recently used entry, NULL if the cache is empty */
+static dedup_entry_t *dedup_lru(void)
+{
+    dedup_entry_t *lru = NULL;
+    int i;
+    for (i = 0; i < COAP_DEDUP_ENTRIES; i++) {
+        dedup_entry_t *e = &dedup_cache[i];
+        if (e->valid && (!lru || (int32_t)(e->used - lru->used) < 0))
+            lru = e;
+    }
+    return lru;
+}
+
+static dedup_entry_t *dedup_free(void)
+{
+    int i;
+    for (i = 0; i < COAP_DEDUP_ENTRIES; i++) {
+        if (!dedup_cache[i].valid)
+            return &dedup_cache[i];
+    }
+    return NULL;
+}
+
+int coap_dedup_lookup(uint32_t ip, uint16_t port, const coap_packet_t *pkt, uint8_t *rsp, size_t rsplen, coap_tick_t now)
+{
+    uint16_t mid = (pkt->hdr.id[0] << 8) | pkt->hdr.id[1];
+    dedup_entry_t *e = dedup_find(ip, port, mid, now);
+
+    if (!e)
+        return COAP_DEDUP_MISS;
+    NODE_DBG("duplicate message %d\n", mid);
+    e->used = ++dedup_clock;
+    if (e->len > rsplen)
+        return 0;
+    if (e->len)
+        c_memcpy(rsp, e->rsp, e->len);
+    return e->len;
+}
+
+void coap_dedup_store(uint32_t ip, uint16_t port, const coap_packet_t *pkt, const uint8_t *rsp, size_t len, coap_tick_t now)
+{
+    uint16_t mid = (pkt->hdr.id[0] << 8) | pkt->hdr.id[1];
+    dedup_entry_t *e;
+
+    if (len > COAP_DEDUP_MEMORY)
+        return;
+
+    if (NULL != (e = dedup_find(ip, port, mid, now)))
+        dedup_drop(e);
+    while (dedup_memory + len > COAP_DEDUP_MEMORY)
+        dedup_drop(dedup_lru());
+    if (NULL == (e = dedup_free())) {
+        e = dedup_lru();
+        dedup_drop(e);
+    }
+
+    if (len) {
+        if (NULL == (e->rsp = (uint8_t *)c_malloc(len)))
+            return;
+        c_memcpy(e->rsp, rsp, len);
+        dedup_memory += len;
+    }
+    e->ip = ip;
+    e->port = port;
+    e->mid = mid;
+    e->len = len;
+    e->expires = now + (pkt->hdr.t == COAP_TYPE_CON ? COAP_EXCHANGE_LIFETIME : COAP_NON_LIFETIME);
+    e->used = ++dedup_clock;
+    e->valid = 1;
+}
+
+void coap_dedup_clear(void)
+{
+    int i;
+    for (i = 0; i < COAP_DEDUP_ENTRIES; i++)
+        dedup_drop(&dedup_cache[i]);
+}
@@ -0,0 +1,50 @@
+#ifndef _DEDUP_H
+#define _DEDUP_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "coap.h"
+#include "node.h"
+
+/*
+ * Message deduplication, http://tools.ietf.org/html/rfc7252#section-4.5
+ *
+ * The server remembers the message ID of recent requests per client together
+ * with the response it sent. A retransmitted request is answered by
+ * replaying that response instead of running the handler again. Entries are
+ * kept for EXCHANGE_LIFETIME (CON) or NON_LIFETIME (NON), and the least
+ * recently used one is dropped when the cache runs out of entries or of
+ * COAP_DEDUP_MEMORY bytes for responses. A response larger than that isn't
+ * cached, its request is handled again if repeated.
+ */
+#ifndef COAP_DEDUP_ENTRIES
+#define COAP_DEDUP_ENTRIES      8
+#endif
+#ifndef COAP_DEDUP_MEMORY
+#define COAP_DEDUP_MEMORY       2048
+#endif
+#define COAP_EXCHANGE_LIFETIME  247000  /* ms */
+#define COAP_NON_LIFETIME       145000
+
+#define COAP_DEDUP_MISS         (-1)
+
+/**
+ * Looks up the request pkt from ip:port. Returns COAP_DEDUP_MISS if it isn't
+ * a duplicate, otherwise the length of the cached response copied to rsp
+ * (0 if there was none).
+ */
+int coap_dedup_lookup(uint32_t ip, uint16_t port, const coap_packet_t *pkt, uint8_t *rsp, size_t rsplen, coap_tick_t now);
+
+/** Remembers the response rsp to the request pkt from ip:port. */
+void coap_dedup_store(uint32_t ip, uint16_t port, const coap_packet_t *pkt, const uint8_t *rsp, size_t len, coap_tick_t now);
+
+/** Forgets all requests. */
+void coap_dedup_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -31,59 +31,65 @@ static int handle_get_well_known_core(const coap_endpoint_t *ep, coap_rw_buffer_
     return coap_make_response(scratch, outpkt, (const uint8_t *)outpkt->content.p, c_strlen(outpkt->content.p), id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_APPLICATION_LINKFORMAT);
 }
 
+extern coap_luser_entry var_head;
 static const coap_endpoint_path_t path_variable = {2, {"v1", "v"}};
-static int handle_get_variable(const coap_endpoint_t *ep, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+
+// the registered variable addressed by /v1/v/[variable], NULL if none
+coap_luser_entry *coap_find_variable(const coap_packet_t *inpkt)
 {
     const coap_option_t *opt;
     uint8_t count;
-    int n;
+    int i;
+    coap_luser_entry *h;
+
+    opt = coap_findOptions(inpkt, COAP_OPTION_URI_PATH, &count);
+    if (NULL == opt || count != path_variable.count + 1)
+        return NULL;
+    for (i = 0; i < path_variable.count; i++)
+    {
+        if (opt[i].buf.len != c_strlen(path_variable.elems[i]) ||
+            0 != c_memcmp(path_variable.elems[i], opt[i].buf.p, opt[i].buf.len))
+            return NULL;
+    }
+    for (h = var_head.next; NULL != h; h = h->next)     // ->next: skip the first entry(head)
+    {
+        if (opt[count-1].buf.len == c_strlen(h->name) &&
+            0 == c_memcmp(h->name, opt[count-1].buf.p, opt[count-1].buf.len))
+            return h;
+    }
+    return NULL;
+}
+
+// responds with the current value of a variable, also used for notifications
+int coap_make_variable_response(coap_rw_buffer_t *scratch, coap_packet_t *outpkt, const coap_luser_entry *h, const coap_buffer_t *tok, uint8_t id_hi, uint8_t id_lo)
+{
     lua_State *L = lua_getstate();
-    if (NULL != (opt = coap_findOptions(inpkt, COAP_OPTION_URI_PATH, &count)))
+    int n = lua_gettop(L);
+    size_t len = 0;
+    const char *res;
+
+    lua_getglobal(L, h->name);
+    if (!lua_isnumber(L, -1) && !lua_isstring(L, -1)) {
+        NODE_DBG ("should be a number or string.\n");
+        lua_settop(L, n);
+        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
+    }
+    res = lua_tolstring(L, -1, &len);
+    lua_settop(L, n);
+    return coap_make_response(scratch, outpkt, (const uint8_t *)res, len, id_hi, id_lo, tok, COAP_RSPCODE_CONTENT, h->content_type);
+}
+
+static int handle_get_variable(const coap_endpoint_t *ep, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+{
+    coap_luser_entry *h = coap_find_variable(inpkt);
+    if (NULL != h && c_strlen(h->name))
     {
-        if ((count != ep->path->count ) && (count != ep->path->count + 1)) // +1 for /f/[function], /v/[variable]
-        {
-            NODE_DBG("should never happen.\n");
-            goto end;
-        }
-        if (count == ep->path->count + 1)
-        {
-            coap_luser_entry *h = ep->user_entry->next;     // ->next: skip the first entry(head)
-            while(NULL != h){
-                if (opt[count-1].buf.len != c_strlen(h->name))
-                {
-                    h = h->next;
-                    continue;
-                }
-                if (0 == c_memcmp(h->name, opt[count-1].buf.p, opt[count-1].buf.len))
-                {
-                    NODE_DBG("/v1/v/");
-                    NODE_DBG((char *)h->name);
-                    NODE_DBG(" match.\n");
-                    if(c_strlen(h->name))
-                    {
-                        n = lua_gettop(L);
-                        lua_getglobal(L, h->name);
-                        if (!lua_isnumber(L, -1) && !lua_isstring(L, -1)) {
-                            NODE_DBG ("should be a number or string.\n");
-                            lua_settop(L, n);
-                            return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
-                        } else {
-                            const char *res = lua_tostring(L,-1);
-                            lua_settop(L, n);
-                            return coap_make_response(scratch, outpkt, (const uint8_t *)res, c_strlen(res), id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, h->content_type);
-                        }
-                    }
-                } else {
-                    h = h->next;
-                }
-            }
-        }else{
-            NODE_DBG("/v1/v match.\n");
-            goto end;
-        }
+        NODE_DBG("/v1/v/");
+        NODE_DBG((char *)h->name);
+        NODE_DBG(" match.\n");
+        return coap_make_variable_response(scratch, outpkt, h, &inpkt->tok, id_hi, id_lo);
     }
     NODE_DBG("none match.\n");
-end:
     return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
 }
 
@@ -168,23 +174,21 @@ static int handle_post_command(const coap_endpoint_t *ep, coap_rw_buffer_t *scra
 {
     if (inpkt->payload.len == 0)
         return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_BAD_REQUEST, COAP_CONTENTTYPE_TEXT_PLAIN);
-    if (inpkt->payload.len > 0)
-    {
-        lua_Load *load = &gLoad;
-        if(load->line_position == 0){
-            coap_buffer_to_string(load->line, load->len,&inpkt->payload);
-            load->line_position = c_strlen(load->line)+1;
-            // load->line[load->line_position-1] = '\n';
-            // load->line[load->line_position] = 0;
-            // load->line_position++;
-            load->done = 1;
-            NODE_DBG("Get command:\n");
-            NODE_DBG(load->line); // buggy here
-            NODE_DBG("\nResult(if any):\n");
-            system_os_post (LUA_TASK_PRIO, LUA_PROCESS_LINE_SIG, 0);
-        }
-        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
+
+    lua_Load *load = &gLoad;
+    if(load->line_position == 0){
+        coap_buffer_to_string(load->line, load->len,&inpkt->payload);
+        load->line_position = c_strlen(load->line)+1;
+        // load->line[load->line_position-1] = '\n';
+        // load->line[load->line_position] = 0;
+        // load->line_position++;
+        load->done = 1;
+        NODE_DBG("Get command:\n");
+        NODE_DBG(load->line); // buggy here
+        NODE_DBG("\nResult(if any):\n");
+        system_os_post (LUA_TASK_PRIO, LUA_PROCESS_LINE_SIG, 0);
     }
+    return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
 }
 
 static uint32_t id = 0;
@@ -11,39 +11,82 @@ void coap_free_node(coap_queue_t *node) {
   c_free(node);
 }
 
-int coap_insert_node(coap_queue_t **queue, coap_queue_t *node) {
-  coap_queue_t *p, *q;
-  if ( !queue || !node )
-    return 0;
+static inline unsigned int bucket_of(coap_tid_t id) {
+  return ((unsigned int)id) % COAP_QUEUE_BUCKETS;
+}
 
-  /* set queue head if empty */
-  if ( !*queue ) {
-    *queue = node;
-    return 1;
-  }
+/* puts node into its slot, returns 0 instead if it is already due */
+static int wheel_place(coap_wheel_t *wheel, coap_queue_t *node) {
+  int32_t d = (int32_t)(node->t - wheel->now);
+  uint32_t exp, hi, chi;
+  coap_queue_t **slot;
 
-  /* replace queue head if PDU's time is less than head's time */
-  q = *queue;
-  if (node->t < q->t) {
-    node->next = q;
-    *queue = node;
-    q->t -= node->t;		/* make q->t relative to node->t */
-    return 1;
+  if (d <= 0)
+    return 0;
+  exp = wheel->cur + ((d + COAP_WHEEL_TICK - 1) >> COAP_WHEEL_SHIFT);
+
+  if (exp - wheel->cur < COAP_WHEEL_SLOTS) {
+    node->level = 0;
+    node->slot = exp & COAP_WHEEL_MASK;
+  } else {
+    hi = exp >> COAP_WHEEL_BITS;
+    chi = wheel->cur >> COAP_WHEEL_BITS;
+    if (hi - chi >= COAP_WHEEL_SLOTS)
+      hi = chi + COAP_WHEEL_SLOTS - 1;   /* too far out, re-sorted when it cascades */
+    node->level = 1;
+    node->slot = hi & COAP_WHEEL_MASK;
   }
 
-  /* search for right place to insert */
-  do {
-    node->t -= q->t;		/* make node-> relative to q->t */
-    p = q;
-    q = q->next;
-  } while (q && q->t <= node->t);
+  slot = &wheel->slots[node->level][node->slot];
+  node->prev = NULL;
+  node->next = *slot;
+  if (*slot)
+    (*slot)->prev = node;
+  *slot = node;
+  wheel->used[node->level] |= 1u << node->slot;
+  return 1;
+}
 
-  /* insert new item */
-  if (q) {
-    q->t -= node->t;		/* make q->t relative to node->t */
+static void wheel_unlink(coap_wheel_t *wheel, coap_queue_t *node) {
+  if (node->prev)
+    node->prev->next = node->next;
+  else if (!(wheel->slots[node->level][node->slot] = node->next))
+    wheel->used[node->level] &= ~(1u << node->slot);
+  if (node->next)
+    node->next->prev = node->prev;
+  node->next = node->prev = NULL;
+}
+
+static void bucket_unlink(coap_wheel_t *wheel, coap_queue_t *node) {
+  coap_queue_t **p = &wheel->buckets[bucket_of(node->id)];
+  while (*p && *p != node)
+    p = &(*p)->hnext;
+  if (*p)
+    *p = node->hnext;
+  node->hnext = NULL;
+  wheel->count--;
+}
+
+int coap_insert_node(coap_wheel_t *wheel, coap_queue_t *node, coap_tick_t now) {
+  coap_queue_t **b;
+  if ( !wheel || !node )
+    return 0;
+
+  if (!wheel->count)
+    wheel->now = now;   /* nothing pending, the wheel may have stood still */
+
+  if (!wheel_place(wheel, node)) {
+    /* due right away, fires with the next tick */
+    coap_tick_t t = node->t;
+    node->t = wheel->now + 1;
+    wheel_place(wheel, node);
+    node->t = t;
   }
-  node->next = q;
-  p->next = node;
+
+  b = &wheel->buckets[bucket_of(node->id)];
+  node->hnext = *b;
+  *b = node;
+  wheel->count++;
   return 1;
 }
 
@@ -57,12 +100,21 @@ int coap_delete_node(coap_queue_t *node) {
   return 1;
 }
 
-void coap_delete_all(coap_queue_t *queue) {
-  if ( !queue )
+void coap_delete_all(coap_wheel_t *wheel) {
+  int l, s;
+  coap_queue_t *node, *next;
+  if ( !wheel )
     return;
 
-  coap_delete_all( queue->next );
-  coap_delete_node( queue );
+  for (l = 0; l < 2; l++) {
+    for (s = 0; s < COAP_WHEEL_SLOTS; s++) {
+      for (node = wheel->slots[l][s]; node; node = next) {
+        next = node->next;
+        coap_delete_node(node);
+      }
+    }
+  }
+  c_memset(wheel, 0, sizeof(*wheel));
 }
 
 coap_queue_t * coap_new_node(void) {
@@ -77,65 +129,114 @@ coap_queue_t * coap_new_node(void) {
   return node;
 }
 
-coap_queue_t * coap_peek_next( coap_queue_t *queue ) {
-  if ( !queue )
+coap_queue_t * coap_find_node(coap_wheel_t *wheel, const coap_tid_t id) {
+  coap_queue_t *node;
+  if ( !wheel )
     return NULL;
 
-  return queue;
+  for (node = wheel->buckets[bucket_of(id)]; node; node = node->hnext) {
+    if (node->id == id)
+      return node;
+  }
+  return NULL;
 }
 
-coap_queue_t * coap_pop_next( coap_queue_t **queue ) {		// this function is called inside timeout callback only.
-  coap_queue_t *next;
-
-  if ( !(*queue) )
-    return NULL;
+int coap_remove_node(coap_wheel_t *wheel, const coap_tid_t id) {
+  coap_queue_t *node = coap_find_node(wheel, id);
+  if ( !node )
+    return 0;
 
-  next = *queue;
-  *queue = (*queue)->next;
-  // if (queue) {
-  //   queue->t += next->t;
-  // }
-  next->next = NULL;
-  return next;
+  wheel_unlink(wheel, node);
+  bucket_unlink(wheel, node);
+  coap_delete_node(node);
+  return 1;
 }
 
-int coap_remove_node( coap_queue_t **queue, const coap_tid_t id){
-  coap_queue_t *p, *q, *node;
-  if ( !queue ) 
-    return 0;
-  if ( !*queue )  // if empty
-    return 0;
+/* takes the nodes of a slot out of the wheel, due ones are added to *expired */
+static void wheel_take(coap_wheel_t *wheel, int level, int slot, coap_queue_t **expired) {
+  coap_queue_t *node = wheel->slots[level][slot], *next;
+
+  wheel->slots[level][slot] = NULL;
+  wheel->used[level] &= ~(1u << slot);
 
-  q = *queue;
-  if (q->id == id) {
-    node = q;
-    *queue = q->next;
-    node->next = NULL;
-    if(*queue){
-      (*queue)->t += node->t;
+  for (; node; node = next) {
+    next = node->next;
+    node->prev = NULL;
+    if (level == 0 || !wheel_place(wheel, node)) {
+      bucket_unlink(wheel, node);
+      node->next = *expired;
+      *expired = node;
     }
-    coap_delete_node(node);
-    return 1;
   }
+}
+
+coap_queue_t * coap_expired(coap_wheel_t *wheel, coap_tick_t now) {
+  coap_queue_t *expired = NULL;
+  uint32_t ticks, boundary;
 
-  /* search for right node to remove */
-  while (q && q->id != id) {
-    p = q;
-    q = q->next;
+  if (!wheel)
+    return NULL;
+  if (!wheel->count) {
+    wheel->now = now;
+    return NULL;
   }
 
-  /* find the node */
-  if (q) {
-    node = q; /* save the node */
-    p->next = q->next;  /* remove the node */
-    q = q->next;
-    node->next = NULL;
-    if (q)   // add node->t to the node after.
-    {
-      q->t += node->t;
+  ticks = (now - wheel->now) >> COAP_WHEEL_SHIFT;
+  if ((int32_t)(now - wheel->now) < 0)
+    ticks = 0;
+
+  while (ticks && wheel->count) {
+    if (!wheel->used[0]) {
+      /* skip to the tick before the next cascade */
+      boundary = (wheel->cur | COAP_WHEEL_MASK) - wheel->cur;
+      if (boundary > ticks - 1)
+        boundary = ticks - 1;
+      wheel->cur += boundary;
+      wheel->now += boundary << COAP_WHEEL_SHIFT;
+      ticks -= boundary;
     }
-    coap_delete_node(node);
-    return 1;
+    wheel->cur++;
+    wheel->now += COAP_WHEEL_TICK;
+    ticks--;
+    if (!(wheel->cur & COAP_WHEEL_MASK))
+      wheel_take(wheel, 1, (wheel->cur >> COAP_WHEEL_BITS) & COAP_WHEEL_MASK, &expired);
+    wheel_take(wheel, 0, wheel->cur & COAP_WHEEL_MASK, &expired);
+  }
+  if (!wheel->count)
+    wheel->now = now;
+  return expired;
+}
+
+/* first set bit at or after position from, counting round; -1 if none */
+static int next_bit(uint32_t bits, int from) {
+  uint32_t r;
+  if (!bits)
+    return -1;
+  r = (bits >> from) | (from ? bits << (32 - from) : 0);
+  return __builtin_ctz(r);
+}
+
+int coap_next_timeout(const coap_wheel_t *wheel, coap_tick_t now, coap_tick_t *ms) {
+  uint32_t next = 0, b;
+  int k, found = 0;
+  int32_t d;
+
+  if (!wheel || !wheel->count)
+    return 0;
+
+  k = next_bit(wheel->used[0], (wheel->cur + 1) & COAP_WHEEL_MASK);
+  if (k >= 0) {
+    next = wheel->cur + 1 + k;
+    found = 1;
+  }
+  k = next_bit(wheel->used[1], ((wheel->cur >> COAP_WHEEL_BITS) + 1) & COAP_WHEEL_MASK);
+  if (k >= 0) {
+    b = ((wheel->cur >> COAP_WHEEL_BITS) + 1 + k) << COAP_WHEEL_BITS;
+    if (!found || (int32_t)(b - next) < 0)
+      next = b;
   }
-  return 0;
+
+  d = (int32_t)(wheel->now + ((next - wheel->cur) << COAP_WHEEL_SHIFT) - now);
+  *ms = d > 0 ? d : 0;
+  return 1;
 }
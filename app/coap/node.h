@@ -12,15 +12,29 @@ struct coap_queue_t;
 typedef uint32_t coap_tick_t;
 
 /*
-1. queue(first)->t store when to send PDU for the next time, it's a base(absolute) time
-2. queue->next->t store the delta between time and base-time.  queue->next->t = timeout + now - basetime
-3. node->next->t store the delta between time and previous->t.  node->next->t = timeout + now - node->t - basetime
-4. time to fire:   10,   15,    18,    25
-		node->t:   10,   5,     3,     7
+1. The retransmission queue is a hierarchical timer wheel of two levels with
+   COAP_WHEEL_SLOTS slots each. A level 0 slot holds the nodes due in one
+   wheel tick (COAP_WHEEL_TICK ms), a level 1 slot those due in one turn of
+   level 0. Level 1 slots are moved down ("cascaded") as level 0 comes round.
+2. node->t is the absolute time (ms) the PDU is to be sent next. Nodes
+   further out than level 1 reaches are parked in its last slot and
+   re-sorted when it cascades.
+3. Inserting and removing a node are O(1), nodes are found by transaction id
+   through a small hash table.
+4. With a 64ms tick, level 0 spans 2s and level 1 65s, which covers the
+   longest retransmission timeout of 48s.
 */
+#define COAP_WHEEL_SHIFT    6
+#define COAP_WHEEL_TICK     (1 << COAP_WHEEL_SHIFT)
+#define COAP_WHEEL_BITS     5
+#define COAP_WHEEL_SLOTS    (1 << COAP_WHEEL_BITS)
+#define COAP_WHEEL_MASK     (COAP_WHEEL_SLOTS - 1)
+#define COAP_QUEUE_BUCKETS  16
 
 typedef struct coap_queue_t {
-  struct coap_queue_t *next;
+  struct coap_queue_t *next;    /**< next node in the same slot, or in the list of expired nodes */
+  struct coap_queue_t *prev;
+  struct coap_queue_t *hnext;   /**< next node in the same hash bucket */
 
   coap_tick_t t;	        /**< when to send PDU for the next time */
   unsigned char retransmit_cnt;	/**< retransmission counter, will be removed when zero */
@@ -31,25 +45,46 @@ typedef struct coap_queue_t {
   // coap_packet_t *pkt;
   coap_pdu_t *pdu;		/**< the CoAP PDU to send */
   struct espconn *pconn;
+  uint32_t remote_ip;		/**< destination, pconn may have talked to others since */
+  uint16_t remote_port;
+  uint8_t level;
+  uint8_t slot;
 } coap_queue_t;
 
+typedef struct {
+  coap_queue_t *slots[2][COAP_WHEEL_SLOTS];
+  uint32_t used[2];             /**< bitmap of the non-empty slots of each level */
+  coap_queue_t *buckets[COAP_QUEUE_BUCKETS];
+  uint32_t cur;                 /**< wheel ticks processed */
+  coap_tick_t now;              /**< the time tick cur was processed */
+  unsigned int count;           /**< nodes in the wheel */
+} coap_wheel_t;
+
 void coap_free_node(coap_queue_t *node);
 
-/** Adds node to given queue, ordered by node->t. */
-int coap_insert_node(coap_queue_t **queue, coap_queue_t *node);
+/** Adds node to the wheel, to expire at node->t. now is the current time. */
+int coap_insert_node(coap_wheel_t *wheel, coap_queue_t *node, coap_tick_t now);
 
 /** Destroys specified node. */
 int coap_delete_node(coap_queue_t *node);
 
-/** Removes all items from given queue and frees the allocated storage. */
-void coap_delete_all(coap_queue_t *queue);
+/** Removes all items from the wheel and frees the allocated storage. */
+void coap_delete_all(coap_wheel_t *wheel);
 
 /** Creates a new node suitable for adding to the CoAP sendqueue. */
 coap_queue_t *coap_new_node(void);
 
-coap_queue_t *coap_pop_next( coap_queue_t **queue );
+/** Returns the node of transaction id, or NULL. */
+coap_queue_t *coap_find_node(coap_wheel_t *wheel, const coap_tid_t id);
+
+/** Removes and destroys the node of transaction id. */
+int coap_remove_node(coap_wheel_t *wheel, const coap_tid_t id);
+
+/** Advances the wheel to now and takes out all expired nodes, returned as a list linked by ->next. */
+coap_queue_t *coap_expired(coap_wheel_t *wheel, coap_tick_t now);
 
-int coap_remove_node( coap_queue_t **queue, const coap_tid_t id);
+/** Sets *ms to the time until the next node expires. Returns 0 if the wheel is empty. */
+int coap_next_timeout(const coap_wheel_t *wheel, coap_tick_t now, coap_tick_t *ms);
 
 #ifdef __cplusplus
 }
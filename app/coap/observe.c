@@ -0,0 +1,186 @@
+#include "c_string.h"
+#include "c_stdlib.h"
+#include "observe.h"
+#include "block.h"
+#include "node.h"
+#include "coap_io.h"
+#include "coap_timer.h"
+
+extern coap_wheel_t gQueue;
+
+static coap_observer_t observers[COAP_MAX_OBSERVERS];
+static uint32_t observe_seq = 0;    // one sequence for all resources, only 24 bits are sent
+
+static void observe_cancel(coap_observer_t *o)
+{
+    if (o->tid != COAP_INVALID_TID) {
+        coap_remove_node(&gQueue, o->tid);
+        coap_timer_start(&gQueue);
+        o->tid = COAP_INVALID_TID;
+    }
+}
+
+static void observe_remove(coap_observer_t *o)
+{
+    NODE_DBG("observer removed.\n");
+    observe_cancel(o);
+    c_memset(o, 0, sizeof(*o));
+    o->tid = COAP_INVALID_TID;
+}
+
+static void observe_digest(const coap_packet_t *pkt, coap_key_t h)
+{
+    c_memset(h, 0, sizeof(coap_key_t));
+    coap_hash(&pkt->hdr.code, 1, h);
+    coap_hash(pkt->payload.p, pkt->payload.len, h);
+}
+
+void coap_observe_request(const coap_packet_t *inpkt, coap_packet_t *outpkt, coap_luser_entry *entry, uint32_t ip, uint16_t port, uint8_t *buf)
+{
+    const coap_option_t *opt;
+    coap_observer_t *o = NULL;
+    coap_block_t block;
+    uint8_t count;
+    int i;
+
+    if (NULL == entry || NULL == (opt = coap_findOptions(inpkt, COAP_OPTION_OBSERVE, &count)))
+        return;
+
+    for (i = 0; i < COAP_MAX_OBSERVERS; i++) {
+        coap_observer_t *p = &observers[i];
+        if (p->entry == entry && p->ip == ip && p->port == port) {
+            o = p;
+            break;
+        }
+        if (NULL == p->entry && NULL == o)
+            o = p;
+    }
+
+    if (coap_decode_var_bytes(opt->buf.p, opt->buf.len) != 0) {   // 1: deregister
+        if (o && o->entry)
+            observe_remove(o);
+        return;
+    }
+    if (NULL == o || outpkt->hdr.code != COAP_RSPCODE_CONTENT || inpkt->tok.len > sizeof(o->tok)) {
+        NODE_DBG("observer not added.\n");     // answered as a plain GET
+        return;
+    }
+
+    if (NULL == o->entry) {
+        o->entry = entry;
+        o->ip = ip;
+        o->port = port;
+        o->tid = COAP_INVALID_TID;
+    }
+    // a re-registration replaces the token
+    o->tkl = inpkt->tok.len;
+    c_memcpy(o->tok, inpkt->tok.p, o->tkl);
+    o->szx = COAP_OBSERVE_SZX;
+    if (coap_get_block(inpkt, COAP_OPTION_BLOCK2, &block) && block.szx < o->szx)
+        o->szx = block.szx;
+    observe_digest(outpkt, o->last);
+
+    coap_add_option(outpkt, COAP_OPTION_OBSERVE, buf, coap_encode_var_bytes(buf, observe_seq & 0xFFFFFF));
+}
+
+static int observe_send(struct espconn *pesp_conn, coap_observer_t *o, coap_key_t digest)
+{
+    coap_pdu_t *pdu;
+    coap_packet_t *pkt;
+    coap_buffer_t tok;
+    uint8_t *opt;
+    uint16_t mid;
+    int rc;
+
+    if (NULL == (pdu = coap_new_pdu()))
+        return 0;
+    pkt = pdu->pkt;
+
+    // the token must outlive the observer while the notification is queued
+    opt = pdu->scratch.p + 2;   // after the content format
+    c_memcpy(opt, o->tok, o->tkl);
+    tok.p = opt;
+    tok.len = o->tkl;
+    opt += o->tkl;
+
+    mid = coap_next_message_id();
+    coap_make_variable_response(&pdu->scratch, pkt, o->entry, &tok, mid >> 8, mid & 0xFF);
+    observe_digest(pkt, digest);
+    if (0 == c_memcmp(digest, o->last, sizeof(coap_key_t))) {
+        coap_delete_pdu(pdu);
+        return 0;   // unchanged
+    }
+
+    pkt->hdr.t = COAP_TYPE_CON;
+    if (pkt->hdr.code == COAP_RSPCODE_CONTENT) {
+        observe_seq++;
+        coap_add_option(pkt, COAP_OPTION_OBSERVE, opt, coap_encode_var_bytes(opt, observe_seq & 0xFFFFFF));
+        opt += COAP_OBSERVE_OPT_SIZE;
+        coap_block2_slice(pkt, NULL, o->szx, opt);  // the client fetches the remaining blocks with GET
+    }
+
+    if (0 != (rc = coap_build(pdu->msg.p, &(pdu->msg.len), pkt))) {
+        NODE_DBG("coap_build failed rc=%d\n", rc);
+        coap_delete_pdu(pdu);
+        return 0;
+    }
+
+    // a newer notification replaces one that hasn't been acknowledged yet
+    observe_cancel(o);
+
+    c_memcpy(pesp_conn->proto.udp->remote_ip, &o->ip, 4);
+    pesp_conn->proto.udp->remote_port = o->port;
+    o->tid = coap_send_confirmed(pesp_conn, pdu);
+    if (o->tid == COAP_INVALID_TID) {
+        coap_delete_pdu(pdu);
+        return 0;
+    }
+    c_memcpy(o->last, digest, sizeof(coap_key_t));
+    if (pkt->hdr.code != COAP_RSPCODE_CONTENT) {
+        // an error notification ends the observation, let it be retransmitted though
+        c_memset(o, 0, sizeof(*o));
+        o->tid = COAP_INVALID_TID;
+    }
+    return 1;
+}
+
+int coap_observe_notify(struct espconn *pesp_conn, coap_luser_entry *entry)
+{
+    coap_key_t digest;
+    int i, sent = 0;
+
+    for (i = 0; i < COAP_MAX_OBSERVERS; i++) {
+        coap_observer_t *o = &observers[i];
+        if (o->entry != entry)
+            continue;
+        sent += observe_send(pesp_conn, o, digest);
+    }
+    return sent;
+}
+
+void coap_observe_ack(coap_tid_t id, int reset)
+{
+    int i;
+    for (i = 0; i < COAP_MAX_OBSERVERS; i++) {
+        coap_observer_t *o = &observers[i];
+        if (o->entry && o->tid == id) {
+            o->tid = COAP_INVALID_TID;  // the node is already gone from the queue
+            if (reset)
+                observe_remove(o);
+        }
+    }
+}
+
+void coap_observe_timeout(coap_tid_t id)
+{
+    coap_observe_ack(id, 1);
+}
+
+void coap_observe_clear(void)
+{
+    int i;
+    for (i = 0; i < COAP_MAX_OBSERVERS; i++) {
+        if (observers[i].entry)
+            observe_remove(&observers[i]);
+    }
+}
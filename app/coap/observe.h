@@ -0,0 +1,62 @@
+#ifndef _OBSERVE_H
+#define _OBSERVE_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "coap.h"
+#include "hash.h"
+#include "espconn.h"
+
+/*
+ * Observing resources, http://tools.ietf.org/html/rfc7641
+ *
+ * A GET with Observe: 0 on a registered variable adds the client to the
+ * observer list of that variable; coap_observe_notify() then pushes the
+ * value to all its observers as a confirmable notification, but only if it
+ * has changed since the last one. An observer is dropped when it deregisters
+ * (Observe: 1), rejects a notification with RST or fails to acknowledge one.
+ */
+#define COAP_MAX_OBSERVERS      4
+#define COAP_OBSERVE_SZX        5       /* 512 byte blocks, notifications use a MAX_REQUEST_SIZE pdu */
+#define COAP_OBSERVE_OPT_SIZE   3
+
+typedef struct
+{
+    coap_luser_entry *entry;    /* observed variable, NULL if the slot is free */
+    uint32_t ip;
+    uint16_t port;
+    uint8_t tok[8];
+    uint8_t tkl;
+    uint8_t szx;                /* block size for notifications */
+    coap_key_t last;            /* hash of the last value sent */
+    coap_tid_t tid;             /* unacknowledged notification */
+} coap_observer_t;
+
+/**
+ * Registers or deregisters the sender of the GET request inpkt for entry,
+ * according to its Observe option, and adds the Observe option to the 2.05
+ * response outpkt if the client is (still) registered. Must be called before
+ * the response payload is split into blocks. buf must hold
+ * COAP_OBSERVE_OPT_SIZE bytes.
+ */
+void coap_observe_request(const coap_packet_t *inpkt, coap_packet_t *outpkt, coap_luser_entry *entry, uint32_t ip, uint16_t port, uint8_t *buf);
+
+/** Sends the current value of entry to all observers that haven't seen it yet. Returns the number of notifications sent. */
+int coap_observe_notify(struct espconn *pesp_conn, coap_luser_entry *entry);
+
+/** A notification has been acknowledged (reset == 0) or rejected with RST. */
+void coap_observe_ack(coap_tid_t id, int reset);
+
+/** A notification was never acknowledged. */
+void coap_observe_timeout(coap_tid_t id);
+
+/** Drops all observers and their pending notifications. */
+void coap_observe_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
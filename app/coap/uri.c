@@ -12,7 +12,7 @@
 #ifndef assert
 // #warning "assertions are disabled"
 #  define assert(x) do { \
-        if(!x) NODE_ERR("uri.c assert!\n");  \
+        if(!(x)) NODE_ERR("uri.c assert!\n");  \
     } while (0)
 #endif
 
@@ -0,0 +1,297 @@
+/*
+ * Base64 and hex codecs, see codec.h.
+ *
+ * The tables are kept in flash as arrays of words, since flash only
+ * allows aligned 32-bit reads, and each call copies the ones it needs to
+ * the stack a word at a time before indexing them by byte. Base64 goes
+ * three bytes to four characters per step while the input lasts, falling
+ * back to a character at a time only for group fragments, padding and
+ * white space. Hex goes a pair of digits per step.
+ */
+
+#include "codec.h"
+
+#define W(a,b,c,d) \
+  ((uint32_t)(a) | (uint32_t)(b) << 8 | (uint32_t)(c) << 16 | (uint32_t)(d) << 24)
+
+/* A word-packed table on the stack, indexed by byte (little endian) */
+#define TABLE_LOAD(local, table) \
+  uint32_t local##_words[sizeof (table) / 4]; \
+  const uint8_t *local = (const uint8_t *)table_load (local##_words, table, sizeof (table) / 4)
+
+static inline uint32_t *table_load (uint32_t *dst, const uint32_t *src, int words)
+{
+  int i;
+  for (i = 0; i < words; i++)
+    dst[i] = src[i];
+  return dst;
+}
+
+static const uint32_t b64_chars[16] ICACHE_RODATA_ATTR = {
+  W('A','B','C','D'), W('E','F','G','H'), W('I','J','K','L'), W('M','N','O','P'),
+  W('Q','R','S','T'), W('U','V','W','X'), W('Y','Z','a','b'), W('c','d','e','f'),
+  W('g','h','i','j'), W('k','l','m','n'), W('o','p','q','r'), W('s','t','u','v'),
+  W('w','x','y','z'), W('0','1','2','3'), W('4','5','6','7'), W('8','9','+','/'),
+};
+
+/* Values of the 7-bit characters in base64, or one of these */
+#define B64_PAD   0x40
+#define B64_SPACE 0x41
+#define B64_BAD   0x80
+
+static const uint32_t b64_values[32] ICACHE_RODATA_ATTR = {
+  W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80), W(0x80,0x41,0x41,0x41), W(0x41,0x41,0x80,0x80),
+  W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80),
+  W(0x41,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x3e), W(0x80,0x80,0x80,0x3f),
+  W(0x34,0x35,0x36,0x37), W(0x38,0x39,0x3a,0x3b), W(0x3c,0x3d,0x80,0x80), W(0x80,0x40,0x80,0x80),
+  W(0x80,0x00,0x01,0x02), W(0x03,0x04,0x05,0x06), W(0x07,0x08,0x09,0x0a), W(0x0b,0x0c,0x0d,0x0e),
+  W(0x0f,0x10,0x11,0x12), W(0x13,0x14,0x15,0x16), W(0x17,0x18,0x19,0x80), W(0x80,0x80,0x80,0x80),
+  W(0x80,0x1a,0x1b,0x1c), W(0x1d,0x1e,0x1f,0x20), W(0x21,0x22,0x23,0x24), W(0x25,0x26,0x27,0x28),
+  W(0x29,0x2a,0x2b,0x2c), W(0x2d,0x2e,0x2f,0x30), W(0x31,0x32,0x33,0x80), W(0x80,0x80,0x80,0x80),
+};
+
+static const uint32_t hex_chars[4] ICACHE_RODATA_ATTR = {
+  W('0','1','2','3'), W('4','5','6','7'), W('8','9','a','b'), W('c','d','e','f'),
+};
+
+/* Values of the 7-bit hex digits, B64_SPACE or B64_BAD */
+static const uint32_t hex_values[32] ICACHE_RODATA_ATTR = {
+  W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80), W(0x80,0x41,0x41,0x41), W(0x41,0x41,0x80,0x80),
+  W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80),
+  W(0x41,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80),
+  W(0x00,0x01,0x02,0x03), W(0x04,0x05,0x06,0x07), W(0x08,0x09,0x80,0x80), W(0x80,0x80,0x80,0x80),
+  W(0x80,0x0a,0x0b,0x0c), W(0x0d,0x0e,0x0f,0x80), W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80),
+  W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80),
+  W(0x80,0x0a,0x0b,0x0c), W(0x0d,0x0e,0x0f,0x80), W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80),
+  W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80), W(0x80,0x80,0x80,0x80),
+};
+
+/* A 128-entry value table on the stack, extended to all byte values */
+#define VALUES_LOAD(local, table) \
+  uint32_t local##_words[64]; \
+  const uint8_t *local = (const uint8_t *)values_load (local##_words, table)
+
+static inline uint32_t *values_load (uint32_t *dst, const uint32_t *src)
+{
+  int i;
+  for (i = 0; i < 32; i++)
+    dst[i] = src[i];
+  for (; i < 64; i++)
+    dst[i] = W(B64_BAD, B64_BAD, B64_BAD, B64_BAD);
+  return dst;
+}
+
+
+void codec_init (codec_state_t *s, int flags)
+{
+  s->bits = 0;
+  s->n = 0;
+  s->pad = 0;
+  s->flags = flags;
+}
+
+
+/* Four characters for the 24 bits in v */
+static inline char *b64_put (const uint8_t *chars, char *q, uint32_t v)
+{
+  q[0] = chars[(v >> 18) & 63];
+  q[1] = chars[(v >> 12) & 63];
+  q[2] = chars[(v >> 6) & 63];
+  q[3] = chars[v & 63];
+  return q + 4;
+}
+
+size_t codec_base64_encode_update (codec_state_t *s, const char *in, size_t len, char *out)
+{
+  TABLE_LOAD (chars, b64_chars);
+  const uint8_t *p = (const uint8_t *)in;
+  char *q = out;
+
+  // Complete the group left over from the last piece
+  while (s->n && len)
+  {
+    s->bits = s->bits << 8 | *p++;
+    len--;
+    if (++s->n == 3)
+    {
+      q = b64_put (chars, q, s->bits);
+      s->n = 0;
+    }
+  }
+
+  for (; len >= 3; len -= 3, p += 3)
+    q = b64_put (chars, q, (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2]);
+
+  for (; len; len--)
+  {
+    s->bits = s->bits << 8 | *p++;
+    s->n++;
+  }
+  return q - out;
+}
+
+size_t codec_base64_encode_end (codec_state_t *s, char *out)
+{
+  if (!s->n)
+    return 0;
+  TABLE_LOAD (chars, b64_chars);
+  b64_put (chars, out, s->bits << (s->n == 1 ? 16 : 8));
+  if (s->n == 1)
+    out[2] = '=';
+  out[3] = '=';
+  s->n = 0;
+  return 4;
+}
+
+size_t codec_base64_encode (const char *in, size_t len, char *out)
+{
+  codec_state_t s;
+  codec_init (&s, 0);
+  size_t n = codec_base64_encode_update (&s, in, len, out);
+  return n + codec_base64_encode_end (&s, out + n);
+}
+
+
+sint32_t codec_base64_decode_update (codec_state_t *s, const char *in, size_t len, char *out)
+{
+  VALUES_LOAD (values, b64_values);
+  const uint8_t *p = (const uint8_t *)in, *end = p + len;
+  uint8_t *q = (uint8_t *)out;
+
+  while (p < end)
+  {
+    // Whole groups
+    if (s->n == 0 && !s->pad)
+    {
+      for (; end - p >= 4; p += 4, q += 3)
+      {
+        uint32_t a = values[p[0]], b = values[p[1]];
+        uint32_t c = values[p[2]], d = values[p[3]];
+        if ((a | b | c | d) & 0xc0)
+          break;
+        uint32_t v = a << 18 | b << 12 | c << 6 | d;
+        q[0] = v >> 16;
+        q[1] = v >> 8;
+        q[2] = v;
+      }
+      if (p == end)
+        break;
+    }
+
+    // A character at a time. The bytes are written as soon as they are
+    // complete, so that the output never overtakes the input.
+    uint8_t v = values[*p];
+    p++;
+    if (v == B64_SPACE && (s->flags & CODEC_SKIP_SPACE))
+      continue;
+    if (v == B64_PAD)
+    {
+      if (s->pad == 2)
+        s->pad = 1;
+      else if (!s->pad && s->n >= 2)
+      {
+        s->pad = s->n == 2 ? 2 : 1;
+        s->n = 0;
+      }
+      else
+        return -1;
+      continue;
+    }
+    if ((v & 0xc0) || s->pad)
+      return -1;
+
+    s->bits = s->bits << 6 | v;
+    switch (++s->n)
+    {
+      case 2: *q++ = s->bits >> 4; break;
+      case 3: *q++ = s->bits >> 2; break;
+      case 4: *q++ = s->bits; s->n = 0; break;
+    }
+  }
+  return q - (uint8_t *)out;
+}
+
+int codec_base64_decode_end (codec_state_t *s)
+{
+  return (s->n == 0 && s->pad != 2) ? 0 : -1;
+}
+
+sint32_t codec_base64_decode (const char *in, size_t len, char *out)
+{
+  codec_state_t s;
+  codec_init (&s, 0);
+  sint32_t n = codec_base64_decode_update (&s, in, len, out);
+  return (n < 0 || codec_base64_decode_end (&s) < 0) ? -1 : n;
+}
+
+
+size_t codec_hex_encode (const char *in, size_t len, char *out)
+{
+  TABLE_LOAD (chars, hex_chars);
+  const uint8_t *p = (const uint8_t *)in;
+  size_t i = len;
+
+  // From the end, so that out may be in
+  while (i--)
+  {
+    uint8_t b = p[i];
+    out[2 * i + 1] = chars[b & 15];
+    out[2 * i] = chars[b >> 4];
+  }
+  return 2 * len;
+}
+
+sint32_t codec_hex_decode_update (codec_state_t *s, const char *in, size_t len, char *out)
+{
+  VALUES_LOAD (values, hex_values);
+  const uint8_t *p = (const uint8_t *)in, *end = p + len;
+  uint8_t *q = (uint8_t *)out;
+
+  while (p < end)
+  {
+    // Whole pairs
+    if (s->n == 0)
+    {
+      for (; end - p >= 2; p += 2)
+      {
+        uint8_t a = values[p[0]], b = values[p[1]];
+        if ((a | b) & 0xc0)
+          break;
+        *q++ = a << 4 | b;
+      }
+      if (p == end)
+        break;
+    }
+
+    uint8_t v = values[*p];
+    p++;
+    if (v == B64_SPACE && (s->flags & CODEC_SKIP_SPACE))
+      continue;
+    if (v & 0xc0)
+      return -1;
+    if (s->n)
+    {
+      *q++ = s->bits << 4 | v;
+      s->n = 0;
+    }
+    else
+    {
+      s->bits = v;
+      s->n = 1;
+    }
+  }
+  return q - (uint8_t *)out;
+}
+
+int codec_hex_decode_end (codec_state_t *s)
+{
+  return s->n ? -1 : 0;
+}
+
+sint32_t codec_hex_decode (const char *in, size_t len, char *out)
+{
+  codec_state_t s;
+  codec_init (&s, 0);
+  sint32_t n = codec_hex_decode_update (&s, in, len, out);
+  return (n < 0 || codec_hex_decode_end (&s) < 0) ? -1 : n;
+}
@@ -0,0 +1,101 @@
+#ifndef _CRYPTO_CODEC_H_
+#define _CRYPTO_CODEC_H_
+
+#include <c_types.h>
+
+/**
+ * Base64 (RFC 4648) and hex codecs, shared by the encoder, crypto, net and
+ * websocket code.
+ *
+ * The one-shot functions handle a whole string. The _update/_end functions
+ * take the data in pieces of any size, a @c codec_state_t carries partial
+ * groups from one piece to the next. Decoders never write ahead of what
+ * they have read, so @c out may be the same buffer as @c in.
+ *
+ * Typical usage for a stream:
+ *   codec_state_t s;
+ *   codec_init (&s, CODEC_SKIP_SPACE);
+ *   while (more input)
+ *     if ((n = codec_base64_decode_update (&s, in, len, out)) < 0)
+ *       error;
+ *   if (codec_base64_decode_end (&s) < 0)
+ *     error;
+ */
+
+/** Length of the base64 encoding of n bytes, with padding */
+#define CODEC_BASE64_LEN(n) (((n) + 2) / 3 * 4)
+
+/** Decoders skip white space instead of failing on it */
+#define CODEC_SKIP_SPACE 1
+
+typedef struct
+{
+  uint32_t bits;  /* pending input */
+  uint8_t n;      /* bytes or characters in bits */
+  uint8_t pad;    /* base64 decoding: 1 after padding, 2 if one more '=' is due */
+  uint8_t flags;
+} codec_state_t;
+
+void codec_init (codec_state_t *s, int flags);
+
+/**
+ * Base64 encodes the next piece of data.
+ * @param out Room for CODEC_BASE64_LEN(len) characters.
+ * @return The number of characters written to @c out.
+ */
+size_t codec_base64_encode_update (codec_state_t *s, const char *in, size_t len, char *out);
+
+/**
+ * Encodes the last partial group with padding.
+ * @param out Room for 4 characters.
+ * @return The number of characters written to @c out.
+ */
+size_t codec_base64_encode_end (codec_state_t *s, char *out);
+
+/**
+ * Decodes the next piece of base64 text.
+ * @param out Room for @c len bytes, may be @c in.
+ * @return The number of bytes written to @c out, or -1 on an invalid
+ *         character or misplaced padding.
+ */
+sint32_t codec_base64_decode_update (codec_state_t *s, const char *in, size_t len, char *out);
+
+/**
+ * Checks that the base64 text ended on a whole group.
+ * @return 0 if it did, -1 otherwise.
+ */
+int codec_base64_decode_end (codec_state_t *s);
+
+/** One-shot encoding, @c out needs room for CODEC_BASE64_LEN(len) */
+size_t codec_base64_encode (const char *in, size_t len, char *out);
+
+/** One-shot strict decoding, @c out needs room for @c len * 3 / 4 bytes
+ *  and may be @c in. Returns the decoded length or -1. */
+sint32_t codec_base64_decode (const char *in, size_t len, char *out);
+
+/**
+ * Lower case hex encoding.
+ * @param out Room for 2 * @c len characters, may be @c in.
+ * @return The number of characters written, 2 * @c len.
+ */
+size_t codec_hex_encode (const char *in, size_t len, char *out);
+
+/**
+ * Decodes the next piece of hex text, in either case.
+ * @param out Room for (@c len + 1) / 2 bytes, may be @c in.
+ * @return The number of bytes written to @c out, or -1 on an invalid
+ *         character.
+ */
+sint32_t codec_hex_decode_update (codec_state_t *s, const char *in, size_t len, char *out);
+
+/**
+ * Checks that the hex text had an even number of digits.
+ * @return 0 if it had, -1 otherwise.
+ */
+int codec_hex_decode_end (codec_state_t *s);
+
+/** One-shot strict decoding, @c out needs room for @c len / 2 bytes and
+ *  may be @c in. Returns the decoded length or -1. */
+sint32_t codec_hex_decode (const char *in, size_t len, char *out);
+
+#endif
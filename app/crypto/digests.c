@@ -29,6 +29,7 @@
  */
 #include "vfs.h"
 #include "digests.h"
+#include "codec.h"
 #include "user_config.h"
 #include "rom.h"
 #include "osapi.h"
@@ -44,7 +45,14 @@
 #include "sha2.h"
 #endif
 
+/* Room for a few blocks of any of the digests below */
+#define DIGEST_READ_BUFFER_SIZE 256
+
+/* The 64-bit host tools (tools/cryptobench) get away with the mismatch
+   below as all lengths fit in 32 bits. */
+#ifndef __LP64__
 typedef char ensure_int_and_size_t_same[(sizeof(int)==sizeof(size_t)) ? 0 : -1];
+#endif
 
 /* None of the functions match the prototype fully due to the void *, and in
    some cases also the int vs size_t len, so wrap declarations in a macro. */
@@ -88,18 +96,10 @@ const digest_mech_info_t *ICACHE_FLASH_ATTR crypto_digest_mech (const char *mech
   return 0;
 }
 
-const char crypto_hexbytes[] = "0123456789abcdef";
-
 // note: supports in-place encoding
 void ICACHE_FLASH_ATTR crypto_encode_asciihex (const char *bin, size_t binlen, char *outbuf)
 {
-  size_t aidx = binlen * 2 -1;
-  int i;
-  for (i = binlen -1; i >= 0; --i)
-  {
-    outbuf[aidx--] = crypto_hexbytes[bin[i] & 0xf];
-    outbuf[aidx--] = crypto_hexbytes[bin[i] >>  4];
-  }
+  codec_hex_encode (bin, binlen, outbuf);
 }
 
 
@@ -123,6 +123,37 @@ int ICACHE_FLASH_ATTR crypto_hash (const digest_mech_info_t *mi,
 }
 
 
+sint32_t ICACHE_FLASH_ATTR crypto_hash_read (const digest_mech_info_t *mi,
+  void *ctx, read_fn read, int readarg, sint32_t len)
+{
+  uint8_t buffer[DIGEST_READ_BUFFER_SIZE];
+  sint32_t done = 0;
+
+  while (len < 0 || done < len)
+  {
+    sint32_t want = sizeof (buffer);
+    if (len >= 0 && len - done < want)
+      want = len - done;
+
+    sint32_t read_len = read (readarg, buffer, want);
+    if (read_len < 0)
+      return -1;
+    mi->update (ctx, buffer, read_len);
+    done += read_len;
+    if (read_len < want)
+      break;  // end of file
+  }
+  return done;
+}
+
+
+void ICACHE_FLASH_ATTR crypto_digest_update (digest_user_datum_t *dudat,
+  const void *data, size_t len)
+{
+  dudat->mech_info->update (dudat->ctx, data, len);
+}
+
+
 int ICACHE_FLASH_ATTR crypto_fhash (const digest_mech_info_t *mi,
   read_fn read, int readarg,
   uint8_t *digest)
@@ -136,21 +167,16 @@ int ICACHE_FLASH_ATTR crypto_fhash (const digest_mech_info_t *mi,
     return ENOMEM;
   mi->create (ctx);
 
-  // Hash bytes from file in blocks
-  uint8_t* buffer = (uint8_t*)os_malloc (mi->block_size);
-  if (!buffer)
-    return ENOMEM;
-  
-  int read_len = 0;
-  do {
-    read_len = read(readarg, buffer, mi->block_size);
-    mi->update (ctx, buffer, read_len);
-  } while (read_len == mi->block_size);
+  // Hash bytes from file, no buffer on the heap
+  if (crypto_hash_read (mi, ctx, read, readarg, -1) < 0)
+  {
+    os_free (ctx);
+    return EIO;
+  }
 
   // Finish up
   mi->finalize (digest, ctx);
 
-  os_free (buffer);
   os_free (ctx);
   return 0;
 }
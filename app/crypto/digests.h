@@ -36,6 +36,23 @@ typedef struct
 } digest_mech_info_t;
 
 
+/**
+ * The state of a hash object from crypto.new_hash() or crypto.new_hmac(), a
+ * userdata with the metatable @c CRYPTO_HASH_METATABLE.
+ *
+ * Other modules can accept such an object from Lua and feed the bytes they
+ * receive into it with @c crypto_digest_update(), without creating Lua
+ * strings. They should hold a registry reference to the object meanwhile.
+ */
+typedef struct {
+  const digest_mech_info_t *mech_info;
+  void *ctx;
+  uint8_t *k_opad;
+} digest_user_datum_t;
+
+#define CRYPTO_HASH_METATABLE "crypto.hash"
+
+
 /**
  * Looks up the mech data for a specified digest algorithm.
  * @param mech The name of the algorithm, e.g. "MD5", "SHA256"
@@ -65,6 +82,26 @@ int crypto_hash (const digest_mech_info_t *mi, const char *data, size_t data_len
  */
 int crypto_fhash (const digest_mech_info_t *mi, read_fn read, int readarg, uint8_t *digest);
 
+/**
+ * Hashes the data returned by a read function into a created context,
+ * through a buffer on the stack.
+ * @param mi       A mech from @c crypto_digest_mech().
+ * @param ctx      A created context for @c mi.
+ * @param read     Pointer to the read function (e.g. vfs_read)
+ * @param readarg  Argument to pass to the read function (e.g. file descriptor)
+ * @param len      Number of bytes to hash, or -1 for all up to end of file.
+ * @return The number of bytes hashed, or -1 if a read failed.
+ */
+sint32_t crypto_hash_read (const digest_mech_info_t *mi, void *ctx, read_fn read, int readarg, sint32_t len);
+
+/**
+ * Feeds data into a hash object, see @c digest_user_datum_t.
+ * @param dudat    The userdata of the hash object.
+ * @param data     The data to add.
+ * @param len      Number of bytes at @c data.
+ */
+void crypto_digest_update (digest_user_datum_t *dudat, const void *data, size_t len);
+
 /**
  * Commence calculating a HMAC signature.
  *
@@ -118,7 +155,4 @@ int crypto_hmac (const digest_mech_info_t *mi, const char *data, size_t data_len
 void crypto_encode_asciihex (const char *bin, size_t bin_len, char *outbuf);
 
 
-/** Text string "0123456789abcdef" */
-const char crypto_hexbytes[17];
-
 #endif
@@ -34,6 +34,7 @@
 #include "mech.h"
 #include "sdk-aes.h"
 #include "c_string.h"
+#include "c_errno.h"
 
 /* ----- AES ---------------------------------------------------------- */
 
@@ -129,3 +130,170 @@ const crypto_mech_t *crypto_encryption_mech (const char *name)
   }
   return 0;
 }
+
+
+/* ----- streaming ciphers -------------------------------------------- */
+
+enum { CIPHER_ECB, CIPHER_CBC, CIPHER_CTR };
+
+static const char *const cipher_modes[] = { "AES-ECB", "AES-CBC", "AES-CTR" };
+
+
+int crypto_cipher_init (crypto_cipher_t *c, const char *name, int op, const char *key, size_t keylen, const char *iv, size_t ivlen, int padding)
+{
+  int mode;
+  for (mode = 0; mode < sizeof (cipher_modes) / sizeof (cipher_modes[0]); ++mode)
+    if (strcasecmp (name, cipher_modes[mode]) == 0)
+      break;
+  if (mode == sizeof (cipher_modes) / sizeof (cipher_modes[0]) || keylen != 16)
+    return EINVAL;
+
+  c_memset (c, 0, sizeof (*c));
+  c->mode = mode;
+  c->op = op;
+  c->padding = padding;
+  if (ivlen)
+    c_memcpy (c->iv, iv, ivlen < AES_BLOCKSIZE ? ivlen : AES_BLOCKSIZE);
+  if (mode == CIPHER_CTR)
+    c->used = AES_BLOCKSIZE;  // no key stream yet
+
+  // CTR mode decrypts by encrypting the counter too
+  c->ctx = aes_funcs[mode == CIPHER_CTR ? OP_ENCRYPT : op].init (key, keylen);
+  return c->ctx ? 0 : ENOMEM;
+}
+
+
+static void cipher_xor (char *dst, const char *src)
+{
+  int i;
+  for (i = 0; i < AES_BLOCKSIZE; ++i)
+    dst[i] ^= src[i];
+}
+
+static void cipher_block (crypto_cipher_t *c, const char *in, char *out)
+{
+  const struct aes_funcs *funcs = &aes_funcs[c->op];
+
+  if (c->mode == CIPHER_ECB)
+    funcs->crypt (c->ctx, in, out);
+  else if (c->op == OP_ENCRYPT)
+  {
+    cipher_xor (c->iv, in);
+    funcs->crypt (c->ctx, c->iv, out);
+    c_memcpy (c->iv, out, AES_BLOCKSIZE);
+  }
+  else
+  {
+    funcs->crypt (c->ctx, in, out);
+    cipher_xor (out, c->iv);
+    c_memcpy (c->iv, in, AES_BLOCKSIZE);
+  }
+}
+
+static size_t cipher_ctr (crypto_cipher_t *c, const char *in, size_t len, char *out)
+{
+  size_t i;
+  for (i = 0; i < len; ++i)
+  {
+    if (c->used == AES_BLOCKSIZE)
+    {
+      aes_encrypt (c->ctx, c->iv, c->buf);
+      int j = AES_BLOCKSIZE;
+      while (j-- && ++c->iv[j] == 0)
+        ;  // big-endian increment of the whole block
+      c->used = 0;
+    }
+    out[i] = in[i] ^ c->buf[c->used++];
+  }
+  return len;
+}
+
+
+size_t crypto_cipher_update (crypto_cipher_t *c, const char *in, size_t len, char *out)
+{
+  if (c->mode == CIPHER_CTR)
+    return cipher_ctr (c, in, len, out);
+
+  // The last block of padded cipher text is only known at finalize
+  bool hold = c->op == OP_DECRYPT && c->padding == CRYPTO_PAD_PKCS7;
+  size_t done = 0;
+
+  while (len)
+  {
+    if (c->used == AES_BLOCKSIZE)
+    {
+      cipher_block (c, c->buf, out + done);
+      done += AES_BLOCKSIZE;
+      c->used = 0;
+    }
+    if (c->used == 0 && (len > AES_BLOCKSIZE || (len == AES_BLOCKSIZE && !hold)))
+    {
+      // Whole blocks straight from the input
+      cipher_block (c, in, out + done);
+      done += AES_BLOCKSIZE;
+      in += AES_BLOCKSIZE;
+      len -= AES_BLOCKSIZE;
+      continue;
+    }
+    size_t n = AES_BLOCKSIZE - c->used;
+    if (n > len)
+      n = len;
+    c_memcpy (c->buf + c->used, in, n);
+    c->used += n;
+    in += n;
+    len -= n;
+    if (c->used == AES_BLOCKSIZE && !hold)
+    {
+      cipher_block (c, c->buf, out + done);
+      done += AES_BLOCKSIZE;
+      c->used = 0;
+    }
+  }
+  return done;
+}
+
+
+int crypto_cipher_finalize (crypto_cipher_t *c, char *out)
+{
+  if (c->mode == CIPHER_CTR)
+    return 0;
+
+  if (c->op == OP_ENCRYPT)
+  {
+    if (c->padding == CRYPTO_PAD_PKCS7)
+      c_memset (c->buf + c->used, AES_BLOCKSIZE - c->used, AES_BLOCKSIZE - c->used);
+    else if (c->used == 0)
+      return 0;
+    else if (c->padding == CRYPTO_PAD_ZERO)
+      c_memset (c->buf + c->used, 0, AES_BLOCKSIZE - c->used);
+    else
+      return -1;
+    cipher_block (c, c->buf, out);
+    c->used = 0;
+    return AES_BLOCKSIZE;
+  }
+
+  if (c->padding != CRYPTO_PAD_PKCS7)
+    return c->used ? -1 : 0;
+  if (c->used != AES_BLOCKSIZE)
+    return -1;
+  cipher_block (c, c->buf, out);
+  c->used = 0;
+
+  uint8_t pad = out[AES_BLOCKSIZE - 1];
+  int i;
+  if (pad == 0 || pad > AES_BLOCKSIZE)
+    return -1;
+  for (i = AES_BLOCKSIZE - pad; i < AES_BLOCKSIZE; ++i)
+    if ((uint8_t)out[i] != pad)
+      return -1;
+  return AES_BLOCKSIZE - pad;
+}
+
+
+void crypto_cipher_free (crypto_cipher_t *c)
+{
+  if (c->ctx)
+    aes_funcs[c->mode == CIPHER_CTR ? OP_ENCRYPT : c->op].deinit (c->ctx);
+  c->ctx = 0;
+}
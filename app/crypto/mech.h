@@ -27,4 +27,77 @@ typedef struct
 
 const crypto_mech_t *crypto_encryption_mech (const char *name);
 
+
+/* Padding of the last block in ECB and CBC mode, see crypto_cipher_init() */
+enum { CRYPTO_PAD_PKCS7, CRYPTO_PAD_ZERO, CRYPTO_PAD_NONE };
+
+/* Largest block size of the ciphers below */
+#define CRYPTO_CIPHER_BLOCK 16
+
+/**
+ * State of a cipher that processes the data in pieces, for data that
+ * does not fit in RAM at once.
+ *
+ * Typical usage:
+ *   crypto_cipher_t c;
+ *   if (crypto_cipher_init (&c, "AES-CBC", OP_ENCRYPT, key, 16, iv, 16,
+ *                           CRYPTO_PAD_PKCS7) == 0) {
+ *     n = crypto_cipher_update (&c, data, len, out);
+ *     ...
+ *     n = crypto_cipher_finalize (&c, out);
+ *     crypto_cipher_free (&c);
+ *   }
+ */
+typedef struct
+{
+  void *ctx;
+  uint8_t mode;
+  uint8_t op;
+  uint8_t padding;
+  uint8_t used;
+  char iv[CRYPTO_CIPHER_BLOCK];   /* chaining value, or counter in CTR mode */
+  char buf[CRYPTO_CIPHER_BLOCK];  /* partial block, or CTR key stream */
+} crypto_cipher_t;
+
+/**
+ * Prepares a cipher.
+ * @param c       The state to initialise.
+ * @param name    "AES-ECB", "AES-CBC" or "AES-CTR", case insensitive.
+ * @param op      OP_ENCRYPT or OP_DECRYPT.
+ * @param key     The key, 16 bytes for AES.
+ * @param iv      The initialisation vector in CBC mode, the initial counter
+ *                block in CTR mode. Missing bytes are zero.
+ * @param padding How to fill the last block in ECB and CBC mode, one of
+ *                CRYPTO_PAD_PKCS7, CRYPTO_PAD_ZERO or CRYPTO_PAD_NONE.
+ * @return 0 on success, EINVAL for an unknown cipher or bad key, ENOMEM.
+ */
+int crypto_cipher_init (crypto_cipher_t *c, const char *name, int op, const char *key, size_t keylen, const char *iv, size_t ivlen, int padding);
+
+/**
+ * Processes the next piece of data.
+ * @param c       A state from crypto_cipher_init().
+ * @param in      The data.
+ * @param len     Number of bytes at @c in.
+ * @param out     Output buffer of at least @c len + CRYPTO_CIPHER_BLOCK
+ *                bytes, not overlapping @c in.
+ * @return The number of bytes written to @c out. Block modes hold back
+ *         partial blocks, and the last block when decrypting with padding.
+ */
+size_t crypto_cipher_update (crypto_cipher_t *c, const char *in, size_t len, char *out);
+
+/**
+ * Processes the bytes held back, adding or removing padding.
+ * @param c       A state from crypto_cipher_init().
+ * @param out     Output buffer of at least CRYPTO_CIPHER_BLOCK bytes.
+ * @return The number of bytes written to @c out, or -1 if the data did
+ *         not end on a block boundary where required or the padding is
+ *         invalid.
+ */
+int crypto_cipher_finalize (crypto_cipher_t *c, char *out);
+
+/**
+ * Releases the key schedule of a cipher. Harmless to call twice.
+ */
+void crypto_cipher_free (crypto_cipher_t *c);
+
 #endif
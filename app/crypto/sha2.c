@@ -57,6 +57,8 @@
  *
  *   #define SHA2_UNROLL_TRANSFORM
  *
+ * NodeMCU defines it in user_config.h, together with SHA2_IRAM to place
+ * the unrolled SHA-256 transform in IRAM.
  */
 
 
@@ -144,9 +146,10 @@ typedef uint64_t sha2_word64;	/* Exactly 8 bytes */
 /* 64-bit Rotate-right (used in SHA-384 and SHA-512): */
 #define S64(b,x)	(((x) >> (b)) | ((x) << (64 - (b))))
 
-/* Two of six logical functions used in SHA-256, SHA-384, and SHA-512: */
-#define Ch(x,y,z)	(((x) & (y)) ^ ((~(x)) & (z)))
-#define Maj(x,y,z)	(((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+/* Two of six logical functions used in SHA-256, SHA-384, and SHA-512,
+ * in the forms that need the fewest operations: */
+#define Ch(x,y,z)	((z) ^ ((x) & ((y) ^ (z))))
+#define Maj(x,y,z)	(((x) & (y)) | ((z) & ((x) | (y))))
 
 /* Four of six logical functions used in SHA-256: */
 #define Sigma0_256(x)	(S32(2,  (x)) ^ S32(13, (x)) ^ S32(22, (x)))
@@ -284,47 +287,42 @@ void ICACHE_FLASH_ATTR SHA256_Init(SHA256_CTX* context) {
 
 #ifdef SHA2_UNROLL_TRANSFORM
 
-/* Unrolled SHA-256 round macros: */
-
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN_
-
-#define ROUND256_0_TO_15(a,b,c,d,e,f,g,h)	\
-	REVERSE32(*data++, W256[j]); \
-	T1 = (h) + Sigma1_256(e) + Ch((e), (f), (g)) + \
-             K256[j] + W256[j]; \
-	(d) += T1; \
-	(h) = T1 + Sigma0_256(a) + Maj((a), (b), (c)); \
-	j++
-
-
-#else /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN_ */
-
-#define ROUND256_0_TO_15(a,b,c,d,e,f,g,h)	\
-	T1 = (h) + Sigma1_256(e) + Ch((e), (f), (g)) + \
-	     K256[j] + (W256[j] = *data++); \
-	(d) += T1; \
-	(h) = T1 + Sigma0_256(a) + Maj((a), (b), (c)); \
-	j++
+/*
+ * SHA-256 for 32-bit targets: the whole message schedule is computed up
+ * front into a 64-word array, then the rounds run eight to a loop pass
+ * with the working variables renamed instead of moved between rounds. The
+ * block is loaded a byte at a time in big-endian order, which needs no
+ * byte swapping on little-endian CPUs and works on unaligned input.
+ *
+ * Define SHA2_IRAM to run it from IRAM instead of through the flash cache.
+ */
 
-#endif /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN_ */
+#ifdef SHA2_IRAM
+#define SHA256_TRANSFORM_ATTR ICACHE_RAM_ATTR
+#else
+#define SHA256_TRANSFORM_ATTR ICACHE_FLASH_ATTR
+#endif
 
-#define ROUND256(a,b,c,d,e,f,g,h)	\
-	s0 = W256[(j+1)&0x0f]; \
-	s0 = sigma0_256(s0); \
-	s1 = W256[(j+14)&0x0f]; \
-	s1 = sigma1_256(s1); \
-	T1 = (h) + Sigma1_256(e) + Ch((e), (f), (g)) + K256[j] + \
-	     (W256[j&0x0f] += s1 + W256[(j+9)&0x0f] + s0); \
+#define ROUND256(a,b,c,d,e,f,g,h,i)	\
+	T1 = (h) + Sigma1_256(e) + Ch((e), (f), (g)) + K256[j+(i)] + W256[j+(i)]; \
 	(d) += T1; \
-	(h) = T1 + Sigma0_256(a) + Maj((a), (b), (c)); \
-	j++
+	(h) = T1 + Sigma0_256(a) + Maj((a), (b), (c))
 
-void ICACHE_FLASH_ATTR SHA256_Transform(SHA256_CTX* context, const sha2_word32* data) {
-	sha2_word32	a, b, c, d, e, f, g, h, s0, s1;
-	sha2_word32	T1, *W256;
+void SHA256_TRANSFORM_ATTR SHA256_Transform(SHA256_CTX* context, const sha2_word32* data) {
+	const sha2_byte	*p = (const sha2_byte*)data;
+	sha2_word32	a, b, c, d, e, f, g, h, T1;
+	sha2_word32	W256[64];
 	int		j;
 
-	W256 = (sha2_word32*)context->buffer;
+	/* Load the block as big-endian words and expand the schedule */
+	for (j = 0; j < 16; j++, p += 4) {
+		W256[j] = ((sha2_word32)p[0] << 24) | ((sha2_word32)p[1] << 16) |
+		          ((sha2_word32)p[2] << 8) | (sha2_word32)p[3];
+	}
+	for (; j < 64; j++) {
+		W256[j] = sigma1_256(W256[j-2]) + W256[j-7] +
+		          sigma0_256(W256[j-15]) + W256[j-16];
+	}
 
 	/* Initialize registers with the prev. intermediate value */
 	a = context->state[0];
@@ -336,30 +334,16 @@ void ICACHE_FLASH_ATTR SHA256_Transform(SHA256_CTX* context, const sha2_word32*
 	g = context->state[6];
 	h = context->state[7];
 
-	j = 0;
-	do {
-		/* Rounds 0 to 15 (unrolled): */
-		ROUND256_0_TO_15(a,b,c,d,e,f,g,h);
-		ROUND256_0_TO_15(h,a,b,c,d,e,f,g);
-		ROUND256_0_TO_15(g,h,a,b,c,d,e,f);
-		ROUND256_0_TO_15(f,g,h,a,b,c,d,e);
-		ROUND256_0_TO_15(e,f,g,h,a,b,c,d);
-		ROUND256_0_TO_15(d,e,f,g,h,a,b,c);
-		ROUND256_0_TO_15(c,d,e,f,g,h,a,b);
-		ROUND256_0_TO_15(b,c,d,e,f,g,h,a);
-	} while (j < 16);
-
-	/* Now for the remaining rounds to 64: */
-	do {
-		ROUND256(a,b,c,d,e,f,g,h);
-		ROUND256(h,a,b,c,d,e,f,g);
-		ROUND256(g,h,a,b,c,d,e,f);
-		ROUND256(f,g,h,a,b,c,d,e);
-		ROUND256(e,f,g,h,a,b,c,d);
-		ROUND256(d,e,f,g,h,a,b,c);
-		ROUND256(c,d,e,f,g,h,a,b);
-		ROUND256(b,c,d,e,f,g,h,a);
-	} while (j < 64);
+	for (j = 0; j < 64; j += 8) {
+		ROUND256(a,b,c,d,e,f,g,h,0);
+		ROUND256(h,a,b,c,d,e,f,g,1);
+		ROUND256(g,h,a,b,c,d,e,f,2);
+		ROUND256(f,g,h,a,b,c,d,e,3);
+		ROUND256(e,f,g,h,a,b,c,d,4);
+		ROUND256(d,e,f,g,h,a,b,c,5);
+		ROUND256(c,d,e,f,g,h,a,b,6);
+		ROUND256(b,c,d,e,f,g,h,a,7);
+	}
 
 	/* Compute the current intermediate hash value */
 	context->state[0] += a;
@@ -401,10 +385,10 @@ void ICACHE_FLASH_ATTR SHA256_Transform(SHA256_CTX* context, const sha2_word32*
 		REVERSE32(*data++,W256[j]);
 		/* Apply the SHA-256 compression function to update a..h */
 		T1 = h + Sigma1_256(e) + Ch(e, f, g) + K256[j] + W256[j];
-#else /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN_ */
+#else /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ */
 		/* Apply the SHA-256 compression function to update a..h with copy */
 		T1 = h + Sigma1_256(e) + Ch(e, f, g) + K256[j] + (W256[j] = *data++);
-#endif /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN_ */
+#endif /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ */
 		T2 = Sigma0_256(a) + Maj(a, b, c);
 		h = g;
 		g = f;
@@ -543,8 +527,8 @@ void ICACHE_FLASH_ATTR SHA256_Final(sha2_byte digest[], SHA256_CTX* context) {
 			/* Begin padding with a 1 bit: */
 			*context->buffer = 0x80;
 		}
-		/* Set the bit count: */
-		*(sha2_word64*)&context->buffer[SHA256_SHORT_BLOCK_LENGTH] = context->bitcount;
+		/* Set the bit count (copied, the transform reads 32-bit words): */
+		MEMCPY_BCOPY(&context->buffer[SHA256_SHORT_BLOCK_LENGTH], &context->bitcount, sizeof(sha2_word64));
 
 		/* Final transform: */
 		SHA256_Transform(context, (sha2_word32*)context->buffer);
@@ -582,7 +566,7 @@ void ICACHE_FLASH_ATTR SHA512_Init(SHA512_CTX* context) {
 #ifdef SHA2_UNROLL_TRANSFORM
 
 /* Unrolled SHA-512 round macros: */
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN_
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
 
 #define ROUND512_0_TO_15(a,b,c,d,e,f,g,h)	\
 	REVERSE64(*data++, W512[j]); \
@@ -593,7 +577,7 @@ void ICACHE_FLASH_ATTR SHA512_Init(SHA512_CTX* context) {
 	j++
 
 
-#else /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN_ */
+#else /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ */
 
 #define ROUND512_0_TO_15(a,b,c,d,e,f,g,h)	\
 	T1 = (h) + Sigma1_512(e) + Ch((e), (f), (g)) + \
@@ -602,7 +586,7 @@ void ICACHE_FLASH_ATTR SHA512_Init(SHA512_CTX* context) {
 	(h) = T1 + Sigma0_512(a) + Maj((a), (b), (c)); \
 	j++
 
-#endif /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN_ */
+#endif /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ */
 
 #define ROUND512(a,b,c,d,e,f,g,h)	\
 	s0 = W512[(j+1)&0x0f]; \
@@ -692,10 +676,10 @@ void ICACHE_FLASH_ATTR SHA512_Transform(SHA512_CTX* context, const sha2_word64*
 		REVERSE64(*data++, W512[j]);
 		/* Apply the SHA-512 compression function to update a..h */
 		T1 = h + Sigma1_512(e) + Ch(e, f, g) + K512[j] + W512[j];
-#else /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN_ */
+#else /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ */
 		/* Apply the SHA-512 compression function to update a..h with copy */
 		T1 = h + Sigma1_512(e) + Ch(e, f, g) + K512[j] + (W512[j] = *data++);
-#endif /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN_ */
+#endif /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ */
 		T2 = Sigma0_512(a) + Maj(a, b, c);
 		h = g;
 		g = f;
@@ -12,6 +12,7 @@
 #include "ets_sys.h"
 #include "osapi.h"
 #include "driver/uart.h"
+#include "driver/uart_ring.h"
 #include "task/task.h"
 #include "user_config.h"
 #include "user_interface.h"
@@ -27,11 +28,33 @@
 #define FUNC_U0CTS                      4
 #endif
 
+#ifndef UART_TX_BUFFER_SIZE
+#define UART_TX_BUFFER_SIZE 512
+#endif
+#if UART_TX_BUFFER_SIZE & (UART_TX_BUFFER_SIZE - 1)
+#error "UART_TX_BUFFER_SIZE must be a power of 2"
+#endif
+// The TX FIFO holds 128 bytes; the interrupt asks for more below this many
+#define UART_TX_FIFO_ROOM   126
+#define UART_TX_EMPTY_LEVEL 16
 
-// For event signalling
+
+// For event signalling: at most one input event is pending at a time
 static task_handle_t sig = 0;
-static uint8 *sig_flag;
-static uint8 isr_flag = 0;
+static task_coalesce_t input_post;
+
+/*
+ * UART0 output is queued in tx_ring and moved into the TX FIFO by the
+ * FIFO empty interrupt, so writers only wait when the ring is full. Then
+ * they feed the FIFO themselves, which works whether or not the interrupt
+ * can run. The ring is written with the UART interrupt masked, so output
+ * from interrupt handlers is queued in order too. tx_sig is posted when
+ * the ring empties.
+ */
+static uint8 tx_buf[UART_TX_BUFFER_SIZE];
+static uart_ring_t tx_ring = UART_RING_INIT(tx_buf, UART_TX_BUFFER_SIZE);
+static task_handle_t tx_sig = 0;
+static task_coalesce_t tx_drain_post;
 
 // UartDev is defined and initialized in rom code.
 extern UartDevice UartDev;
@@ -41,7 +64,87 @@ static os_timer_t autobaud_timer;
 static void (*alt_uart0_tx)(char txchar);
 
 LOCAL void ICACHE_RAM_ATTR
-uart0_rx_intr_handler(void *para);
+uart0_intr_handler(void *para);
+
+/*
+ * Masks the interrupts up to level 3, which include the UART's, and
+ * unmasks them again. Unlike ets_intr_lock() this nests, so output can
+ * be queued from code that holds that lock.
+ */
+static inline uint32 tx_lock(void)
+{
+    uint32 ps;
+    __asm__ __volatile__("rsil %0, 3" : "=a" (ps) :: "memory");
+    return ps;
+}
+
+static inline void tx_unlock(uint32 ps)
+{
+    __asm__ __volatile__("wsr %0, ps; rsync" :: "a" (ps) : "memory");
+}
+
+static inline uint16 ICACHE_RAM_ATTR uart0_tx_fifo_room(void)
+{
+    uint32 fifo_cnt = (READ_PERI_REG(UART_STATUS(UART0)) >> UART_TXFIFO_CNT_S) & UART_TXFIFO_CNT;
+    return fifo_cnt < UART_TX_FIFO_ROOM ? UART_TX_FIFO_ROOM - fifo_cnt : 0;
+}
+
+/******************************************************************************
+ * FunctionName : uart0_tx_fill
+ * Description  : Internal used function
+ *                Moves queued output into the TX FIFO, as much as it takes.
+ *                Called by the interrupt handler, or with it masked.
+ * Parameters   : NONE
+ * Returns      : NONE
+*******************************************************************************/
+LOCAL void ICACHE_RAM_ATTR
+uart0_tx_fill(void)
+{
+    const uint8 *data;
+    uint16 n, i, room = uart0_tx_fifo_room();
+
+    // At most two runs, the second from the start of the ring
+    while (room && (n = uart_ring_peek(&tx_ring, &data)) != 0) {
+        if (n > room)
+            n = room;
+        for (i = 0; i < n; i++)
+            WRITE_PERI_REG(UART_FIFO(UART0), data[i]);
+        uart_ring_skip(&tx_ring, n);
+        room -= n;
+    }
+}
+
+/******************************************************************************
+ * FunctionName : uart0_tx_queue
+ * Description  : Internal used function
+ *                Queues output for UART0, waiting only while the ring is full
+ * Parameters   : const uint8 *buf - the bytes
+ *                uint16 len - their number
+ * Returns      : NONE
+*******************************************************************************/
+LOCAL void ICACHE_FLASH_ATTR
+uart0_tx_queue(const uint8 *buf, uint16 len)
+{
+    while (len) {
+        uint32 ps;
+        uint16 n;
+
+        if (uart_ring_free(&tx_ring) == 0) {
+            // Full: make room by feeding the FIFO at its pace
+            while (uart0_tx_fifo_room() == 0)
+                ;
+            ps = tx_lock();
+            uart0_tx_fill();
+            tx_unlock(ps);
+        }
+        ps = tx_lock();
+        n = uart_ring_put(&tx_ring, buf, len);
+        SET_PERI_REG_MASK(UART_INT_ENA(UART0), UART_TXFIFO_EMPTY_INT_ENA);
+        tx_unlock(ps);
+        buf += n;
+        len -= n;
+    }
+}
 
 /******************************************************************************
  * FunctionName : uart_config
@@ -58,7 +161,7 @@ uart_config(uint8 uart_no)
         PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO2_U, FUNC_U1TXD_BK);
     } else {
         /* rcv_buff size if 0x100 */
-        ETS_UART_INTR_ATTACH(uart0_rx_intr_handler,  &(UartDev.rcv_buff));
+        ETS_UART_INTR_ATTACH(uart0_intr_handler,  &(UartDev.rcv_buff));
         PIN_PULLUP_DIS(PERIPHS_IO_MUX_U0TXD_U);
         PIN_FUNC_SELECT(PERIPHS_IO_MUX_U0TXD_U, FUNC_U0TXD);
         PIN_PULLUP_EN(PERIPHS_IO_MUX_U0RXD_U);
@@ -77,13 +180,16 @@ uart_config(uint8 uart_no)
     SET_PERI_REG_MASK(UART_CONF0(uart_no), UART_RXFIFO_RST | UART_TXFIFO_RST);
     CLEAR_PERI_REG_MASK(UART_CONF0(uart_no), UART_RXFIFO_RST | UART_TXFIFO_RST);
 
-    //set rx fifo trigger
-    WRITE_PERI_REG(UART_CONF1(uart_no), (UartDev.rcv_buff.TrigLvl & UART_RXFIFO_FULL_THRHD) << UART_RXFIFO_FULL_THRHD_S);
+    //set rx fifo trigger, and the tx one for UART0's queued output
+    WRITE_PERI_REG(UART_CONF1(uart_no), ((UartDev.rcv_buff.TrigLvl & UART_RXFIFO_FULL_THRHD) << UART_RXFIFO_FULL_THRHD_S)
+                   | ((UART_TX_EMPTY_LEVEL & UART_TXFIFO_EMPTY_THRHD) << UART_TXFIFO_EMPTY_THRHD_S));
 
     //clear all interrupt
     WRITE_PERI_REG(UART_INT_CLR(uart_no), 0xffff);
-    //enable rx_interrupt
+    //enable rx_interrupt, and tx_interrupt while output is queued
     SET_PERI_REG_MASK(UART_INT_ENA(uart_no), UART_RXFIFO_FULL_INT_ENA);
+    if (uart_no == UART0 && uart_ring_used(&tx_ring))
+        SET_PERI_REG_MASK(UART_INT_ENA(uart_no), UART_TXFIFO_EMPTY_INT_ENA);
 }
 
 
@@ -122,15 +228,18 @@ uart0_alt(uint8 on)
 /******************************************************************************
  * FunctionName : uart_tx_one_char
  * Description  : Internal used function
- *                Use uart interface to transfer one char
+ *                Use uart interface to transfer one char, queued for UART0
  * Parameters   : uint8 TxChar - character to tx
  * Returns      : OK
 *******************************************************************************/
 STATUS ICACHE_FLASH_ATTR
 uart_tx_one_char(uint8 uart, uint8 TxChar)
 {
-    if (uart == 0 && alt_uart0_tx) {
-      (*alt_uart0_tx)(TxChar);
+    if (uart == UART0) {
+      if (alt_uart0_tx)
+        (*alt_uart0_tx)(TxChar);
+      else
+        uart0_tx_queue(&TxChar, 1);
       return OK;
     }
 
@@ -182,6 +291,11 @@ uart0_tx_buffer(uint8 *buf, uint16 len)
 {
   uint16 i;
 
+  if (!alt_uart0_tx)
+  {
+    uart0_tx_queue(buf, len);
+    return;
+  }
   for (i = 0; i < len; i++)
   {
     uart_tx_one_char(UART0, buf[i]);
@@ -190,18 +304,69 @@ uart0_tx_buffer(uint8 *buf, uint16 len)
 
 /******************************************************************************
  * FunctionName : uart0_sendStr
- * Description  : use uart0 to transfer buffer
- * Parameters   : uint8 *buf - point to send buffer
- *                uint16 len - buffer len
+ * Description  : use uart0 to transfer a string, as uart0_putc() does
+ *                each char, but queueing the runs between line ends at once
+ * Parameters   : const char *str - the string
  * Returns      :
 *******************************************************************************/
 void ICACHE_FLASH_ATTR uart0_sendStr(const char *str)
 {
     while(*str)
     {
-        // uart_tx_one_char(UART0, *str++);
-        uart0_putc(*str++);
+        const char *run = str;
+        while (*str && *str != '\n' && *str != '\r')
+            str++;
+        if (str > run)
+            uart0_tx_buffer((uint8 *)run, str - run);
+        if (*str)
+            uart0_putc(*str++);
+    }
+}
+
+/******************************************************************************
+ * FunctionName : uart0_tx_free
+ * Description  : room left in the queue for UART0 output
+ * Parameters   : NONE
+ * Returns      : the bytes that can be written without waiting
+*******************************************************************************/
+uint16 ICACHE_FLASH_ATTR uart0_tx_free(void)
+{
+    return uart_ring_free(&tx_ring);
+}
+
+/******************************************************************************
+ * FunctionName : uart0_tx_flush
+ * Description  : waits until the queued UART0 output has been sent, before
+ *                a restart or a change of the bit rate
+ * Parameters   : NONE
+ * Returns      : NONE
+*******************************************************************************/
+void ICACHE_FLASH_ATTR uart0_tx_flush(void)
+{
+    while (uart_ring_used(&tx_ring)) {
+        uint32 ps;
+        while (uart0_tx_fifo_room() == 0)
+            ;
+        ps = tx_lock();
+        uart0_tx_fill();
+        tx_unlock(ps);
     }
+    while ((READ_PERI_REG(UART_STATUS(UART0)) >> UART_TXFIFO_CNT_S) & UART_TXFIFO_CNT)
+        ;
+}
+
+/******************************************************************************
+ * FunctionName : uart0_tx_notify
+ * Description  : sets the task to post when the queued UART0 output has all
+ *                gone into the TX FIFO
+ * Parameters   : os_signal_t sig_drained - signal to post, with a
+ *                                          task_coalesce_t * as parameter,
+ *                                          0 for none
+ * Returns      : NONE
+*******************************************************************************/
+void ICACHE_FLASH_ATTR uart0_tx_notify(os_signal_t sig_drained)
+{
+    tx_sig = sig_drained;
 }
 
 /******************************************************************************
@@ -227,14 +392,14 @@ void ICACHE_FLASH_ATTR uart0_putc(const char c)
 }
 
 /******************************************************************************
- * FunctionName : uart0_rx_intr_handler
+ * FunctionName : uart0_intr_handler
  * Description  : Internal used function
  *                UART0 interrupt handler, add self handle code inside
  * Parameters   : void *para - point to ETS_UART_INTR_ATTACH's arg
  * Returns      : NONE
 *******************************************************************************/
 LOCAL void
-uart0_rx_intr_handler(void *para)
+uart0_intr_handler(void *para)
 {
     /* uart0 and uart1 intr combine togther, when interrupt occur, see reg 0x3ff20020, bit2, bit0 represents
      * uart1 and uart0 respectively
@@ -242,8 +407,19 @@ uart0_rx_intr_handler(void *para)
     RcvMsgBuff *pRxBuff = (RcvMsgBuff *)para;
     uint8 RcvChar;
     bool got_input = false;
+    uint32 status = READ_PERI_REG(UART_INT_ST(UART0));
+
+    if (status & UART_TXFIFO_EMPTY_INT_ST) {
+        uart0_tx_fill();
+        if (uart_ring_used(&tx_ring) == 0) {
+            CLEAR_PERI_REG_MASK(UART_INT_ENA(UART0), UART_TXFIFO_EMPTY_INT_ENA);
+            if (tx_sig)
+                task_post_coalesced (TASK_PRIORITY_LOW, tx_sig, &tx_drain_post, 1);
+        }
+        WRITE_PERI_REG(UART_INT_CLR(UART0), UART_TXFIFO_EMPTY_INT_CLR);
+    }
 
-    if (UART_RXFIFO_FULL_INT_ST != (READ_PERI_REG(UART_INT_ST(UART0)) & UART_RXFIFO_FULL_INT_ST)) {
+    if (UART_RXFIFO_FULL_INT_ST != (status & UART_RXFIFO_FULL_INT_ST)) {
         return;
     }
 
@@ -280,10 +456,7 @@ uart0_rx_intr_handler(void *para)
     }
 
     if (got_input && sig) {
-      if (isr_flag == *sig_flag) {
-        isr_flag ^= 0x01;
-        task_post_low (sig, 0x8000 | isr_flag << 14 | false);
-      }
+      task_post_coalesced (TASK_PRIORITY_LOW, sig, &input_post, 1);
     }
 }
 
@@ -322,15 +495,14 @@ uart_stop_autobaud()
  * Description  : user interface for init uart
  * Parameters   : UartBautRate uart0_br - uart0 bautrate
  *                UartBautRate uart1_br - uart1 bautrate
- *                os_signal_t  sig_input - signal to post
- *                uint8       *flag_input - flag of consumer task
+ *                os_signal_t  sig_input - signal to post, with a
+ *                                         task_coalesce_t * as parameter
  * Returns      : NONE
 *******************************************************************************/
 void ICACHE_FLASH_ATTR
-uart_init(UartBautRate uart0_br, UartBautRate uart1_br, os_signal_t sig_input, uint8 *flag_input)
+uart_init(UartBautRate uart0_br, UartBautRate uart1_br, os_signal_t sig_input)
 {
     sig = sig_input;
-    sig_flag = flag_input;
 
     // rom use 74880 baut_rate, here reinitialize
     UartDev.baut_rate = uart0_br;
@@ -348,6 +520,9 @@ uart_setup(uint8 uart_no)
 #ifdef BIT_RATE_AUTOBAUD
     uart_stop_autobaud();
 #endif
+    // What was written before goes at the old bit rate
+    if (uart_no == UART0)
+        uart0_tx_flush();
     ETS_UART_INTR_DISABLE();
     uart_config(uart_no);
     ETS_UART_INTR_ENABLE();
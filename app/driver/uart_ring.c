@@ -0,0 +1,26 @@
+/*
+ * Byte ring for UART output, see driver/uart_ring.h
+ */
+
+#include "osapi.h"
+#include "driver/uart_ring.h"
+
+uint16_t ICACHE_FLASH_ATTR
+uart_ring_put(uart_ring_t *r, const uint8_t *data, uint16_t len)
+{
+  uint16_t head = r->head;
+  uint16_t room = r->mask + 1 - (uint16_t)(head - r->tail);
+  uint16_t start = head & r->mask, run;
+
+  if (len > room)
+    len = room;
+  // Up to the end of the buffer, then the rest from its start
+  run = r->mask + 1 - start;
+  if (run > len)
+    run = len;
+  os_memcpy(r->buf + start, data, run);
+  os_memcpy(r->buf, data + run, len - run);
+  UART_RING_BARRIER();
+  r->head = head + len;
+  return len;
+}
@@ -0,0 +1,132 @@
+/*
+ * Incremental decoder for HTTP/1.1 chunked transfer coding.
+ */
+
+#include "httpchunked.h"
+
+enum
+{
+  CHUNK_SIZE_START,   /* expecting the first hex digit of a chunk-size */
+  CHUNK_SIZE,         /* inside chunk-size */
+  CHUNK_EXT,          /* skipping chunk-ext / CR up to LF */
+  CHUNK_DATA,
+  CHUNK_DATA_END,     /* expecting CRLF after chunk data */
+  CHUNK_TRAILER_START,
+  CHUNK_TRAILER,      /* skipping a trailer field line */
+  CHUNK_DONE,
+  CHUNK_ERROR
+};
+
+/* Refuse chunk sizes that would overflow the 32bit counter */
+#define CHUNK_SIZE_LIMIT 0x0FFFFFFFu
+
+void http_chunked_init (http_chunked_t *c)
+{
+  c->size = 0;
+  c->state = CHUNK_SIZE_START;
+}
+
+static int hexval (char ch)
+{
+  if (ch >= '0' && ch <= '9')
+    return ch - '0';
+  if (ch >= 'a' && ch <= 'f')
+    return ch - 'a' + 10;
+  if (ch >= 'A' && ch <= 'F')
+    return ch - 'A' + 10;
+  return -1;
+}
+
+int http_chunked_next (http_chunked_t *c, const char **in, size_t *len,
+                       const char **data, size_t *dlen)
+{
+  const char *p = *in;
+  const char *end = p + *len;
+
+  *data = NULL;
+  *dlen = 0;
+
+  while (p < end)
+  {
+    char ch = *p;
+    int v;
+
+    switch (c->state)
+    {
+      case CHUNK_SIZE_START:
+      case CHUNK_SIZE:
+        v = hexval (ch);
+        if (v >= 0)
+        {
+          if (c->size > (CHUNK_SIZE_LIMIT >> 4))
+          {
+            c->state = CHUNK_ERROR;
+            break;
+          }
+          c->size = (c->size << 4) | v;
+          c->state = CHUNK_SIZE;
+          ++p;
+          break;
+        }
+        if (c->state == CHUNK_SIZE_START)
+        {
+          c->state = CHUNK_ERROR;
+          break;
+        }
+        /* the size ends at an extension, CR or LF; look at this byte again */
+        c->state = CHUNK_EXT;
+        /* fall through */
+      case CHUNK_EXT:
+        ++p;
+        if (ch == '\n')
+          c->state = c->size ? CHUNK_DATA : CHUNK_TRAILER_START;
+        break;
+      case CHUNK_DATA:
+      {
+        size_t avail = end - p;
+        size_t n = avail < c->size ? avail : c->size;
+        *data = p;
+        *dlen = n;
+        p += n;
+        c->size -= n;
+        if (!c->size)
+          c->state = CHUNK_DATA_END;
+        *len -= p - *in;
+        *in = p;
+        return HTTP_CHUNKED_MORE;
+      }
+      case CHUNK_DATA_END:
+        ++p;
+        if (ch == '\n')
+          c->state = CHUNK_SIZE_START;
+        else if (ch != '\r')
+          c->state = CHUNK_ERROR;
+        break;
+      case CHUNK_TRAILER_START:
+        ++p;
+        if (ch == '\n')
+          c->state = CHUNK_DONE;
+        else if (ch != '\r')
+          c->state = CHUNK_TRAILER;
+        break;
+      case CHUNK_TRAILER:
+        ++p;
+        if (ch == '\n')
+          c->state = CHUNK_TRAILER_START;
+        break;
+      default:
+        end = p; /* stop consuming */
+        break;
+    }
+    if (c->state == CHUNK_DONE || c->state == CHUNK_ERROR)
+      break;
+  }
+
+  *len -= p - *in;
+  *in = p;
+  if (c->state == CHUNK_DONE)
+    return HTTP_CHUNKED_DONE;
+  if (c->state == CHUNK_ERROR)
+    return HTTP_CHUNKED_ERROR;
+  return HTTP_CHUNKED_MORE;
+}
@@ -0,0 +1,36 @@
+/*
+ * Incremental decoder for HTTP/1.1 chunked transfer coding (RFC 7230 4.1).
+ *
+ * The decoder keeps only a few bytes of state, so the encoded stream can be
+ * fed in whatever pieces the network delivers it in; chunk boundaries may
+ * fall anywhere, including in the middle of a chunk-size line. Decoded data
+ * is never copied: each call returns a span pointing into the input.
+ */
+
+#ifndef __HTTPCHUNKED_H__
+#define __HTTPCHUNKED_H__
+
+#include "c_types.h"
+
+#define HTTP_CHUNKED_MORE   0   /* more input needed, or a data span returned */
+#define HTTP_CHUNKED_DONE   1   /* terminating chunk and trailer consumed */
+#define HTTP_CHUNKED_ERROR  (-1)
+
+typedef struct
+{
+  uint32_t size;    /* bytes left in the current chunk */
+  uint8_t  state;
+} http_chunked_t;
+
+void http_chunked_init (http_chunked_t *c);
+
+/*
+ * Decode from *in (of *len bytes), advancing both past consumed input.
+ * Stops as soon as a span of chunk data has been found, which is returned
+ * through data/dlen (dlen is 0 if none was found). Callers loop until *len
+ * is 0 or the return value is not HTTP_CHUNKED_MORE.
+ */
+int http_chunked_next (http_chunked_t *c, const char **in, size_t *len,
+                       const char **data, size_t *dlen);
+
+#endif /* __HTTPCHUNKED_H__ */
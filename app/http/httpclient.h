@@ -46,6 +46,11 @@ static const char log_prefix[] = "HTTP client: ";
  */
 #define HTTP_REQUEST_TIMEOUT_MS    (10000)
 
+/*
+ * Number of idle persistent connections kept open, see http_set_keepalive().
+ */
+#define HTTP_POOL_SIZE             (2)
+
 /*
  * "full_response" is a string containing all response headers and the response body.
  * "response_body and "http_status" are extracted from "full_response" for convenience.
@@ -55,6 +60,14 @@ static const char log_prefix[] = "HTTP client: ";
  */
 typedef void (* http_callback_t)(char * response_body, int http_status, char * full_response);
 
+/*
+ * Streaming callback: invoked with each piece of the response body as it
+ * arrives, so the response is never held in RAM as a whole. Chunked transfer
+ * coding has already been removed. A final call with data == NULL ends the
+ * response; http_status is then HTTP_STATUS_GENERIC_ERROR if it failed.
+ */
+typedef void (* http_data_callback_t)(void * arg, int http_status, const char * data, size_t len);
+
 /*
  * Call this function to skip URL parsing if the arguments are already in separate variables.
  */
@@ -68,6 +81,20 @@ void ICACHE_FLASH_ATTR http_raw_request(const char * hostname, int port, bool se
  */
 void ICACHE_FLASH_ATTR http_request(const char * url, const char * method, const char * headers, const char * post_data, http_callback_t callback_handle, int redirect_follow_count);
 
+/*
+ * Like http_request(), but streams the response body to data_handle.
+ * Try:
+ * http_stream("http://example.com/firmware.bin", "GET", NULL, NULL, my_data_callback, my_arg);
+ */
+void ICACHE_FLASH_ATTR http_stream(const char * url, const char * method, const char * headers, const char * post_data, http_data_callback_t data_handle, void * arg);
+
+/*
+ * Keep up to HTTP_POOL_SIZE plain HTTP connections open for idle_ms after a
+ * response and reuse them for subsequent requests to the same host and port.
+ * 0 (the default) closes every connection after its response.
+ */
+void ICACHE_FLASH_ATTR http_set_keepalive(uint32 idle_ms);
+
 /*
  * Post data to a web form.
  * The data should be encoded as any format.
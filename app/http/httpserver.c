@@ -0,0 +1,523 @@
+/*
+ * Transport independent HTTP/1.x request parser and response framing.
+ */
+
+#include "httpserver.h"
+#include "c_string.h"
+#include "c_stdlib.h"
+
+enum
+{
+  PARSE_HEADERS,
+  PARSE_BODY,
+  PARSE_CHUNKED,
+  PARSE_DONE,
+  PARSE_FAILED
+};
+
+static const char * const method_names[] = {
+  "", "GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS", "PATCH"
+};
+
+#define METHOD_COUNT (sizeof (method_names) / sizeof (method_names[0]))
+
+
+void httpd_parser_init (httpd_parser_t *p)
+{
+  c_memset (p, 0, sizeof (*p));
+  httpd_parser_reset (p);
+}
+
+
+void httpd_parser_reset (httpd_parser_t *p)
+{
+  /* keep the (possibly grown) header buffer for the next request */
+  p->hdr_len = 0;
+  p->line_len = 0;
+  p->state = PARSE_HEADERS;
+  p->method = HTTPD_METHOD_UNKNOWN;
+  p->flags = 0;
+  p->status = 0;
+  p->path = p->query = p->fields = p->fields_end = NULL;
+  p->path_len = p->query_len = 0;
+  p->content_length = p->remaining = 0;
+  http_chunked_init (&p->chunked);
+}
+
+
+void httpd_parser_free (httpd_parser_t *p)
+{
+  if (p->hdr)
+    c_free (p->hdr);
+  p->hdr = NULL;
+  p->hdr_cap = 0;
+}
+
+
+bool httpd_parser_done (const httpd_parser_t *p)
+{
+  return p->state == PARSE_DONE;
+}
+
+
+static int fail (httpd_parser_t *p, uint16_t status)
+{
+  p->state = PARSE_FAILED;
+  p->status = status;
+  return HTTPD_PARSE_ERROR;
+}
+
+
+static char lower (char c)
+{
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+
+/* Case-insensitive search for token within a comma separated field value */
+static bool has_token (const char *value, const char *token)
+{
+  size_t tlen = c_strlen (token);
+  while (*value)
+  {
+    while (*value == ' ' || *value == '\t' || *value == ',')
+      ++value;
+    size_t i = 0;
+    while (i < tlen && value[i] && lower (value[i]) == token[i])
+      ++i;
+    if (i == tlen && (value[i] == 0 || value[i] == ',' || value[i] == ' ' || value[i] == ';'))
+      return true;
+    while (*value && *value != ',')
+      ++value;
+  }
+  return false;
+}
+
+
+/*
+ * Request line and header fields are in p->hdr, NUL terminated. Split the
+ * request line and rewrite each "Name: value\r\n" field in place as
+ * "name\0value\0", which httpd_header_next() then walks.
+ */
+static int parse_head (httpd_parser_t *p)
+{
+  char *s = p->hdr;
+  char *end = p->hdr + p->hdr_len;
+
+  /* method */
+  char *sp = s;
+  while (sp < end && *sp != ' ')
+    ++sp;
+  if (sp == end)
+    return fail (p, 400);
+  *sp = 0;
+  unsigned m;
+  for (m = 1; m < METHOD_COUNT; ++m)
+    if (c_strcmp (s, method_names[m]) == 0)
+      break;
+  if (m == METHOD_COUNT)
+    return fail (p, 501);
+  p->method = m;
+
+  /* request-target */
+  s = sp + 1;
+  sp = s;
+  while (sp < end && *sp != ' ' && *sp != '\r' && *sp != '\n')
+    ++sp;
+  if (sp == end || sp == s || *sp != ' ')
+    return fail (p, 400);
+  *sp = 0;
+  p->path = s;
+  char *q = c_strchr (s, '?');
+  if (q)
+  {
+    *q++ = 0;
+    p->query = q;
+    p->query_len = sp - q;
+  }
+  p->path_len = c_strlen (s);
+
+  /* HTTP-version */
+  s = sp + 1;
+  if (c_strncmp (s, "HTTP/1.", 7) != 0)
+    return fail (p, 505);
+  if (s[7] != '0')
+    p->flags |= HTTPD_REQ_HTTP11 | HTTPD_REQ_KEEPALIVE;
+  while (s < end && *s != '\n')
+    ++s;
+  ++s;
+
+  /* header fields */
+  p->fields = s;
+  bool have_length = false;
+  while (s < end)
+  {
+    char *eol = s;
+    while (eol < end && *eol != '\n')
+      ++eol;
+    char *line_end = eol;
+    if (line_end > s && line_end[-1] == '\r')
+      --line_end;
+    if (line_end == s)
+      break; /* empty line, end of header */
+
+    char *colon = s;
+    while (colon < line_end && *colon != ':')
+    {
+      *colon = lower (*colon);
+      ++colon;
+    }
+    if (colon == line_end || colon == s)
+      return fail (p, 400);
+    *colon = 0;
+
+    /* move the trimmed value up against the name */
+    char *v = colon + 1;
+    while (v < line_end && (*v == ' ' || *v == '\t'))
+      ++v;
+    char *ve = line_end;
+    while (ve > v && (ve[-1] == ' ' || ve[-1] == '\t'))
+      --ve;
+    char *d = colon + 1;
+    while (v < ve)
+      *d++ = *v++;
+    v = colon + 1;
+    while (d <= eol)
+      *d++ = 0;
+
+    if (c_strcmp (s, "content-length") == 0)
+    {
+      uint32_t n = 0;
+      const char *digit = v;
+      if (!*digit)
+        return fail (p, 400);
+      for (; *digit; ++digit)
+      {
+        if (*digit < '0' || *digit > '9' || n > 0x0FFFFFFFu)
+          return fail (p, 400);
+        n = n * 10 + (*digit - '0');
+      }
+      p->content_length = n;
+      have_length = true;
+    }
+    else if (c_strcmp (s, "connection") == 0)
+    {
+      if (has_token (v, "close"))
+        p->flags &= ~HTTPD_REQ_KEEPALIVE;
+      else if (has_token (v, "keep-alive"))
+        p->flags |= HTTPD_REQ_KEEPALIVE;
+    }
+    else if (c_strcmp (s, "transfer-encoding") == 0)
+    {
+      if (!has_token (v, "chunked"))
+        return fail (p, 501);
+      p->flags |= HTTPD_REQ_CHUNKED;
+    }
+
+    s = eol + 1;
+  }
+  p->fields_end = s;
+
+  if (p->flags & HTTPD_REQ_CHUNKED)
+  {
+    if (have_length)
+      return fail (p, 400);
+    p->state = PARSE_CHUNKED;
+  }
+  else
+  {
+    p->remaining = p->content_length;
+    p->state = p->remaining ? PARSE_BODY : PARSE_DONE;
+  }
+  return 0;
+}
+
+
+/*
+ * Append header bytes until the empty line is seen. Returns the number of
+ * bytes taken from data, with p->state moved on once the header is complete.
+ */
+static int take_header (httpd_parser_t *p, const char *data, size_t len)
+{
+  size_t i;
+  for (i = 0; i < len; ++i)
+  {
+    char c = data[i];
+
+    /* ignore empty lines preceding the request line (RFC 7230 3.5) */
+    if (p->hdr_len == 0 && (c == '\r' || c == '\n'))
+      continue;
+
+    /* one byte is always kept spare for the terminating NUL */
+    if (p->hdr_len + 1 >= p->hdr_cap)
+    {
+      uint16_t cap = p->hdr_cap ? p->hdr_cap * 2 : HTTPD_HEADER_INIT;
+      if (cap > HTTPD_HEADER_MAX || p->hdr_len + 1 >= HTTPD_HEADER_MAX)
+        return fail (p, 431);
+      char *n = (char *)c_realloc (p->hdr, cap);
+      if (!n)
+        return fail (p, 503);
+      p->hdr = n;
+      p->hdr_cap = cap;
+    }
+    p->hdr[p->hdr_len++] = c;
+
+    if (c == '\n')
+    {
+      if (p->line_len == 0)
+      {
+        p->hdr[p->hdr_len] = 0;
+        ++i;
+        if (parse_head (p) < 0)
+          return HTTPD_PARSE_ERROR;
+        return i;
+      }
+      p->line_len = 0;
+    }
+    else if (c != '\r')
+      ++p->line_len;
+  }
+  return i;
+}
+
+
+int httpd_parser_feed (httpd_parser_t *p, const char *data, size_t len,
+                       const httpd_parser_cbs_t *cbs, void *arg)
+{
+  const char *start = data;
+
+  if (p->state == PARSE_DONE)
+    return 0;
+
+  while (p->state != PARSE_DONE)
+  {
+    switch (p->state)
+    {
+      case PARSE_HEADERS:
+      {
+        int n = take_header (p, data, len);
+        if (n < 0)
+          return n;
+        data += n;
+        len -= n;
+        if (p->state == PARSE_HEADERS)
+          return data - start; /* need more */
+        if (cbs->on_headers && cbs->on_headers (p, arg))
+          return HTTPD_PARSE_ABORT;
+        break;
+      }
+      case PARSE_BODY:
+      {
+        if (!len)
+          return data - start;
+        size_t n = len < p->remaining ? len : p->remaining;
+        p->remaining -= n;
+        if (!p->remaining)
+          p->state = PARSE_DONE;
+        if (cbs->on_body && cbs->on_body (p, data, n, arg))
+          return HTTPD_PARSE_ABORT;
+        data += n;
+        len -= n;
+        break;
+      }
+      case PARSE_CHUNKED:
+      {
+        if (!len)
+          return data - start;
+        const char *d;
+        size_t dlen;
+        int res = http_chunked_next (&p->chunked, &data, &len, &d, &dlen);
+        if (res == HTTP_CHUNKED_ERROR)
+          return fail (p, 400);
+        if (res == HTTP_CHUNKED_DONE)
+          p->state = PARSE_DONE;
+        if (dlen && cbs->on_body && cbs->on_body (p, d, dlen, arg))
+          return HTTPD_PARSE_ABORT;
+        break;
+      }
+      default:
+        return HTTPD_PARSE_ERROR;
+    }
+  }
+
+  if (cbs->on_complete && cbs->on_complete (p, arg))
+    return HTTPD_PARSE_ABORT;
+  return data - start;
+}
+
+
+bool httpd_header_next (const httpd_parser_t *p, const char **pos,
+                        const char **name, const char **value)
+{
+  const char *s = *pos ? *pos : p->fields;
+  if (!s)
+    return false;
+  while (s < p->fields_end && !*s)
+    ++s;
+  if (s >= p->fields_end || *s == '\r' || *s == '\n')
+    return false;
+
+  *name = s;
+  s += c_strlen (s) + 1;
+  *value = s;
+  *pos = s + c_strlen (s) + 1;
+  return true;
+}
+
+
+const char *httpd_header_get (const httpd_parser_t *p, const char *name)
+{
+  const char *pos = NULL, *n, *v;
+  while (httpd_header_next (p, &pos, &n, &v))
+    if (c_strcmp (n, name) == 0)
+      return v;
+  return NULL;
+}
+
+
+bool httpd_route_match (const httpd_parser_t *p, uint8_t method, bool prefix,
+                        const char *path, size_t path_len)
+{
+  if (method != HTTPD_METHOD_UNKNOWN && method != p->method &&
+      !(method == HTTPD_METHOD_GET && p->method == HTTPD_METHOD_HEAD))
+    return false;
+  if (prefix ? p->path_len < path_len : p->path_len != path_len)
+    return false;
+  return c_strncmp (p->path, path, path_len) == 0;
+}
+
+
+const char *httpd_method_name (uint8_t method)
+{
+  return method < METHOD_COUNT ? method_names[method] : "";
+}
+
+
+const char *httpd_status_reason (int status)
+{
+  switch (status)
+  {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 411: return "Length Required";
+    case 413: return "Payload Too Large";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    case 505: return "HTTP Version Not Supported";
+    default:  return "Unknown";
+  }
+}
+
+
+static const struct { const char *ext; const char *type; } mime_types[] = {
+  { "html", "text/html" },
+  { "htm",  "text/html" },
+  { "css",  "text/css" },
+  { "js",   "application/javascript" },
+  { "json", "application/json" },
+  { "txt",  "text/plain" },
+  { "xml",  "text/xml" },
+  { "png",  "image/png" },
+  { "jpg",  "image/jpeg" },
+  { "gif",  "image/gif" },
+  { "svg",  "image/svg+xml" },
+  { "ico",  "image/x-icon" },
+};
+
+
+const char *httpd_mime_type (const char *path)
+{
+  const char *dot = c_strrchr (path, '.');
+  if (dot && !c_strchr (dot, '/'))
+  {
+    unsigned i;
+    for (i = 0; i < sizeof (mime_types) / sizeof (mime_types[0]); ++i)
+      if (c_strcmp (dot + 1, mime_types[i].ext) == 0)
+        return mime_types[i].type;
+  }
+  return "application/octet-stream";
+}
+
+
+static char *append (char *d, const char *end, const char *s)
+{
+  while (*s && d < end)
+    *d++ = *s++;
+  return *s ? NULL : d;
+}
+
+
+static char *append_uint (char *d, const char *end, uint32_t v)
+{
+  char tmp[10];
+  int n = 0;
+  do
+  {
+    tmp[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  if (end - d < n)
+    return NULL;
+  while (n)
+    *d++ = tmp[--n];
+  return d;
+}
+
+
+size_t httpd_format_head (char *buf, size_t size, int status, int32_t content_length,
+                          bool keepalive, bool chunked)
+{
+  const char *end = buf + size;
+  char *d = buf;
+
+  d = append (d, end, "HTTP/1.1 ");
+  if (d) d = append_uint (d, end, status);
+  if (d) d = append (d, end, " ");
+  if (d) d = append (d, end, httpd_status_reason (status));
+  if (d) d = append (d, end, "\r\n");
+  if (content_length >= 0)
+  {
+    if (d) d = append (d, end, "Content-Length: ");
+    if (d) d = append_uint (d, end, content_length);
+    if (d) d = append (d, end, "\r\n");
+  }
+  else if (chunked)
+  {
+    if (d) d = append (d, end, "Transfer-Encoding: chunked\r\n");
+  }
+  if (d) d = append (d, end, keepalive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+  return d ? d - buf : 0;
+}
+
+
+size_t httpd_format_chunk_size (char *buf, size_t len)
+{
+  static const char hex[] = "0123456789abcdef";
+  char tmp[8];
+  int n = 0;
+  do
+  {
+    tmp[n++] = hex[len & 0xf];
+    len >>= 4;
+  } while (len && n < 8);
+  size_t out = 0;
+  while (n)
+    buf[out++] = tmp[--n];
+  buf[out++] = '\r';
+  buf[out++] = '\n';
+  return out;
+}
@@ -0,0 +1,134 @@
+/*
+ * Transport independent core of the httpd module: an incremental HTTP/1.x
+ * request parser plus helpers for framing responses.
+ *
+ * Nothing in here knows about lwIP or Lua. The parser is fed raw bytes as
+ * they arrive and reports the request through callbacks, so the same code
+ * can be driven by a tcp_pcb on the device or by a stub transport on a host.
+ */
+
+#ifndef __HTTPSERVER_H__
+#define __HTTPSERVER_H__
+
+#include "c_types.h"
+#include "httpchunked.h"
+
+/*
+ * Header block limits. The header buffer starts small and is doubled as
+ * needed, up to HTTPD_HEADER_MAX; larger requests are refused with 431.
+ */
+#ifndef HTTPD_HEADER_MAX
+#define HTTPD_HEADER_MAX    1024
+#endif
+#define HTTPD_HEADER_INIT   256
+
+typedef enum
+{
+  HTTPD_METHOD_UNKNOWN = 0,
+  HTTPD_METHOD_GET,
+  HTTPD_METHOD_HEAD,
+  HTTPD_METHOD_POST,
+  HTTPD_METHOD_PUT,
+  HTTPD_METHOD_DELETE,
+  HTTPD_METHOD_OPTIONS,
+  HTTPD_METHOD_PATCH,
+} httpd_method_t;
+
+#define HTTPD_REQ_HTTP11      0x01
+#define HTTPD_REQ_KEEPALIVE   0x02
+#define HTTPD_REQ_CHUNKED     0x04
+
+typedef struct httpd_parser httpd_parser_t;
+
+/*
+ * Parser callbacks. Returning non-zero from any of them stops parsing;
+ * httpd_parser_feed() then returns HTTPD_PARSE_ABORT.
+ */
+typedef struct
+{
+  int (*on_headers) (httpd_parser_t *p, void *arg);
+  int (*on_body) (httpd_parser_t *p, const char *data, size_t len, void *arg);
+  int (*on_complete) (httpd_parser_t *p, void *arg);
+} httpd_parser_cbs_t;
+
+struct httpd_parser
+{
+  char     *hdr;            /* header accumulation buffer */
+  uint16_t  hdr_len;
+  uint16_t  hdr_cap;
+  uint16_t  line_len;       /* length of the header line being received */
+  uint8_t   state;
+  uint8_t   method;
+  uint8_t   flags;          /* HTTPD_REQ_xxx */
+  uint16_t  status;         /* HTTP status describing a parse failure */
+
+  /* valid from on_headers until the parser is reset */
+  const char *path;
+  uint16_t    path_len;
+  const char *query;        /* NULL if the target had no '?' */
+  uint16_t    query_len;
+  const char *fields;       /* normalised header fields, see httpd_header_next */
+  const char *fields_end;
+
+  uint32_t  content_length;
+  uint32_t  remaining;      /* body bytes still expected (identity coding) */
+  http_chunked_t chunked;
+};
+
+#define HTTPD_PARSE_ERROR   (-1)  /* malformed request, p->status says why */
+#define HTTPD_PARSE_ABORT   (-2)  /* a callback asked to stop */
+
+void httpd_parser_init (httpd_parser_t *p);
+void httpd_parser_reset (httpd_parser_t *p);
+void httpd_parser_free (httpd_parser_t *p);
+
+/*
+ * Feed received bytes to the parser. Parsing stops at the end of a request,
+ * so pipelined data is left unconsumed for the next request. Returns the
+ * number of bytes consumed, or HTTPD_PARSE_ERROR / HTTPD_PARSE_ABORT.
+ */
+int httpd_parser_feed (httpd_parser_t *p, const char *data, size_t len,
+                       const httpd_parser_cbs_t *cbs, void *arg);
+
+/* True once the full request including its body has been parsed */
+bool httpd_parser_done (const httpd_parser_t *p);
+
+/*
+ * Iterate the request header fields. Field names are lower-cased and values
+ * have surrounding whitespace removed; both are NUL terminated. Start with
+ * *pos = NULL. Returns false when there are no more fields.
+ */
+bool httpd_header_next (const httpd_parser_t *p, const char **pos,
+                        const char **name, const char **value);
+
+/* Look up a single header field by its lower-case name, NULL if absent */
+const char *httpd_header_get (const httpd_parser_t *p, const char *name);
+
+/*
+ * True if a route for method (HTTPD_METHOD_UNKNOWN for any) and path takes
+ * the parsed request. A prefix route, one given with a trailing '*', takes
+ * every path starting with path; GET routes also take HEAD requests.
+ */
+bool httpd_route_match (const httpd_parser_t *p, uint8_t method, bool prefix,
+                        const char *path, size_t path_len);
+
+const char *httpd_method_name (uint8_t method);
+const char *httpd_status_reason (int status);
+
+/* Guess the Content-Type from a file name's extension */
+const char *httpd_mime_type (const char *path);
+
+/*
+ * Format the status line and the framing header fields of a response into
+ * buf. A negative content_length selects chunked coding for HTTP/1.1 clients
+ * and close-delimited bodies otherwise. The caller appends any extra fields
+ * and the terminating empty line. Returns the length written, or 0 if buf is
+ * too small.
+ */
+size_t httpd_format_head (char *buf, size_t size, int status, int32_t content_length,
+                          bool keepalive, bool chunked);
+
+/* Format a chunk-size line, returns its length (at most 10 bytes) */
+size_t httpd_format_chunk_size (char *buf, size_t len);
+
+#endif /* __HTTPSERVER_H__ */
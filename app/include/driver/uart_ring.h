@@ -0,0 +1,55 @@
+#ifndef UART_RING_H
+#define UART_RING_H
+
+#include "c_types.h"
+
+/*
+ * Byte ring between one writer and one reader, such as the code queueing
+ * UART output and the interrupt handler moving it into the TX FIFO. head
+ * and tail count the bytes ever put and taken, modulo 2^16, so the ring
+ * can be full without a byte kept free, and each side only stores its own
+ * counter: no lock is needed between them. Several writers must exclude
+ * each other. The reader takes the bytes in place, in at most two
+ * contiguous runs, the way a DMA engine would.
+ */
+
+typedef struct {
+  uint8_t *buf;
+  uint16_t mask;              // size - 1, the size a power of 2 up to 32 KB
+  volatile uint16_t head;     // bytes put, written by the writer only
+  volatile uint16_t tail;     // bytes taken, written by the reader only
+} uart_ring_t;
+
+// An empty ring over size bytes of buf, the size a power of 2
+#define UART_RING_INIT(buf, size) { (buf), (size) - 1, 0, 0 }
+
+// Keeps the compiler from moving accesses to the bytes past a counter update
+#define UART_RING_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+// Puts as many of len bytes as there is room for, returns their number
+uint16_t uart_ring_put(uart_ring_t *r, const uint8_t *data, uint16_t len);
+
+static inline uint16_t uart_ring_used(const uart_ring_t *r) {
+  return (uint16_t)(r->head - r->tail);
+}
+
+static inline uint16_t uart_ring_free(const uart_ring_t *r) {
+  return r->mask + 1 - uart_ring_used(r);
+}
+
+// Points at the oldest bytes, returns how many follow contiguously
+static inline uint16_t uart_ring_peek(const uart_ring_t *r, const uint8_t **data) {
+  uint16_t tail = r->tail, used = (uint16_t)(r->head - tail);
+  uint16_t start = tail & r->mask, run = r->mask + 1 - start;
+
+  *data = r->buf + start;
+  return used < run ? used : run;
+}
+
+// Drops n bytes the reader has taken after uart_ring_peek()
+static inline void uart_ring_skip(uart_ring_t *r, uint16_t n) {
+  UART_RING_BARRIER();
+  r->tail += n;
+}
+
+#endif
@@ -18,7 +18,6 @@
 * is just a fixed fingerprint and the count is allocated serially by the task get_id()
 * function.
 */
-#define task_post(priority,handle,param) system_os_post(priority, ((handle) | priority), param)
 #define task_post_low(handle,param)    task_post(TASK_PRIORITY_LOW,    handle, param)
 #define task_post_medium(handle,param) task_post(TASK_PRIORITY_MEDIUM, handle, param)
 #define task_post_high(handle,param)   task_post(TASK_PRIORITY_HIGH,   handle, param)
@@ -28,8 +27,60 @@
 
 typedef void (*task_callback_t)(task_param_t param, uint8 prio);
 
+/* Counters of a priority's queue, since boot or the last reset */
+typedef struct {
+  uint32 posted;      /* events queued */
+  uint32 dropped;     /* posts refused because the queue was full */
+  uint32 coalesced;   /* coalescing posts merged into a pending one */
+  uint16 depth;       /* events waiting now */
+  uint16 max_depth;   /* high-water mark of depth */
+  uint16 size;        /* capacity */
+} task_queue_stats_t;
+
+/*
+ * State of a coalescing post, owned by the poster and zero initialised.
+ * However often it is posted, there is at most one event pending for it;
+ * the handler gets a pointer to it as parameter and takes the bits and
+ * the count accumulated since it last did.
+ */
+typedef struct {
+  uint32 bits;        /* OR of the bits posted */
+  uint32 count;       /* number of posts */
+  bool   pending;
+} task_coalesce_t;
+
+/* Counters of a task handle, times in microseconds */
+typedef struct {
+  uint32 count;       /* events handled */
+  uint64 run_us;      /* total handler run time */
+  uint32 run_max_us;
+  uint64 latency_us;  /* total time from post to dispatch */
+  uint32 latency_max_us;
+} task_stats_t;
+
 bool task_init_handler(uint8 priority, uint8 qlen);
 task_handle_t task_get_id(task_callback_t t);
 
-#endif
+/*
+ * Queues an event for a task handle. Safe to call from interrupt handlers.
+ * Returns false if the priority's queue is full, which is counted as a drop.
+ */
+bool task_post(uint8 priority, task_handle_t handle, task_param_t param);
 
+/*
+ * Adds bits to a coalescing post, queueing an event for the handle unless
+ * one is pending already. Safe to call from interrupt handlers. Returns
+ * false if the event could not be queued; the bits are kept for the next
+ * post.
+ */
+bool task_post_coalesced(uint8 priority, task_handle_t handle, task_coalesce_t *c, uint32 bits);
+
+/* In the handler: returns the bits, and the count if wanted, and resets them */
+uint32 task_coalesce_take(task_coalesce_t *c, uint32 *count);
+
+bool task_queue_stats(uint8 priority, task_queue_stats_t *stats);
+int task_count_handlers(void);
+bool task_handler_stats(int index, task_callback_t *func, task_stats_t *stats);
+void task_reset_stats(void);
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ * Tracepoints: records of (id, CPU cycle count, argument) written into a
+ * ring in RAM, which node.trace.dump() prints for tools/trace_decode.py to
+ * turn into a timeline. Unlike debug output they take a few cycles, so
+ * they leave the timing they are to show alone.
+ *
+ * TRACE(id, arg) compiles to nothing unless TRACEPOINTS is defined in
+ * user_config.h. The ring is written without a lock, so tracepoints go in
+ * task and callback context only, not in interrupt handlers.
+ */
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "user_config.h"
+
+// Most come in pairs, X when a span starts and X_END when it ends
+enum {
+  TRACE_NONE,
+  TRACE_TASK, TRACE_TASK_END,                   // handler, from 1 as in node.task.stats()
+  TRACE_NET_RECV, TRACE_NET_RECV_END,           // espconn callbacks; bytes received
+  TRACE_NET_SENT, TRACE_NET_SENT_END,
+  TRACE_NET_CONNECT, TRACE_NET_CONNECT_END,
+  TRACE_NET_DISCONNECT, TRACE_NET_DISCONNECT_END,
+  TRACE_NET_RECONNECT, TRACE_NET_RECONNECT_END, // error
+  TRACE_LUA_CALL, TRACE_LUA_CALL_END,           // depth << 16 | line defined, or status
+  TRACE_GC_STEP, TRACE_GC_STEP_END,             // collector state
+  TRACE_GC_FULL, TRACE_GC_FULL_END,
+  TRACE_FLASH_ERASE, TRACE_FLASH_ERASE_END,     // sector
+  TRACE_MARK,                                   // node.trace.mark(arg)
+  TRACE_IDS
+};
+
+#if defined(TRACEPOINTS) && !defined(LUA_CROSS_COMPILER)
+
+#include "c_types.h"
+
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 512   // records, a power of 2
+#endif
+
+typedef struct {
+  uint32_t ccount;
+  uint32_t tag;               // id in the low 8 bits, the argument above
+} trace_record_t;
+
+extern trace_record_t trace_ring[TRACE_RING_SIZE];
+extern uint32_t trace_count;  // records written since the last dump
+extern bool trace_stopped;
+
+static inline uint32_t trace_ccount (void) {
+#ifdef __XTENSA__
+  uint32_t ccount;
+  __asm__ __volatile__("rsr %0,ccount" : "=a" (ccount));
+  return ccount;
+#else
+  extern unsigned int xthal_get_ccount(void);
+  return xthal_get_ccount();
+#endif
+}
+
+static inline void trace_point (unsigned id, uint32_t arg) {
+  if (!trace_stopped) {
+    trace_record_t *r = &trace_ring[trace_count++ & (TRACE_RING_SIZE - 1)];
+    r->ccount = trace_ccount();
+    r->tag = id | arg << 8;
+  }
+}
+
+// Prints the ring, oldest record first, and empties it
+void trace_dump(void);
+
+#define TRACE(id, arg) trace_point((id), (uint32_t)(arg))
+
+#else
+
+#define TRACE(id, arg) ((void)0)
+
+#endif
+
+#endif
@@ -20,6 +20,19 @@ extern void luaL_assertfail(const char *file, int line, const char *message);
 #define lua_assert(x)    ((x) ? (void) 0 : luaL_assertfail(__FILE__, __LINE__, #x))
 #endif
 
+// This traces the heap for node.heapinfo(): live Lua blocks by size class,
+// and C blocks from c_malloc() and friends by size class and call site.
+// It costs a little time per allocation and about 3 KB of RAM for the
+// tables, plus the file names of the call sites.
+//#define HEAP_TRACE
+
+// This records tracepoints in the task dispatcher, the espconn callbacks,
+// lua_call() and lua_pcall(), the garbage collector and SPIFFS erases into
+// a ring in RAM, for node.trace.dump(). Each record takes a few cycles and
+// 8 bytes of the ring, which holds TRACE_RING_SIZE of them.
+//#define TRACEPOINTS
+//#define TRACE_RING_SIZE 512
+
 // This enables lots of debug output and changes the serial bit rate. This
 // is normally only used by hardcore developers
 // #define DEVELOP_VERSION
@@ -30,6 +43,11 @@ extern void luaL_assertfail(const char *file, int line, const char *message);
 
 #define BIT_RATE_DEFAULT BIT_RATE_115200
 
+// Output to UART0, from print() and uart.write(0, ...), is queued in a
+// buffer of this many bytes, a power of 2, and sent by the UART interrupt,
+// so that writers only wait for the UART while the buffer is full.
+#define UART_TX_BUFFER_SIZE 512
+
 // This enables automatic baud rate detection at startup
 #define BIT_RATE_AUTOBAUD
 
@@ -67,6 +85,10 @@ extern void luaL_assertfail(const char *file, int line, const char *message);
 //#define CLIENT_SSL_ENABLE
 //#define MD2_ENABLE
 #define SHA2_ENABLE
+// Unrolled SHA-256/512 transforms, faster for about 1 KB more flash.
+// SHA2_IRAM runs the SHA-256 one from IRAM, for heavy HMAC or file hashing.
+#define SHA2_UNROLL_TRANSFORM
+//#define SHA2_IRAM
 
 #define BUILD_SPIFFS
 #define SPIFFS_CACHE 1
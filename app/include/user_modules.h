@@ -21,9 +21,11 @@
 //#define LUA_USE_MODULES_ADXL345
 //#define LUA_USE_MODULES_AM2320
 //#define LUA_USE_MODULES_APA102
+//#define LUA_USE_MODULES_ASYNC
 #define LUA_USE_MODULES_BIT
 //#define LUA_USE_MODULES_BMP085
 //#define LUA_USE_MODULES_BME280
+//#define LUA_USE_MODULES_CBOR
 //#define LUA_USE_MODULES_CJSON
 //#define LUA_USE_MODULES_COAP
 #define LUA_USE_MODULES_LWM2M
@@ -36,6 +38,7 @@
 #define LUA_USE_MODULES_GPIO
 //#define LUA_USE_MODULES_HMC5883L
 //#define LUA_USE_MODULES_HTTP
+//#define LUA_USE_MODULES_HTTPD
 //#define LUA_USE_MODULES_HX711
 #define LUA_USE_MODULES_I2C
 //#define LUA_USE_MODULES_L3G4200D
@@ -9,6 +9,7 @@
 
 #include "c_stddef.h"
 #include "mem.h"
+#include "user_config.h"
 
 #include <stdlib.h>
 
@@ -31,10 +32,21 @@
 #define os_realloc(p, s) mem_realloc((p), (s))
 #endif
 
+#ifdef HEAP_TRACE
+// Tagged with the call site for node.heapinfo(), see lheap.c
+#define c_free(p) lheap_trace_free(p)
+#define c_malloc(s) lheap_trace_malloc((s), 0, __FILE__, __LINE__)
+#define c_zalloc(s) lheap_trace_malloc((s), 1, __FILE__, __LINE__)
+#define c_realloc(p, s) lheap_trace_realloc((p), (s), __FILE__, __LINE__)
+void *lheap_trace_malloc(size_t size, int zero, const char *file, unsigned line);
+void *lheap_trace_realloc(void *p, size_t size, const char *file, unsigned line);
+void lheap_trace_free(void *p);
+#else
 #define c_free os_free
 #define c_malloc os_malloc
 #define c_zalloc os_zalloc
 #define c_realloc os_realloc
+#endif
 
 #define c_abs	abs
 #define c_atoi	atoi
@@ -27,6 +27,7 @@
 #include "lundump.h"
 #include "lvm.h"
 #include "lrotable.h"
+#include "trace.h"
 
 #if 0
 const char lua_ident[] =
@@ -823,13 +824,20 @@ LUA_API int lua_setfenv (lua_State *L, int idx) {
      api_check(L, (nr) == LUA_MULTRET || (L->ci->top - L->top >= (nr) - (na)))
 	
 
+/* tracepoint argument: C call depth, and the line of a Lua function or the status */
+#define tracecall(L,v)  ((L)->nCcalls << 16 | ((v) & 0xFFFF))
+#define traceline(o)  (ttisfunction(o) && !clvalue(o)->c.isC ? \
+                       clvalue(o)->l.p->linedefined : 0)
+
 LUA_API void lua_call (lua_State *L, int nargs, int nresults) {
   StkId func;
   lua_lock(L);
   api_checknelems(L, nargs+1);
   checkresults(L, nargs, nresults);
   func = L->top - (nargs+1);
+  TRACE(TRACE_LUA_CALL, tracecall(L, traceline(func)));
   luaD_call(L, func, nresults);
+  TRACE(TRACE_LUA_CALL_END, tracecall(L, 0));
   adjustresults(L, nresults);
   lua_unlock(L);
 }
@@ -868,7 +876,9 @@ LUA_API int lua_pcall (lua_State *L, int nargs, int nresults, int errfunc) {
   }
   c.func = L->top - (nargs+1);  /* function to be called */
   c.nresults = nresults;
+  TRACE(TRACE_LUA_CALL, tracecall(L, traceline(c.func)));
   status = luaD_pcall(L, f_call, &c, savestack(L, c.func), func);
+  TRACE(TRACE_LUA_CALL_END, tracecall(L, status));
   adjustresults(L, nresults);
   lua_unlock(L);
   return status;
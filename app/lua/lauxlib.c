@@ -780,13 +780,22 @@ static int l_check_memlimit(lua_State *L, size_t needbytes) {
 }
 
 
+#if defined(HEAP_TRACE) && !defined(LUA_CROSS_COMPILER)
+/* Lua blocks are traced by size in luaM_realloc_, not as C blocks */
+#define l_free     os_free
+#define l_realloc  os_realloc
+#else
+#define l_free     c_free
+#define l_realloc  c_realloc
+#endif
+
 static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
   lua_State *L = (lua_State *)ud;
   int mode = L == NULL ? 0 : G(L)->egcmode;
   void *nptr;
 
   if (nsize == 0) {
-    c_free(ptr);
+    l_free(ptr);
     return NULL;
   }
   if (L != NULL && (mode & EGC_ALWAYS)) /* always collect memory if requested */
@@ -798,10 +807,10 @@ static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
     if(G(L)->memlimit > 0 && (mode & EGC_ON_MEM_LIMIT) && l_check_memlimit(L, nsize - osize))
       return NULL;
   }
-  nptr = (void *)c_realloc(ptr, nsize);
+  nptr = (void *)l_realloc(ptr, nsize);
   if (nptr == NULL && L != NULL && (mode & EGC_ON_ALLOC_FAILURE)) {
     luaC_fullgc(L); /* emergency full collection. */
-    nptr = (void *)c_realloc(ptr, nsize); /* try allocation again */
+    nptr = (void *)l_realloc(ptr, nsize); /* try allocation again */
   }
   return nptr;
 }
@@ -22,6 +22,7 @@
 #include "ltable.h"
 #include "ltm.h"
 #include "lrotable.h"
+#include "trace.h"
 
 #define GCSTEPSIZE	1024u
 #define GCSWEEPMAX	40
@@ -520,6 +521,7 @@ static void markroot (lua_State *L) {
   markvalue(g, registry(L));
   markmt(g);
   g->gcstate = GCSpropagate;
+  g->gccycles++;
 }
 
 
@@ -626,6 +628,7 @@ void luaC_step (lua_State *L) {
   global_State *g = G(L);
   if(is_block_gc(L)) return;
   set_block_gc(L);
+  TRACE(TRACE_GC_STEP, g->gcstate);
   l_mem lim = (GCSTEPSIZE/100) * g->gcstepmul;
   if (lim == 0)
     lim = (MAX_LUMEM-1)/2;  /* no limit */
@@ -649,6 +652,7 @@ void luaC_step (lua_State *L) {
     lua_assert(g->totalbytes >= g->estimate);
     setthreshold(g);
   }
+  TRACE(TRACE_GC_STEP_END, g->gcstate);
   unset_block_gc(L);
 }
 
@@ -665,6 +669,7 @@ void luaC_fullgc (lua_State *L) {
   global_State *g = G(L);
   if(is_block_gc(L)) return;
   set_block_gc(L);
+  TRACE(TRACE_GC_FULL, g->gcstate);
   if (g->gcstate <= GCSpropagate) {
     /* reset sweep marks to sweep all elements (returning them to white) */
     g->sweepstrgc = 0;
@@ -686,6 +691,7 @@ void luaC_fullgc (lua_State *L) {
     singlestep(L);
   }
   setthreshold(g);
+  TRACE(TRACE_GC_FULL_END, g->gcstate);
   unset_block_gc(L);
 }
 
@@ -0,0 +1,361 @@
+// Lua heap report and allocation tracer
+
+/*
+ * node.heapinfo() reports the free heap, the largest block that can still
+ * be allocated, and the Lua heap split by the type of the object owning
+ * each block. The split walks the lists of collectable objects when it is
+ * asked for, so it costs nothing meanwhile. The size of the string table
+ * and the number of collections come from the global state.
+ *
+ * With HEAP_TRACE, luaM_realloc_() counts every live Lua block into a size
+ * class and keeps the peak of the Lua heap, and c_malloc() and friends
+ * record the size and call site of each C block in a small open addressed
+ * table, so the C heap is reported by site too. C blocks that do not fit
+ * in the tables, or are freed other than with c_free(), are only counted
+ * as untracked.
+ */
+
+#include "lheap.h"
+#include "lfunc.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+
+#include "c_types.h"
+#include "c_stdlib.h"
+#include "c_string.h"
+#include "user_interface.h"
+
+// The types the Lua heap is split by
+enum {
+  LHEAP_STRING, LHEAP_TABLE, LHEAP_FUNCTION, LHEAP_USERDATA, LHEAP_THREAD,
+  LHEAP_PROTO, LHEAP_UPVALUE, LHEAP_TYPES
+};
+
+static const char *const lheap_type_names[LHEAP_TYPES] = {
+  "string", "table", "function", "userdata", "thread", "proto", "upvalue"
+};
+
+// Adds the bytes of an object and of the arrays it owns, as they are freed
+static void lheap_add_object (lua_State *L, GCObject *o, lu_mem *bytes) {
+  switch (o->gch.tt) {
+    case LUA_TSTRING:
+      bytes[LHEAP_STRING] += sizestring(gco2ts(o));
+      break;
+    case LUA_TTABLE: {
+      Table *t = gco2h(o);
+      bytes[LHEAP_TABLE] += sizeof(Table) + t->sizearray * sizeof(TValue) +
+                            (luaH_isdummy(t->node) ? 0 : sizenode(t) * sizeof(Node));
+      break;
+    }
+    case LUA_TFUNCTION: {
+      Closure *c = gco2cl(o);
+      bytes[LHEAP_FUNCTION] += c->c.isC ? sizeCclosure(c->c.nupvalues) :
+                                          sizeLclosure(c->l.nupvalues);
+      break;
+    }
+    case LUA_TUSERDATA:
+      bytes[LHEAP_USERDATA] += sizeudata(gco2u(o));
+      break;
+    case LUA_TTHREAD: {
+      lua_State *th = gco2th(o);
+      // The main thread itself is part of the global state
+      if (th != G(L)->mainthread)
+        bytes[LHEAP_THREAD] += sizeof(lua_State) + LUAI_EXTRASPACE;
+      bytes[LHEAP_THREAD] += th->stacksize * sizeof(TValue) + th->size_ci * sizeof(CallInfo);
+      break;
+    }
+    case LUA_TPROTO: {
+      Proto *f = gco2p(o);
+      bytes[LHEAP_PROTO] += sizeof(Proto) + f->sizep * sizeof(Proto *) +
+                            f->sizek * sizeof(TValue) + f->sizelocvars * sizeof(struct LocVar) +
+                            f->sizeupvalues * sizeof(TString *);
+      if (!proto_is_readonly(f)) {
+        bytes[LHEAP_PROTO] += f->sizecode * sizeof(Instruction);
+#ifdef LUA_OPTIMIZE_DEBUG
+        if (f->packedlineinfo)
+          bytes[LHEAP_PROTO] += c_strlen(cast(char *, f->packedlineinfo)) + 1;
+#else
+        bytes[LHEAP_PROTO] += f->sizelineinfo * sizeof(int);
+#endif
+      }
+      break;
+    }
+    case LUA_TUPVAL:
+      bytes[LHEAP_UPVALUE] += sizeof(UpVal);
+      break;
+  }
+}
+
+static void lheap_lua_bytes (lua_State *L, lu_mem *bytes) {
+  global_State *g = G(L);
+  GCObject *o;
+  UpVal *uv;
+  int i;
+
+  c_memset(bytes, 0, LHEAP_TYPES * sizeof(lu_mem));
+  for (o = g->rootgc; o; o = o->gch.next)
+    lheap_add_object(L, o, bytes);
+  // Userdata waiting for __gc are on a circular list of their own
+  if (g->tmudata) {
+    o = g->tmudata;
+    do {
+      o = o->gch.next;
+      lheap_add_object(L, o, bytes);
+    } while (o != g->tmudata);
+  }
+  for (i = 0; i < g->strt.size; i++)
+    for (o = g->strt.hash[i]; o; o = o->gch.next)
+      lheap_add_object(L, o, bytes);
+  for (uv = g->uvhead.u.l.next; uv != &g->uvhead; uv = uv->u.l.next)
+    bytes[LHEAP_UPVALUE] += sizeof(UpVal);
+}
+
+// Finds the largest block that can be allocated, to within 8 bytes
+static uint32_t lheap_largest (uint32_t avail) {
+  uint32_t lo = 0, hi = avail + 1;   // lo fits, hi does not
+
+  while (hi - lo > 8) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    void *p = os_malloc(mid);
+    if (p) {
+      os_free(p);
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+#ifdef HEAP_TRACE
+
+typedef struct {
+  const char *file;
+  uint32_t line;
+  uint32_t blocks, bytes, peak;
+} lheap_site_t;
+
+typedef struct {
+  void *p;
+  uint32_t size : 24;
+  uint32_t site : 8;
+} lheap_block_t;
+
+static struct {
+  uint32_t lua_class[LHEAP_CLASSES];  // live blocks per size class
+  uint32_t c_class[LHEAP_CLASSES];
+  uint32_t untracked;
+  uint32_t lua_peak;                  // since the last node.heapinfo()
+  uint16_t nsites, nblocks;
+  lheap_site_t site[LHEAP_SITES];
+  lheap_block_t block[LHEAP_BLOCKS];
+} lheap;
+
+static unsigned lheap_class (size_t size) {
+  if (size <= 8)
+    return 0;
+  unsigned c = 32 - __builtin_clz((uint32_t)size - 1) - 3;
+  return c < LHEAP_CLASSES ? c : LHEAP_CLASSES - 1;
+}
+
+void lheap_trace_lua (size_t osize, size_t nsize, size_t total) {
+  if (osize)
+    lheap.lua_class[lheap_class(osize)]--;
+  if (nsize)
+    lheap.lua_class[lheap_class(nsize)]++;
+  if (total > lheap.lua_peak)
+    lheap.lua_peak = total;
+}
+
+static unsigned lheap_hash (void *p) {
+  return ((((uint32_t)(size_t)p >> 2) * 2654435761u) >> 16) % LHEAP_BLOCKS;
+}
+
+// Returns the slot of p, or the empty slot where it would go
+static unsigned lheap_find (void *p) {
+  unsigned i = lheap_hash(p);
+  while (lheap.block[i].p && lheap.block[i].p != p)
+    i = (i + 1) % LHEAP_BLOCKS;
+  return i;
+}
+
+static void lheap_count (unsigned site, size_t size, bool add) {
+  lheap_site_t *s = &lheap.site[site];
+  if (add) {
+    lheap.c_class[lheap_class(size)]++;
+    s->blocks++;
+    s->bytes += size;
+    if (s->bytes > s->peak)
+      s->peak = s->bytes;
+  } else {
+    lheap.c_class[lheap_class(size)]--;
+    s->blocks--;
+    s->bytes -= size;
+  }
+}
+
+static int lheap_site (const char *file, unsigned line) {
+  int i;
+  for (i = 0; i < lheap.nsites; i++)
+    if (lheap.site[i].line == line &&
+        (lheap.site[i].file == file || !c_strcmp(lheap.site[i].file, file)))
+      return i;
+  if (lheap.nsites == LHEAP_SITES)
+    return -1;
+  lheap.site[i].file = file;
+  lheap.site[i].line = line;
+  return lheap.nsites++;
+}
+
+static void lheap_track (void *p, size_t size, const char *file, unsigned line) {
+  int site = lheap_site(file, line);
+  // Kept at most 3/4 full, so that probes stay short
+  if (site < 0 || size >= (1 << 24) || lheap.nblocks >= LHEAP_BLOCKS * 3 / 4) {
+    lheap.untracked++;
+    return;
+  }
+  unsigned i = lheap_find(p);
+  if (lheap.block[i].p)   // freed without c_free(), the address reused
+    lheap_count(lheap.block[i].site, lheap.block[i].size, false);
+  else
+    lheap.nblocks++;
+  lheap.block[i].p = p;
+  lheap.block[i].size = size;
+  lheap.block[i].site = site;
+  lheap_count(site, size, true);
+}
+
+// Removes the block in slot i, if any
+static void lheap_remove (unsigned i) {
+  unsigned j, k;
+  if (!lheap.block[i].p)
+    return;
+  lheap_count(lheap.block[i].site, lheap.block[i].size, false);
+  lheap.nblocks--;
+  // Moves later blocks of the probe sequence up into the hole
+  for (j = i;;) {
+    lheap.block[i].p = NULL;
+    do {
+      j = (j + 1) % LHEAP_BLOCKS;
+      if (!lheap.block[j].p)
+        return;
+      k = lheap_hash(lheap.block[j].p);
+    } while (i <= j ? (i < k && k <= j) : (i < k || k <= j));
+    lheap.block[i] = lheap.block[j];
+    i = j;
+  }
+}
+
+void *lheap_trace_malloc (size_t size, int zero, const char *file, unsigned line) {
+  void *p = zero ? os_zalloc(size) : os_malloc(size);
+  if (p)
+    lheap_track(p, size, file, line);
+  return p;
+}
+
+void *lheap_trace_realloc (void *p, size_t size, const char *file, unsigned line) {
+  if (!p)
+    return lheap_trace_malloc(size, 0, file, line);
+  unsigned i = lheap_find(p);
+  void *np = os_realloc(p, size);
+  if (np || !size) {
+    lheap_remove(i);
+    if (np)
+      lheap_track(np, size, file, line);
+  }
+  return np;
+}
+
+void lheap_trace_free (void *p) {
+  if (p)
+    lheap_remove(lheap_find(p));
+  os_free(p);
+}
+
+static void lheap_push_classes (lua_State *L, const uint32_t *class) {
+  int i;
+  lua_createtable(L, LHEAP_CLASSES, 0);
+  for (i = 0; i < LHEAP_CLASSES; i++) {
+    lua_pushinteger(L, class[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+}
+
+#endif
+
+// Lua: info = node.heapinfo()
+int lheap_info (lua_State *L) {
+  // Measured before the result takes any heap
+  uint32_t avail = system_get_free_heap_size();
+  uint32_t largest = lheap_largest(avail);
+  global_State *g = G(L);
+  lu_mem total = g->totalbytes, bytes[LHEAP_TYPES], other;
+  int i;
+
+  lheap_lua_bytes(L, bytes);
+  other = total;
+  lua_createtable(L, 0, 10);
+  lua_pushinteger(L, avail);
+  lua_setfield(L, -2, "free");
+  lua_pushinteger(L, largest);
+  lua_setfield(L, -2, "largest");
+  // 0 with the free heap in one block, towards 100 as it is split up
+  lua_pushinteger(L, avail ? (uint32_t)((uint64_t)(avail - largest) * 100 / avail) : 0);
+  lua_setfield(L, -2, "fragmentation");
+
+  lua_createtable(L, 0, LHEAP_TYPES + 2);
+  for (i = 0; i < LHEAP_TYPES; i++) {
+    lua_pushinteger(L, bytes[i]);
+    lua_setfield(L, -2, lheap_type_names[i]);
+    other -= bytes[i];
+  }
+  lua_pushinteger(L, other);
+  lua_setfield(L, -2, "other");
+  lua_pushinteger(L, total);
+  lua_setfield(L, -2, "total");
+#ifdef HEAP_TRACE
+  lua_pushinteger(L, lheap.lua_peak > total ? lheap.lua_peak : total);
+  lua_setfield(L, -2, "peak");
+#endif
+  lua_setfield(L, -2, "lua");
+
+  lua_createtable(L, 0, 2);
+  lua_pushinteger(L, g->strt.nuse);
+  lua_setfield(L, -2, "count");
+  lua_pushinteger(L, g->strt.size);
+  lua_setfield(L, -2, "slots");
+  lua_setfield(L, -2, "strings");
+  lua_pushinteger(L, g->gccycles);
+  lua_setfield(L, -2, "gccycles");
+
+#ifdef HEAP_TRACE
+  lua_createtable(L, 0, 2);
+  lheap_push_classes(L, lheap.lua_class);
+  lua_setfield(L, -2, "lua");
+  lheap_push_classes(L, lheap.c_class);
+  lua_setfield(L, -2, "c");
+  lua_setfield(L, -2, "sizes");
+
+  lua_createtable(L, 0, lheap.nsites);
+  for (i = 0; i < lheap.nsites; i++) {
+    lheap_site_t *s = &lheap.site[i];
+    lua_pushfstring(L, "%s:%d", s->file, s->line);
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, s->blocks);
+    lua_setfield(L, -2, "blocks");
+    lua_pushinteger(L, s->bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushinteger(L, s->peak);
+    lua_setfield(L, -2, "peak");
+    lua_rawset(L, -3);
+  }
+  lua_setfield(L, -2, "sites");
+  lua_pushinteger(L, lheap.untracked);
+  lua_setfield(L, -2, "untracked");
+  // The next peak counts from here, without the result
+  lheap.lua_peak = total;
+#endif
+  return 1;
+}
@@ -0,0 +1,27 @@
+// Lua heap report and allocation tracer interface
+
+#ifndef __LHEAP_H__
+#define __LHEAP_H__
+
+#include "lua.h"
+
+// Power of two size classes: up to 8 bytes, up to 16, ... up to 8 KB, larger
+#define LHEAP_CLASSES     12
+// C call sites and live C blocks the tracer can tell apart
+#define LHEAP_SITES       48
+#define LHEAP_BLOCKS      256
+
+// Lua: node.heapinfo()
+int lheap_info(lua_State *L);
+
+#ifdef HEAP_TRACE
+// A Lua block resized from osize to nsize, either of them 0, making total
+void lheap_trace_lua(size_t osize, size_t nsize, size_t total);
+
+// c_malloc() and friends, tagged with their call site
+void *lheap_trace_malloc(size_t size, int zero, const char *file, unsigned line);
+void *lheap_trace_realloc(void *p, size_t size, const char *file, unsigned line);
+void lheap_trace_free(void *p);
+#endif
+
+#endif
@@ -16,6 +16,7 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "lheap.h"
 
 
 
@@ -80,6 +81,9 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
     luaD_throw(L, LUA_ERRMEM);
   lua_assert((nsize == 0) == (block == NULL));
   g->totalbytes = (g->totalbytes - osize) + nsize;
+#if defined(HEAP_TRACE) && !defined(LUA_CROSS_COMPILER)
+  lheap_trace_lua(osize, nsize, g->totalbytes);
+#endif
   return block;
 }
 
@@ -85,6 +85,7 @@ typedef struct global_State {
   lu_mem memlimit;  /* maximum number of bytes that can be allocated, 0 = no limit. */
   lu_mem estimate;  /* an estimate of number of bytes actually in use */
   lu_mem gcdept;  /* how much GC is `behind schedule' */
+  lu_int32 gccycles;  /* number of collections started */
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC `granularity' */
   int egcmode;    /* emergency garbage collection operation mode */
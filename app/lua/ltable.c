@@ -748,12 +748,13 @@ int luaH_getn_ro (void *t) {
   return len;
 }
 
+int luaH_isdummy (Node *n) { return n == dummynode; }
+
+
 #if defined(LUA_DEBUG)
 
 Node *luaH_mainposition (const Table *t, const TValue *key) {
   return mainposition(t, key);
 }
 
-int luaH_isdummy (Node *n) { return n == dummynode; }
-
 #endif
@@ -23,6 +23,7 @@
 //#include "os.h"
 #include "lwip/mem.h"
 #include "lwip/app/espconn_tcp.h"
+#include "trace.h"
 
 #ifdef MEMLEAK_DEBUG
 static const char mem_debug_file[] ICACHE_RODATA_ATTR = __FILE__;
@@ -270,7 +271,9 @@ espconn_tcp_reconnect(void *arg)
 		os_free(precon_cb);
 		precon_cb = NULL;
 		if (espconn && espconn->proto.tcp && espconn->proto.tcp->reconnect_callback != NULL) {
+			TRACE(TRACE_NET_RECONNECT, re_err);
 			espconn->proto.tcp->reconnect_callback(espconn, re_err);
+			TRACE(TRACE_NET_RECONNECT_END, re_err);
 		}
 	} else {
 		espconn_printf("espconn_tcp_reconnect err\n");
@@ -371,7 +374,9 @@ espconn_tcp_disconnect_successful(void *arg)
 		os_free(pdiscon_cb);
 		pdiscon_cb = NULL;
 		if (espconn->proto.tcp && espconn->proto.tcp->disconnect_callback != NULL) {
+			TRACE(TRACE_NET_DISCONNECT, 0);
 			espconn->proto.tcp->disconnect_callback(espconn);
+			TRACE(TRACE_NET_DISCONNECT_END, 0);
 		}
 	} else {
 		espconn_printf("espconn_tcp_disconnect err\n");
@@ -638,7 +643,9 @@ espconn_client_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
         	precv_cb->pespconn ->state = ESPCONN_READ;
         	precv_cb->pcommon.pcb = pcb;
             if (precv_cb->pespconn->recv_callback != NULL) {
+            	TRACE(TRACE_NET_RECV, length);
             	precv_cb->pespconn->recv_callback(precv_cb->pespconn, pdata, length);
+            	TRACE(TRACE_NET_RECV_END, length);
             }
             /*switch the state of espconn for next packet copy*/
             if (pcb->state == ESTABLISHED)
@@ -716,7 +723,9 @@ static void ICACHE_FLASH_ATTR espconn_tcp_finish(void *arg)
 			premove = NULL;
 			pfinish->pespconn->state = ESPCONN_CONNECT;
 			if (pfinish->pespconn->sent_callback != NULL) {
+				TRACE(TRACE_NET_SENT, 0);
 				pfinish->pespconn->sent_callback(pfinish->pespconn);
+				TRACE(TRACE_NET_SENT_END, 0);
 			}
 			pfinish->pcommon.packet_info.sent_length = len;
 		} else
@@ -854,7 +863,9 @@ espconn_client_connect(void *arg, struct tcp_pcb *tpcb, err_t err)
 		espconn_tcp_set_buf_count(pcon->pespconn, 1);
 
 		if (pcon->pespconn->proto.tcp->connect_callback != NULL) {
+			TRACE(TRACE_NET_CONNECT, 0);
 			pcon->pespconn->proto.tcp->connect_callback(pcon->pespconn);
+			TRACE(TRACE_NET_CONNECT_END, 0);
 		}
 
 		/*Enable keep alive option*/
@@ -1015,7 +1026,9 @@ espconn_server_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
         	precv_cb->pespconn ->state = ESPCONN_READ;
         	precv_cb->pcommon.pcb = pcb;
             if (precv_cb->pespconn->recv_callback != NULL) {
+            	TRACE(TRACE_NET_RECV, data_cntr);
             	precv_cb->pespconn->recv_callback(precv_cb->pespconn, data_ptr, data_cntr);
+            	TRACE(TRACE_NET_RECV_END, data_cntr);
             }
 
             /*switch the state of espconn for next packet copy*/
@@ -1260,7 +1273,9 @@ espconn_tcp_accept(void *arg, struct tcp_pcb *pcb, err_t err)
 	espconn_tcp_set_buf_count(paccept->pespconn, 1);
 
 	if (paccept->pespconn->proto.tcp->connect_callback != NULL) {
+		TRACE(TRACE_NET_CONNECT, 0);
 		paccept->pespconn->proto.tcp->connect_callback(paccept->pespconn);
+		TRACE(TRACE_NET_CONNECT_END, 0);
 	}
 
 	/*Enable keep alive option*/
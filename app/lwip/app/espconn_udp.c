@@ -21,6 +21,7 @@
 #include "lwip/udp.h"
 
 #include "lwip/app/espconn_udp.h"
+#include "trace.h"
 
 #ifdef MEMLEAK_DEBUG
 static const char mem_debug_file[] ICACHE_RODATA_ATTR = __FILE__;
@@ -40,7 +41,9 @@ static void ICACHE_FLASH_ATTR espconn_data_sentcb(struct espconn *pespconn)
     }
 
     if (pespconn->sent_callback != NULL) {
+        TRACE(TRACE_NET_SENT, 0);
         pespconn->sent_callback(pespconn);
+        TRACE(TRACE_NET_SENT_END, 0);
     }
 }
 
@@ -320,7 +323,9 @@ espconn_udp_recv(void *arg, struct udp_pcb *upcb, struct pbuf *p,
         pbuf_free(p);
 		if (length != 0) {
 			if (precv->pespconn->recv_callback != NULL) {
+				TRACE(TRACE_NET_RECV, length);
 				precv->pespconn->recv_callback(precv->pespconn, pdata, length);
+				TRACE(TRACE_NET_RECV_END, length);
 			}
 		}
 		os_free(pdata);
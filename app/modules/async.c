@@ -0,0 +1,217 @@
+// Module for running sequential code in coroutines on top of callbacks
+
+/*
+ * A coroutine started with async.run() waits by yielding from C, and is
+ * resumed directly with lua_resume() by whatever it waits for: a timer, a
+ * task, or a callback made by async.callback(). Such a callback is a C
+ * closure whose upvalues are the coroutine and its state, so a pending
+ * operation costs one small closure rather than a Lua closure with the
+ * upvalues of the code around it, and a coroutine nothing refers to any
+ * more is collected with its callbacks.
+ *
+ * The state upvalue of a callback is false when idle, true while its
+ * coroutine waits for it, or a table of calls that arrived before that.
+ */
+
+#include "module.h"
+#include "lauxlib.h"
+#include "c_stdlib.h"
+#include "user_interface.h"
+#include "task/task.h"
+
+#define ASYNC_MAX_SLEEP 6870947  // ms, as tmr
+
+typedef struct {
+  os_timer_t timer;
+  int ref;            // the sleeping coroutine
+} async_sleep_t;
+
+static task_handle_t async_task_handle;
+
+// Returns the running coroutine, raising an error on the main thread
+static lua_State *async_current (lua_State *L) {
+  if (lua_pushthread(L))
+    luaL_error(L, "not in a coroutine");
+  lua_pop(L, 1);
+  return L;
+}
+
+/*
+ * Resumes co with the nargs values on top of L, dropping what it yields or
+ * returns. An error in the coroutine is raised again in L.
+ */
+static void async_resume (lua_State *L, lua_State *co, int nargs) {
+  lua_xmove(L, co, nargs);
+  int status = lua_resume(co, nargs);
+  if (status == 0 || status == LUA_YIELD) {
+    lua_settop(co, 0);
+  } else {
+    lua_xmove(co, L, 1);
+    lua_error(L);
+  }
+}
+
+// Resumes the coroutine in a registry reference, releasing it
+static void async_resume_ref (int ref) {
+  lua_State *L = lua_getstate();
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+  luaL_unref(L, LUA_REGISTRYINDEX, ref);
+  lua_State *co = lua_tothread(L, -1);
+  lua_pop(L, 1);
+  if (co && lua_status(co) == LUA_YIELD)
+    async_resume(L, co, 0);
+}
+
+// Lua: co = async.run(func, ...)
+static int async_run (lua_State *L) {
+  int nargs = lua_gettop(L) - 1;
+  luaL_checkanyfunction(L, 1);
+  lua_State *co = lua_newthread(L);
+  lua_insert(L, 1);
+  lua_xmove(L, co, nargs + 1);
+  lua_xmove(co, L, nargs);
+  // Only the function is left on co, the arguments go back on it to start it
+  async_resume(L, co, nargs);
+  return 1;
+}
+
+// The callback made by async.callback(): resumes or queues for its coroutine
+static int async_callback_call (lua_State *L) {
+  int nargs = lua_gettop(L);
+  lua_State *co = lua_tothread(L, lua_upvalueindex(1));
+
+  lua_pushvalue(L, lua_upvalueindex(2));
+  if (lua_isboolean(L, -1) && lua_toboolean(L, -1) && lua_status(co) == LUA_YIELD) {
+    lua_pop(L, 1);
+    lua_pushboolean(L, 0);
+    lua_replace(L, lua_upvalueindex(2));
+    async_resume(L, co, nargs);
+    return 0;
+  }
+  // Not waited for yet: keep the arguments for async.wait()
+  if (!lua_istable(L, -1)) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_replace(L, lua_upvalueindex(2));
+  }
+  lua_createtable(L, nargs, 1);
+  int i;
+  for (i = 1; i <= nargs; i++) {
+    lua_pushvalue(L, i);
+    lua_rawseti(L, -2, i);
+  }
+  lua_pushinteger(L, nargs);
+  lua_setfield(L, -2, "n");
+  lua_rawseti(L, -2, lua_objlen(L, -2) + 1);
+  return 0;
+}
+
+// Lua: cb = async.callback()
+static int async_callback (lua_State *L) {
+  async_current(L);
+  lua_pushthread(L);
+  lua_pushboolean(L, 0);
+  lua_pushcclosure(L, async_callback_call, 2);
+  return 1;
+}
+
+// Lua: ... = async.wait(cb)
+static int async_wait (lua_State *L) {
+  lua_State *co = async_current(L);
+  luaL_argcheck(L, lua_tocfunction(L, 1) == async_callback_call, 1, "not an async callback");
+  lua_getupvalue(L, 1, 1);
+  luaL_argcheck(L, lua_tothread(L, -1) == co, 1, "callback of another coroutine");
+  lua_pop(L, 1);
+
+  lua_getupvalue(L, 1, 2);
+  if (!lua_istable(L, -1)) {
+    lua_pushboolean(L, 1);
+    lua_setupvalue(L, 1, 2);
+    lua_settop(L, 0);
+    return lua_yield(L, 0);
+  }
+
+  // Called already: take the oldest call off the queue
+  int queue = lua_gettop(L);
+  int n = lua_objlen(L, queue), i;
+  lua_rawgeti(L, queue, 1);
+  for (i = 1; i < n; i++) {
+    lua_rawgeti(L, queue, i + 1);
+    lua_rawseti(L, queue, i);
+  }
+  lua_pushnil(L);
+  lua_rawseti(L, queue, n);
+  if (n == 1) {
+    lua_pushboolean(L, 0);
+    lua_setupvalue(L, 1, 2);
+  }
+
+  int args = lua_gettop(L);
+  lua_getfield(L, args, "n");
+  int nargs = lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  luaL_checkstack(L, nargs, "too many results");
+  for (i = 1; i <= nargs; i++)
+    lua_rawgeti(L, args, i);
+  return nargs;
+}
+
+static void async_sleep_done (void *arg) {
+  async_sleep_t *s = (async_sleep_t *)arg;
+  int ref = s->ref;
+  c_free(s);
+  async_resume_ref(ref);
+}
+
+// Lua: async.sleep(ms)
+static int async_sleep (lua_State *L) {
+  async_current(L);
+  uint32_t ms = luaL_checkinteger(L, 1);
+  luaL_argcheck(L, ms > 0 && ms <= ASYNC_MAX_SLEEP, 1, "invalid time");
+
+  async_sleep_t *s = (async_sleep_t *)c_malloc(sizeof(async_sleep_t));
+  if (!s)
+    return luaL_error(L, "not enough memory");
+  lua_pushthread(L);
+  s->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  os_timer_setfn(&s->timer, async_sleep_done, s);
+  os_timer_arm(&s->timer, ms, 0);
+  lua_settop(L, 0);
+  return lua_yield(L, 0);
+}
+
+static void async_task (task_param_t ref, uint8 priority) {
+  (void)priority;
+  async_resume_ref((int)ref);
+}
+
+// Lua: async.yield() -- lets the other tasks and the SDK run
+static int async_yield (lua_State *L) {
+  async_current(L);
+  lua_pushthread(L);
+  int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  if (!task_post_low(async_task_handle, (task_param_t)ref)) {
+    luaL_unref(L, LUA_REGISTRYINDEX, ref);
+    return luaL_error(L, "Task queue overflow");
+  }
+  lua_settop(L, 0);
+  return lua_yield(L, 0);
+}
+
+static int luaopen_async (lua_State *L) {
+  async_task_handle = task_get_id(async_task);
+  return 0;
+}
+
+// Module function map
+static const LUA_REG_TYPE async_map[] = {
+  { LSTRKEY( "run" ),      LFUNCVAL( async_run ) },
+  { LSTRKEY( "callback" ), LFUNCVAL( async_callback ) },
+  { LSTRKEY( "wait" ),     LFUNCVAL( async_wait ) },
+  { LSTRKEY( "sleep" ),    LFUNCVAL( async_sleep ) },
+  { LSTRKEY( "yield" ),    LFUNCVAL( async_yield ) },
+  { LNILKEY, LNILVAL }
+};
+
+NODEMCU_MODULE(ASYNC, "async", async_map, luaopen_async);
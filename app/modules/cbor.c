@@ -0,0 +1,890 @@
+// Module for CBOR (RFC 7049) encoding and decoding
+//
+// CBOR carries the JSON data model in a binary form: numbers are stored
+// as integers or IEEE floats instead of text, and strings are length
+// prefixed instead of escaped. The Lua mapping follows cjson: null is a
+// lightuserdata (cbor.null), tables with positive integer keys are arrays
+// and anything else is a map.
+
+#include "module.h"
+#include "lauxlib.h"
+#include "c_string.h"
+#include "c_stdlib.h"
+#include "c_math.h"
+#include "c_limits.h"
+
+#define DEFAULT_SPARSE_CONVERT 0
+#define DEFAULT_SPARSE_RATIO 2
+#define DEFAULT_SPARSE_SAFE 10
+#define DEFAULT_ENCODE_MAX_DEPTH 1000
+#define DEFAULT_DECODE_MAX_DEPTH 1000
+
+#define CBOR_ENCODE_CHUNK 1024
+#define CBOR_BUFFER_INIT 256
+
+#define METATABLE_HEAP "cbor.heap"
+
+/* Major types, in the top three bits of the initial byte */
+#define CBOR_UINT   0x00
+#define CBOR_NINT   0x20
+#define CBOR_BYTES  0x40
+#define CBOR_TEXT   0x60
+#define CBOR_ARRAY  0x80
+#define CBOR_MAP    0xa0
+#define CBOR_TAG    0xc0
+#define CBOR_SIMPLE 0xe0
+
+#define CBOR_FALSE     0xf4
+#define CBOR_TRUE      0xf5
+#define CBOR_NULL      0xf6
+#define CBOR_UNDEFINED 0xf7
+#define CBOR_FLOAT16   0xf9
+#define CBOR_FLOAT32   0xfa
+#define CBOR_FLOAT64   0xfb
+#define CBOR_BREAK     0xff
+
+#define CBOR_INDEFINITE 31
+
+typedef struct {
+  int encode_sparse_convert;
+  int encode_sparse_ratio;
+  int encode_sparse_safe;
+  int encode_max_depth;
+  int decode_max_depth;
+} cbor_config_t;
+
+static cbor_config_t cbor_cfg = {
+  DEFAULT_SPARSE_CONVERT,
+  DEFAULT_SPARSE_RATIO,
+  DEFAULT_SPARSE_SAFE,
+  DEFAULT_ENCODE_MAX_DEPTH,
+  DEFAULT_DECODE_MAX_DEPTH
+};
+
+/* The output starts in a buffer on the C stack. Larger output moves to the
+ * heap, owned by a userdata in stack slot `slot` that frees it should an
+ * error from the encoder or from a sink unwind the stack. */
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  size_t size;
+  uint8_t **heap;
+  int slot;
+  int sink;       /* stack index of the sink, 0 when returning a string */
+} cbor_buffer_t;
+
+typedef uint32_t __attribute__((__may_alias__)) cbor_word_t;
+
+typedef union {
+  float f;
+  uint32_t u;
+} cbor_float_t;
+
+typedef union {
+  double d;
+  uint64_t u;
+} cbor_double_t;
+
+/* ===== CONFIGURATION ===== */
+
+static void cbor_arg_init(lua_State *L, int args)
+{
+  luaL_argcheck(L, lua_gettop(L) <= args, args + 1, "found too many arguments");
+  lua_settop(L, args);
+}
+
+static int cbor_integer_option(lua_State *L, int optindex, int *setting,
+                               int min, int max)
+{
+  int value;
+
+  if (!lua_isnil(L, optindex)) {
+    value = luaL_checkinteger(L, optindex);
+    luaL_argcheck(L, min <= value && value <= max, optindex, "out of range");
+    *setting = value;
+  }
+  lua_pushinteger(L, *setting);
+  return 1;
+}
+
+// Lua: cbor.encode_sparse_array([convert[, ratio[, safe]]])
+static int cbor_cfg_encode_sparse_array(lua_State *L)
+{
+  cbor_arg_init(L, 3);
+  if (!lua_isnil(L, 1)) {
+    luaL_checktype(L, 1, LUA_TBOOLEAN);
+    cbor_cfg.encode_sparse_convert = lua_toboolean(L, 1);
+  }
+  lua_pushboolean(L, cbor_cfg.encode_sparse_convert);
+  cbor_integer_option(L, 2, &cbor_cfg.encode_sparse_ratio, 0, INT_MAX);
+  cbor_integer_option(L, 3, &cbor_cfg.encode_sparse_safe, 0, INT_MAX);
+  return 3;
+}
+
+// Lua: cbor.encode_max_depth([depth])
+static int cbor_cfg_encode_max_depth(lua_State *L)
+{
+  cbor_arg_init(L, 1);
+  return cbor_integer_option(L, 1, &cbor_cfg.encode_max_depth, 1, INT_MAX);
+}
+
+// Lua: cbor.decode_max_depth([depth])
+static int cbor_cfg_decode_max_depth(lua_State *L)
+{
+  cbor_arg_init(L, 1);
+  return cbor_integer_option(L, 1, &cbor_cfg.decode_max_depth, 1, INT_MAX);
+}
+
+/* ===== ENCODING ===== */
+
+static int cbor_heap_gc(lua_State *L)
+{
+  uint8_t **heap = (uint8_t **)luaL_checkudata(L, 1, METATABLE_HEAP);
+
+  if (*heap) {
+    c_free(*heap);
+    *heap = NULL;
+  }
+  return 0;
+}
+
+/* Move the buffer to a heap block of the given size */
+static void cbor_buffer_resize(lua_State *L, cbor_buffer_t *b, size_t size)
+{
+  uint8_t *buf;
+
+  if (!b->heap) {
+    b->heap = (uint8_t **)lua_newuserdata(L, sizeof(uint8_t *));
+    *b->heap = NULL;
+    luaL_getmetatable(L, METATABLE_HEAP);
+    lua_setmetatable(L, -2);
+    lua_replace(L, b->slot);
+  }
+  if (*b->heap) {
+    buf = (uint8_t *)c_realloc(*b->heap, size);
+  } else if ((buf = (uint8_t *)c_malloc(size)) != NULL) {
+    c_memcpy(buf, b->buf, b->len);
+  }
+  if (!buf)
+    luaL_error(L, "not enough memory");
+  *b->heap = b->buf = buf;
+  b->size = size;
+}
+
+static void cbor_buffer_init(lua_State *L, cbor_buffer_t *b, uint8_t *init,
+                             size_t size, int sink)
+{
+  lua_pushnil(L);
+  b->slot = lua_gettop(L);
+  b->heap = NULL;
+  b->sink = sink;
+  b->len = 0;
+  b->buf = init;
+  b->size = sink ? size : CBOR_BUFFER_INIT;
+  if (b->size > CBOR_BUFFER_INIT)
+    cbor_buffer_resize(L, b, size);
+}
+
+/* Release the heap block now rather than at the next collection */
+static void cbor_buffer_free(cbor_buffer_t *b)
+{
+  if (b->heap && *b->heap) {
+    c_free(*b->heap);
+    *b->heap = NULL;
+  }
+}
+
+/* Hand the buffered bytes to the sink, a function or an object with a
+ * write method (file object, socket wrapper, ...) */
+static void cbor_flush(lua_State *L, cbor_buffer_t *b)
+{
+  int t = lua_type(L, b->sink);
+
+  if (b->len == 0)
+    return;
+  if (t == LUA_TFUNCTION || t == LUA_TLIGHTFUNCTION) {
+    lua_pushvalue(L, b->sink);
+    lua_pushlstring(L, (const char *)b->buf, b->len);
+    lua_call(L, 1, 1);
+  } else {
+    lua_getfield(L, b->sink, "write");
+    lua_pushvalue(L, b->sink);
+    lua_pushlstring(L, (const char *)b->buf, b->len);
+    lua_call(L, 2, 1);
+  }
+  b->len = 0;
+  if (lua_isboolean(L, -1) && !lua_toboolean(L, -1))
+    luaL_error(L, "CBOR sink failed");
+  lua_pop(L, 1);
+}
+
+/* Make room for n contiguous bytes; with a sink n is 1 */
+static uint8_t *cbor_reserve(lua_State *L, cbor_buffer_t *b, size_t n)
+{
+  if (b->len + n > b->size) {
+    if (b->sink) {
+      cbor_flush(L, b);
+    } else {
+      size_t size = b->size * 2;
+
+      while (b->len + n > size)
+        size *= 2;
+      cbor_buffer_resize(L, b, size);
+    }
+  }
+  return b->buf + b->len;
+}
+
+static void cbor_put(lua_State *L, cbor_buffer_t *b, const void *data, size_t len)
+{
+  const uint8_t *p = (const uint8_t *)data;
+
+  if (b->len + len <= b->size) {
+    c_memcpy(b->buf + b->len, p, len);
+    b->len += len;
+    return;
+  }
+  if (!b->sink) {
+    c_memcpy(cbor_reserve(L, b, len), p, len);
+    b->len += len;
+    return;
+  }
+  while (len) {
+    size_t n = b->size - b->len;
+
+    if (n == 0) {
+      cbor_flush(L, b);
+      n = b->size;
+    }
+    if (n > len)
+      n = len;
+    c_memcpy(b->buf + b->len, p, n);
+    b->len += n;
+    p += n;
+    len -= n;
+  }
+}
+
+/* Store the n lowest bytes of v in network order */
+static void cbor_put_be(uint8_t *p, uint64_t v, int n)
+{
+  while (n--) {
+    p[n] = (uint8_t)v;
+    v >>= 8;
+  }
+}
+
+/* The initial byte of a data item with its argument in the shortest
+ * form, returns the length */
+static int cbor_head(uint8_t *head, int major, uint64_t v)
+{
+  int n;
+
+  if (v < 24) {
+    head[0] = major | (int)v;
+    return 1;
+  } else if (v <= 0xff) {
+    head[0] = major | 24;
+    n = 1;
+  } else if (v <= 0xffff) {
+    head[0] = major | 25;
+    n = 2;
+  } else if (v <= 0xffffffffULL) {
+    head[0] = major | 26;
+    n = 4;
+  } else {
+    head[0] = major | 27;
+    n = 8;
+  }
+  cbor_put_be(head + 1, v, n);
+  return n + 1;
+}
+
+static void cbor_put_head(lua_State *L, cbor_buffer_t *b, int major, uint64_t v)
+{
+  uint8_t head[9];
+
+  cbor_put(L, b, head, cbor_head(head, major, v));
+}
+
+static void cbor_put_byte(lua_State *L, cbor_buffer_t *b, int c)
+{
+  *cbor_reserve(L, b, 1) = c;
+  b->len++;
+}
+
+#ifndef LUA_NUMBER_INTEGRAL
+/* The half precision form of a single, if it has one */
+static int cbor_half(uint32_t u, uint32_t *h)
+{
+  uint32_t sign = (u >> 16) & 0x8000, mant = u & 0x7fffff;
+  int exp = (int)((u >> 23) & 0xff) - 127;
+
+  if (exp == 128) {             /* Inf and NaN */
+    *h = sign | 0x7c00 | (mant ? 0x200 : 0);
+    return 1;
+  }
+  if (exp == -127 && mant == 0) {
+    *h = sign;
+    return 1;
+  }
+  if (exp >= -14 && exp <= 15) {
+    if (mant & 0x1fff)
+      return 0;
+    *h = sign | (exp + 15) << 10 | mant >> 13;
+    return 1;
+  }
+  if (exp >= -24 && exp < -14) {  /* subnormal halfs */
+    int shift = -1 - exp;
+
+    mant |= 0x800000;
+    if (mant & ((1UL << shift) - 1))
+      return 0;
+    *h = sign | mant >> shift;
+    return 1;
+  }
+  return 0;
+}
+#endif
+
+/* Integers go out as such, other numbers in the smallest float that holds
+ * them exactly */
+static void cbor_put_number(lua_State *L, cbor_buffer_t *b, lua_Number num)
+{
+#ifdef LUA_NUMBER_INTEGRAL
+  if (num < 0)
+    cbor_put_head(L, b, CBOR_NINT, (uint64_t)(-1 - (int64_t)num));
+  else
+    cbor_put_head(L, b, CBOR_UINT, (uint64_t)num);
+#else
+  cbor_float_t f;
+  uint32_t h;
+  uint8_t head[9];
+
+  if (num > -18446744073709551616.0 && num < 18446744073709551616.0 &&
+      floor(num) == num && (num != 0 || !signbit(num))) {
+    if (num < 0)
+      cbor_put_head(L, b, CBOR_NINT, (uint64_t)-num - 1);
+    else
+      cbor_put_head(L, b, CBOR_UINT, (uint64_t)num);
+    return;
+  }
+
+  f.f = (float)num;
+  if (f.f == num || num != num) {
+    if (cbor_half(f.u, &h)) {
+      head[0] = CBOR_FLOAT16;
+      cbor_put_be(head + 1, h, 2);
+      cbor_put(L, b, head, 3);
+    } else {
+      head[0] = CBOR_FLOAT32;
+      cbor_put_be(head + 1, f.u, 4);
+      cbor_put(L, b, head, 5);
+    }
+  } else {
+    cbor_double_t d;
+
+    d.d = num;
+    head[0] = CBOR_FLOAT64;
+    cbor_put_be(head + 1, d.u, 8);
+    cbor_put(L, b, head, 9);
+  }
+#endif
+}
+
+/* Lua strings are bytes; only valid UTF-8 goes out as a text string */
+static int cbor_is_utf8(const uint8_t *s, size_t len)
+{
+  static const uint32_t min[] = { 0, 0x80, 0x800, 0x10000 };
+  const uint8_t *end = s + len;
+
+  while (s < end) {
+    uint32_t c;
+    int i, n;
+
+    /* ASCII a word at a time */
+    if (((size_t)s & 3) == 0) {
+      while (end - s >= 4 && !(*(const cbor_word_t *)s & 0x80808080UL))
+        s += 4;
+      if (s == end)
+        break;
+    }
+    c = *s++;
+    if (c < 0x80)
+      continue;
+    if (c < 0xc2)
+      return 0;
+    else if (c < 0xe0)
+      n = 1, c &= 0x1f;
+    else if (c < 0xf0)
+      n = 2, c &= 0x0f;
+    else if (c < 0xf5)
+      n = 3, c &= 0x07;
+    else
+      return 0;
+    if (end - s < n)
+      return 0;
+    for (i = 0; i < n; i++) {
+      if ((*s & 0xc0) != 0x80)
+        return 0;
+      c = (c << 6) | (*s++ & 0x3f);
+    }
+    /* overlong forms, surrogates and beyond U+10FFFF */
+    if (c < min[n] || (c >= 0xd800 && c < 0xe000) || c > 0x10ffff)
+      return 0;
+  }
+  return 1;
+}
+
+static void cbor_put_string(lua_State *L, cbor_buffer_t *b, int lindex)
+{
+  size_t len;
+  const char *s = lua_tolstring(L, lindex, &len);
+
+  cbor_put_head(L, b, cbor_is_utf8((const uint8_t *)s, len) ? CBOR_TEXT : CBOR_BYTES, len);
+  cbor_put(L, b, s, len);
+}
+
+/* The length of the table on top of the stack if it is an array, else -1.
+ * Same rules as cjson, including the sparse array configuration. */
+static int cbor_array_length(lua_State *L)
+{
+  lua_Number k;
+  int max = 0, items = 0;
+
+  lua_pushnil(L);
+  while (lua_next(L, -2) != 0) {
+    if (lua_type(L, -2) == LUA_TNUMBER && (k = lua_tonumber(L, -2)) >= 1 &&
+        floor(k) == k && k <= INT_MAX) {
+      if (k > max)
+        max = k;
+      items++;
+      lua_pop(L, 1);
+      continue;
+    }
+    lua_pop(L, 2);
+    return -1;
+  }
+
+  if (cbor_cfg.encode_sparse_ratio > 0 &&
+      max > items * cbor_cfg.encode_sparse_ratio &&
+      max > cbor_cfg.encode_sparse_safe) {
+    if (!cbor_cfg.encode_sparse_convert)
+      luaL_error(L, "Cannot serialise table: excessively sparse array");
+    return -1;
+  }
+  return max;
+}
+
+static void cbor_put_value(lua_State *L, cbor_buffer_t *b, int depth);
+
+/* The key/value pairs of the table on top of the stack, returns their number */
+static int cbor_put_pairs(lua_State *L, cbor_buffer_t *b, int depth)
+{
+  int n = 0;
+
+  lua_pushnil(L);
+  while (lua_next(L, -2) != 0) {
+    int t = lua_type(L, -2);
+
+    if (t != LUA_TSTRING && t != LUA_TNUMBER && t != LUA_TBOOLEAN)
+      luaL_error(L, "Cannot serialise %s: table key must be a number or string",
+                 lua_typename(L, t));
+    lua_pushvalue(L, -2);
+    cbor_put_value(L, b, depth);
+    lua_pop(L, 1);
+    cbor_put_value(L, b, depth);
+    lua_pop(L, 1);
+    n++;
+  }
+  return n;
+}
+
+static void cbor_put_table(lua_State *L, cbor_buffer_t *b, int depth)
+{
+  int i, n;
+
+  if (depth > cbor_cfg.encode_max_depth || !lua_checkstack(L, 4))
+    luaL_error(L, "Cannot serialise, excessive nesting (%d)", depth);
+
+  n = cbor_array_length(L);
+  if (n > 0) {
+    cbor_put_head(L, b, CBOR_ARRAY, n);
+    for (i = 1; i <= n; i++) {
+      lua_rawgeti(L, -1, i);
+      cbor_put_value(L, b, depth);
+      lua_pop(L, 1);
+    }
+    return;
+  }
+
+  if (b->sink) {
+    /* Written bytes may be gone already, count first */
+    n = 0;
+    lua_pushnil(L);
+    while (lua_next(L, -2) != 0) {
+      lua_pop(L, 1);
+      n++;
+    }
+    cbor_put_head(L, b, CBOR_MAP, n);
+    cbor_put_pairs(L, b, depth);
+  } else {
+    /* Counting would take a second traversal. Leave room for a one byte
+     * head and move the pairs up in the rare case of 24 or more. */
+    uint8_t head[9];
+    size_t at = b->len, hlen;
+
+    cbor_put_byte(L, b, CBOR_MAP);
+    n = cbor_put_pairs(L, b, depth);
+    hlen = cbor_head(head, CBOR_MAP, n);
+    if (hlen > 1) {
+      cbor_reserve(L, b, hlen - 1);
+      os_memmove(b->buf + at + hlen, b->buf + at + 1, b->len - at - 1);
+      b->len += hlen - 1;
+    }
+    c_memcpy(b->buf + at, head, hlen);
+  }
+}
+
+/* Append the value on top of the stack */
+static void cbor_put_value(lua_State *L, cbor_buffer_t *b, int depth)
+{
+  switch (lua_type(L, -1)) {
+  case LUA_TSTRING:
+    cbor_put_string(L, b, -1);
+    break;
+  case LUA_TNUMBER:
+    cbor_put_number(L, b, lua_tonumber(L, -1));
+    break;
+  case LUA_TBOOLEAN:
+    cbor_put_byte(L, b, lua_toboolean(L, -1) ? CBOR_TRUE : CBOR_FALSE);
+    break;
+  case LUA_TTABLE:
+    cbor_put_table(L, b, depth + 1);
+    break;
+  case LUA_TNIL:
+    cbor_put_byte(L, b, CBOR_NULL);
+    break;
+  case LUA_TLIGHTUSERDATA:
+    if (lua_touserdata(L, -1) == NULL) {
+      cbor_put_byte(L, b, CBOR_NULL);
+      break;
+    }
+  default:
+    luaL_error(L, "Cannot serialise %s: type not supported",
+               lua_typename(L, lua_type(L, -1)));
+  }
+}
+
+// Lua: cbor.encode(value[, sink[, chunk]])
+static int cbor_encode(lua_State *L)
+{
+  uint8_t init[CBOR_BUFFER_INIT];
+  cbor_buffer_t b;
+  int t = lua_type(L, 2);
+  int chunk;
+
+  luaL_checkany(L, 1);
+  if (t == LUA_TNONE || t == LUA_TNIL) {
+    lua_settop(L, 1);
+    cbor_buffer_init(L, &b, init, 0, 0);
+    lua_pushvalue(L, 1);
+    cbor_put_value(L, &b, 0);
+    lua_pushlstring(L, (const char *)b.buf, b.len);
+    cbor_buffer_free(&b);
+    return 1;
+  }
+
+  chunk = luaL_optint(L, 3, CBOR_ENCODE_CHUNK);
+  luaL_argcheck(L, t == LUA_TFUNCTION || t == LUA_TLIGHTFUNCTION ||
+                t == LUA_TTABLE || t == LUA_TUSERDATA, 2,
+                "function or object with a write method expected");
+  luaL_argcheck(L, chunk > 0, 3, "chunk size must be positive");
+  lua_settop(L, 2);
+  cbor_buffer_init(L, &b, init, chunk, 2);
+  lua_pushvalue(L, 1);
+  cbor_put_value(L, &b, 0);
+  cbor_flush(L, &b);
+  cbor_buffer_free(&b);
+  return 0;
+}
+
+/* ===== DECODING ===== */
+
+typedef struct {
+  const uint8_t *start;
+  const uint8_t *p;
+  const uint8_t *end;
+  int depth;
+} cbor_decode_t;
+
+static void cbor_error(lua_State *L, cbor_decode_t *d, const char *what)
+{
+  luaL_error(L, "%s CBOR data at byte %d", what, (int)(d->p - d->start) + 1);
+}
+
+static void cbor_need(lua_State *L, cbor_decode_t *d, uint64_t n)
+{
+  if ((uint64_t)(d->end - d->p) < n)
+    cbor_error(L, d, "Truncated");
+}
+
+static uint64_t cbor_get_be(cbor_decode_t *d, int n)
+{
+  uint64_t v = 0;
+
+  while (n--)
+    v = (v << 8) | *d->p++;
+  return v;
+}
+
+/* The argument that follows an initial byte with additional info `info` */
+static uint64_t cbor_get_arg(lua_State *L, cbor_decode_t *d, int info)
+{
+  int n;
+
+  if (info < 24)
+    return info;
+  if (info > 27) {
+    d->p--;
+    cbor_error(L, d, "Invalid");
+  }
+  n = 1 << (info - 24);
+  cbor_need(L, d, n);
+  return cbor_get_be(d, n);
+}
+
+static int cbor_at_break(lua_State *L, cbor_decode_t *d)
+{
+  cbor_need(L, d, 1);
+  if (*d->p == CBOR_BREAK) {
+    d->p++;
+    return 1;
+  }
+  return 0;
+}
+
+static void cbor_get_value(lua_State *L, cbor_decode_t *d);
+
+static void cbor_get_string(lua_State *L, cbor_decode_t *d, int major, int info)
+{
+  luaL_Buffer lb;
+  uint64_t len;
+
+  if (info != CBOR_INDEFINITE) {
+    len = cbor_get_arg(L, d, info);
+    cbor_need(L, d, len);
+    lua_pushlstring(L, (const char *)d->p, (size_t)len);
+    d->p += len;
+    return;
+  }
+
+  /* Chunks of the same major type, each of definite length */
+  luaL_buffinit(L, &lb);
+  while (!cbor_at_break(L, d)) {
+    int ib = *d->p++;
+
+    if ((ib & 0xe0) != major || (ib & 0x1f) == CBOR_INDEFINITE) {
+      d->p--;
+      cbor_error(L, d, "Invalid");
+    }
+    len = cbor_get_arg(L, d, ib & 0x1f);
+    cbor_need(L, d, len);
+    luaL_addlstring(&lb, (const char *)d->p, (size_t)len);
+    d->p += len;
+  }
+  luaL_pushresult(&lb);
+}
+
+/* The initial size of a table is capped by what the input can hold, at
+ * least `item` bytes for each entry */
+static int cbor_table_hint(cbor_decode_t *d, uint64_t n, int item)
+{
+  uint64_t left = (d->end - d->p) / item;
+
+  return n < left ? (int)n : (int)left;
+}
+
+static void cbor_get_array(lua_State *L, cbor_decode_t *d, int info)
+{
+  int i;
+
+  if (info == CBOR_INDEFINITE) {
+    lua_newtable(L);
+    for (i = 1; !cbor_at_break(L, d); i++) {
+      cbor_get_value(L, d);
+      lua_rawseti(L, -2, i);
+    }
+  } else {
+    uint64_t n = cbor_get_arg(L, d, info);
+
+    lua_createtable(L, cbor_table_hint(d, n, 1), 0);
+    for (i = 1; (uint64_t)i <= n; i++) {
+      cbor_get_value(L, d);
+      lua_rawseti(L, -2, i);
+    }
+  }
+}
+
+static void cbor_get_map(lua_State *L, cbor_decode_t *d, int info)
+{
+  if (info == CBOR_INDEFINITE) {
+    lua_newtable(L);
+    while (!cbor_at_break(L, d)) {
+      cbor_get_value(L, d);
+      cbor_get_value(L, d);
+      lua_rawset(L, -3);
+    }
+  } else {
+    uint64_t i, n = cbor_get_arg(L, d, info);
+
+    lua_createtable(L, 0, cbor_table_hint(d, n, 2));
+    for (i = 0; i < n; i++) {
+      cbor_get_value(L, d);
+      cbor_get_value(L, d);
+      lua_rawset(L, -3);
+    }
+  }
+}
+
+static lua_Number cbor_get_half(uint32_t h)
+{
+  cbor_float_t f;
+  uint32_t exp = (h >> 10) & 0x1f, mant = h & 0x3ff;
+
+  if (exp == 0) {
+    f.f = mant * (1.0f / 16777216.0f);
+    f.u |= (h & 0x8000) << 16;
+  } else if (exp == 31) {
+    f.u = (h & 0x8000) << 16 | 0x7f800000 | mant << 13;
+  } else {
+    f.u = (h & 0x8000) << 16 | (exp + 112) << 23 | mant << 13;
+  }
+  return f.f;
+}
+
+static void cbor_get_simple(lua_State *L, cbor_decode_t *d, int info)
+{
+  cbor_float_t f;
+  cbor_double_t dbl;
+
+  switch (info) {
+  case CBOR_FALSE & 0x1f:
+  case CBOR_TRUE & 0x1f:
+    lua_pushboolean(L, info == (CBOR_TRUE & 0x1f));
+    break;
+  case CBOR_NULL & 0x1f:
+  case CBOR_UNDEFINED & 0x1f:
+    /* Lua tables cannot hold nil, as in cjson */
+    lua_pushlightuserdata(L, NULL);
+    break;
+  case CBOR_FLOAT16 & 0x1f:
+    cbor_need(L, d, 2);
+    lua_pushnumber(L, cbor_get_half((uint32_t)cbor_get_be(d, 2)));
+    break;
+  case CBOR_FLOAT32 & 0x1f:
+    cbor_need(L, d, 4);
+    f.u = (uint32_t)cbor_get_be(d, 4);
+    lua_pushnumber(L, f.f);
+    break;
+  case CBOR_FLOAT64 & 0x1f:
+    cbor_need(L, d, 8);
+    dbl.u = cbor_get_be(d, 8);
+    lua_pushnumber(L, dbl.d);
+    break;
+  case CBOR_BREAK & 0x1f:
+    d->p--;
+    cbor_error(L, d, "Unexpected break in");
+  default:
+    d->p--;
+    cbor_error(L, d, "Unsupported simple value in");
+  }
+}
+
+/* Push the next data item */
+static void cbor_get_value(lua_State *L, cbor_decode_t *d)
+{
+  int ib, major, info;
+
+  /* Tags only annotate the item that follows; skip them */
+  do {
+    cbor_need(L, d, 1);
+    ib = *d->p++;
+    major = ib & 0xe0;
+    info = ib & 0x1f;
+    if (major == CBOR_TAG)
+      cbor_get_arg(L, d, info);
+  } while (major == CBOR_TAG);
+
+  switch (major) {
+  case CBOR_UINT:
+    lua_pushnumber(L, (lua_Number)cbor_get_arg(L, d, info));
+    break;
+  case CBOR_NINT:
+    lua_pushnumber(L, -1 - (lua_Number)cbor_get_arg(L, d, info));
+    break;
+  case CBOR_BYTES:
+  case CBOR_TEXT:
+    cbor_get_string(L, d, major, info);
+    break;
+  case CBOR_ARRAY:
+  case CBOR_MAP:
+    if (++d->depth > cbor_cfg.decode_max_depth || !lua_checkstack(L, 4)) {
+      d->p--;
+      luaL_error(L, "Found too many nested data structures (%d) at byte %d",
+                 d->depth, (int)(d->p - d->start) + 1);
+    }
+    if (major == CBOR_ARRAY)
+      cbor_get_array(L, d, info);
+    else
+      cbor_get_map(L, d, info);
+    d->depth--;
+    break;
+  default:
+    cbor_get_simple(L, d, info);
+  }
+}
+
+// Lua: value, next = cbor.decode(data[, pos])
+static int cbor_decode(lua_State *L)
+{
+  cbor_decode_t d;
+  size_t len;
+  const char *s = luaL_checklstring(L, 1, &len);
+  int pos = luaL_optint(L, 2, 1);
+
+  luaL_argcheck(L, pos >= 1 && (size_t)pos <= len + 1, 2, "out of range");
+  d.start = (const uint8_t *)s;
+  d.p = d.start + pos - 1;
+  d.end = d.start + len;
+  d.depth = 0;
+
+  lua_settop(L, 1);
+  cbor_get_value(L, &d);
+  lua_pushinteger(L, (int)(d.p - d.start) + 1);
+  return 2;
+}
+
+static const LUA_REG_TYPE cbor_heap_map[] = {
+  { LSTRKEY( "__gc" ),                LFUNCVAL( cbor_heap_gc ) },
+  { LNILKEY, LNILVAL }
+};
+
+// Module function map
+static const LUA_REG_TYPE cbor_map[] = {
+  { LSTRKEY( "encode" ),              LFUNCVAL( cbor_encode ) },
+  { LSTRKEY( "decode" ),              LFUNCVAL( cbor_decode ) },
+  { LSTRKEY( "encode_sparse_array" ), LFUNCVAL( cbor_cfg_encode_sparse_array ) },
+  { LSTRKEY( "encode_max_depth" ),    LFUNCVAL( cbor_cfg_encode_max_depth ) },
+  { LSTRKEY( "decode_max_depth" ),    LFUNCVAL( cbor_cfg_decode_max_depth ) },
+  { LSTRKEY( "null" ),                LUDATA( NULL ) },
+  { LNILKEY, LNILVAL }
+};
+
+int luaopen_cbor(lua_State *L)
+{
+  luaL_rometatable(L, METATABLE_HEAP, (void *)cbor_heap_map);
+  return 0;
+}
+
+NODEMCU_MODULE(CBOR, "cbor", cbor_map, luaopen_cbor);
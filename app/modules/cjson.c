@@ -152,12 +152,47 @@ typedef struct {
     int decode_max_depth;
 } json_config_t;
 
+/* A compiled template, see cjson.compile(). Object and array nodes describe
+ * the tables the decoder expects; values without a node are decoded as
+ * usual. */
+typedef enum {
+    SCHEMA_OBJECT,
+    SCHEMA_ARRAY
+} json_schema_type_t;
+
+typedef struct json_schema_node {
+    json_schema_type_t type;
+    int size;           /* lua_createtable() hint, grows with the documents */
+    int first;          /* object: its keys are keys[first .. first+count-1] */
+    int count;
+    int hint;           /* object: position of the key expected next */
+    struct json_schema_node *item;  /* array: node of the items, or NULL */
+} json_schema_node_t;
+
+typedef struct {
+    const char *str;    /* points into the interned key string */
+    size_t len;
+    int ref;            /* index of the key string in the key table */
+    unsigned stamp;     /* object instance which set the key last */
+    json_schema_node_t *node;       /* node of the value, or NULL */
+} json_schema_key_t;
+
+typedef struct {
+    json_schema_node_t *nodes;      /* nodes[0] is the root */
+    json_schema_key_t *keys;
+    int nnodes;
+    int nkeys;
+    unsigned stamp;
+} json_schema_t;
+
 typedef struct {
     const char *data;
     const char *ptr;
     strbuf_t *tmp;    /* Temporary storage for strings */
     json_config_t *cfg;
     int current_depth;
+    json_schema_t *schema;  /* Only used with a schema node */
+    int schema_keys;        /* Stack index of the key table */
 } json_parse_t;
 
 typedef struct {
@@ -213,56 +248,74 @@ static const char *char2escape[256] = {
 #endif
 
 /* ===== HELPER FUNCTION ===== */
-static const char escape_array[36][8] ICACHE_STORE_ATTR ICACHE_RODATA_ATTR = {
-    {'\\','u','0','0','0','0','\0','\0'},
-    {'\\','u','0','0','0','1','\0','\0'},
-    {'\\','u','0','0','0','2','\0','\0'},
-    {'\\','u','0','0','0','3','\0','\0'},
-    {'\\','u','0','0','0','4','\0','\0'},
-    {'\\','u','0','0','0','5','\0','\0'},
-    {'\\','u','0','0','0','6','\0','\0'},
-    {'\\','u','0','0','0','7','\0','\0'},
-    {'\\','b','\0','\0','\0','\0','\0','\0'},
-    {'\\','t','\0','\0','\0','\0','\0','\0'},
-    {'\\','n','\0','\0','\0','\0','\0','\0'},
-    {'\\','u','0','0','0','b','\0','\0'},
-    {'\\','f','\0','\0','\0','\0','\0','\0'},
-    {'\\','r','\0','\0','\0','\0','\0','\0'},
-    {'\\','u','0','0','0','e','\0','\0'},
-    {'\\','u','0','0','0','f','\0','\0'},
-    {'\\','u','0','0','1','0','\0','\0'},
-    {'\\','u','0','0','1','1','\0','\0'},
-    {'\\','u','0','0','1','2','\0','\0'},
-    {'\\','u','0','0','1','3','\0','\0'},
-    {'\\','u','0','0','1','4','\0','\0'},
-    {'\\','u','0','0','1','5','\0','\0'},
-    {'\\','u','0','0','1','6','\0','\0'},
-    {'\\','u','0','0','1','7','\0','\0'},
-    {'\\','u','0','0','1','8','\0','\0'},
-    {'\\','u','0','0','1','9','\0','\0'},
-    {'\\','u','0','0','1','a','\0','\0'},
-    {'\\','u','0','0','1','b','\0','\0'},
-    {'\\','u','0','0','1','c','\0','\0'},
-    {'\\','u','0','0','1','d','\0','\0'},
-    {'\\','u','0','0','1','e','\0','\0'},
-    {'\\','u','0','0','1','f','\0','\0'},
-    {'\\','\"','\0','\0','\0','\0','\0','\0'},
-    {'\\','/','\0','\0','\0','\0','\0','\0'},
-    {'\\','\\','\0','\0','\0','\0','\0','\0'},
-    {'\\','u','0','0','7','f','\0','\0'}
-};
 
-static const char *char2escape(unsigned char c){
-    if(c<32) return escape_array[c];
+/* Characters escaped when encoding: control characters, '"', '/', '\\'
+ * and DEL. Everything else, including UTF-8 sequences, is copied as is. */
+static inline int json_escape_needed(unsigned char c)
+{
+    return c < 0x20 || c == '\"' || c == '/' || c == '\\' || c == 0x7f;
+}
 
-    switch(c){
-        case 34: return escape_array[32];
-        case 47: return escape_array[33];
-        case 92: return escape_array[34];
-        case 127: return escape_array[35];
-        default:
-        return NULL;
+/* Word at a time tests for the same characters, four bytes per step.
+ * Each macro is non-zero if any byte of x is less than / equal to c. */
+typedef uint32_t __attribute__((__may_alias__)) json_word_t;
+
+#define JSON_ONES           0x01010101u
+#define JSON_HIGHS          0x80808080u
+#define JSON_HAS_LESS(x, c) (((x) - JSON_ONES * (c)) & ~(x) & JSON_HIGHS)
+#define JSON_HAS_BYTE(x, c) JSON_HAS_LESS((x) ^ (JSON_ONES * (c)), 1)
+
+static inline uint32_t json_escape_word(uint32_t x)
+{
+    return JSON_HAS_LESS(x, 0x20) | JSON_HAS_BYTE(x, '\"') |
+           JSON_HAS_BYTE(x, '/') | JSON_HAS_BYTE(x, '\\') |
+           JSON_HAS_BYTE(x, 0x7f);
+}
+
+/* Returns the number of bytes at the start of str which need no escaping */
+static size_t json_escape_span(const char *str, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)str;
+    const unsigned char *end = p + len;
+
+    /* Up to a word boundary, the loads below must be aligned */
+    while (p < end && ((size_t)p & 3)) {
+        if (json_escape_needed(*p))
+            return p - (const unsigned char *)str;
+        p++;
+    }
+    while (end - p >= 4 && !json_escape_word(*(const json_word_t *)p))
+        p += 4;
+    while (p < end && !json_escape_needed(*p))
+        p++;
+
+    return p - (const unsigned char *)str;
+}
+
+/* Writes the escape sequence for c to p, returns the end of it */
+static char *json_escape_char(char *p, unsigned char c)
+{
+    *p++ = '\\';
+    switch (c) {
+    case '\b': *p++ = 'b'; break;
+    case '\t': *p++ = 't'; break;
+    case '\n': *p++ = 'n'; break;
+    case '\f': *p++ = 'f'; break;
+    case '\r': *p++ = 'r'; break;
+    case '\"':
+    case '/':
+    case '\\': *p++ = c; break;
+    default:
+        /* \u00XX, c is below 0x80 */
+        *p++ = 'u';
+        *p++ = '0';
+        *p++ = '0';
+        *p++ = '0' + (c >> 4);
+        c &= 15;
+        *p++ = c < 10 ? '0' + c : 'a' - 10 + c;
+        break;
     }
+    return p;
 }
 
 static json_token_type_t ch2token(unsigned char c){
@@ -588,6 +641,50 @@ static int cfg_init(json_config_t *cfg){
 
     return 0;
 }
+/* ===== RESUMABLE STATE ===== */
+
+/* The streaming encoder and decoder return to Lua between chunks with
+ * tables and keys of their traversal still live. These are parked in a
+ * registry table while suspended. */
+
+/* Move the values above base into the table *ref, *slots tells how many */
+static void json_park(lua_State *l, int *ref, int *slots, int base)
+{
+    int i, n = lua_gettop(l) - base;
+
+    if (n == 0 && *slots == 0)
+        return;
+    if (*ref == LUA_NOREF) {
+        lua_newtable(l);
+        *ref = luaL_ref(l, LUA_REGISTRYINDEX);
+    }
+    lua_rawgeti(l, LUA_REGISTRYINDEX, *ref);
+    lua_insert(l, base + 1);
+    for (i = n; i >= 1; i--)
+        lua_rawseti(l, base + 1, i);
+    for (i = n + 1; i <= *slots; i++) {
+        lua_pushnil(l);
+        lua_rawseti(l, base + 1, i);
+    }
+    lua_pop(l, 1);
+    *slots = n;
+}
+
+/* Push the parked values back onto the stack */
+static void json_unpark(lua_State *l, int ref, int slots)
+{
+    int i, t;
+
+    if (slots == 0)
+        return;
+    luaL_checkstack(l, slots + 3, "too many nested data structures");
+    lua_rawgeti(l, LUA_REGISTRYINDEX, ref);
+    t = lua_gettop(l);
+    for (i = 1; i <= slots; i++)
+        lua_rawgeti(l, t, i);
+    lua_remove(l, t);
+}
+
 /* ===== ENCODING ===== */
 
 static void json_encode_exception(lua_State *l, json_config_t *cfg, strbuf_t *json, int lindex,
@@ -607,10 +704,9 @@ static void json_encode_exception(lua_State *l, json_config_t *cfg, strbuf_t *js
  * Returns nothing. Doesn't remove string from Lua stack */
 static void json_append_string(lua_State *l, strbuf_t *json, int lindex)
 {
-    const char *escstr;
-    int i;
     const char *str;
-    size_t len;
+    size_t len, run;
+    char *p;
 
     str = lua_tolstring(l, lindex, &len);
 
@@ -620,24 +716,21 @@ static void json_append_string(lua_State *l, strbuf_t *json, int lindex)
      * This gains ~5% speedup. */
     strbuf_ensure_empty_length(json, len * 6 + 2);
 
-    strbuf_append_char_unsafe(json, '\"');
-    for (i = 0; i < len; i++) {
-        escstr = char2escape((unsigned char)str[i]);
-        if (escstr){
-            int i;
-            char temp[8];  // for now, 8-bytes is enough.
-            for (i=0; i < 8; ++i)
-            {
-                temp[i] = byte_of_aligned_array(escstr, i);
-                if(temp[i]==0) break;
-            }
-            escstr = temp;
-            strbuf_append_string(json, escstr);
-        }
-        else
-            strbuf_append_char_unsafe(json, str[i]);
+    /* Copy runs of plain characters in one go */
+    p = strbuf_empty_ptr(json);
+    *p++ = '\"';
+    for (;;) {
+        run = json_escape_span(str, len);
+        c_memcpy(p, str, run);
+        p += run;
+        if (run == len)
+            break;
+        p = json_escape_char(p, (unsigned char)str[run]);
+        str += run + 1;
+        len -= run + 1;
     }
-    strbuf_append_char_unsafe(json, '\"');
+    *p++ = '\"';
+    strbuf_extend_length(json, p - strbuf_empty_ptr(json));
 }
 
 /* Find the size of the array on the top of the Lua stack
@@ -739,6 +832,26 @@ static void json_append_array(lua_State *l, json_config_t *cfg, int current_dept
     strbuf_append_char(json, ']');
 }
 
+/* Writes the decimal digits of value to buf, returns their number */
+static int json_format_int(char *buf, int32_t value)
+{
+    char digits[10];
+    uint32_t u = value < 0 ? -(uint32_t)value : (uint32_t)value;
+    int n = 0, len = 0;
+
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+
+    if (value < 0)
+        buf[len++] = '-';
+    while (n)
+        buf[len++] = digits[--n];
+
+    return len;
+}
+
 static void json_append_number(lua_State *l, json_config_t *cfg,
                                strbuf_t *json, int lindex)
 {
@@ -773,6 +886,17 @@ static void json_append_number(lua_State *l, json_config_t *cfg,
     }
 
     strbuf_ensure_empty_length(json, FPCONV_G_FMT_BUFSIZE);
+
+    /* Integers print the same with LUA_NUMBER_FMT, without the cost of
+     * formatting a double. -0 is left to c_sprintf(). */
+    if (num >= -2147483647.0 && num <= 2147483647.0) {
+        int32_t i = (int32_t)num;
+        if (i == num && (i || !signbit(num))) {
+            strbuf_extend_length(json, json_format_int(strbuf_empty_ptr(json), i));
+            return;
+        }
+    }
+
     // len = fpconv_g_fmt(strbuf_empty_ptr(json), num, cfg->encode_number_precision);
     c_sprintf(strbuf_empty_ptr(json), LUA_NUMBER_FMT, (LUA_NUMBER)num);
     len = c_strlen(strbuf_empty_ptr(json));
@@ -865,6 +989,276 @@ static void json_append_data(lua_State *l, json_config_t *cfg,
     }
 }
 
+/* ===== STREAMING ENCODER ===== */
+
+/* The streaming encoder walks the value with an explicit stack instead of
+ * recursing through json_append_data(), so it can stop whenever a chunk's
+ * worth of output is buffered and resume later. Lua stack per level:
+ * array: table; object: table, key. */
+
+#define METATABLE_ENCODER "cjson.encoder"
+#define JSON_ENCODER_CHUNK 1024
+
+typedef struct {
+    int is_object;
+    int length;         /* array length */
+    int count;          /* elements written so far */
+} json_encoder_frame_t;
+
+typedef enum {
+    E_START,
+    E_RUNNING,
+    E_DONE
+} json_encoder_state_t;
+
+typedef struct {
+    strbuf_t buf;
+    json_encoder_frame_t *frames;
+    int depth;
+    int frames_size;
+    int chunk;
+    int state;
+    int busy;           /* inside a call, or an earlier one failed */
+    int value_ref;      /* value to encode, until started */
+    int stack_ref;
+    int slots;
+} json_encoder_t;
+
+/* Write the value on top of the stack. Scalars are popped, tables stay on
+ * the stack as a new level */
+static void json_encoder_value(lua_State *l, json_config_t *cfg, json_encoder_t *e)
+{
+    json_encoder_frame_t *f;
+    int len;
+
+    if (lua_type(l, -1) != LUA_TTABLE) {
+        json_append_data(l, cfg, e->depth, &e->buf);
+        lua_pop(l, 1);
+        return;
+    }
+
+    json_check_encode_depth(l, cfg, e->depth + 1, &e->buf);
+    len = lua_array_length(l, cfg, &e->buf);
+
+    if (e->depth == e->frames_size) {
+        int size = e->frames_size ? e->frames_size * 2 : 8;
+        f = (json_encoder_frame_t *)c_realloc(e->frames, size * sizeof(*f));
+        if (!f)
+            luaL_error(l, "not enough memory");
+        e->frames = f;
+        e->frames_size = size;
+    }
+    f = &e->frames[e->depth++];
+    f->is_object = len <= 0;
+    f->length = len;
+    f->count = 0;
+
+    if (f->is_object) {
+        strbuf_append_char(&e->buf, '{');
+        lua_pushnil(l);
+    } else {
+        strbuf_append_char(&e->buf, '[');
+    }
+}
+
+/* Write the next element of the innermost table, or close it */
+static void json_encoder_step(lua_State *l, json_config_t *cfg, json_encoder_t *e)
+{
+    json_encoder_frame_t *f = &e->frames[e->depth - 1];
+    int keytype;
+
+    if (!f->is_object) {
+        if (f->count < f->length) {
+            if (f->count++)
+                strbuf_append_char(&e->buf, ',');
+            lua_rawgeti(l, -1, f->count);
+            json_encoder_value(l, cfg, e);
+            return;
+        }
+        strbuf_append_char(&e->buf, ']');
+    } else {
+        /* table, key */
+        if (lua_next(l, -2) != 0) {
+            if (f->count++)
+                strbuf_append_char(&e->buf, ',');
+            keytype = lua_type(l, -2);
+            if (keytype == LUA_TNUMBER) {
+                strbuf_append_char(&e->buf, '"');
+                json_append_number(l, cfg, &e->buf, -2);
+                strbuf_append_mem(&e->buf, "\":", 2);
+            } else if (keytype == LUA_TSTRING) {
+                json_append_string(l, &e->buf, -2);
+                strbuf_append_char(&e->buf, ':');
+            } else {
+                json_encode_exception(l, cfg, &e->buf, -2,
+                                      "table key must be a number or string");
+            }
+            json_encoder_value(l, cfg, e);
+            return;
+        }
+        strbuf_append_char(&e->buf, '}');
+    }
+    lua_pop(l, 1);
+    e->depth--;
+}
+
+/* Encode until at least a chunk is buffered or the value is complete */
+static void json_encoder_fill(lua_State *l, json_encoder_t *e)
+{
+    json_config_t *cfg = json_fetch_config(l);
+
+    if (e->state == E_START) {
+        lua_rawgeti(l, LUA_REGISTRYINDEX, e->value_ref);
+        luaL_unref(l, LUA_REGISTRYINDEX, e->value_ref);
+        e->value_ref = LUA_NOREF;
+        e->state = E_RUNNING;
+        json_encoder_value(l, cfg, e);
+    }
+    while (e->depth && strbuf_length(&e->buf) < e->chunk)
+        json_encoder_step(l, cfg, e);
+    if (!e->depth)
+        e->state = E_DONE;
+    if (!strbuf_allocated(&e->buf))
+        luaL_error(l, "not enough memory");
+}
+
+/* Push the next chunk of output, returns 0 when there is none yet */
+static int json_encoder_chunk(lua_State *l, json_encoder_t *e)
+{
+    int len = strbuf_length(&e->buf);
+
+    if (len == 0 || (len < e->chunk && e->state != E_DONE))
+        return 0;
+    if (len > e->chunk)
+        len = e->chunk;
+    lua_pushlstring(l, e->buf.buf, len);
+    e->buf.length -= len;
+    os_memmove(e->buf.buf, e->buf.buf + len, e->buf.length);
+    return 1;
+}
+
+static json_encoder_t *json_encoder_new(lua_State *l, int value, int chunk)
+{
+    json_encoder_t *e;
+
+    e = (json_encoder_t *)lua_newuserdata(l, sizeof(json_encoder_t));
+    c_memset(e, 0, sizeof(json_encoder_t));
+    e->chunk = chunk;
+    e->state = E_START;
+    e->value_ref = e->stack_ref = LUA_NOREF;
+    luaL_getmetatable(l, METATABLE_ENCODER);
+    lua_setmetatable(l, -2);
+
+    /* Room for a chunk plus the longest number or escape sequence */
+    if (strbuf_init(&e->buf, chunk + FPCONV_G_FMT_BUFSIZE) < 0)
+        luaL_error(l, "not enough memory");
+
+    lua_pushvalue(l, value);
+    e->value_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+    return e;
+}
+
+/* Send the chunk on top of the stack to a function or an object with a
+ * write method (file object, httpd response, ...) and pop it */
+static void json_encoder_sink(lua_State *l, int sink)
+{
+    if (lua_type(l, sink) == LUA_TFUNCTION || lua_type(l, sink) == LUA_TLIGHTFUNCTION) {
+        lua_pushvalue(l, sink);
+        lua_insert(l, -2);
+        lua_call(l, 1, 1);
+    } else {
+        lua_getfield(l, sink, "write");
+        lua_insert(l, -2);
+        lua_pushvalue(l, sink);
+        lua_insert(l, -2);
+        lua_call(l, 2, 1);
+    }
+    if (lua_isboolean(l, -1) && !lua_toboolean(l, -1))
+        luaL_error(l, "JSON sink failed");
+    lua_pop(l, 1);
+}
+
+/* Lua: cjson.encode(value, sink[, chunk]) */
+static int json_encode_to_sink(lua_State *l)
+{
+    json_encoder_t *e;
+    int chunk = luaL_optint(l, 3, JSON_ENCODER_CHUNK);
+    int t = lua_type(l, 2);
+
+    luaL_argcheck(l, t == LUA_TFUNCTION || t == LUA_TLIGHTFUNCTION ||
+                  t == LUA_TTABLE || t == LUA_TUSERDATA, 2,
+                  "function or object with a write method expected");
+    luaL_argcheck(l, chunk > 0, 3, "chunk size must be positive");
+
+    lua_settop(l, 2);
+    e = json_encoder_new(l, 1, chunk);
+    lua_insert(l, 1);           /* encoder, value, sink */
+    e->busy = 1;
+    do {
+        json_encoder_fill(l, e);
+        while (json_encoder_chunk(l, e))
+            json_encoder_sink(l, 3);
+    } while (e->state != E_DONE);
+    e->busy = 0;
+    return 0;
+}
+
+// Lua: cjson.encoder(value[, chunk])
+static int json_encoder_create(lua_State *l)
+{
+    int chunk = luaL_optint(l, 2, JSON_ENCODER_CHUNK);
+
+    luaL_argcheck(l, chunk > 0, 2, "chunk size must be positive");
+    lua_settop(l, 1);
+    json_encoder_new(l, 1, chunk);
+    return 1;
+}
+
+// Lua: encoder:read()
+static int json_encoder_read(lua_State *l)
+{
+    json_encoder_t *e = (json_encoder_t *)luaL_checkudata(l, 1, METATABLE_ENCODER);
+    int base;
+
+    if (e->busy)
+        return luaL_error(l, "encoder busy or failed");
+
+    lua_settop(l, 1);
+    base = lua_gettop(l);
+    e->busy = 1;
+    json_unpark(l, e->stack_ref, e->slots);
+    if (e->state != E_DONE)
+        json_encoder_fill(l, e);
+    json_park(l, &e->stack_ref, &e->slots, base);
+    e->busy = 0;
+
+    if (!json_encoder_chunk(l, e))
+        lua_pushnil(l);
+    return 1;
+}
+
+static int json_encoder_gc(lua_State *l)
+{
+    json_encoder_t *e = (json_encoder_t *)luaL_checkudata(l, 1, METATABLE_ENCODER);
+
+    strbuf_free(&e->buf);
+    if (e->frames) {
+        c_free(e->frames);
+        e->frames = NULL;
+    }
+    luaL_unref(l, LUA_REGISTRYINDEX, e->value_ref);
+    luaL_unref(l, LUA_REGISTRYINDEX, e->stack_ref);
+    e->value_ref = e->stack_ref = LUA_NOREF;
+    return 0;
+}
+
+static const LUA_REG_TYPE json_encoder_map[] = {
+  { LSTRKEY( "read" ),    LFUNCVAL( json_encoder_read ) },
+  { LSTRKEY( "__gc" ),    LFUNCVAL( json_encoder_gc ) },
+  { LSTRKEY( "__index" ), LROVAL( json_encoder_map ) },
+  { LNILKEY, LNILVAL }
+};
+
 static int json_encode(lua_State *l)
 {
     json_config_t *cfg = json_fetch_config(l);
@@ -873,7 +1267,10 @@ static int json_encode(lua_State *l)
     char *json;
     int len;
 
-    luaL_argcheck(l, lua_gettop(l) == 1, 1, "expected 1 argument");
+    if (lua_gettop(l) > 1 && !lua_isnil(l, 2))
+        return json_encode_to_sink(l);
+    luaL_argcheck(l, lua_gettop(l) >= 1, 1, "expected 1 argument");
+    lua_settop(l, 1);
 
     if (!cfg->encode_keep_buffer) {
         /* Use private buffer */
@@ -900,7 +1297,8 @@ static int json_encode(lua_State *l)
 /* ===== DECODING ===== */
 
 static void json_process_value(lua_State *l, json_parse_t *json,
-                               json_token_t *token);
+                               json_token_t *token,
+                               json_schema_node_t *node, int reuse);
 
 static int hexdigit2int(char hex)
 {
@@ -1319,30 +1717,177 @@ static void json_decode_descend(lua_State *l, json_parse_t *json, int slots)
         json->current_depth, json->ptr - json->data);
 }
 
-static void json_parse_object_context(lua_State *l, json_parse_t *json)
+/* Find the key of an object node matching str. Keys are moved into the
+ * order they arrive in, so documents of one shape match at the first try. */
+static json_schema_key_t *json_schema_find_key(json_parse_t *json,
+                                               json_schema_node_t *node,
+                                               const char *str, size_t len)
+{
+    json_schema_key_t *keys = json->schema->keys + node->first;
+    json_schema_key_t tmp;
+    int i, j;
+
+    for (i = 0, j = node->hint; i < node->count; i++, j++) {
+        if (j == node->count)
+            j = 0;
+        if (keys[j].len != len || c_memcmp(keys[j].str, str, len))
+            continue;
+        if (j != node->hint) {
+            tmp = keys[j];
+            keys[j] = keys[node->hint];
+            keys[node->hint] = tmp;
+            j = node->hint;
+        }
+        if (++node->hint == node->count)
+            node->hint = 0;
+        return &keys[j];
+    }
+    return NULL;
+}
+
+/* Whether a value starting with token can be decoded into a reused table */
+static int json_schema_fits(json_schema_node_t *node, json_token_t *token)
+{
+    if (!node)
+        return 0;
+    if (node->type == SCHEMA_OBJECT)
+        return token->type == T_OBJ_BEGIN;
+    return token->type == T_ARR_BEGIN;
+}
+
+/* Push the table found at key (top of stack) in the table below it if the
+ * value starting with token can be decoded into it. Returns whether it did. */
+static int json_schema_reuse(lua_State *l, json_schema_node_t *node,
+                             json_token_t *token, int array_index)
+{
+    if (!json_schema_fits(node, token))
+        return 0;
+    if (array_index) {
+        lua_rawgeti(l, -1, array_index);
+    } else {
+        lua_pushvalue(l, -1);
+        lua_rawget(l, -3);
+    }
+    if (lua_istable(l, -1))
+        return 1;
+    lua_pop(l, 1);
+    return 0;
+}
+
+/* Prepare a reused object table: remove every key the template doesn't
+ * have. Key strings are interned, so comparing the pointers suffices. */
+static void json_schema_sweep_object(lua_State *l, json_parse_t *json,
+                                     json_schema_node_t *node)
+{
+    json_schema_key_t *keys = json->schema->keys + node->first;
+    const char *str;
+    int i;
+
+    lua_pushnil(l);
+    while (lua_next(l, -2) != 0) {
+        lua_pop(l, 1);
+        if (lua_type(l, -1) == LUA_TSTRING) {
+            str = lua_tostring(l, -1);
+            for (i = 0; i < node->count && keys[i].str != str; i++)
+                ;
+            if (i < node->count)
+                continue;
+        }
+        /* Clearing a field during lua_next() is allowed */
+        lua_pushvalue(l, -1);
+        lua_pushnil(l);
+        lua_rawset(l, -4);
+    }
+}
+
+/* Remove the template keys of a reused object table which the document
+ * didn't set */
+static void json_schema_clear_object(lua_State *l, json_parse_t *json,
+                                     json_schema_node_t *node, unsigned stamp)
+{
+    json_schema_key_t *key = json->schema->keys + node->first;
+    int i;
+
+    for (i = 0; i < node->count; i++, key++) {
+        if (key->stamp == stamp)
+            continue;
+        /* Setting an absent key to nil would still insert it */
+        lua_rawgeti(l, json->schema_keys, key->ref);
+        lua_pushvalue(l, -1);
+        lua_rawget(l, -3);
+        if (lua_isnil(l, -1)) {
+            lua_pop(l, 2);
+        } else {
+            lua_pop(l, 1);
+            lua_pushnil(l);
+            lua_rawset(l, -3);
+        }
+    }
+}
+
+/* Remove everything but the items 1 .. n from a reused array table */
+static void json_schema_clear_array(lua_State *l, int n)
+{
+    double k;
+
+    lua_pushnil(l);
+    while (lua_next(l, -2) != 0) {
+        lua_pop(l, 1);
+        if (lua_type(l, -1) == LUA_TNUMBER) {
+            k = lua_tonumber(l, -1);
+            if (k >= 1 && k <= n && floor(k) == k)
+                continue;
+        }
+        lua_pushvalue(l, -1);
+        lua_pushnil(l);
+        lua_rawset(l, -4);
+    }
+}
+
+/* Parse an object into a new table, or into the table on top of the stack
+ * if reuse is set. node may be NULL. */
+static void json_parse_object_context(lua_State *l, json_parse_t *json,
+                                      json_schema_node_t *node, int reuse)
 {
     json_token_t token;
+    json_schema_key_t *key = NULL;
+    unsigned stamp = 0;
+    int count = 0;
 
-    /* 3 slots required:
-     * .., table, key, value */
-    json_decode_descend(l, json, 3);
+    /* 4 slots required:
+     * .., table, key, reused value, value */
+    json_decode_descend(l, json, 4);
 
-    lua_newtable(l);
+    if (node) {
+        stamp = ++json->schema->stamp;
+        node->hint = 0;
+    }
+    if (reuse)
+        json_schema_sweep_object(l, json, node);
+    else
+        lua_createtable(l, 0, node ? node->size : 0);
 
     json_next_token(json, &token);
 
     /* Handle empty objects */
-    if (token.type == T_OBJ_END) {
-        json_decode_ascend(json);
-        return;
-    }
+    if (token.type == T_OBJ_END)
+        goto done;
 
     while (1) {
         if (token.type != T_STRING)
             json_throw_parse_error(l, json, "object key string", &token);
 
-        /* Push key */
-        lua_pushlstring(l, token.value.string, token.string_len);
+        /* Push key, the one interned by the schema if it has it */
+        if (node)
+            key = json_schema_find_key(json, node, token.value.string,
+                                       token.string_len);
+        if (key) {
+            key->stamp = stamp;
+            lua_rawgeti(l, json->schema_keys, key->ref);
+        } else {
+            lua_pushlstring(l, token.value.string, token.string_len);
+        }
+        count++;
 
         json_next_token(json, &token);
         if (token.type != T_COLON)
@@ -1350,54 +1895,65 @@ static void json_parse_object_context(lua_State *l, json_parse_t *json)
 
         /* Fetch value */
         json_next_token(json, &token);
-        json_process_value(l, json, &token);
+        if (key)
+            json_process_value(l, json, &token, key->node,
+                               reuse && json_schema_reuse(l, key->node, &token, 0));
+        else
+            json_process_value(l, json, &token, NULL, 0);
 
         /* Set key = value */
         lua_rawset(l, -3);
 
         json_next_token(json, &token);
 
-        if (token.type == T_OBJ_END) {
-            json_decode_ascend(json);
-            return;
-        }
+        if (token.type == T_OBJ_END)
+            goto done;
 
         if (token.type != T_COMMA)
             json_throw_parse_error(l, json, "comma or object end", &token);
 
         json_next_token(json, &token);
     }
+
+done:
+    if (reuse)
+        json_schema_clear_object(l, json, node, stamp);
+    if (node && count > node->size)
+        node->size = count;
+    json_decode_ascend(json);
 }
 
-/* Handle the array context */
-static void json_parse_array_context(lua_State *l, json_parse_t *json)
+/* Handle the array context, arguments as for json_parse_object_context() */
+static void json_parse_array_context(lua_State *l, json_parse_t *json,
+                                     json_schema_node_t *node, int reuse)
 {
+    json_schema_node_t *item = node ? node->item : NULL;
     json_token_t token;
-    int i;
+    int i = 1;
 
-    /* 2 slots required:
-     * .., table, value */
-    json_decode_descend(l, json, 2);
+    /* 3 slots required:
+     * .., table, reused value, value */
+    json_decode_descend(l, json, 3);
 
-    lua_newtable(l);
+    if (!reuse)
+        lua_createtable(l, node ? node->size : 0, 0);
 
     json_next_token(json, &token);
 
     /* Handle empty arrays */
-    if (token.type == T_ARR_END) {
-        json_decode_ascend(json);
-        return;
-    }
+    if (token.type == T_ARR_END)
+        goto done;
 
     for (i = 1; ; i++) {
-        json_process_value(l, json, &token);
+        json_process_value(l, json, &token, item,
+                           reuse && json_schema_reuse(l, item, &token, i));
         lua_rawseti(l, -2, i);            /* arr[i] = value */
 
         json_next_token(json, &token);
 
         if (token.type == T_ARR_END) {
-            json_decode_ascend(json);
-            return;
+            i++;
+            break;
         }
 
         if (token.type != T_COMMA)
@@ -1405,11 +1961,21 @@ static void json_parse_array_context(lua_State *l, json_parse_t *json)
 
         json_next_token(json, &token);
     }
+
+done:
+    /* i is the first index past the array */
+    if (reuse)
+        json_schema_clear_array(l, i - 1);
+    if (node && i - 1 > node->size)
+        node->size = i - 1;
+    json_decode_ascend(json);
 }
 
-/* Handle the "value" context */
+/* Handle the "value" context. With reuse set, the table on top of the stack
+ * is decoded into; only done when json_schema_fits(node, token). */
 static void json_process_value(lua_State *l, json_parse_t *json,
-                               json_token_t *token)
+                               json_token_t *token,
+                               json_schema_node_t *node, int reuse)
 {
     switch (token->type) {
     case T_STRING:
@@ -1422,10 +1988,14 @@ static void json_process_value(lua_State *l, json_parse_t *json,
         lua_pushboolean(l, token->value.boolean);
         break;;
     case T_OBJ_BEGIN:
-        json_parse_object_context(l, json);
+        if (node && node->type != SCHEMA_OBJECT)
+            node = NULL;
+        json_parse_object_context(l, json, node, reuse);
         break;;
     case T_ARR_BEGIN:
-        json_parse_array_context(l, json);
+        if (node && node->type != SCHEMA_ARRAY)
+            node = NULL;
+        json_parse_array_context(l, json, node, reuse);
         break;;
     case T_NULL:
         /* In Lua, setting "t[k] = nil" will delete k from the table.
@@ -1437,18 +2007,24 @@ static void json_process_value(lua_State *l, json_parse_t *json,
     }
 }
 
-static int json_decode(lua_State *l)
+/* Decode the document at stack index lindex and push the value. With a
+ * schema, its key table must be at stack index keys and the table at index
+ * target (if not 0) is decoded into when the document fits. */
+static void json_decode_document(lua_State *l, int lindex,
+                                 json_schema_t *schema, int keys, int target)
 {
     json_parse_t json;
     json_token_t token;
+    json_schema_node_t *root = NULL;
     size_t json_len;
-
-    luaL_argcheck(l, lua_gettop(l) == 1, 1, "expected 1 argument");
+    int reuse = 0;
 
     json.cfg = json_fetch_config(l);
-    json.data = luaL_checklstring(l, 1, &json_len);
+    json.data = luaL_checklstring(l, lindex, &json_len);
     json.current_depth = 0;
     json.ptr = json.data;
+    json.schema = schema;
+    json.schema_keys = keys;
 
     /* Detect Unicode other than UTF-8 (see RFC 4627, Sec 3)
      *
@@ -1463,11 +2039,17 @@ static int json_decode(lua_State *l)
      * string must be smaller than the entire json string */
     json.tmp = strbuf_new(json_len);
     if(json.tmp == NULL){
-        return luaL_error(l, "not enough memory");
+        luaL_error(l, "not enough memory");
     }
 
     json_next_token(&json, &token);
-    json_process_value(l, &json, &token);
+    if (schema && schema->nnodes)
+        root = schema->nodes;
+    if (target && json_schema_fits(root, &token)) {
+        lua_pushvalue(l, target);
+        reuse = 1;
+    }
+    json_process_value(l, &json, &token, root, reuse);
 
     /* Ensure there is no more input left */
     json_next_token(&json, &token);
@@ -1476,10 +2058,717 @@ static int json_decode(lua_State *l)
         json_throw_parse_error(l, &json, "the end", &token);
 
     strbuf_free(json.tmp);
+}
 
+static int json_decode(lua_State *l)
+{
+    luaL_argcheck(l, lua_gettop(l) == 1, 1, "expected 1 argument");
+
+    json_decode_document(l, 1, NULL, 0, 0);
+    return 1;
+}
+
+/* ===== COMPILED TEMPLATES ===== */
+
+/* cjson.compile(template) turns an example of the documents to be decoded
+ * into a schema: the key strings of every object are interned once and kept
+ * in a key table, and every object and array remembers how big its tables
+ * get. schema:decode() then pushes the kept keys instead of hashing the key
+ * text again, creates tables at their final size and optionally fills the
+ * tables of a previous result in place. Parts of a document which don't
+ * match the template are decoded as cjson.decode() would. */
+
+#define METATABLE_SCHEMA "cjson.schema"
+
+/* Object if t has string keys, array if it has t[1], otherwise nothing */
+static int json_schema_kind(lua_State *l, int t)
+{
+    int kind = -1;
+
+    lua_pushnil(l);
+    while (lua_next(l, t) != 0) {
+        lua_pop(l, 1);
+        if (lua_type(l, -1) == LUA_TSTRING) {
+            lua_pop(l, 1);
+            return SCHEMA_OBJECT;
+        }
+    }
+    lua_rawgeti(l, t, 1);
+    if (!lua_isnil(l, -1))
+        kind = SCHEMA_ARRAY;
+    lua_pop(l, 1);
+    return kind;
+}
+
+/* Count the nodes and keys needed for the template at index t */
+static void json_schema_count(lua_State *l, int t, int depth,
+                              int *nnodes, int *nkeys)
+{
+    int kind = json_schema_kind(l, t);
+
+    if (kind < 0)
+        return;
+    if (depth > json_fetch_config(l)->decode_max_depth)
+        luaL_error(l, "template nested too deeply");
+    luaL_checkstack(l, 3, "template nested too deeply");
+    (*nnodes)++;
+
+    if (kind == SCHEMA_ARRAY) {
+        lua_rawgeti(l, t, 1);
+        if (lua_istable(l, -1))
+            json_schema_count(l, lua_gettop(l), depth + 1, nnodes, nkeys);
+        lua_pop(l, 1);
+        return;
+    }
+
+    lua_pushnil(l);
+    while (lua_next(l, t) != 0) {
+        if (lua_type(l, -2) == LUA_TSTRING) {
+            (*nkeys)++;
+            if (lua_istable(l, -1))
+                json_schema_count(l, lua_gettop(l), depth + 1, nnodes, nkeys);
+        }
+        lua_pop(l, 1);
+    }
+}
+
+/* Fill in the node for the template at index t, in the same order as
+ * json_schema_count() counted them. keys is the stack index of the key
+ * table. Returns the node, or NULL. */
+static json_schema_node_t *json_schema_fill(lua_State *l, json_schema_t *s,
+                                            int t, int keys)
+{
+    json_schema_node_t *node;
+    json_schema_key_t *key;
+    int kind = json_schema_kind(l, t);
+
+    if (kind < 0)
+        return NULL;
+    node = &s->nodes[s->nnodes++];
+    node->type = kind;
+    node->hint = 0;
+    node->item = NULL;
+    node->first = s->nkeys;
+    node->count = 0;
+
+    if (kind == SCHEMA_ARRAY) {
+        node->size = lua_objlen(l, t);
+        lua_rawgeti(l, t, 1);
+        if (lua_istable(l, -1))
+            node->item = json_schema_fill(l, s, lua_gettop(l), keys);
+        lua_pop(l, 1);
+        return node;
+    }
+
+    /* Reserve the keys of this object before those of nested ones */
+    lua_pushnil(l);
+    while (lua_next(l, t) != 0) {
+        if (lua_type(l, -2) == LUA_TSTRING)
+            node->count++;
+        lua_pop(l, 1);
+    }
+    node->size = node->count;
+    s->nkeys += node->count;
+
+    key = s->keys + node->first;
+    lua_pushnil(l);
+    while (lua_next(l, t) != 0) {
+        if (lua_type(l, -2) == LUA_TSTRING) {
+            key->str = lua_tolstring(l, -2, &key->len);
+            key->ref = key - s->keys + 1;
+            key->stamp = 0;
+            key->node = NULL;
+            lua_pushvalue(l, -2);
+            lua_rawseti(l, keys, key->ref);
+            if (lua_istable(l, -1))
+                key->node = json_schema_fill(l, s, lua_gettop(l), keys);
+            key++;
+        }
+        lua_pop(l, 1);
+    }
+    return node;
+}
+
+// Lua: schema = cjson.compile(template)
+static int json_schema_compile(lua_State *l)
+{
+    json_schema_t *s;
+    int nnodes = 0, nkeys = 0;
+
+    luaL_argcheck(l, lua_gettop(l) == 1, 1, "expected 1 argument");
+    if (lua_type(l, 1) == LUA_TSTRING) {
+        /* A JSON example of the documents */
+        json_decode_document(l, 1, NULL, 0, 0);
+        lua_replace(l, 1);
+    }
+    luaL_checktype(l, 1, LUA_TTABLE);
+
+    json_schema_count(l, 1, 1, &nnodes, &nkeys);
+
+    /* Nodes and keys live in the userdata, the key strings in its
+     * environment table */
+    s = (json_schema_t *)lua_newuserdata(l, sizeof(json_schema_t) +
+        nnodes * sizeof(json_schema_node_t) + nkeys * sizeof(json_schema_key_t));
+    s->nodes = (json_schema_node_t *)(s + 1);
+    s->keys = (json_schema_key_t *)(s->nodes + nnodes);
+    s->nnodes = 0;
+    s->nkeys = 0;
+    s->stamp = 0;
+    luaL_getmetatable(l, METATABLE_SCHEMA);
+    lua_setmetatable(l, -2);
+
+    lua_createtable(l, nkeys, 0);
+    json_schema_fill(l, s, 1, lua_gettop(l));
+    lua_setfenv(l, -2);
+
+    return 1;
+}
+
+// Lua: value = schema:decode(text[, target])
+static int json_schema_decode(lua_State *l)
+{
+    json_schema_t *s = (json_schema_t *)luaL_checkudata(l, 1, METATABLE_SCHEMA);
+
+    luaL_checkstring(l, 2);
+    if (!lua_isnoneornil(l, 3))
+        luaL_checktype(l, 3, LUA_TTABLE);
+    lua_settop(l, 3);
+    lua_getfenv(l, 1);
+
+    json_decode_document(l, 2, s, 4, lua_istable(l, 3) ? 3 : 0);
     return 1;
 }
 
+static const LUA_REG_TYPE json_schema_map[] = {
+  { LSTRKEY( "decode" ),  LFUNCVAL( json_schema_decode ) },
+  { LSTRKEY( "__index" ), LROVAL( json_schema_map ) },
+  { LNILKEY, LNILVAL }
+};
+
+/* ===== STREAMING DECODER ===== */
+
+/* cjson.decoder() accepts a document in arbitrary pieces. Complete tokens are
+ * handed to json_next_token() straight from the chunk; only a token cut off
+ * at the end of a chunk is copied and kept for the next write. Instead of a
+ * table tree the decoder reports (path, value) pairs to a Lua callback, or
+ * builds just the subtrees matching a list of path patterns. */
+
+#define METATABLE_DECODER "cjson.decoder"
+
+typedef enum {
+    S_VALUE,            /* value expected */
+    S_VALUE_OR_END,     /* after '[' */
+    S_KEY,              /* after ',' in an object */
+    S_KEY_OR_END,       /* after '{' */
+    S_COLON,
+    S_COMMA_OR_END,
+    S_DONE              /* top level value complete */
+} json_stream_state_t;
+
+/* What was expected when the input ends early, indexed by state */
+static const char *json_stream_expected[] = {
+    "value", "value", "object key string", "object key string", "colon",
+    NULL, "the end"
+};
+
+#define MATCH_NONE      0
+#define MATCH_EXACT     1
+#define MATCH_PREFIX    2   /* a descendant may match */
+
+typedef struct {
+    int is_object;
+    int index;          /* array element being parsed, 1 based */
+    int path_len;       /* length of the path of this container */
+} json_stream_frame_t;
+
+typedef struct {
+    strbuf_t buf;       /* unconsumed input, at most one partial token */
+    strbuf_t tmp;       /* temporary storage for strings */
+    strbuf_t path;      /* path of the current value, e.g. "list.2.name" */
+    json_stream_frame_t *frames;
+    int depth;
+    int frames_size;
+    int state;
+    int busy;           /* inside write(), or an earlier write() failed */
+    int build;          /* frame of the selected subtree being built, or -1 */
+    int skip;           /* frame of a subtree no pattern can match, or -1 */
+    int build_slots;    /* partial subtree values parked in build_ref */
+    int cb_ref;
+    int build_ref;
+    char *select;       /* NUL separated patterns, ends with an empty one */
+    int offset;         /* input consumed before buf */
+} json_stream_t;
+
+/* Length of the token at p if no further input can change it, 0 if it may
+ * continue in the next chunk. p points at a non-whitespace character. */
+static int json_stream_token_len(const char *p, const char *end, int final)
+{
+    const char *q = p + 1;
+
+    if (*p == '"') {
+        while (q < end) {
+            if (*q == '\\')
+                q += 2;
+            else if (*q++ == '"')
+                return q - p;
+        }
+        return final ? end - p : 0;
+    }
+
+    /* Single character tokens, including invalid ones */
+    if (ch2token((unsigned char)*p) != T_UNKNOWN)
+        return 1;
+
+    /* Numbers and literals run up to whitespace or a structural character */
+    while (q < end) {
+        json_token_type_t t = ch2token((unsigned char)*q);
+        if (t != T_UNKNOWN && t != T_ERROR)
+            break;
+        q++;
+    }
+    if (q == end && !final)
+        return 0;
+    return q - p;
+}
+
+/* Compare a dotted path against a pattern, "*" matches any one segment */
+static int json_stream_match(const char *path, int len, const char *pat)
+{
+    const char *end = path + len;
+    const char *seg;
+    int n;
+
+    if (len == 0)
+        return *pat ? MATCH_PREFIX : MATCH_EXACT;
+
+    while (1) {
+        for (seg = path; path < end && *path != '.'; path++)
+            ;
+        n = path - seg;
+        if (pat[0] == '*' && (pat[1] == '.' || pat[1] == 0))
+            pat++;
+        else if (c_strncmp(pat, seg, n) == 0 && (pat[n] == '.' || pat[n] == 0))
+            pat += n;
+        else
+            return MATCH_NONE;
+
+        if (path == end)
+            return *pat ? MATCH_PREFIX : MATCH_EXACT;
+        if (*pat == 0)
+            return MATCH_NONE;
+        path++;
+        pat++;
+    }
+}
+
+static int json_stream_select(json_stream_t *s)
+{
+    const char *pat;
+    int m, best = MATCH_NONE;
+
+    for (pat = s->select; *pat; pat += c_strlen(pat) + 1) {
+        m = json_stream_match(s->path.buf, s->path.length, pat);
+        if (m == MATCH_EXACT)
+            return m;
+        if (m == MATCH_PREFIX)
+            best = m;
+    }
+    return best;
+}
+
+/* Replace the last path segment with the key or index of the current value */
+static void json_stream_set_segment(json_stream_t *s, const char *seg, int len)
+{
+    json_stream_frame_t *f = &s->frames[s->depth - 1];
+
+    s->path.length = f->path_len;
+    if (f->path_len)
+        strbuf_append_char(&s->path, '.');
+    strbuf_append_mem(&s->path, seg, len);
+}
+
+/* Pass the value on top of the stack to the callback and pop it */
+static void json_stream_emit(lua_State *l, json_stream_t *s)
+{
+    lua_rawgeti(l, LUA_REGISTRYINDEX, s->cb_ref);
+    lua_pushlstring(l, s->path.buf, s->path.length);
+    lua_pushvalue(l, -3);
+    lua_call(l, 2, 0);
+    lua_pop(l, 1);
+}
+
+/* Store the value on top of the stack in the subtree being built */
+static void json_stream_attach(lua_State *l, json_stream_t *s)
+{
+    json_stream_frame_t *f = &s->frames[s->depth - 1];
+
+    if (f->is_object)
+        lua_rawset(l, -3);
+    else
+        lua_rawseti(l, -2, f->index);
+}
+
+static void json_stream_push(lua_State *l, json_stream_t *s, json_parse_t *json,
+                             int is_object)
+{
+    json_stream_frame_t *f;
+
+    if (s->depth >= json->cfg->decode_max_depth ||
+        (s->build >= 0 && !lua_checkstack(l, 3)))
+        luaL_error(l, "Found too many nested data structures (%d) at character %d",
+                   s->depth + 1, s->offset + (json->ptr - json->data));
+
+    if (s->depth == s->frames_size) {
+        int size = s->frames_size ? s->frames_size * 2 : 8;
+        f = (json_stream_frame_t *)c_realloc(s->frames, size * sizeof(*f));
+        if (!f)
+            luaL_error(l, "not enough memory");
+        s->frames = f;
+        s->frames_size = size;
+    }
+
+    f = &s->frames[s->depth++];
+    f->is_object = is_object;
+    f->index = 0;
+    f->path_len = s->path.length;
+    s->state = is_object ? S_KEY_OR_END : S_VALUE_OR_END;
+}
+
+static void json_stream_value_done(json_stream_t *s)
+{
+    s->state = s->depth ? S_COMMA_OR_END : S_DONE;
+}
+
+static void json_stream_pop(lua_State *l, json_stream_t *s)
+{
+    int idx = --s->depth;
+
+    s->path.length = s->frames[idx].path_len;
+    if (s->build == idx) {
+        s->build = -1;
+        json_stream_emit(l, s);
+    } else if (s->build >= 0) {
+        json_stream_attach(l, s);
+    }
+    if (s->skip == idx)
+        s->skip = -1;
+    json_stream_value_done(s);
+}
+
+static void json_stream_value(lua_State *l, json_stream_t *s, json_parse_t *json,
+                              json_token_t *token)
+{
+    int track = s->build < 0 && s->skip < 0;
+    int m = MATCH_NONE;
+
+    if (s->depth && !s->frames[s->depth - 1].is_object) {
+        int index = ++s->frames[s->depth - 1].index;
+        if (track) {
+            char num[12];
+            json_stream_set_segment(s, num, c_sprintf(num, "%d", index));
+        }
+    }
+    if (track && s->select)
+        m = json_stream_select(s);
+
+    switch (token->type) {
+    case T_OBJ_BEGIN:
+    case T_ARR_BEGIN:
+        json_stream_push(l, s, json, token->type == T_OBJ_BEGIN);
+        if (s->build >= 0) {
+            lua_newtable(l);
+        } else if (track && s->select) {
+            if (m == MATCH_EXACT) {
+                s->build = s->depth - 1;
+                luaL_checkstack(l, 3, "too many nested data structures");
+                lua_newtable(l);
+            } else if (m == MATCH_NONE) {
+                s->skip = s->depth - 1;
+            }
+        }
+        break;
+    case T_STRING:
+    case T_NUMBER:
+    case T_BOOLEAN:
+    case T_NULL:
+        if (s->build >= 0) {
+            json_process_value(l, json, token, NULL, 0);
+            json_stream_attach(l, s);
+        } else if (track && (!s->select || m == MATCH_EXACT)) {
+            json_process_value(l, json, token, NULL, 0);
+            json_stream_emit(l, s);
+        }
+        json_stream_value_done(s);
+        break;
+    default:
+        json_throw_parse_error(l, json, "value", token);
+    }
+}
+
+static void json_stream_token(lua_State *l, json_stream_t *s, json_parse_t *json,
+                              json_token_t *token)
+{
+    json_stream_frame_t *f;
+
+    switch (s->state) {
+    case S_KEY_OR_END:
+        if (token->type == T_OBJ_END) {
+            json_stream_pop(l, s);
+            break;
+        }
+        /* fall through */
+    case S_KEY:
+        if (token->type != T_STRING)
+            json_throw_parse_error(l, json, "object key string", token);
+        if (s->build >= 0)
+            lua_pushlstring(l, token->value.string, token->string_len);
+        else if (s->skip < 0)
+            json_stream_set_segment(s, token->value.string, token->string_len);
+        s->state = S_COLON;
+        break;
+    case S_COLON:
+        if (token->type != T_COLON)
+            json_throw_parse_error(l, json, "colon", token);
+        s->state = S_VALUE;
+        break;
+    case S_COMMA_OR_END:
+        f = &s->frames[s->depth - 1];
+        if (token->type == (f->is_object ? T_OBJ_END : T_ARR_END)) {
+            json_stream_pop(l, s);
+            break;
+        }
+        if (token->type != T_COMMA)
+            json_throw_parse_error(l, json, f->is_object ?
+                "comma or object end" : "comma or array end", token);
+        s->state = f->is_object ? S_KEY : S_VALUE;
+        break;
+    case S_VALUE_OR_END:
+        if (token->type == T_ARR_END) {
+            json_stream_pop(l, s);
+            break;
+        }
+        /* fall through */
+    case S_VALUE:
+        json_stream_value(l, s, json, token);
+        break;
+    default:
+        json_throw_parse_error(l, json, "the end", token);
+    }
+}
+
+/* Parse as many complete tokens of data as possible and keep the rest */
+static void json_stream_feed(lua_State *l, json_stream_t *s,
+                             const char *data, size_t len, int final)
+{
+    json_parse_t json;
+    json_token_t token;
+    const char *end;
+    int toklen, from_buf = s->buf.length > 0;
+
+    if (from_buf) {
+        strbuf_append_mem(&s->buf, data, len);
+        if (!strbuf_allocated(&s->buf))
+            luaL_error(l, "not enough memory");
+        strbuf_ensure_null(&s->buf);
+        data = s->buf.buf;
+        len = s->buf.length;
+    }
+    end = data + len;
+
+    /* Detect Unicode other than UTF-8, see json_decode() */
+    if (s->offset == 0 && len >= 2 && (!data[0] || !data[1]))
+        luaL_error(l, "JSON parser does not support UTF-16 or UTF-32");
+
+    json.data = data;
+    json.ptr = data;
+    json.tmp = &s->tmp;
+    json.cfg = json_fetch_config(l);
+    json.current_depth = 0;
+
+    while (1) {
+        while (json.ptr < end && ch2token((unsigned char)*json.ptr) == T_WHITESPACE)
+            json.ptr++;
+        if (json.ptr == end)
+            break;
+        toklen = json_stream_token_len(json.ptr, end, final);
+        if (!toklen)
+            break;
+
+        /* Decoded strings are never longer than their JSON form */
+        if (*json.ptr == '"') {
+            strbuf_reset(&s->tmp);
+            if (toklen > strbuf_empty_length(&s->tmp) &&
+                strbuf_resize(&s->tmp, toklen) < 0)
+                luaL_error(l, "not enough memory");
+        }
+
+        json_next_token(&json, &token);
+        token.index += s->offset;
+        if (token.type == T_ERROR)
+            json_throw_parse_error(l, &json, "value", &token);
+        json_stream_token(l, s, &json, &token);
+    }
+
+    s->offset += json.ptr - json.data;
+    len = end - json.ptr;
+    if (from_buf) {
+        os_memmove(s->buf.buf, json.ptr, len);
+        s->buf.length = len;
+    } else if (len) {
+        strbuf_append_mem(&s->buf, json.ptr, len);
+        if (!strbuf_allocated(&s->buf))
+            luaL_error(l, "not enough memory");
+    }
+}
+
+static int json_stream_write_common(lua_State *l, int final)
+{
+    json_stream_t *s = (json_stream_t *)luaL_checkudata(l, 1, METATABLE_DECODER);
+    size_t len = 0;
+    const char *data = final ? luaL_optlstring(l, 2, "", &len)
+                             : luaL_checklstring(l, 2, &len);
+    int base;
+
+    if (s->busy)
+        return luaL_error(l, "decoder busy or failed");
+    if (final && s->state == S_DONE && len == 0 && s->buf.length == 0)
+        return 0;
+
+    lua_settop(l, 2);
+    base = lua_gettop(l);
+    s->busy = 1;
+    json_unpark(l, s->build_ref, s->build_slots);
+    json_stream_feed(l, s, data, len, final);
+
+    if (final && s->state != S_DONE) {
+        const char *exp = json_stream_expected[s->state];
+        json_parse_t json;
+        json_token_t token;
+
+        if (s->state == S_COMMA_OR_END)
+            exp = s->frames[s->depth - 1].is_object ?
+                "comma or object end" : "comma or array end";
+        json.tmp = &s->tmp;
+        token.type = T_END;
+        token.index = s->offset;
+        json_throw_parse_error(l, &json, exp, &token);
+    }
+
+    json_park(l, &s->build_ref, &s->build_slots, base);
+    s->busy = 0;
+    return 0;
+}
+
+// Lua: decoder:write(chunk)
+static int json_stream_write(lua_State *l)
+{
+    return json_stream_write_common(l, 0);
+}
+
+// Lua: decoder:finish([chunk])
+static int json_stream_finish(lua_State *l)
+{
+    return json_stream_write_common(l, 1);
+}
+
+static int json_stream_gc(lua_State *l)
+{
+    json_stream_t *s = (json_stream_t *)luaL_checkudata(l, 1, METATABLE_DECODER);
+
+    strbuf_free(&s->buf);
+    strbuf_free(&s->tmp);
+    strbuf_free(&s->path);
+    if (s->frames) {
+        c_free(s->frames);
+        s->frames = NULL;
+    }
+    if (s->select) {
+        c_free(s->select);
+        s->select = NULL;
+    }
+    luaL_unref(l, LUA_REGISTRYINDEX, s->cb_ref);
+    luaL_unref(l, LUA_REGISTRYINDEX, s->build_ref);
+    s->cb_ref = s->build_ref = LUA_NOREF;
+    return 0;
+}
+
+/* Copy the selector string(s) at index idx into a NUL separated list */
+static char *json_stream_patterns(lua_State *l, int idx)
+{
+    size_t total = 1, len;
+    char *list, *p;
+    int i, n = 1;
+
+    if (lua_type(l, idx) == LUA_TTABLE) {
+        n = lua_objlen(l, idx);
+        for (i = 1; i <= n; i++) {
+            lua_rawgeti(l, idx, i);
+            if (lua_type(l, -1) != LUA_TSTRING)
+                luaL_argerror(l, idx, "expected table of strings");
+            total += lua_objlen(l, -1) + 1;
+            lua_pop(l, 1);
+        }
+    } else {
+        luaL_checklstring(l, idx, &len);
+        total += len + 1;
+    }
+
+    p = list = (char *)c_malloc(total);
+    if (!list)
+        luaL_error(l, "not enough memory");
+    for (i = 1; i <= n; i++) {
+        const char *pat;
+        if (lua_type(l, idx) == LUA_TTABLE) {
+            lua_rawgeti(l, idx, i);
+            pat = lua_tolstring(l, -1, &len);
+            lua_pop(l, 1);  /* still referenced by the table */
+        } else {
+            pat = lua_tolstring(l, idx, &len);
+        }
+        c_memcpy(p, pat, len);
+        p[len] = 0;
+        p += len + 1;
+    }
+    *p = 0;
+    return list;
+}
+
+// Lua: cjson.decoder(function(path, value) end[, select])
+static int json_stream_new(lua_State *l)
+{
+    json_stream_t *s;
+
+    luaL_checkanyfunction(l, 1);
+    lua_settop(l, 2);
+
+    s = (json_stream_t *)lua_newuserdata(l, sizeof(json_stream_t));
+    c_memset(s, 0, sizeof(json_stream_t));
+    s->build = s->skip = -1;
+    s->cb_ref = s->build_ref = LUA_NOREF;
+    s->state = S_VALUE;
+    luaL_getmetatable(l, METATABLE_DECODER);
+    lua_setmetatable(l, -2);
+
+    if (!lua_isnil(l, 2))
+        s->select = json_stream_patterns(l, 2);
+
+    if (strbuf_init(&s->buf, 63) < 0 || strbuf_init(&s->tmp, 63) < 0 ||
+        strbuf_init(&s->path, 63) < 0)
+        return luaL_error(l, "not enough memory");
+
+    lua_pushvalue(l, 1);
+    s->cb_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+    return 1;
+}
+
+static const LUA_REG_TYPE json_stream_map[] = {
+  { LSTRKEY( "write" ),   LFUNCVAL( json_stream_write ) },
+  { LSTRKEY( "finish" ),  LFUNCVAL( json_stream_finish ) },
+  { LSTRKEY( "__gc" ),    LFUNCVAL( json_stream_gc ) },
+  { LSTRKEY( "__index" ), LROVAL( json_stream_map ) },
+  { LNILKEY, LNILVAL }
+};
+
 /* ===== INITIALISATION ===== */
 #if 0
 #if !defined(LUA_VERSION_NUM) || LUA_VERSION_NUM < 502
@@ -1603,7 +2892,10 @@ int luaopen_cjson_safe(lua_State *l)
 // Module function map
 static const LUA_REG_TYPE cjson_map[] = {
   { LSTRKEY( "encode" ),                  LFUNCVAL( json_encode ) },
+  { LSTRKEY( "encoder" ),                 LFUNCVAL( json_encoder_create ) },
   { LSTRKEY( "decode" ),                  LFUNCVAL( json_decode ) },
+  { LSTRKEY( "decoder" ),                 LFUNCVAL( json_stream_new ) },
+  { LSTRKEY( "compile" ),                 LFUNCVAL( json_schema_compile ) },
 //{ LSTRKEY( "encode_sparse_array" ),     LFUNCVAL( json_cfg_encode_sparse_array ) },
 //{ LSTRKEY( "encode_max_depth" ),        LFUNCVAL( json_cfg_encode_max_depth ) },
 //{ LSTRKEY( "decode_max_depth" ),        LFUNCVAL( json_cfg_decode_max_depth ) },
@@ -1622,6 +2914,9 @@ int luaopen_cjson( lua_State *L )
   if(-1==cfg_init(&_cfg)){
     return luaL_error(L, "BUG: Unable to init config for cjson");;
   }
+  luaL_rometatable(L, METATABLE_ENCODER, (void *)json_encoder_map);
+  luaL_rometatable(L, METATABLE_DECODER, (void *)json_stream_map);
+  luaL_rometatable(L, METATABLE_SCHEMA, (void *)json_schema_map);
   return 0;
 }
 
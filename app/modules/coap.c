@@ -19,8 +19,14 @@
 #include "coap_timer.h"
 #include "coap_io.h"
 #include "coap_server.h"
+#include "observe.h"
+#include "block.h"
+#include "dedup.h"
 
-coap_queue_t *gQueue = NULL;
+coap_wheel_t gQueue;     // retransmission queue, shared by server and clients
+
+extern coap_luser_entry *variable_entry;
+extern coap_luser_entry *function_entry;
 
 typedef struct lcoap_userdata
 {
@@ -44,8 +50,6 @@ static void coap_received(void *arg, char *pdata, unsigned short len)
   }
   // c_memcpy(buf, pdata, len);
 
-  size_t rsplen = coap_server_respond(pdata, len, buf, MAX_MESSAGE_SIZE+1);
-
   // SDK 1.4.0 changed behaviour, for UDP server need to look up remote ip/port
   remot_info *pr = 0;
   if (espconn_get_connection_info (pesp_conn, &pr, 0) != ESPCONN_OK)
@@ -54,7 +58,12 @@ static void coap_received(void *arg, char *pdata, unsigned short len)
   os_memmove (pesp_conn->proto.udp->remote_ip, pr->remote_ip, 4);
   // The remot_info apparently should *not* be os_free()d, fyi
 
-  espconn_sent(pesp_conn, (unsigned char *)buf, rsplen);
+  uint32_t ip = 0;
+  c_memcpy(&ip, pr->remote_ip, sizeof(ip));
+  size_t rsplen = coap_server_respond(pdata, len, buf, MAX_MESSAGE_SIZE+1, ip, pr->remote_port);
+
+  if (rsplen > 0)   // nothing to send for ACK/RST or a bad packet
+    espconn_sent(pesp_conn, (unsigned char *)buf, rsplen);
 
   // c_memset(buf, 0, sizeof(buf));
 }
@@ -277,12 +286,7 @@ static void coap_response_handler(void *arg, char *pdata, unsigned short len)
     coap_transaction_id(ip, port, &pkt, &id);
 
     /* transaction done, remove the node from queue */
-    // stop timer
-    coap_timer_stop();
-    // remove the node
     coap_remove_node(&gQueue, id);
-    // calculate time elapsed
-    coap_timer_update(&gQueue);
     coap_timer_start(&gQueue);
 
     if (COAP_RESPONSE_CLASS(pkt.hdr.code) == 2)
@@ -299,7 +303,7 @@ static void coap_response_handler(void *arg, char *pdata, unsigned short len)
   }
 
 end:
-  if(!gQueue){ // if there is no node pending in the queue, disconnect from host.
+  if(!gQueue.count){ // if there is no node pending in the queue, disconnect from host.
     if(pesp_conn->proto.udp->remote_port || pesp_conn->proto.udp->local_port)
       espconn_delete(pesp_conn);
   }
@@ -428,8 +432,6 @@ static int coap_request( lua_State* L, coap_method_t m )
   return 0;  
 }
 
-extern coap_luser_entry *variable_entry;
-extern coap_luser_entry *function_entry;
 // Lua: coap:var/func( string )
 static int coap_regist( lua_State* L, const char* mt, int isvar )
 {
@@ -479,6 +481,9 @@ static int coap_createServer( lua_State* L )
 static int coap_server_delete( lua_State* L )
 {
   const char *mt = "coap_server";
+  coap_observe_clear();
+  coap_block1_clear();
+  coap_dedup_clear();
   return coap_delete(L, mt);
 }
 
@@ -493,6 +498,9 @@ static int coap_server_listen( lua_State* L )
 static int coap_server_close( lua_State* L )
 {
   const char *mt = "coap_server";
+  coap_observe_clear();
+  coap_block1_clear();
+  coap_dedup_clear();
   return coap_close(L, mt);
 }
 
@@ -517,6 +525,30 @@ static int coap_server_func( lua_State* L )
   return coap_regist(L, mt, 0);
 }
 
+// Lua: n = server:notify( "name" )
+static int coap_server_notify( lua_State* L )
+{
+  lcoap_userdata *cud;
+  size_t l;
+  coap_luser_entry *h;
+
+  cud = (lcoap_userdata *)luaL_checkudata(L, 1, "coap_server");
+  luaL_argcheck(L, cud, 1, "Server expected");
+  const char *name = luaL_checklstring( L, 2, &l );
+
+  for(h = variable_entry->next; h != NULL; h = h->next){   // ->next: skip the head
+    if(h->name != NULL && c_strcmp(h->name, name) == 0)
+      break;
+  }
+  if(h == NULL)
+    return luaL_error( L, "not a registered variable" );
+  if(cud->pesp_conn == NULL || LUA_NOREF == cud->self_ref)
+    return luaL_error( L, "not listening" );
+
+  lua_pushinteger(L, coap_observe_notify(cud->pesp_conn, h));
+  return 1;
+}
+
 // Lua: s = coap.createClient(function(conn))
 static int coap_createClient( lua_State* L )
 {
@@ -561,6 +593,7 @@ static const LUA_REG_TYPE coap_server_map[] = {
   { LSTRKEY( "close" ),   LFUNCVAL( coap_server_close ) },
   { LSTRKEY( "var" ),     LFUNCVAL( coap_server_var ) },
   { LSTRKEY( "func" ),    LFUNCVAL( coap_server_func ) },
+  { LSTRKEY( "notify" ),  LFUNCVAL( coap_server_notify ) },
   { LSTRKEY( "__gc" ),    LFUNCVAL( coap_server_delete ) },
   { LSTRKEY( "__index" ), LROVAL( coap_server_map ) },
   { LNILKEY, LNILVAL }
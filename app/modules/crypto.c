@@ -7,20 +7,16 @@
 #include "c_types.h"
 #include "c_stdlib.h"
 #include "vfs.h"
+#include "file.h"
 #include "../crypto/digests.h"
 #include "../crypto/mech.h"
+#include "../crypto/codec.h"
 #include "lmem.h"
 
 #include "user_interface.h"
 
 #include "rom.h"
 
-typedef struct {
-  const digest_mech_info_t *mech_info;
-  void *ctx;
-  uint8_t *k_opad;
-} digest_user_datum_t;
-
 /**
   * hash = crypto.sha1(input)
   *
@@ -32,7 +28,7 @@ static int crypto_sha1( lua_State* L )
   SHA1_CTX ctx;
   uint8_t digest[20];
   // Read the string from lua (with length)
-  int len;
+  size_t len;
   const char* msg = luaL_checklstring(L, 1, &len);
   // Use the SHA* functions in the rom
   SHA1Init(&ctx);
@@ -44,30 +40,6 @@ static int crypto_sha1( lua_State* L )
   return 1;
 }
 
-#ifdef LUA_USE_MODULES_ENCODER
-static int call_encoder( lua_State* L, const char *function ) {
-  if (lua_gettop(L) != 1) { 
-    luaL_error(L, "%s must have one argument", function);
-  }
-  lua_getfield(L, LUA_GLOBALSINDEX, "encoder");
-  if (!lua_istable(L, -1) && !lua_isrotable(L, -1)) { // also need table just in case encoder has been overloaded
-    luaL_error(L, "Cannot find encoder.%s", function); 
-  }
-  lua_getfield(L, -1, function);
-  lua_insert(L, 1);    //move function below the argument
-  lua_pop(L, 1);       //and dump the encoder rotable from stack.
-  lua_call(L,1,1);     // call encoder.xxx(string)
-  return 1;
-}
-
-static int crypto_base64_encode (lua_State* L) { 
-  return call_encoder(L, "toBase64"); 
-}
-static int crypto_hex_encode (lua_State* L) { 
-  return call_encoder(L, "toHex"); 
-}
-#else
-static const char* bytes64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 /**
   * encoded = crypto.toBase64(raw)
   *
@@ -75,21 +47,12 @@ static const char* bytes64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwx
   */
 static int crypto_base64_encode( lua_State* L )
 {
-  int len;
+  size_t len;
   const char* msg = luaL_checklstring(L, 1, &len);
-  int blen = (len + 2) / 3 * 4;
-  char* out = (char*)c_malloc(blen);
-  int j = 0, i;
-  for (i = 0; i < len; i += 3) {
-    int a = msg[i];
-    int b = (i + 1 < len) ? msg[i + 1] : 0;
-    int c = (i + 2 < len) ? msg[i + 2] : 0;
-    out[j++] = bytes64[a >> 2];
-    out[j++] = bytes64[((a & 3) << 4) | (b >> 4)];
-    out[j++] = (i + 1 < len) ? bytes64[((b & 15) << 2) | (c >> 6)] : 61;
-    out[j++] = (i + 2 < len) ? bytes64[(c & 63)] : 61;
-  }
-  lua_pushlstring(L, out, j);
+  char* out = (char*)c_malloc(CODEC_BASE64_LEN(len) + 1);
+  if (!out)
+    return luaL_error(L, "insufficient memory");
+  lua_pushlstring(L, out, codec_base64_encode(msg, len, out));
   c_free(out);
   return 1;
 }
@@ -101,19 +64,15 @@ static int crypto_base64_encode( lua_State* L )
   */
 static int crypto_hex_encode( lua_State* L)
 {
-  int len;
+  size_t len;
   const char* msg = luaL_checklstring(L, 1, &len);
-  char* out = (char*)c_malloc(len * 2);
-  int i, j = 0;
-  for (i = 0; i < len; i++) {
-    out[j++] = crypto_hexbytes[msg[i] >> 4];
-    out[j++] = crypto_hexbytes[msg[i] & 0xf];
-  }
-  lua_pushlstring(L, out, len*2);
+  char* out = (char*)c_malloc(len * 2 + 1);
+  if (!out)
+    return luaL_error(L, "insufficient memory");
+  lua_pushlstring(L, out, codec_hex_encode(msg, len, out));
   c_free(out);
   return 1;
 }
-#endif
 /**
   * masked = crypto.mask(message, mask)
   *
@@ -121,7 +80,7 @@ static int crypto_hex_encode( lua_State* L)
   */
 static int crypto_mask( lua_State* L )
 {
-  int len, mask_len;
+  size_t len, mask_len;
   const char* msg = luaL_checklstring(L, 1, &len);
   const char* mask = luaL_checklstring(L, 2, &mask_len);
   int i;
@@ -137,6 +96,7 @@ static int crypto_mask( lua_State* L )
 static inline int bad_mech (lua_State *L) { return luaL_error (L, "unknown hash mech"); }
 static inline int bad_mem  (lua_State *L) { return luaL_error (L, "insufficient memory"); }
 static inline int bad_file (lua_State *L) { return luaL_error (L, "file does not exist"); }
+static inline int bad_read (lua_State *L) { return luaL_error (L, "file read error"); }
 
 /* rawdigest = crypto.hash("MD5", str)
  * strdigest = crypto.toHex(rawdigest)
@@ -190,7 +150,7 @@ static int crypto_new_hash_hmac (lua_State *L, int what)
 
   // create a userdataum with specific metatable
   digest_user_datum_t *dudat = (digest_user_datum_t *)lua_newuserdata(L, sizeof(digest_user_datum_t));
-  luaL_getmetatable(L, "crypto.hash");
+  luaL_getmetatable(L, CRYPTO_HASH_METATABLE);
   lua_setmetatable(L, -2);
 
   // Set pointers to the mechanics and CTX
@@ -223,7 +183,7 @@ static int crypto_hash_update (lua_State *L)
   digest_user_datum_t *dudat;
   size_t sl;
 
-  dudat = (digest_user_datum_t *)luaL_checkudata(L, 1, "crypto.hash");
+  dudat = (digest_user_datum_t *)luaL_checkudata(L, 1, CRYPTO_HASH_METATABLE);
 
   const digest_mech_info_t *mi = dudat->mech_info;
 
@@ -242,7 +202,7 @@ static int crypto_hash_finalize (lua_State *L)
   digest_user_datum_t *dudat;
   size_t sl;
 
-  dudat = (digest_user_datum_t *)luaL_checkudata(L, 1, "crypto.hash");
+  dudat = (digest_user_datum_t *)luaL_checkudata(L, 1, CRYPTO_HASH_METATABLE);
 
   const digest_mech_info_t *mi = dudat->mech_info;
 
@@ -262,7 +222,7 @@ static int crypto_hash_gcdelete (lua_State *L)
   NODE_DBG("enter crypto_hash_delete.\n");
   digest_user_datum_t *dudat;
 
-  dudat = (digest_user_datum_t *)luaL_checkudata(L, 1, "crypto.hash");
+  dudat = (digest_user_datum_t *)luaL_checkudata(L, 1, CRYPTO_HASH_METATABLE);
 
   // luaM_free() uses type info to obtain original size, so have to delve
   // one level deeper and explicitly pass the size due to void*
@@ -278,6 +238,51 @@ static sint32_t vfs_read_wrap (int fd, void *ptr, size_t len)
   return vfs_read (fd, ptr, len);
 }
 
+/* Called as object, params:
+   1 - userdata "this"
+   2 - file object or file name
+   3 - optional offset to start at, default the current position of a
+       file object or the start of a named file
+   4 - optional number of bytes, default up to the end of the file
+   Returns the number of bytes hashed. The file is read through a buffer
+   on the C stack, none of it passes through Lua strings. */
+static int crypto_hash_update_file (lua_State *L)
+{
+  digest_user_datum_t *dudat;
+  int fd, opened = 0;
+  sint32_t done = -1;
+
+  dudat = (digest_user_datum_t *)luaL_checkudata(L, 1, CRYPTO_HASH_METATABLE);
+  int seek = !lua_isnoneornil (L, 3);
+  sint32_t offset = luaL_optinteger (L, 3, 0);
+  sint32_t len = luaL_optinteger (L, 4, -1);
+  luaL_argcheck (L, offset >= 0, 3, "out of range");
+  luaL_argcheck (L, len >= -1, 4, "out of range");
+
+  if (lua_type (L, 2) == LUA_TSTRING)
+  {
+    fd = vfs_open (lua_tostring (L, 2), "r");
+    if (!fd)
+      return bad_file (L);
+    opened = 1;
+  }
+  else
+  {
+    fd = file_getfd (L, 2);
+  }
+
+  if (!seek || vfs_lseek (fd, offset, VFS_SEEK_SET) >= 0)
+    done = crypto_hash_read (dudat->mech_info, dudat->ctx, &vfs_read_wrap, fd, len);
+
+  if (opened)
+    vfs_close (fd);
+  if (done < 0)
+    return bad_read (L);
+
+  lua_pushinteger (L, done);
+  return 1;
+}
+
 /* rawdigest = crypto.hash("MD5", filename)
  * strdigest = crypto.toHex(rawdigest)
  */
@@ -305,6 +310,8 @@ static int crypto_flhash (lua_State *L)
     return bad_mem (L);
   else if (returncode == EINVAL)
     return bad_mech(L);
+  else if (returncode == EIO)
+    return bad_read(L);
   else
     lua_pushlstring (L, digest, sizeof (digest));
 
@@ -396,15 +403,207 @@ static int lcrypto_decrypt (lua_State *L)
   return crypto_encdec (L, false);
 }
 
+
+#define CRYPTO_CIPHER_METATABLE "crypto.cipher"
+
+/* Input is processed in pieces of this size through buffers on the stack */
+#define CIPHER_CHUNK 256
+
+static inline int bad_write (lua_State *L) { return luaL_error (L, "file write error"); }
+
+/* cipher = crypto.new_cipher("AES-CBC", "encrypt", key [, iv [, padding]]) */
+static int crypto_new_cipher (lua_State *L)
+{
+  static const char *const ops[] = { "encrypt", "decrypt", NULL };
+  static const char *const pads[] = { "pkcs7", "zero", "none", NULL };
+
+  const char *name = luaL_checkstring (L, 1);
+  int op = luaL_checkoption (L, 2, NULL, ops);
+  size_t klen;
+  const char *key = luaL_checklstring (L, 3, &klen);
+  size_t ivlen;
+  const char *iv = luaL_optlstring (L, 4, "", &ivlen);
+  int padding = luaL_checkoption (L, 5, "pkcs7", pads);
+  luaL_argcheck (L, klen == 16, 3, "must be 16 bytes");
+
+  crypto_cipher_t *c = (crypto_cipher_t *)lua_newuserdata (L, sizeof (crypto_cipher_t));
+  c->ctx = 0;
+  luaL_getmetatable (L, CRYPTO_CIPHER_METATABLE);
+  lua_setmetatable (L, -2);
+
+  int err = crypto_cipher_init (c, name, op == 0 ? OP_ENCRYPT : OP_DECRYPT,
+    key, klen, iv, ivlen, padding);
+  if (err == ENOMEM)
+    return bad_mem (L);
+  if (err)
+    return luaL_error (L, "unknown cipher: %s", name);
+  return 1;
+}
+
+static crypto_cipher_t *check_cipher (lua_State *L)
+{
+  crypto_cipher_t *c = (crypto_cipher_t *)luaL_checkudata (L, 1, CRYPTO_CIPHER_METATABLE);
+  if (!c->ctx)
+    luaL_error (L, "cipher finalized");
+  return c;
+}
+
+/* The output goes either to the file object at index idx, or when there is
+   none into a Lua string */
+typedef struct {
+  int fd;
+  sint32_t written;
+  luaL_Buffer b;
+} cipher_out_t;
+
+static void cipher_out_init (lua_State *L, cipher_out_t *out, int idx)
+{
+  out->written = 0;
+  if (lua_isnoneornil (L, idx))
+  {
+    out->fd = 0;
+    luaL_buffinit (L, &out->b);
+  }
+  else
+  {
+    out->fd = file_getfd (L, idx);
+  }
+}
+
+static bool cipher_out_add (cipher_out_t *out, const char *data, size_t len)
+{
+  if (!out->fd)
+    luaL_addlstring (&out->b, data, len);
+  else if (len && vfs_write (out->fd, data, len) != len)
+    return false;
+  out->written += len;
+  return true;
+}
+
+static int cipher_out_result (lua_State *L, cipher_out_t *out)
+{
+  if (out->fd)
+    lua_pushinteger (L, out->written);
+  else
+    luaL_pushresult (&out->b);
+  return 1;
+}
+
+/* Called as object, params:
+   1 - userdata "this"
+   2 - the next piece of data
+   3 - optional file object to write the output to
+   Returns the output so far, or the number of bytes written to the file. */
+static int crypto_cipher_update_l (lua_State *L)
+{
+  crypto_cipher_t *c = check_cipher (L);
+  size_t len;
+  const char *data = luaL_checklstring (L, 2, &len);
+  char buf[CIPHER_CHUNK + CRYPTO_CIPHER_BLOCK];
+  cipher_out_t out;
+
+  cipher_out_init (L, &out, 3);
+  while (len)
+  {
+    size_t n = len < CIPHER_CHUNK ? len : CIPHER_CHUNK;
+    if (!cipher_out_add (&out, buf, crypto_cipher_update (c, data, n, buf)))
+      return bad_write (L);
+    data += n;
+    len -= n;
+  }
+  return cipher_out_result (L, &out);
+}
+
+/* Called as object, params:
+   1 - userdata "this"
+   2 - file object to read from, from its current position
+   3 - optional file object to write the output to
+   4 - optional number of bytes to read, default up to the end of the file
+   Returns the output so far, or the number of bytes written to the file. */
+static int crypto_cipher_update_file (lua_State *L)
+{
+  crypto_cipher_t *c = check_cipher (L);
+  sint32_t len = luaL_optinteger (L, 4, -1);
+  luaL_argcheck (L, len >= -1, 4, "out of range");
+  char in[CIPHER_CHUNK];
+  char buf[CIPHER_CHUNK + CRYPTO_CIPHER_BLOCK];
+  cipher_out_t out;
+  int fd = file_getfd (L, 2), err = 0;
+
+  // The output buffer can raise, so the file is left to its owner to close
+  cipher_out_init (L, &out, 3);
+  while (len != 0)
+  {
+    sint32_t want = (len < 0 || len > CIPHER_CHUNK) ? CIPHER_CHUNK : len;
+    sint32_t n = vfs_read (fd, in, want);
+    if (n < 0)
+    {
+      err = 1;
+      break;
+    }
+    if (!cipher_out_add (&out, buf, crypto_cipher_update (c, in, n, buf)))
+    {
+      err = 2;
+      break;
+    }
+    if (len > 0)
+      len -= n;
+    if (n < want)
+      break;  // end of file
+  }
+
+  if (err)
+    return err == 1 ? bad_read (L) : bad_write (L);
+  return cipher_out_result (L, &out);
+}
+
+/* Called as object, params:
+   1 - userdata "this"
+   2 - optional file object to write the output to
+   Returns the rest of the output, or the number of bytes written to the
+   file. The cipher can not be used afterwards. */
+static int crypto_cipher_finalize_l (lua_State *L)
+{
+  crypto_cipher_t *c = check_cipher (L);
+  char buf[CRYPTO_CIPHER_BLOCK];
+  cipher_out_t out;
+
+  cipher_out_init (L, &out, 2);
+  int n = crypto_cipher_finalize (c, buf);
+  crypto_cipher_free (c);
+  if (n < 0)
+    return luaL_error (L, "bad padding or incomplete block");
+  if (!cipher_out_add (&out, buf, n))
+    return bad_write (L);
+  return cipher_out_result (L, &out);
+}
+
+static int crypto_cipher_gcdelete (lua_State *L)
+{
+  crypto_cipher_free ((crypto_cipher_t *)luaL_checkudata (L, 1, CRYPTO_CIPHER_METATABLE));
+  return 0;
+}
+
 // Hash function map
 static const LUA_REG_TYPE crypto_hash_map[] = {
   { LSTRKEY( "update" ),  LFUNCVAL( crypto_hash_update ) },
+  { LSTRKEY( "update_file" ), LFUNCVAL( crypto_hash_update_file ) },
   { LSTRKEY( "finalize" ),   LFUNCVAL( crypto_hash_finalize ) },
   { LSTRKEY( "__gc" ),    LFUNCVAL( crypto_hash_gcdelete ) },
   { LSTRKEY( "__index" ), LROVAL( crypto_hash_map ) },
   { LNILKEY, LNILVAL }
 };
 
+// Cipher function map
+static const LUA_REG_TYPE crypto_cipher_map[] = {
+  { LSTRKEY( "update" ),      LFUNCVAL( crypto_cipher_update_l ) },
+  { LSTRKEY( "update_file" ), LFUNCVAL( crypto_cipher_update_file ) },
+  { LSTRKEY( "finalize" ),    LFUNCVAL( crypto_cipher_finalize_l ) },
+  { LSTRKEY( "__gc" ),        LFUNCVAL( crypto_cipher_gcdelete ) },
+  { LSTRKEY( "__index" ),     LROVAL( crypto_cipher_map ) },
+  { LNILKEY, LNILVAL }
+};
+
 
 // Module function map
 static const LUA_REG_TYPE crypto_map[] = {
@@ -419,12 +618,14 @@ static const LUA_REG_TYPE crypto_map[] = {
   { LSTRKEY( "new_hmac"   ),   LFUNCVAL( crypto_new_hmac ) },
   { LSTRKEY( "encrypt" ),  LFUNCVAL( lcrypto_encrypt ) },
   { LSTRKEY( "decrypt" ),  LFUNCVAL( lcrypto_decrypt ) },
+  { LSTRKEY( "new_cipher" ), LFUNCVAL( crypto_new_cipher ) },
   { LNILKEY, LNILVAL }
 };
 
 int luaopen_crypto ( lua_State *L )
 {
-  luaL_rometatable(L, "crypto.hash", (void *)crypto_hash_map);  // create metatable for crypto.hash
+  luaL_rometatable(L, CRYPTO_HASH_METATABLE, (void *)crypto_hash_map);  // create metatable for crypto.hash
+  luaL_rometatable(L, CRYPTO_CIPHER_METATABLE, (void *)crypto_cipher_map);  // create metatable for crypto.cipher
   return 0;
 }
 
@@ -8,6 +8,7 @@
 #include "c_types.h"
 #include "vfs.h"
 #include "c_string.h"
+#include "file.h"
 
 #include <alloca.h>
 
@@ -233,6 +234,13 @@ static int get_file_obj( lua_State *L, int *argpos )
   }
 }
 
+int file_getfd( lua_State *L, int idx )
+{
+  file_fd_ud *ud = (file_fd_ud *)luaL_checkudata(L, idx, "file.obj");
+  luaL_argcheck(L, ud->fd, idx, "file is closed");
+  return ud->fd;
+}
+
 #define GET_FILE_OBJ int argpos; \
   int fd = get_file_obj( L, &argpos );
 
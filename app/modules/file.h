@@ -0,0 +1,10 @@
+#ifndef APP_MODULES_FILE_H_
+#define APP_MODULES_FILE_H_
+
+#include "lua.h"
+
+// The vfs descriptor of the file.open() object at idx, for other modules
+// to read or write it. Raises an error if it is not one or is closed.
+int file_getfd(lua_State *L, int idx);
+
+#endif /* APP_MODULES_FILE_H_ */
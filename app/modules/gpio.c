@@ -34,25 +34,31 @@ static int gpio_cb_ref[GPIO_PIN_NUM];
 // It also re-enables the pin interrupt, so that we get another callback queued
 static void gpio_intr_callback_task (task_param_t param, uint8 priority)
 {
-  unsigned pin = param >> 1;
-  unsigned level = param & 1;
+  // All pins that interrupted since the last run, each with a single callback
+  uint32_t bits = task_coalesce_take((task_coalesce_t *)param, NULL);
+  unsigned pin, level;
+  uint32_t when, count;
   UNUSED(priority);
 
-  NODE_DBG("pin:%d, level:%d \n", pin, level);
-  if(gpio_cb_ref[pin] != LUA_NOREF) {
-    // GPIO callbacks are run in L0 and inlcude the level as a parameter
+  for (pin = 0; bits; pin++, bits >>= 1) {
+    if (!(bits & 1))
+      continue;
+    count = platform_gpio_take_intr(pin, &level, &when);
+    NODE_DBG("pin:%d, level:%d, count:%d \n", pin, level, count);
+    if (count == 0 || gpio_cb_ref[pin] == LUA_NOREF)
+      continue;
+    // GPIO callbacks are run in L0 and include the level, the time of the
+    // last edge and the number of edges as parameters
     lua_State *L = lua_getstate();
     NODE_DBG("Calling: %08x\n", gpio_cb_ref[pin]);
-    //
-    if (!INTERRUPT_TYPE_IS_LEVEL(pin_int_type[pin])) {
-      // Edge triggered -- re-enable the interrupt
-      platform_gpio_intr_init(pin, pin_int_type[pin]);
-    }
 
     // Do the actual callback
     lua_rawgeti(L, LUA_REGISTRYINDEX, gpio_cb_ref[pin]);
     lua_pushinteger(L, level);
-    lua_call(L, 1, 0);
+    // Masked as tmr.now() is, so the two compare and stay positive
+    lua_pushinteger(L, 0x7FFFFFFF & when);
+    lua_pushinteger(L, count);
+    lua_call(L, 3, 0);
 
     if (INTERRUPT_TYPE_IS_LEVEL(pin_int_type[pin])) {
       // Level triggered -- re-enable the callback
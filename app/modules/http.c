@@ -8,6 +8,8 @@
 #include "platform.h"
 #include "cpu_esp8266.h"
 #include "httpclient.h"
+#include "c_stdlib.h"
+#include "../crypto/digests.h"
 
 static int http_callback_registry  = LUA_NOREF;
 
@@ -211,6 +213,97 @@ static int http_lapi_get( lua_State *L )
   return 0;
 }
 
+typedef struct
+{
+  int cb_ref;
+  int digest_ref;
+  digest_user_datum_t *digest;    // hash object fed with the body, or NULL
+} http_stream_t;
+
+static void http_stream_callback( void * arg, int http_status, const char * data, size_t len )
+{
+  http_stream_t *st = (http_stream_t *)arg;
+  lua_State *L = lua_getstate();
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, st->cb_ref);
+  lua_pushnumber(L, http_status);
+  if (data && st->digest)
+  {
+    // Hashed without a Lua string, the callback only learns the length
+    crypto_digest_update(st->digest, data, len);
+    lua_pushinteger(L, len);
+  }
+  else if (data)
+  {
+    lua_pushlstring(L, data, len);
+  }
+  else
+  {
+    // End of the response, the callback is not needed any more
+    lua_pushnil(L);
+    luaL_unref(L, LUA_REGISTRYINDEX, st->cb_ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, st->digest_ref);
+    c_free(st);
+  }
+  lua_call(L, 2, 0); // With 2 arguments and 0 result
+}
+
+// Lua: http.stream( url, method, header, body, function(status, chunk) end[, hashobj] )
+static int http_lapi_stream( lua_State *L )
+{
+  int length;
+  const char * url     = luaL_checklstring(L, 1, &length);
+  const char * method  = luaL_checklstring(L, 2, &length);
+  const char * headers = NULL;
+  const char * body    = NULL;
+  digest_user_datum_t *digest = NULL;
+  http_stream_t *st;
+
+  if (lua_isstring(L, 3))
+  {
+    headers = luaL_checklstring(L, 3, &length);
+  }
+  if (lua_isstring(L, 4))
+  {
+    body = luaL_checklstring(L, 4, &length);
+  }
+
+  luaL_argcheck(L, lua_type(L, 5) == LUA_TFUNCTION || lua_type(L, 5) == LUA_TLIGHTFUNCTION, 5, "function expected");
+  if (!lua_isnoneornil(L, 6))
+  {
+    digest = (digest_user_datum_t *)luaL_checkudata(L, 6, CRYPTO_HASH_METATABLE);
+  }
+
+  st = (http_stream_t *)c_malloc(sizeof(http_stream_t));
+  if (!st)
+  {
+    return luaL_error(L, "not enough memory");
+  }
+  lua_pushvalue(L, 5);  // copy argument (func) to the top of stack
+  st->cb_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  st->digest = digest;
+  st->digest_ref = LUA_NOREF;
+  if (digest)
+  {
+    lua_pushvalue(L, 6);
+    st->digest_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+
+  // Every request carries its own callback, so streams may run concurrently
+  http_stream(url, method, headers, body, http_stream_callback, st);
+  return 0;
+}
+
+// Lua: http.keepalive( seconds )
+static int http_lapi_keepalive( lua_State *L )
+{
+  int seconds = luaL_checkinteger(L, 1);
+  luaL_argcheck(L, seconds >= 0 && seconds <= 3600, 1, "out of range");
+
+  http_set_keepalive(seconds * 1000);
+  return 0;
+}
+
 // Module function map
 static const LUA_REG_TYPE http_map[] = {
   { LSTRKEY( "request" ),         LFUNCVAL( http_lapi_request ) },
@@ -218,6 +311,8 @@ static const LUA_REG_TYPE http_map[] = {
   { LSTRKEY( "put" ),             LFUNCVAL( http_lapi_put ) },
   { LSTRKEY( "delete" ),          LFUNCVAL( http_lapi_delete ) },
   { LSTRKEY( "get" ),             LFUNCVAL( http_lapi_get ) },
+  { LSTRKEY( "stream" ),          LFUNCVAL( http_lapi_stream ) },
+  { LSTRKEY( "keepalive" ),       LFUNCVAL( http_lapi_keepalive ) },
 
   { LSTRKEY( "OK" ),              LNUMVAL( 0 ) },
   { LSTRKEY( "ERROR" ),           LNUMVAL( HTTP_STATUS_GENERIC_ERROR ) },
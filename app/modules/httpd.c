@@ -0,0 +1,1117 @@
+// Module for a lightweight event-driven HTTP server
+//
+// Example usage:
+// srv = httpd.createServer(80)
+// srv:route("GET", "/hello", function(req, res) res:send("hello " .. (req.query or "")) end)
+// srv:static("/", "www/")
+
+#include "module.h"
+#include "lauxlib.h"
+#include "lmem.h"
+#include "platform.h"
+
+#include "c_string.h"
+#include "c_stdlib.h"
+
+#include "lwip/tcp.h"
+#include "lwip/pbuf.h"
+#include "vfs.h"
+#include "httpserver.h"
+
+#define METATABLE_SERVER   "httpd.server"
+#define METATABLE_RESPONSE "httpd.response"
+
+#define HTTPD_DEFAULT_KEEPALIVE 10   /* seconds a connection may idle */
+#define HTTPD_RESPONSE_TIMEOUT  30   /* seconds a response may make no progress */
+#define HTTPD_DEFAULT_MAXCONN   4
+#define HTTPD_POLL_INTERVAL     4    /* in 500ms lwIP coarse timer ticks */
+#define HTTPD_POLL_SECONDS      2
+#define HTTPD_FILE_CHUNK        512
+#define HTTPD_STATIC_INDEX      "index.html"
+
+enum
+{
+  RESP_IDLE,        /* no response in progress */
+  RESP_PENDING,     /* handler called, nothing sent yet */
+  RESP_STREAMING,   /* head sent, body written piece by piece */
+  RESP_FILE,        /* head sent, body streamed from conn->fd */
+  RESP_DONE         /* fully handed over, waiting for the send queue */
+};
+
+typedef struct httpd_route
+{
+  struct httpd_route *next;
+  uint8_t  method;          /* HTTPD_METHOD_UNKNOWN matches any method */
+  uint8_t  prefix;          /* path given with a trailing '*' */
+  int      fn_ref;          /* handler, or LUA_NOREF for a static mount */
+  char    *dir;             /* static mount root directory */
+  uint16_t path_len;
+  char     path[1];
+} httpd_route;
+
+typedef struct httpd_outq
+{
+  struct httpd_outq *next;
+  uint16_t len;
+  uint16_t off;
+  char     data[1];
+} httpd_outq;
+
+struct httpd_server;
+struct httpd_response;
+
+typedef struct httpd_conn
+{
+  struct httpd_conn   *next;
+  struct tcp_pcb      *pcb;
+  struct httpd_server *srv;
+  httpd_parser_t       parser;
+  httpd_outq          *outq;
+  httpd_outq          *outq_tail;
+  struct pbuf         *pending;    /* received data not yet parsed */
+  uint16_t             pending_off;
+  int                  fd;         /* file being streamed out */
+  int                  res_ref;
+  int                  req_ref;
+  struct httpd_response *res;
+  uint16_t             idle;       /* seconds without traffic */
+  uint8_t              resp;       /* RESP_xxx */
+  uint8_t              chunked;    /* response uses chunked coding */
+  uint8_t              head_only;  /* response to a HEAD request */
+  uint8_t              keepalive;  /* connection stays open afterwards */
+  uint8_t              busy;       /* inside conn_input(), defer freeing */
+  uint8_t              dead;       /* pcb gone, free once not busy */
+} httpd_conn;
+
+typedef struct httpd_server
+{
+  struct tcp_pcb *pcb;
+  httpd_route    *routes;
+  httpd_route    *routes_tail;
+  httpd_conn     *conns;
+  int             self_ref;
+  uint16_t        keepalive;
+  uint8_t         maxconn;
+  uint8_t         nconn;
+} httpd_server;
+
+typedef struct httpd_response
+{
+  httpd_conn *conn;
+} httpd_response;
+
+
+/*
+ * The lwIP callbacks in progress, innermost first. A callback must return
+ * ERR_ABRT if its pcb was aborted meanwhile, which may happen to any of
+ * them, e.g. when a handler calls srv:close().
+ */
+typedef struct httpd_cb
+{
+  struct httpd_cb *outer;
+  struct tcp_pcb  *pcb;
+  bool             aborted;
+} httpd_cb;
+
+static httpd_cb *cb_current;
+
+static void cb_enter (httpd_cb *cb, struct tcp_pcb *pcb)
+{
+  cb->outer = cb_current;
+  cb->pcb = pcb;
+  cb->aborted = false;
+  cb_current = cb;
+}
+
+static err_t cb_leave (httpd_cb *cb)
+{
+  cb_current = cb->outer;
+  return cb->aborted ? ERR_ABRT : ERR_OK;
+}
+
+static void pcb_abort (struct tcp_pcb *pcb)
+{
+  httpd_cb *cb;
+  for (cb = cb_current; cb; cb = cb->outer)
+    if (cb->pcb == pcb)
+      cb->aborted = true;
+  tcp_abort(pcb);
+}
+
+static void conn_input (httpd_conn *conn);
+static void conn_drain (httpd_conn *conn);
+
+// ---- connection housekeeping ---------------------------------------------
+
+static void conn_release_refs (httpd_conn *conn)
+{
+  lua_State *L = lua_getstate();
+  if (conn->res)
+    conn->res->conn = NULL;
+  conn->res = NULL;
+  luaL_unref(L, LUA_REGISTRYINDEX, conn->res_ref);
+  conn->res_ref = LUA_NOREF;
+  luaL_unref(L, LUA_REGISTRYINDEX, conn->req_ref);
+  conn->req_ref = LUA_NOREF;
+}
+
+static void conn_unlink (httpd_conn *conn)
+{
+  httpd_server *srv = conn->srv;
+  if (!srv)
+    return;
+  httpd_conn **pp;
+  for (pp = &srv->conns; *pp; pp = &(*pp)->next)
+  {
+    if (*pp == conn)
+    {
+      *pp = conn->next;
+      srv->nconn--;
+      break;
+    }
+  }
+  conn->srv = NULL;
+}
+
+static void conn_free (httpd_conn *conn)
+{
+  conn_unlink(conn);
+
+  conn_release_refs(conn);
+  while (conn->outq)
+  {
+    httpd_outq *q = conn->outq;
+    conn->outq = q->next;
+    c_free(q);
+  }
+  if (conn->pending)
+    pbuf_free(conn->pending);
+  if (conn->fd)
+    vfs_close(conn->fd);
+  httpd_parser_free(&conn->parser);
+  c_free(conn);
+}
+
+/* Detach from the pcb. The conn itself goes once nobody is using it. */
+static void conn_detach (httpd_conn *conn)
+{
+  if (conn->pcb)
+  {
+    tcp_arg(conn->pcb, NULL);
+    tcp_recv(conn->pcb, NULL);
+    tcp_sent(conn->pcb, NULL);
+    tcp_err(conn->pcb, NULL);
+    tcp_poll(conn->pcb, NULL, 0);
+    conn->pcb = NULL;
+  }
+  conn->dead = 1;
+  if (!conn->busy)
+    conn_free(conn);
+}
+
+static void conn_close (httpd_conn *conn)
+{
+  struct tcp_pcb *pcb = conn->pcb;
+  conn_detach(conn);
+  if (pcb && tcp_close(pcb) != ERR_OK)
+    pcb_abort(pcb);
+}
+
+static void conn_abort (httpd_conn *conn)
+{
+  struct tcp_pcb *pcb = conn->pcb;
+  conn_detach(conn);
+  if (pcb)
+    pcb_abort(pcb);
+}
+
+// ---- output --------------------------------------------------------------
+
+/* Hand data to lwIP as far as its send buffer allows, queue the rest. */
+static bool conn_write (httpd_conn *conn, const char *data, size_t len)
+{
+  if (!conn->pcb)
+    return false;
+
+  if (!conn->outq)
+  {
+    size_t room = tcp_sndbuf(conn->pcb);
+    size_t n = len < room ? len : room;
+    if (n && tcp_write(conn->pcb, data, n, TCP_WRITE_FLAG_COPY) == ERR_OK)
+    {
+      data += n;
+      len -= n;
+    }
+  }
+
+  while (len)
+  {
+    uint16_t n = len > 0xffff ? 0xffff : len;
+    httpd_outq *q = (httpd_outq *)c_malloc(sizeof(httpd_outq) + n);
+    if (!q)
+      return false;
+    q->next = NULL;
+    q->len = n;
+    q->off = 0;
+    c_memcpy(q->data, data, n);
+    if (conn->outq_tail)
+      conn->outq_tail->next = q;
+    else
+      conn->outq = q;
+    conn->outq_tail = q;
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool conn_write_chunk (httpd_conn *conn, const char *data, size_t len)
+{
+  if (!conn->chunked)
+    return conn_write(conn, data, len);
+
+  char sz[10];
+  size_t n = httpd_format_chunk_size(sz, len);
+  return conn_write(conn, sz, n) &&
+         conn_write(conn, data, len) &&
+         conn_write(conn, "\r\n", 2);
+}
+
+/* Finished with the current response: keep the connection or close it. */
+static void conn_response_complete (httpd_conn *conn)
+{
+  conn->resp = RESP_IDLE;
+  if (conn->res)
+    conn->res->conn = NULL;
+  conn->res = NULL;
+  luaL_unref(lua_getstate(), LUA_REGISTRYINDEX, conn->res_ref);
+  conn->res_ref = LUA_NOREF;
+
+  if (!conn->keepalive)
+  {
+    conn_close(conn);
+    return;
+  }
+  conn->idle = 0;
+  conn_input(conn); /* carry on with any pipelined request */
+}
+
+/*
+ * Move queued output, and file content, into lwIP's send buffer. This may
+ * complete the response and thereby close and free the connection.
+ */
+static void conn_drain (httpd_conn *conn)
+{
+  while (conn->pcb && conn->outq)
+  {
+    httpd_outq *q = conn->outq;
+    size_t room = tcp_sndbuf(conn->pcb);
+    size_t n = q->len - q->off;
+    if (n > room)
+      n = room;
+    if (!n || tcp_write(conn->pcb, q->data + q->off, n, TCP_WRITE_FLAG_COPY) != ERR_OK)
+      return;
+    q->off += n;
+    if (q->off < q->len)
+      return;
+    conn->outq = q->next;
+    if (!conn->outq)
+      conn->outq_tail = NULL;
+    c_free(q);
+  }
+
+  while (conn->pcb && conn->resp == RESP_FILE)
+  {
+    size_t room = tcp_sndbuf(conn->pcb);
+    if (room > HTTPD_FILE_CHUNK)
+      room = HTTPD_FILE_CHUNK;
+    if (!room)
+      return;
+    char *buf = (char *)c_malloc(room);
+    if (!buf)
+      return;
+    sint32_t n = vfs_read(conn->fd, buf, room);
+    if (n > 0 && tcp_write(conn->pcb, buf, n, TCP_WRITE_FLAG_COPY) != ERR_OK)
+    {
+      /* lwIP is out of queue space, retry from the sent/poll callback */
+      vfs_lseek(conn->fd, -n, VFS_SEEK_CUR);
+      n = 0;
+      room = 0;
+    }
+    c_free(buf);
+    if (!room)
+      return;
+    if (n <= 0 || vfs_eof(conn->fd))
+    {
+      vfs_close(conn->fd);
+      conn->fd = 0;
+      conn->resp = RESP_DONE;
+    }
+  }
+
+  if (!conn->pcb)
+    return;
+  tcp_output(conn->pcb);
+  if (conn->resp == RESP_DONE && !conn->outq)
+    conn_response_complete(conn);
+}
+
+/* Write the user supplied header table at idx, noting a Content-Type */
+static bool write_user_headers (lua_State *L, httpd_conn *conn, int idx, bool *have_type)
+{
+  bool ok = true;
+  *have_type = false;
+  if (!idx || !lua_istable(L, idx))
+    return true;
+  lua_pushnil(L);
+  while (ok && lua_next(L, idx))
+  {
+    size_t klen, vlen;
+    const char *k = lua_tolstring(L, -2, &klen);
+    const char *v = lua_tolstring(L, -1, &vlen);
+    if (k && v)
+    {
+      if (klen == 12 && (k[0] | 0x20) == 'c' && c_strncmp(k + 1, "ontent-", 7) == 0 &&
+          (k[8] | 0x20) == 't')
+        *have_type = true;
+      ok = conn_write(conn, k, klen) && conn_write(conn, ": ", 2) &&
+           conn_write(conn, v, vlen) && conn_write(conn, "\r\n", 2);
+    }
+    lua_pop(L, 1);
+  }
+  if (!ok)
+    lua_pop(L, 1); /* the key left behind by breaking out of lua_next */
+  return ok;
+}
+
+/*
+ * Send the response head. content_length < 0 streams the body with chunked
+ * coding, or delimits it by closing the connection for HTTP/1.0 clients.
+ */
+static bool conn_send_head (lua_State *L, httpd_conn *conn, int status, int32_t content_length,
+                            int headers_idx, const char *content_type, const char *extra)
+{
+  httpd_parser_t *p = &conn->parser;
+  bool http11 = (p->flags & HTTPD_REQ_HTTP11) != 0;
+
+  conn->chunked = (content_length < 0 && http11);
+  if (content_length < 0 && !http11)
+    conn->keepalive = 0;
+
+  char head[96];
+  size_t n = httpd_format_head(head, sizeof(head), status, content_length,
+                               conn->keepalive, conn->chunked);
+  bool have_type;
+  bool ok = conn_write(conn, head, n) && write_user_headers(L, conn, headers_idx, &have_type);
+  if (ok && !have_type && content_type)
+    ok = conn_write(conn, "Content-Type: ", 14) &&
+         conn_write(conn, content_type, c_strlen(content_type)) &&
+         conn_write(conn, "\r\n", 2);
+  if (ok && extra)
+    ok = conn_write(conn, extra, c_strlen(extra));
+  return ok && conn_write(conn, "\r\n", 2);
+}
+
+/* Canned response without a body, used for errors raised before Lua sees the request */
+static void conn_send_status (httpd_conn *conn, int status, bool close)
+{
+  char head[128];
+  if (close)
+    conn->keepalive = 0;
+  size_t n = httpd_format_head(head, sizeof(head) - 2, status, 0, conn->keepalive, false);
+  head[n++] = '\r';
+  head[n++] = '\n';
+  conn->resp = RESP_DONE;
+  conn_write(conn, head, n);
+  conn_drain(conn);
+}
+
+// ---- request handling ----------------------------------------------------
+
+static httpd_route *find_route (httpd_server *srv, httpd_parser_t *p)
+{
+  httpd_route *r;
+  for (r = srv->routes; r; r = r->next)
+    if (httpd_route_match(p, r->method, r->prefix, r->path, r->path_len))
+      return r;
+  return NULL;
+}
+
+/* Open name, preferring a pre-compressed name.gz if the client accepts it */
+static int open_static (httpd_conn *conn, const char *name, bool *gzip)
+{
+  const char *accept = httpd_header_get(&conn->parser, "accept-encoding");
+  *gzip = false;
+  if (accept && c_strstr(accept, "gzip"))
+  {
+    size_t len = c_strlen(name);
+    char *gz = (char *)c_malloc(len + 4);
+    if (gz)
+    {
+      c_memcpy(gz, name, len);
+      c_memcpy(gz + len, ".gz", 4);
+      int fd = vfs_open(gz, "r");
+      c_free(gz);
+      if (fd)
+      {
+        *gzip = true;
+        return fd;
+      }
+    }
+  }
+  return vfs_open(name, "r");
+}
+
+static bool conn_send_file (lua_State *L, httpd_conn *conn, const char *name, int status, int headers_idx)
+{
+  bool gzip;
+  int fd = open_static(conn, name, &gzip);
+  if (!fd)
+    return false;
+
+  conn_send_head(L, conn, status, vfs_size(fd), headers_idx, httpd_mime_type(name),
+                 gzip ? "Content-Encoding: gzip\r\n" : NULL);
+  if (conn->head_only)
+  {
+    vfs_close(fd);
+    conn->resp = RESP_DONE;
+  }
+  else
+  {
+    conn->fd = fd;
+    conn->resp = RESP_FILE;
+  }
+  conn_drain(conn);
+  return true;
+}
+
+static void serve_static (httpd_conn *conn, httpd_route *r)
+{
+  httpd_parser_t *p = &conn->parser;
+  if (p->method != HTTPD_METHOD_GET && p->method != HTTPD_METHOD_HEAD)
+  {
+    conn_send_status(conn, 405, false);
+    return;
+  }
+
+  const char *rel = p->path + r->path_len;
+  while (*rel == '/')
+    ++rel;
+  size_t dlen = c_strlen(r->dir), rlen = c_strlen(rel);
+  if (c_strstr(rel, ".."))
+  {
+    conn_send_status(conn, 403, false);
+    return;
+  }
+
+  bool index = (rlen == 0 || rel[rlen - 1] == '/');
+  char *name = (char *)c_malloc(dlen + rlen + sizeof(HTTPD_STATIC_INDEX));
+  if (!name)
+  {
+    conn_send_status(conn, 503, true);
+    return;
+  }
+  c_memcpy(name, r->dir, dlen);
+  c_memcpy(name + dlen, rel, rlen);
+  name[dlen + rlen] = 0;
+  if (index)
+    c_strcpy(name + dlen + rlen, HTTPD_STATIC_INDEX);
+
+  if (!conn_send_file(lua_getstate(), conn, name, 200, 0))
+    conn_send_status(conn, 404, false);
+  c_free(name);
+}
+
+static void push_request (lua_State *L, httpd_parser_t *p)
+{
+  lua_createtable(L, 0, 4);
+  lua_pushstring(L, httpd_method_name(p->method));
+  lua_setfield(L, -2, "method");
+  lua_pushlstring(L, p->path, p->path_len);
+  lua_setfield(L, -2, "path");
+  if (p->query)
+  {
+    lua_pushlstring(L, p->query, p->query_len);
+    lua_setfield(L, -2, "query");
+  }
+  lua_newtable(L);
+  const char *pos = NULL, *name, *value;
+  while (httpd_header_next(p, &pos, &name, &value))
+  {
+    lua_pushstring(L, value);
+    lua_setfield(L, -2, name);
+  }
+  lua_setfield(L, -2, "headers");
+}
+
+static int on_headers (httpd_parser_t *p, void *arg)
+{
+  httpd_conn *conn = (httpd_conn *)arg;
+  lua_State *L = lua_getstate();
+
+  conn->keepalive = (p->flags & HTTPD_REQ_KEEPALIVE) && conn->srv->keepalive;
+  conn->head_only = (p->method == HTTPD_METHOD_HEAD);
+  conn->chunked = 0;
+
+  httpd_route *r = find_route(conn->srv, p);
+  if (!r)
+  {
+    conn_send_status(conn, 404, false);
+    return conn->dead;
+  }
+  if (r->fn_ref == LUA_NOREF)
+  {
+    serve_static(conn, r);
+    return conn->dead;
+  }
+
+  conn->resp = RESP_PENDING;
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, r->fn_ref);
+  push_request(L, p);
+  lua_pushvalue(L, -1);
+  conn->req_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+  httpd_response *res = (httpd_response *)lua_newuserdata(L, sizeof(httpd_response));
+  res->conn = conn;
+  luaL_getmetatable(L, METATABLE_RESPONSE);
+  lua_setmetatable(L, -2);
+  lua_pushvalue(L, -1);
+  conn->res_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  conn->res = res;
+
+  lua_call(L, 2, 0);
+  return conn->dead;
+}
+
+/* Pass body data to the request's ondata function, data == NULL at the end */
+static int deliver_body (httpd_conn *conn, const char *data, size_t len)
+{
+  if (conn->req_ref == LUA_NOREF)
+    return conn->dead;
+
+  lua_State *L = lua_getstate();
+  lua_rawgeti(L, LUA_REGISTRYINDEX, conn->req_ref);
+  lua_getfield(L, -1, "ondata");
+  if (lua_isfunction(L, -1))
+  {
+    lua_insert(L, -2);
+    if (data)
+      lua_pushlstring(L, data, len);
+    else
+      lua_pushnil(L);
+    lua_call(L, 2, 0);
+  }
+  else
+    lua_pop(L, 2);
+  return conn->dead;
+}
+
+static int on_body (httpd_parser_t *p, const char *data, size_t len, void *arg)
+{
+  return deliver_body((httpd_conn *)arg, data, len);
+}
+
+static int on_complete (httpd_parser_t *p, void *arg)
+{
+  httpd_conn *conn = (httpd_conn *)arg;
+  int res = deliver_body(conn, NULL, 0);
+  luaL_unref(lua_getstate(), LUA_REGISTRYINDEX, conn->req_ref);
+  conn->req_ref = LUA_NOREF;
+  return res;
+}
+
+static const httpd_parser_cbs_t parser_cbs = { on_headers, on_body, on_complete };
+
+/* Parse pending input for as long as we're able to act on it */
+static void conn_input (httpd_conn *conn)
+{
+  if (conn->busy)
+    return; /* re-entered from a response completing within a callback */
+  conn->busy = 1;
+
+  while (conn->pcb && conn->pending)
+  {
+    if (httpd_parser_done(&conn->parser))
+    {
+      if (conn->resp != RESP_IDLE)
+        break; /* wait for the response before the next request */
+      httpd_parser_reset(&conn->parser);
+    }
+
+    /* locate the pbuf holding the first unparsed byte */
+    struct pbuf *q = conn->pending;
+    uint16_t off = conn->pending_off;
+    while (off >= q->len)
+    {
+      off -= q->len;
+      q = q->next;
+    }
+
+    int n = httpd_parser_feed(&conn->parser, (const char *)q->payload + off, q->len - off,
+                              &parser_cbs, conn);
+    if (n == HTTPD_PARSE_ABORT || conn->dead)
+      break;
+    if (n == HTTPD_PARSE_ERROR)
+    {
+      if (conn->resp == RESP_IDLE)
+        conn_send_status(conn, conn->parser.status, true);
+      else
+        conn_abort(conn);
+      break;
+    }
+
+    conn->pending_off += n;
+    if (conn->pending_off >= conn->pending->tot_len)
+    {
+      if (conn->pcb)
+        tcp_recved(conn->pcb, conn->pending->tot_len);
+      pbuf_free(conn->pending);
+      conn->pending = NULL;
+      conn->pending_off = 0;
+    }
+  }
+
+  /* a completed request with its response already done frees the parser */
+  if (!conn->dead && conn->resp == RESP_IDLE && httpd_parser_done(&conn->parser))
+    httpd_parser_reset(&conn->parser);
+
+  conn->busy = 0;
+  if (conn->dead)
+    conn_free(conn);
+}
+
+// ---- lwIP callbacks ------------------------------------------------------
+
+static err_t httpd_recv_cb (void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+  httpd_conn *conn = (httpd_conn *)arg;
+  if (!conn || err != ERR_OK)
+  {
+    if (p)
+      pbuf_free(p);
+    tcp_abort(pcb);
+    return ERR_ABRT;
+  }
+
+  httpd_cb cb;
+  cb_enter(&cb, pcb);
+  if (!p)
+  {
+    /* remote side closed; if a response is underway, let it finish */
+    conn->keepalive = 0;
+    if (conn->resp == RESP_IDLE)
+      conn_close(conn);
+    return cb_leave(&cb);
+  }
+
+  conn->idle = 0;
+  if (conn->pending)
+    pbuf_cat(conn->pending, p);
+  else
+  {
+    conn->pending = p;
+    conn->pending_off = 0;
+  }
+
+  conn_input(conn);
+  return cb_leave(&cb);
+}
+
+static err_t httpd_sent_cb (void *arg, struct tcp_pcb *pcb, u16_t len)
+{
+  httpd_conn *conn = (httpd_conn *)arg;
+  if (!conn)
+    return ERR_OK;
+  httpd_cb cb;
+  cb_enter(&cb, pcb);
+  conn->idle = 0;
+  conn_drain(conn);
+  return cb_leave(&cb);
+}
+
+static err_t httpd_poll_cb (void *arg, struct tcp_pcb *pcb)
+{
+  httpd_conn *conn = (httpd_conn *)arg;
+  if (!conn)
+  {
+    tcp_abort(pcb);
+    return ERR_ABRT;
+  }
+
+  /*
+   * An idle keep-alive connection, a client that stalled mid-request, a
+   * handler that never responds or a client that stopped reading the
+   * response would otherwise hold its connection slot for good.
+   */
+  conn->idle += HTTPD_POLL_SECONDS;
+  uint16_t limit = conn->resp != RESP_IDLE ? HTTPD_RESPONSE_TIMEOUT :
+                   conn->srv->keepalive ? conn->srv->keepalive : HTTPD_DEFAULT_KEEPALIVE;
+  if (conn->idle >= limit)
+  {
+    conn_abort(conn);
+    return ERR_ABRT;
+  }
+  if (conn->resp == RESP_IDLE)
+    return ERR_OK;
+
+  httpd_cb cb;
+  cb_enter(&cb, pcb);
+  conn_drain(conn);
+  return cb_leave(&cb);
+}
+
+static void httpd_err_cb (void *arg, err_t err)
+{
+  httpd_conn *conn = (httpd_conn *)arg;
+  if (!conn)
+    return;
+  conn->pcb = NULL; /* already freed by lwIP */
+  conn_detach(conn);
+}
+
+static err_t httpd_accept_cb (void *arg, struct tcp_pcb *pcb, err_t err)
+{
+  httpd_server *srv = (httpd_server *)arg;
+  if (!srv || !srv->pcb || err != ERR_OK)
+    return ERR_VAL;
+
+  tcp_accepted(srv->pcb);
+  if (srv->nconn >= srv->maxconn)
+  {
+    tcp_abort(pcb);
+    return ERR_ABRT;
+  }
+
+  httpd_conn *conn = (httpd_conn *)c_zalloc(sizeof(httpd_conn));
+  if (!conn)
+  {
+    tcp_abort(pcb);
+    return ERR_ABRT;
+  }
+  conn->pcb = pcb;
+  conn->srv = srv;
+  conn->res_ref = conn->req_ref = LUA_NOREF;
+  httpd_parser_init(&conn->parser);
+  conn->next = srv->conns;
+  srv->conns = conn;
+  srv->nconn++;
+
+  tcp_arg(pcb, conn);
+  tcp_recv(pcb, httpd_recv_cb);
+  tcp_sent(pcb, httpd_sent_cb);
+  tcp_err(pcb, httpd_err_cb);
+  tcp_poll(pcb, httpd_poll_cb, HTTPD_POLL_INTERVAL);
+  tcp_nagle_disable(pcb);
+  return ERR_OK;
+}
+
+// ---- Lua: response object ------------------------------------------------
+
+static httpd_conn *check_response (lua_State *L)
+{
+  httpd_response *res = (httpd_response *)luaL_checkudata(L, 1, METATABLE_RESPONSE);
+  return res->conn;
+}
+
+// Lua: res:send(body [, status [, headers]])
+static int httpd_res_send (lua_State *L)
+{
+  httpd_conn *conn = check_response(L);
+  size_t len;
+  const char *body = luaL_optlstring(L, 2, "", &len);
+  int status = luaL_optint(L, 3, 200);
+  if (!conn || conn->resp != RESP_PENDING)
+  {
+    lua_pushboolean(L, false);
+    return 1;
+  }
+
+  bool ok = conn_send_head(L, conn, status, len, 4, "text/html", NULL);
+  if (ok && !conn->head_only)
+    ok = conn_write(conn, body, len);
+  conn->resp = RESP_DONE;
+  conn_drain(conn);
+  lua_pushboolean(L, ok);
+  return 1;
+}
+
+// Lua: res:begin([status [, headers]])
+static int httpd_res_begin (lua_State *L)
+{
+  httpd_conn *conn = check_response(L);
+  int status = luaL_optint(L, 2, 200);
+  if (!conn || conn->resp != RESP_PENDING)
+  {
+    lua_pushboolean(L, false);
+    return 1;
+  }
+
+  bool ok = conn_send_head(L, conn, status, -1, 3, "text/html", NULL);
+  conn->resp = RESP_STREAMING;
+  if (conn->head_only)
+    conn->chunked = 0;
+  conn_drain(conn);
+  lua_pushboolean(L, ok);
+  return 1;
+}
+
+// Lua: res:write(data)
+static int httpd_res_write (lua_State *L)
+{
+  httpd_conn *conn = check_response(L);
+  size_t len;
+  const char *data = luaL_checklstring(L, 2, &len);
+  bool ok = conn && conn->resp == RESP_STREAMING;
+  if (ok && len && !conn->head_only)
+  {
+    ok = conn_write_chunk(conn, data, len);
+    conn_drain(conn);
+  }
+  lua_pushboolean(L, ok);
+  return 1;
+}
+
+// Lua: res:finish([data])
+static int httpd_res_finish (lua_State *L)
+{
+  httpd_conn *conn = check_response(L);
+  size_t len = 0;
+  const char *data = luaL_optlstring(L, 2, NULL, &len);
+  if (!conn || conn->resp != RESP_STREAMING)
+  {
+    lua_pushboolean(L, false);
+    return 1;
+  }
+
+  bool ok = true;
+  if (!conn->head_only)
+  {
+    if (len)
+      ok = conn_write_chunk(conn, data, len);
+    if (ok && conn->chunked)
+      ok = conn_write(conn, "0\r\n\r\n", 5);
+  }
+  conn->resp = RESP_DONE;
+  conn_drain(conn);
+  lua_pushboolean(L, ok);
+  return 1;
+}
+
+// Lua: res:file(path [, status [, headers]])
+static int httpd_res_file (lua_State *L)
+{
+  httpd_conn *conn = check_response(L);
+  const char *name = luaL_checkstring(L, 2);
+  int status = luaL_optint(L, 3, 200);
+  bool ok = conn && conn->resp == RESP_PENDING;
+  if (ok)
+    ok = conn_send_file(L, conn, name, status, 4);
+  lua_pushboolean(L, ok);
+  return 1;
+}
+
+// ---- Lua: server object --------------------------------------------------
+
+// Lua: srv = httpd.createServer([port [, config]])
+static int httpd_create_server (lua_State *L)
+{
+  int port = luaL_optint(L, 1, 80);
+  httpd_server *srv = (httpd_server *)lua_newuserdata(L, sizeof(httpd_server));
+  c_memset(srv, 0, sizeof(*srv));
+  srv->self_ref = LUA_NOREF;
+  srv->keepalive = HTTPD_DEFAULT_KEEPALIVE;
+  srv->maxconn = HTTPD_DEFAULT_MAXCONN;
+  luaL_getmetatable(L, METATABLE_SERVER);
+  lua_setmetatable(L, -2);
+
+  if (lua_istable(L, 2))
+  {
+    lua_getfield(L, 2, "keepalive");
+    srv->keepalive = luaL_optint(L, -1, HTTPD_DEFAULT_KEEPALIVE);
+    lua_getfield(L, 2, "maxconn");
+    srv->maxconn = luaL_optint(L, -1, HTTPD_DEFAULT_MAXCONN);
+    lua_pop(L, 2);
+    if (!srv->maxconn)
+      return luaL_error(L, "maxconn must be at least 1");
+  }
+
+  struct tcp_pcb *pcb = tcp_new();
+  if (!pcb)
+    return luaL_error(L, "out of memory");
+  if (tcp_bind(pcb, IP_ADDR_ANY, port) != ERR_OK)
+  {
+    tcp_abort(pcb);
+    return luaL_error(L, "port %d in use", port);
+  }
+  srv->pcb = tcp_listen(pcb);
+  if (!srv->pcb)
+  {
+    tcp_abort(pcb); /* original wasn't freed for us */
+    return luaL_error(L, "listen failed");
+  }
+  tcp_arg(srv->pcb, srv);
+  tcp_accept(srv->pcb, httpd_accept_cb);
+
+  /* anchor the server while it's listening */
+  lua_pushvalue(L, -1);
+  srv->self_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  return 1;
+}
+
+static httpd_route *add_route (lua_State *L, httpd_server *srv, uint8_t method, const char *path)
+{
+  size_t len = c_strlen(path);
+  bool prefix = (len && path[len - 1] == '*');
+  if (prefix)
+    --len;
+
+  httpd_route *r = (httpd_route *)c_zalloc(sizeof(httpd_route) + len);
+  if (!r)
+    luaL_error(L, "out of memory");
+  r->method = method;
+  r->prefix = prefix;
+  r->fn_ref = LUA_NOREF;
+  r->path_len = len;
+  c_memcpy(r->path, path, len);
+  r->path[len] = 0;
+
+  /* first match wins, so routes are kept in registration order */
+  if (srv->routes_tail)
+    srv->routes_tail->next = r;
+  else
+    srv->routes = r;
+  srv->routes_tail = r;
+  return r;
+}
+
+// Lua: srv:route(method, path, function(req, res) end)
+static int httpd_srv_route (lua_State *L)
+{
+  httpd_server *srv = (httpd_server *)luaL_checkudata(L, 1, METATABLE_SERVER);
+  const char *method = luaL_checkstring(L, 2);
+  const char *path = luaL_checkstring(L, 3);
+  luaL_checkanyfunction(L, 4);
+
+  uint8_t m = HTTPD_METHOD_UNKNOWN;
+  if (c_strcmp(method, "*") != 0)
+  {
+    for (m = HTTPD_METHOD_GET; m <= HTTPD_METHOD_PATCH; ++m)
+      if (c_strcmp(method, httpd_method_name(m)) == 0)
+        break;
+    if (m > HTTPD_METHOD_PATCH)
+      return luaL_error(L, "unknown method %s", method);
+  }
+
+  httpd_route *r = add_route(L, srv, m, path);
+  lua_pushvalue(L, 4);
+  r->fn_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  return 0;
+}
+
+// Lua: srv:static(urlprefix, dir)
+static int httpd_srv_static (lua_State *L)
+{
+  httpd_server *srv = (httpd_server *)luaL_checkudata(L, 1, METATABLE_SERVER);
+  const char *prefix = luaL_checkstring(L, 2);
+  const char *dir = luaL_optstring(L, 3, "");
+
+  lua_pushfstring(L, "%s*", prefix);
+  httpd_route *r = add_route(L, srv, HTTPD_METHOD_UNKNOWN, lua_tostring(L, -1));
+  /* copied only now, so that an error above can't leak it */
+  r->dir = c_strdup(dir);
+  if (!r->dir)
+  {
+    /* take the half-made route back off the end of the list */
+    httpd_route **pp = &srv->routes;
+    srv->routes_tail = NULL;
+    while (*pp != r)
+    {
+      srv->routes_tail = *pp;
+      pp = &(*pp)->next;
+    }
+    *pp = NULL;
+    c_free(r);
+    return luaL_error(L, "out of memory");
+  }
+  return 0;
+}
+
+static void server_close (lua_State *L, httpd_server *srv)
+{
+  if (srv->pcb)
+  {
+    tcp_arg(srv->pcb, NULL);
+    tcp_accept(srv->pcb, NULL);
+    tcp_close(srv->pcb); /* cannot fail for listening sockets */
+    srv->pcb = NULL;
+  }
+  while (srv->conns)
+  {
+    httpd_conn *conn = srv->conns;
+    conn_unlink(conn);
+    conn_abort(conn);
+  }
+
+  luaL_unref(L, LUA_REGISTRYINDEX, srv->self_ref);
+  srv->self_ref = LUA_NOREF;
+}
+
+// Lua: srv:close()
+static int httpd_srv_close (lua_State *L)
+{
+  httpd_server *srv = (httpd_server *)luaL_checkudata(L, 1, METATABLE_SERVER);
+  server_close(L, srv);
+  return 0;
+}
+
+static int httpd_srv_gc (lua_State *L)
+{
+  httpd_server *srv = (httpd_server *)luaL_checkudata(L, 1, METATABLE_SERVER);
+  server_close(L, srv);
+  while (srv->routes)
+  {
+    httpd_route *r = srv->routes;
+    srv->routes = r->next;
+    luaL_unref(L, LUA_REGISTRYINDEX, r->fn_ref);
+    if (r->dir)
+      c_free(r->dir);
+    c_free(r);
+  }
+  srv->routes_tail = NULL;
+  return 0;
+}
+
+
+static const LUA_REG_TYPE httpd_response_map[] = {
+  { LSTRKEY( "send" ),    LFUNCVAL( httpd_res_send ) },
+  { LSTRKEY( "begin" ),   LFUNCVAL( httpd_res_begin ) },
+  { LSTRKEY( "write" ),   LFUNCVAL( httpd_res_write ) },
+  { LSTRKEY( "finish" ),  LFUNCVAL( httpd_res_finish ) },
+  { LSTRKEY( "file" ),    LFUNCVAL( httpd_res_file ) },
+  { LSTRKEY( "__index" ), LROVAL( httpd_response_map ) },
+  { LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE httpd_server_map[] = {
+  { LSTRKEY( "route" ),   LFUNCVAL( httpd_srv_route ) },
+  { LSTRKEY( "static" ),  LFUNCVAL( httpd_srv_static ) },
+  { LSTRKEY( "close" ),   LFUNCVAL( httpd_srv_close ) },
+  { LSTRKEY( "__gc" ),    LFUNCVAL( httpd_srv_gc ) },
+  { LSTRKEY( "__index" ), LROVAL( httpd_server_map ) },
+  { LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE httpd_map[] = {
+  { LSTRKEY( "createServer" ), LFUNCVAL( httpd_create_server ) },
+  { LNILKEY, LNILVAL }
+};
+
+int luaopen_httpd (lua_State *L)
+{
+  luaL_rometatable(L, METATABLE_SERVER, (void *)httpd_server_map);
+  luaL_rometatable(L, METATABLE_RESPONSE, (void *)httpd_response_map);
+  return 0;
+}
+
+NODEMCU_MODULE(HTTPD, "httpd", httpd_map, luaopen_httpd);
@@ -13,6 +13,8 @@
 #include "lwip/ip_addr.h"
 #include "espconn.h"
 #include "lwip/dns.h" 
+#include "../crypto/digests.h"
+#include "../crypto/codec.h"
 
 #define TCP ESPCONN_TCP
 #define UDP ESPCONN_UDP
@@ -50,6 +52,8 @@ typedef struct lnet_userdata
   int cb_receive_ref;
   int cb_send_ref;
   int cb_dns_found_ref;
+  int digest_ref;                 // hash object fed with received data
+  digest_user_datum_t *digest;
 #ifdef CLIENT_SSL_ENABLE
   uint8_t secure;
 #endif
@@ -149,6 +153,8 @@ static void net_socket_received(void *arg, char *pdata, unsigned short len)
   lnet_userdata *nud = (lnet_userdata *)pesp_conn->reverse;
   if(nud == NULL)
     return;
+  if(nud->digest)
+    crypto_digest_update(nud->digest, pdata, len);
   if(nud->cb_receive_ref == LUA_NOREF)
     return;
   if(nud->self_ref == LUA_NOREF)
@@ -305,6 +311,8 @@ static void net_server_connected(void *arg) // for tcp only
   skt->cb_receive_ref = LUA_NOREF;
   skt->cb_send_ref = LUA_NOREF;
   skt->cb_dns_found_ref = LUA_NOREF;
+  skt->digest_ref = LUA_NOREF;
+  skt->digest = NULL;
 
 #ifdef CLIENT_SSL_ENABLE
   skt->secure = 0;    // as a server SSL is not supported.
@@ -412,6 +420,8 @@ static int net_create( lua_State* L, const char* mt )
   nud->cb_receive_ref = LUA_NOREF;
   nud->cb_send_ref = LUA_NOREF;
   nud->cb_dns_found_ref = LUA_NOREF;
+  nud->digest_ref = LUA_NOREF;
+  nud->digest = NULL;
   nud->pesp_conn = NULL;
 #ifdef CLIENT_SSL_ENABLE
   nud->secure = secure;
@@ -556,6 +566,11 @@ static int net_delete( lua_State* L, const char* mt )
     luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_dns_found_ref);
     nud->cb_dns_found_ref = LUA_NOREF;
   }
+  if(LUA_NOREF!=nud->digest_ref){
+    luaL_unref(L, LUA_REGISTRYINDEX, nud->digest_ref);
+    nud->digest_ref = LUA_NOREF;
+    nud->digest = NULL;
+  }
   lua_gc(L, LUA_GCSTOP, 0);
   if(LUA_NOREF!=nud->self_ref){
     luaL_unref(L, LUA_REGISTRYINDEX, nud->self_ref);
@@ -1309,6 +1324,28 @@ static int net_socket_hold( lua_State* L )
   return 0;
 }
 
+// Lua: socket:digest(hashobj)
+// Received data is fed into a crypto.new_hash() or crypto.new_hmac() object
+// before the "receive" callback, if any, is called. nil detaches it.
+static int net_socket_digest( lua_State* L )
+{
+  lnet_userdata *nud = (lnet_userdata *)luaL_checkudata(L, 1, "net.socket");
+  digest_user_datum_t *digest = NULL;
+
+  if (!lua_isnoneornil(L, 2))
+    digest = (digest_user_datum_t *)luaL_checkudata(L, 2, CRYPTO_HASH_METATABLE);
+
+  if (nud->digest_ref != LUA_NOREF)
+    luaL_unref(L, LUA_REGISTRYINDEX, nud->digest_ref);
+  nud->digest_ref = LUA_NOREF;
+  nud->digest = digest;
+  if (digest) {
+    lua_pushvalue(L, 2);
+    nud->digest_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+  return 0;
+}
+
 static int net_socket_unhold( lua_State* L )
 {
   const char *mt = "net.socket";
@@ -1415,13 +1452,6 @@ static int net_multicastLeave( lua_State* L )
 
 // Returns NULL on success, error message otherwise
 static const char *append_pem_blob(const char *pem, const char *type, uint8_t **buffer_p, uint8_t *buffer_limit, const char *name) {
-  char unb64[256];
-  memset(unb64, 0xff, sizeof(unb64));
-  int i;
-  for (i = 0; i < 64; i++) {
-    unb64["ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"[i]] = i;
-  }
-
   if (!pem) {
     return "No PEM blob";
   }
@@ -1449,34 +1479,30 @@ static const char *append_pem_blob(const char *pem, const char *type, uint8_t **
   uint8_t *buffer = *buffer_p;
 
   uint8_t *dest = buffer + 32 + 2;  // Leave space for name and length
-  int bitcount = 0;
-  int accumulator = 0;
-  for (; *pem && dest < buffer_limit; pem++) {
-    int val = unb64[*(uint8_t*) pem];
-    if (val & 0xC0) {
-      // not a base64 character
-      if (isspace(*(uint8_t*) pem)) {
-	continue;
-      }
-      if (*pem == '=') {
-	// just ignore -- at the end
-	bitcount = 0;
-	continue;
-      }
-      if (*pem == '-') {
-	break;
-      }
+  const char *end = strstr(pem, "-----END ");
+  if (!end) {
+    return "Invalid PEM format data";
+  }
+  codec_state_t state;
+  codec_init(&state, CODEC_SKIP_SPACE);
+  while (pem < end) {
+    // Never more characters than there are bytes left, decoding
+    // produces at most one byte per character
+    size_t n = end - pem;
+    if (n > (size_t) (buffer_limit - dest)) {
+      n = buffer_limit - dest;
+    }
+    if (!n) {
+      return "Invalid PEM format data";
+    }
+    sint32_t got = codec_base64_decode_update(&state, pem, n, (char *) dest);
+    if (got < 0) {
       return "Invalid character in PEM";
-    } else {
-      bitcount += 6;
-      accumulator = (accumulator << 6) + val;
-      if (bitcount >= 8) {
-	bitcount -= 8;
-	*dest++ = accumulator >> bitcount;
-      }
     }
+    pem += n;
+    dest += got;
   }
-  if (dest >= buffer_limit || strncmp(pem, "-----END ", 9) || strncmp(pem + 9, type, strlen(type)) || bitcount) {
+  if (dest >= buffer_limit || codec_base64_decode_end(&state) || strncmp(end + 9, type, strlen(type))) {
     return "Invalid PEM format data";
   }
   size_t len = dest - (buffer + 32 + 2);
@@ -1700,6 +1726,7 @@ static const LUA_REG_TYPE net_socket_map[] = {
   { LSTRKEY( "send" ),    LFUNCVAL( net_socket_send ) },
   { LSTRKEY( "hold" ),    LFUNCVAL( net_socket_hold ) },
   { LSTRKEY( "unhold" ),  LFUNCVAL( net_socket_unhold ) },
+  { LSTRKEY( "digest" ),  LFUNCVAL( net_socket_digest ) },
   { LSTRKEY( "dns" ),     LFUNCVAL( net_socket_dns ) },
   { LSTRKEY( "getpeer" ), LFUNCVAL( net_socket_getpeer ) },
 //{ LSTRKEY( "delete" ),  LFUNCVAL( net_socket_delete ) },
@@ -10,6 +10,7 @@
 #include "lobject.h"
 #include "lstate.h"
 #include "legc.h"
+#include "lheap.h"
 
 #include "lopcodes.h"
 #include "lstring.h"
@@ -27,6 +28,7 @@
 #include "user_version.h"
 #include "rom.h"
 #include "task/task.h"
+#include "trace.h"
 
 #define CPU80MHZ 80
 #define CPU160MHZ 160
@@ -34,6 +36,7 @@
 // Lua: restart()
 static int node_restart( lua_State* L )
 {
+  uart0_tx_flush();
   system_restart();
   return 0;
 }
@@ -60,8 +63,10 @@ static int node_deepsleep( lua_State* L )
     // if ( us <= 0 )
     if ( us < 0 )
       return luaL_error( L, "wrong arg range" );
-    else
+    else {
+      uart0_tx_flush();
       system_deep_sleep( us );
+    }
   }
   return 0;
 }
@@ -336,6 +341,55 @@ static int node_task_post( lua_State* L )
   return 0;
 }
 
+static void set_number_field (lua_State *L, const char *name, lua_Number n)
+{
+  lua_pushnumber(L, n);
+  lua_setfield(L, -2, name);
+}
+
+// Lua: node.task.stats([reset]) -- queue and handler counters, optionally reset
+static int node_task_stats( lua_State* L )
+{
+  static const char *const names[] = { "low", "medium", "high" };
+  int reset = lua_toboolean(L, 1);
+  unsigned p;
+  int i, n = task_count_handlers();
+
+  lua_createtable(L, 0, TASK_PRIORITY_COUNT + 1);
+  for (p = 0; p < TASK_PRIORITY_COUNT; p++) {
+    task_queue_stats_t qs;
+    task_queue_stats(p, &qs);
+    lua_createtable(L, 0, 6);
+    set_number_field(L, "posted", qs.posted);
+    set_number_field(L, "dropped", qs.dropped);
+    set_number_field(L, "coalesced", qs.coalesced);
+    set_number_field(L, "depth", qs.depth);
+    set_number_field(L, "max_depth", qs.max_depth);
+    set_number_field(L, "size", qs.size);
+    lua_setfield(L, -2, names[p]);
+  }
+
+  lua_createtable(L, n, 0);
+  for (i = 0; i < n; i++) {
+    task_callback_t func;
+    task_stats_t ts;
+    task_handler_stats(i, &func, &ts);
+    lua_createtable(L, 0, 6);
+    set_number_field(L, "handler", (size_t)func);
+    set_number_field(L, "count", ts.count);
+    set_number_field(L, "run_us", ts.run_us);
+    set_number_field(L, "run_max_us", ts.run_max_us);
+    set_number_field(L, "latency_us", ts.latency_us);
+    set_number_field(L, "latency_max_us", ts.latency_max_us);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "tasks");
+
+  if (reset)
+    task_reset_stats();
+  return 1;
+}
+
 // Lua: setcpufreq(mhz)
 // mhz is either CPU80MHZ od CPU160MHZ
 static int node_setcpufreq(lua_State* L)
@@ -467,6 +521,35 @@ static int node_osprint( lua_State* L )
   return 0;  
 }
 
+#ifdef TRACEPOINTS
+// Lua: node.trace.dump() prints the tracepoint records and drops them
+static int node_trace_dump( lua_State* L )
+{
+  trace_dump();
+  return 0;
+}
+
+// Lua: node.trace.mark([arg]) records a point of the Lua code
+static int node_trace_mark( lua_State* L )
+{
+  TRACE(TRACE_MARK, luaL_optinteger(L, 1, 0));
+  return 0;
+}
+
+// Lua: node.trace.stop() keeps the records there are, node.trace.start() adds again
+static int node_trace_stop( lua_State* L )
+{
+  trace_stopped = true;
+  return 0;
+}
+
+static int node_trace_start( lua_State* L )
+{
+  trace_stopped = false;
+  return 0;
+}
+#endif
+
 // Module function map
 
 static const LUA_REG_TYPE node_egc_map[] = {
@@ -479,11 +562,21 @@ static const LUA_REG_TYPE node_egc_map[] = {
 };
 static const LUA_REG_TYPE node_task_map[] = {
   { LSTRKEY( "post" ),            LFUNCVAL( node_task_post ) },
+  { LSTRKEY( "stats" ),           LFUNCVAL( node_task_stats ) },
   { LSTRKEY( "LOW_PRIORITY" ),    LNUMVAL( TASK_PRIORITY_LOW ) },
   { LSTRKEY( "MEDIUM_PRIORITY" ), LNUMVAL( TASK_PRIORITY_MEDIUM ) },
   { LSTRKEY( "HIGH_PRIORITY" ),   LNUMVAL( TASK_PRIORITY_HIGH ) },
   { LNILKEY, LNILVAL }
 };
+#ifdef TRACEPOINTS
+static const LUA_REG_TYPE node_trace_map[] = {
+  { LSTRKEY( "dump" ),  LFUNCVAL( node_trace_dump ) },
+  { LSTRKEY( "mark" ),  LFUNCVAL( node_trace_mark ) },
+  { LSTRKEY( "start" ), LFUNCVAL( node_trace_start ) },
+  { LSTRKEY( "stop" ),  LFUNCVAL( node_trace_stop ) },
+  { LNILKEY, LNILVAL }
+};
+#endif
 
 static const LUA_REG_TYPE node_map[] =
 {
@@ -494,6 +587,7 @@ static const LUA_REG_TYPE node_map[] =
   { LSTRKEY( "flashid" ), LFUNCVAL( node_flashid ) },
   { LSTRKEY( "flashsize" ), LFUNCVAL( node_flashsize) },
   { LSTRKEY( "heap" ), LFUNCVAL( node_heap ) },
+  { LSTRKEY( "heapinfo" ), LFUNCVAL( lheap_info ) },
   { LSTRKEY( "input" ), LFUNCVAL( node_input ) },
   { LSTRKEY( "output" ), LFUNCVAL( node_output ) },
 // Moved to adc module, use adc.readvdd33()
@@ -509,6 +603,9 @@ static const LUA_REG_TYPE node_map[] =
 #endif
   { LSTRKEY( "egc" ),  LROVAL( node_egc_map ) },
   { LSTRKEY( "task" ), LROVAL( node_task_map ) },
+#ifdef TRACEPOINTS
+  { LSTRKEY( "trace" ), LROVAL( node_trace_map ) },
+#endif
 #ifdef DEVELOPMENT_TOOLS
   { LSTRKEY( "osprint" ), LFUNCVAL( node_osprint ) },
 #endif
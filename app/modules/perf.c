@@ -4,6 +4,11 @@
 // 
 // perf.start(start, end, nbins[, pc offset on stack])
 // perf.stop()  -> total sample, samples outside range, table { addr -> count , .. }
+//
+// and by sampling the Lua call stack at regular intervals
+//
+// perf.luastart([interval us[, depth[, nstacks]]])
+// perf.luastop()  -> total samples, table { folded stack -> count, .. }, samples dropped
 
 
 #include "ets_sys.h"
@@ -138,9 +143,243 @@ static int perf_stop(lua_State *L)
   return 4;
 }
 
+/*
+ * The Lua profiler. The timer only sets a flag; a count hook polls it
+ * every LPROF_HOOK_COUNT VM instructions and, when set, walks the stack
+ * at that safe point. Time spent in a C function is thus counted to the
+ * Lua line that called it. A sample is a stack of frames, each the index
+ * of its function in a table of names and its current line, and samples
+ * are counted in an open addressed table of distinct stacks.
+ */
+
+#define LPROF_OWNER      ((os_param_t) 'l')
+#define LPROF_HOOK_COUNT 100
+#define LPROF_DEPTH_MAX  16
+
+typedef struct {
+  int ref;
+  int names_ref;        // function -> index, index -> frame name
+  uint16_t nnames;
+  uint16_t depth;       // frames per stack
+  uint16_t nstacks;
+  uint32_t total_samples;
+  uint32_t dropped_samples;
+  // nstacks entries of a count and depth frames, function index << 16 | line,
+  // with frames past the bottom of the stack 0
+  uint32_t stack[1];
+} LPROF;
+
+static LPROF *lprof;
+static volatile bool lprof_due;
+
+static void ICACHE_RAM_ATTR lprof_timer_cb(os_param_t p)
+{
+  (void) p;
+  lprof_due = true;
+}
+
+// Returns the index of the function pushed by lua_getinfo(L, "f"), popping it
+static uint32_t lprof_name_index(lua_State *L, lua_Debug *ar)
+{
+  lua_rawgeti(L, LUA_REGISTRYINDEX, lprof->names_ref);
+  lua_pushvalue(L, -2);
+  lua_rawget(L, -2);
+  uint32_t index = lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  if (!index && lprof->nnames < 0xFFFF) {
+    const char *name = ar->name && os_strcmp(ar->name, "?") ? ar->name : NULL;
+    index = ++lprof->nnames;
+    lua_pushvalue(L, -2);
+    lua_pushinteger(L, index);
+    lua_rawset(L, -3);
+    // Local names are stripped at the default debug level, a function
+    // without one goes by the line it is defined on
+    if (*ar->what == 'C')
+      lua_pushfstring(L, "%s [C]", name ? name : "?");
+    else if (name)
+      lua_pushfstring(L, "%s (%s:", name, ar->short_src);
+    else if (*ar->what == 'm')
+      lua_pushfstring(L, "main (%s:", ar->short_src);
+    else
+      lua_pushfstring(L, "<%d> (%s:", ar->linedefined, ar->short_src);
+    lua_rawseti(L, -2, index);
+  }
+  lua_pop(L, 2);
+  return index;
+}
+
+static void lprof_sample(lua_State *L)
+{
+  uint32_t frame[LPROF_DEPTH_MAX];
+  uint32_t hash = 2166136261u;
+  lua_Debug ar;
+  int level, n = 0, i;
+
+  for (level = 0; n < lprof->depth && lua_getstack(L, level, &ar); level++) {
+    lua_getinfo(L, "Slnf", &ar);
+    if (*ar.what == 't') {    // tail call: nothing left of the caller
+      lua_pop(L, 1);
+      continue;
+    }
+    uint32_t line = ar.currentline > 0 ? (ar.currentline > 0xFFFF ? 0xFFFF : ar.currentline) : 0;
+    frame[n] = lprof_name_index(L, &ar) << 16 | line;
+    hash = (hash ^ frame[n]) * 16777619u;
+    n++;
+  }
+  for (i = n; i < lprof->depth; i++)
+    frame[i] = 0;
+
+  lprof->total_samples++;
+  uint32_t size = 1 + lprof->depth;
+  uint32_t slot = hash % lprof->nstacks;
+  for (i = 0; i < lprof->nstacks; i++) {
+    uint32_t *entry = &lprof->stack[slot * size];
+    if (!entry[0]) {
+      memcpy(entry + 1, frame, lprof->depth * sizeof(uint32_t));
+      entry[0] = 1;
+      return;
+    }
+    if (!memcmp(entry + 1, frame, lprof->depth * sizeof(uint32_t))) {
+      entry[0]++;
+      return;
+    }
+    if (++slot == lprof->nstacks)
+      slot = 0;
+  }
+  lprof->dropped_samples++;
+}
+
+static void lprof_hook(lua_State *L, lua_Debug *ar)
+{
+  (void) ar;
+  if (!lprof) {
+    // A coroutine created while profiling still has the hook
+    lua_sethook(L, NULL, 0, 0);
+    return;
+  }
+  if (lprof_due) {
+    lprof_due = false;
+    lprof_sample(L);
+  }
+}
+
+static void lprof_close(lua_State *L)
+{
+  platform_hw_timer_close(LPROF_OWNER);
+  lua_sethook(L, NULL, 0, 0);
+  luaL_unref(L, LUA_REGISTRYINDEX, lprof->names_ref);
+  luaL_unref(L, LUA_REGISTRYINDEX, lprof->ref);
+  lprof = NULL;
+}
+
+// Lua: perf.luastart([interval us[, depth[, nstacks]]])
+static int perf_luastart(lua_State *L)
+{
+  uint32_t interval = luaL_optinteger(L, 1, 1000);
+  uint32_t depth = luaL_optinteger(L, 2, 8);
+  uint32_t nstacks = luaL_optinteger(L, 3, 64);
+
+  luaL_argcheck(L, interval >= 100, 1, "at least 100 us");
+  luaL_argcheck(L, depth > 0 && depth <= LPROF_DEPTH_MAX, 2, "out of range");
+  luaL_argcheck(L, nstacks > 0 && nstacks <= 0xFFFF, 3, "out of range");
+
+  // The profiler runs on the main thread, whatever called this
+  lua_State *L0 = lua_getstate();
+  if (lprof)
+    lprof_close(L0);
+
+  size_t data_size = sizeof(LPROF) + nstacks * (1 + depth) * sizeof(uint32_t);
+  LPROF *d = (LPROF *) lua_newuserdata(L, data_size);
+  memset(d, 0, data_size);
+  d->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_newtable(L);
+  d->names_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  d->depth = depth;
+  d->nstacks = nstacks;
+  lprof = d;
+
+  if (!platform_hw_timer_init(LPROF_OWNER, FRC1_SOURCE, TRUE)) {
+    lprof_close(L0);
+    return luaL_error(L, "Unable to initialize timer");
+  }
+  lprof_due = false;
+  lua_sethook(L0, lprof_hook, LUA_MASKCOUNT, LPROF_HOOK_COUNT);
+  if (L != L0)
+    lua_sethook(L, lprof_hook, LUA_MASKCOUNT, LPROF_HOOK_COUNT);
+  platform_hw_timer_set_func(LPROF_OWNER, lprof_timer_cb, 0);
+  platform_hw_timer_arm_us(LPROF_OWNER, interval);
+  return 0;
+}
+
+// Lua: total, stacks, dropped = perf.luastop()
+static int perf_luastop(lua_State *L)
+{
+  if (!lprof)
+    return 0;
+
+  LPROF *d = lprof;
+  platform_hw_timer_close(LPROF_OWNER);
+  lprof = NULL;
+  lua_sethook(lua_getstate(), NULL, 0, 0);
+  lua_sethook(L, NULL, 0, 0);
+
+  lua_pushnumber(L, d->total_samples);
+  lua_newtable(L);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, d->names_ref);
+  int names = lua_gettop(L);
+  uint32_t size = 1 + d->depth;
+  int i, j;
+  for (i = 0; i < d->nstacks; i++) {
+    uint32_t *entry = &d->stack[i * size];
+    if (!entry[0])
+      continue;
+    // Folded: the outermost frame first, separated by semicolons
+    luaL_Buffer b;
+    bool first = true;
+    luaL_buffinit(L, &b);
+    for (j = d->depth; j > 0; j--) {
+      uint32_t frame = entry[j];
+      if (!frame)
+        continue;
+      if (!first)
+        luaL_addchar(&b, ';');
+      first = false;
+      // Index 0 when the names ran out
+      lua_rawgeti(L, names, frame >> 16);
+      if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        lua_pushliteral(L, "?");
+      }
+      // Lua functions end in "(source:", C functions have no line
+      size_t len;
+      const char *name = lua_tolstring(L, -1, &len);
+      bool lua_function = len && name[len - 1] == ':';
+      luaL_addvalue(&b);
+      if (lua_function) {
+        if (frame & 0xFFFF)
+          lua_pushfstring(L, "%d)", (int) (frame & 0xFFFF));
+        else
+          lua_pushliteral(L, "?)");
+        luaL_addvalue(&b);
+      }
+    }
+    luaL_pushresult(&b);
+    lua_pushnumber(L, entry[0]);
+    lua_settable(L, names - 1);
+  }
+  lua_pop(L, 1);
+  lua_pushnumber(L, d->dropped_samples);
+
+  luaL_unref(L, LUA_REGISTRYINDEX, d->names_ref);
+  luaL_unref(L, LUA_REGISTRYINDEX, d->ref);
+  return 3;
+}
+
 static const LUA_REG_TYPE perf_map[] = {
   { LSTRKEY( "start" ),   LFUNCVAL( perf_start ) },
   { LSTRKEY( "stop" ),    LFUNCVAL( perf_stop ) },
+  { LSTRKEY( "luastart" ), LFUNCVAL( perf_luastart ) },
+  { LSTRKEY( "luastop" ),  LFUNCVAL( perf_luastop ) },
   { LNILKEY, LNILVAL }
 };
 
@@ -25,6 +25,10 @@
 ** f - float
 ** d - double
 ** ' ' - ignored
+**
+** Formats are compiled into a list of fields with their endianness and
+** alignment settled, see struct.compile(). Format strings passed to pack,
+** unpack and size are compiled once and kept in a cache of weak values.
 */
 
 
@@ -134,18 +138,6 @@ static size_t optsize (lua_State *L, char opt, const char **fmt) {
 }
 
 
-/*
-** return number of bytes needed to align an element of size 'size'
-** at current position 'len'
-*/
-static int gettoalign (size_t len, Header *h, int opt, size_t size) {
-  if (size == 0 || opt == 'c') return 0;
-  if (size > (size_t)h->align)
-    size = h->align;  /* respect max. alignment */
-  return (size - (len & (size - 1))) & (size - 1);
-}
-
-
 /*
 ** options to control endianess and alignment
 */
@@ -209,25 +201,130 @@ static void correctbytes (char *b, int size, int endian) {
 }
 
 
+/*
+** {======================================================
+** Compiled formats
+** =======================================================
+*/
+
+#define LAYOUT_METATABLE "struct.layout"
+
+static int cache_ref = LUA_NOREF;  /* compiled formats, by format string */
+
+#ifndef LUA_NUMBER_INTEGRAL
+#define FIELD_OPTIONS "bBhHlLTiIxcsfd"
+#else
+#define FIELD_OPTIONS "bBhHlLTiIxcs"
+#endif
+
+typedef struct Field {
+  char opt;             /* format option */
+  char endian;
+  unsigned char align;  /* alignment before the field, 0 for none */
+  size_t size;          /* 0 for 's' and 'c0' */
+} Field;
+
+typedef struct Layout {
+  int nfields;
+  int size;  /* packed size, -1 when it depends on the data */
+  Field field[1];
+} Layout;
+
+
+/*
+** number of bytes needed to align position 'pos' to 'align'
+*/
+#define toalign(pos, align) \
+  ((align) ? ((align) - ((pos) & ((align) - 1))) & ((align) - 1) : 0)
+
+
+/*
+** parse a format string into a new layout userdata on the stack; every
+** option takes at least one character, so 'len' fields are enough
+*/
+static Layout *compile (lua_State *L, const char *fmt, size_t len) {
+  Layout *lay = (Layout *)lua_newuserdata(L, sizeof(Layout) +
+                                             (len ? len - 1 : 0) * sizeof(Field));
+  Header h;
+  size_t pos = 0;
+  int fixed = 1;
+  defaultoptions(&h);
+  lay->nfields = 0;
+  while (*fmt) {
+    int opt = *fmt++;
+    size_t size = optsize(L, opt, &fmt);
+    Field *f;
+    int align;
+    if (!strchr(FIELD_OPTIONS, opt)) {
+      controloptions(L, opt, &fmt, &h);
+      continue;
+    }
+    f = &lay->field[lay->nfields++];
+    align = (size == 0 || opt == 'c') ? 0 : (size > (size_t)h.align ? h.align : (int)size);
+    f->opt = opt;
+    f->endian = h.endian;
+    f->align = align > 1 ? align : 0;
+    f->size = size;
+    pos += toalign(pos, f->align) + size;
+    if (opt == 's' || (opt == 'c' && size == 0))
+      fixed = 0;
+  }
+  lay->size = fixed ? (int)pos : -1;
+  luaL_getmetatable(L, LAYOUT_METATABLE);
+  lua_setmetatable(L, -2);
+  return lay;
+}
+
+
+/*
+** the layout given as first argument, either compiled or as a format
+** string; a format is looked up in the cache and compiled when missing.
+** The layout replaces the format string on the stack, keeping it alive.
+*/
+static const Layout *getlayout (lua_State *L) {
+  size_t len;
+  const char *fmt;
+  Layout *lay;
+  if (lua_type(L, 1) == LUA_TUSERDATA)
+    return (const Layout *)luaL_checkudata(L, 1, LAYOUT_METATABLE);
+  fmt = luaL_checklstring(L, 1, &len);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, cache_ref);
+  lua_pushvalue(L, 1);
+  lua_rawget(L, -2);
+  lay = (Layout *)lua_touserdata(L, -1);
+  if (lay == NULL) {
+    lua_pop(L, 1);
+    lay = compile(L, fmt, len);
+    lua_pushvalue(L, 1);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4);
+  }
+  lua_replace(L, 1);
+  lua_pop(L, 1);  /* cache */
+  return lay;
+}
+
+/* }====================================================== */
+
+
 static int b_pack (lua_State *L) {
   luaL_Buffer b;
-  const char *fmt = luaL_checkstring(L, 1);
-  Header h;
+  const Layout *lay = getlayout(L);
+  const Field *f = lay->field, *end = f + lay->nfields;
   int arg = 2;
   size_t totalsize = 0;
-  defaultoptions(&h);
   lua_pushnil(L);  /* mark to separate arguments from string buffer */
   luaL_buffinit(L, &b);
-  while (*fmt != '\0') {
-    int opt = *fmt++;
-    size_t size = optsize(L, opt, &fmt);
-    int toalign = gettoalign(totalsize, &h, opt, size);
-    totalsize += toalign;
-    while (toalign-- > 0) luaL_addchar(&b, '\0');
+  for (; f < end; f++) {
+    int opt = f->opt;
+    size_t size = f->size;
+    int align = toalign(totalsize, f->align);
+    totalsize += align;
+    while (align-- > 0) luaL_addchar(&b, '\0');
     switch (opt) {
       case 'b': case 'B': case 'h': case 'H':
       case 'l': case 'L': case 'T': case 'i': case 'I': {  /* integer types */
-        putinteger(L, &b, arg++, h.endian, size);
+        putinteger(L, &b, arg++, f->endian, size);
         break;
       }
       case 'x': {
@@ -236,14 +333,14 @@ static int b_pack (lua_State *L) {
       }
 #ifndef LUA_NUMBER_INTEGRAL
       case 'f': {
-        float f = (float)luaL_checknumber(L, arg++);
-        correctbytes((char *)&f, size, h.endian);
-        luaL_addlstring(&b, (char *)&f, size);
+        float fl = (float)luaL_checknumber(L, arg++);
+        correctbytes((char *)&fl, size, f->endian);
+        luaL_addlstring(&b, (char *)&fl, size);
         break;
       }
       case 'd': {
         double d = luaL_checknumber(L, arg++);
-        correctbytes((char *)&d, size, h.endian);
+        correctbytes((char *)&d, size, f->endian);
         luaL_addlstring(&b, (char *)&d, size);
         break;
       }
@@ -260,7 +357,6 @@ static int b_pack (lua_State *L) {
         }
         break;
       }
-      default: controloptions(L, opt, &fmt, &h);
     }
     totalsize += size;
   }
@@ -297,24 +393,23 @@ static lua_Number getinteger (const char *buff, int endian,
 
 
 static int b_unpack (lua_State *L) {
-  Header h;
-  const char *fmt = luaL_checkstring(L, 1);
+  const Layout *lay = getlayout(L);
+  const Field *f = lay->field, *end = f + lay->nfields;
   size_t ld;
   const char *data = luaL_checklstring(L, 2, &ld);
   size_t pos = luaL_optinteger(L, 3, 1) - 1;
-  defaultoptions(&h);
   lua_settop(L, 2);
-  while (*fmt) {
-    int opt = *fmt++;
-    size_t size = optsize(L, opt, &fmt);
-    pos += gettoalign(pos, &h, opt, size);
+  luaL_checkstack(L, lay->nfields + 1, "too many results");
+  for (; f < end; f++) {
+    int opt = f->opt;
+    size_t size = f->size;
+    pos += toalign(pos, f->align);
     luaL_argcheck(L, pos+size <= ld, 2, "data string too short");
-    luaL_checkstack(L, 2, "too many results");
     switch (opt) {
       case 'b': case 'B': case 'h': case 'H':
       case 'l': case 'L': case 'T': case 'i':  case 'I': {  /* integer types */
         int issigned = islower(opt);
-        lua_Number res = getinteger(data+pos, h.endian, issigned, size);
+        lua_Number res = getinteger(data+pos, f->endian, issigned, size);
         lua_pushnumber(L, res);
         break;
       }
@@ -323,16 +418,16 @@ static int b_unpack (lua_State *L) {
       }
 #ifndef LUA_NUMBER_INTEGRAL
       case 'f': {
-        float f;
-        memcpy(&f, data+pos, size);
-        correctbytes((char *)&f, sizeof(f), h.endian);
-        lua_pushnumber(L, f);
+        float fl;
+        memcpy(&fl, data+pos, size);
+        correctbytes((char *)&fl, sizeof(fl), f->endian);
+        lua_pushnumber(L, fl);
         break;
       }
       case 'd': {
         double d;
         memcpy(&d, data+pos, size);
-        correctbytes((char *)&d, sizeof(d), h.endian);
+        correctbytes((char *)&d, sizeof(d), f->endian);
         lua_pushnumber(L, d);
         break;
       }
@@ -356,7 +451,6 @@ static int b_unpack (lua_State *L) {
         lua_pushlstring(L, data+pos, size - 1);
         break;
       }
-      default: controloptions(L, opt, &fmt, &h);
     }
     pos += size;
   }
@@ -366,23 +460,22 @@ static int b_unpack (lua_State *L) {
 
 
 static int b_size (lua_State *L) {
-  Header h;
-  const char *fmt = luaL_checkstring(L, 1);
-  size_t pos = 0;
-  defaultoptions(&h);
-  while (*fmt) {
-    int opt = *fmt++;
-    size_t size = optsize(L, opt, &fmt);
-    pos += gettoalign(pos, &h, opt, size);
-    if (opt == 's')
-      luaL_argerror(L, 1, "option 's' has no fixed size");
-    else if (opt == 'c' && size == 0)
-      luaL_argerror(L, 1, "option 'c0' has no fixed size");
-    if (!isalnum(opt))
-      controloptions(L, opt, &fmt, &h);
-    pos += size;
+  const Layout *lay = getlayout(L);
+  if (lay->size < 0) {
+    const Field *f = lay->field;
+    while (f->opt != 's' && (f->opt != 'c' || f->size != 0))
+      f++;
+    luaL_argerror(L, 1, f->opt == 's' ? "option 's' has no fixed size"
+                                      : "option 'c0' has no fixed size");
   }
-  lua_pushinteger(L, pos);
+  lua_pushinteger(L, lay->size);
+  return 1;
+}
+
+
+static int b_compile (lua_State *L) {
+  getlayout(L);
+  lua_settop(L, 1);
   return 1;
 }
 
@@ -390,15 +483,36 @@ static int b_size (lua_State *L) {
 
 
 
+static const LUA_REG_TYPE layout_map[] = {
+  {LSTRKEY("pack"), LFUNCVAL(b_pack)},
+  {LSTRKEY("unpack"), LFUNCVAL(b_unpack)},
+  {LSTRKEY("size"), LFUNCVAL(b_size)},
+  {LSTRKEY("__index"), LROVAL(layout_map)},
+  {LNILKEY, LNILVAL}
+};
+
 static const LUA_REG_TYPE thislib[] = {
   {LSTRKEY("pack"), LFUNCVAL(b_pack)},
   {LSTRKEY("unpack"), LFUNCVAL(b_unpack)},
   {LSTRKEY("size"), LFUNCVAL(b_size)},
+  {LSTRKEY("compile"), LFUNCVAL(b_compile)},
   {LNILKEY, LNILVAL}
 };
 
 
-NODEMCU_MODULE(STRUCT, "struct", thislib, NULL);
+int luaopen_struct (lua_State *L) {
+  luaL_rometatable(L, LAYOUT_METATABLE, (void *)layout_map);
+  lua_newtable(L);
+  lua_newtable(L);
+  lua_pushliteral(L, "v");
+  lua_setfield(L, -2, "__mode");
+  lua_setmetatable(L, -2);
+  cache_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  return 0;
+}
+
+
+NODEMCU_MODULE(STRUCT, "struct", thislib, luaopen_struct);
 
 /******************************************************************************
 * Copyright (C) 2010-2012 Lua.org, PUC-Rio.  All rights reserved.
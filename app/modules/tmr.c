@@ -53,6 +53,7 @@ tmr.softwd(int)
 #include "platform.h"
 #include "c_types.h"
 #include "user_interface.h"
+#include "tmr_wheel.h"
 
 #define TIMER_MODE_OFF 3
 #define TIMER_MODE_SINGLE 0
@@ -64,13 +65,15 @@ tmr.softwd(int)
 #define STRINGIFY(x) STRINGIFY_VAL(x)
 
 // assuming system_timer_reinit() has *not* been called
-#define MAX_TIMEOUT_DEF 6870947  //SDK 1.5.3 limit (0x68D7A3)
+#define MAX_ARM_DEF 6870947  //SDK 1.5.3 limit (0x68D7A3)
+// the timer wheel takes up to 2^31 ms, less some slack for its clock
+#define MAX_TIMEOUT_DEF 2000000000
 
 static const uint32 MAX_TIMEOUT=MAX_TIMEOUT_DEF;
 static const char* MAX_TIMEOUT_ERR_STR = "Range: 1-"STRINGIFY(MAX_TIMEOUT_DEF);
 
 typedef struct{
-	os_timer_t os;
+	tmr_wheel_node_t node;
 	sint32_t lua_ref, self_ref;
 	uint32_t interval;
 	uint8_t mode;
@@ -94,11 +97,75 @@ static sint32_t soft_watchdog  = -1;
 static timer_struct_t alarm_timers[NUM_TMR];
 static os_timer_t rtc_timer;
 
-static void alarm_timer_common(void* arg){
-	timer_t tmr = (timer_t)arg;
+// All alarms are nodes of one timer wheel, which ticks in milliseconds
+// and is driven by a single SDK timer armed for its next expiry
+static tmr_wheel_t wheel;
+static os_timer_t wheel_timer;
+static uint32_t wheel_ms, wheel_us;
+static uint32_t wheel_armed;       // tick wheel_timer is armed for
+static bool wheel_is_armed, wheel_running;
+
+// Milliseconds since boot, from the microsecond counter, which wraps in
+// 71 minutes: the rtc timer calls this every second to keep up
+static uint32_t wheel_now(void){
+	uint32_t us = system_get_time();
+	uint32_t elapsed = us - wheel_us;
+	wheel_ms += elapsed / 1000;
+	wheel_us = us - elapsed % 1000;
+	return wheel_ms;
+}
+
+static void wheel_arm(void){
+	uint32_t next;
+	if (wheel_running || !tmr_wheel_next(&wheel, &next))
+		return;
+	if (wheel_is_armed && (int32_t)(next - wheel_armed) >= 0)
+		return;
+	sint32_t delay = next - wheel_now();
+	if (delay < 0)
+		delay = 0;
+	if (delay > MAX_ARM_DEF)
+		delay = MAX_ARM_DEF;
+	ets_timer_disarm(&wheel_timer);
+	ets_timer_arm_new(&wheel_timer, delay, 0, 1);
+	wheel_armed = wheel_ms + delay;
+	wheel_is_armed = true;
+}
+
+static void alarm_timer_common(tmr_wheel_node_t *node);
+
+static void wheel_callback(void *arg){
+	wheel_is_armed = false;
+	wheel_running = true;
+	tmr_wheel_run(&wheel, wheel_now(), alarm_timer_common);
+	wheel_running = false;
+	wheel_arm();
+}
+
+static void wheel_start(timer_t tmr){
+	uint32_t now = wheel_now(), next;
+	// With nothing due, bring the wheel up to now so that long intervals
+	// are taken from here; this runs no alarms
+	if (!tmr_wheel_next(&wheel, &next) || (int32_t)(next - now) > 0)
+		tmr_wheel_run(&wheel, now, alarm_timer_common);
+	tmr_wheel_add(&wheel, &tmr->node, now + tmr->interval);
+	wheel_arm();
+}
+
+static void alarm_timer_common(tmr_wheel_node_t *node){
+	timer_t tmr = (timer_t)node;
 	lua_State* L = lua_getstate();
 	if(tmr->lua_ref == LUA_NOREF)
 		return;
+	if(tmr->mode == TIMER_MODE_AUTO){
+		// Next period from this expiry rather than from now, so the alarm
+		// does not drift; periods already missed are skipped
+		uint32_t expires = node->expires + tmr->interval;
+		uint32_t late = wheel.now - expires;
+		if ((int32_t)late > 0)
+			expires += (late / tmr->interval + 1) * tmr->interval;
+		tmr_wheel_add(&wheel, node, expires);
+	}
 	lua_rawgeti(L, LUA_REGISTRYINDEX, tmr->lua_ref);
 	if (tmr->self_ref == LUA_REFNIL) {
 		uint32_t id = tmr - alarm_timers;
@@ -172,14 +239,13 @@ static int tmr_register(lua_State* L){
 	lua_pushvalue(L, 4);
 	sint32_t ref = luaL_ref(L, LUA_REGISTRYINDEX);
 	if(!(tmr->mode & TIMER_IDLE_FLAG) && tmr->mode != TIMER_MODE_OFF)
-		ets_timer_disarm(&tmr->os);
+		tmr_wheel_del(&wheel, &tmr->node);
 	//there was a bug in this part, the second part of the following condition was missing
 	if(tmr->lua_ref != LUA_NOREF && tmr->lua_ref != ref)
 		luaL_unref(L, LUA_REGISTRYINDEX, tmr->lua_ref);
 	tmr->lua_ref = ref;
 	tmr->mode = mode|TIMER_IDLE_FLAG;
 	tmr->interval = interval;
-	ets_timer_setfn(&tmr->os, alarm_timer_common, tmr);
 	return 0;  
 }
 
@@ -197,7 +263,7 @@ static int tmr_start(lua_State* L){
 		lua_pushboolean(L, 0);
 	}else{
 		tmr->mode &= ~TIMER_IDLE_FLAG;
-		ets_timer_arm_new(&tmr->os, tmr->interval, tmr->mode==TIMER_MODE_AUTO, 1);
+		wheel_start(tmr);
 		lua_pushboolean(L, 1);
 	}
 	return 1;
@@ -221,7 +287,7 @@ static int tmr_stop(lua_State* L){
 	//we return false if the timer is idle (of not registered)
 	if(!(tmr->mode & TIMER_IDLE_FLAG) && tmr->mode != TIMER_MODE_OFF){
 		tmr->mode |= TIMER_IDLE_FLAG;
-		ets_timer_disarm(&tmr->os);
+		tmr_wheel_del(&wheel, &tmr->node);
 		lua_pushboolean(L, 1);
 	}else{
 		lua_pushboolean(L, 0);
@@ -239,7 +305,7 @@ static int tmr_unregister(lua_State* L){
 	}
 
 	if(!(tmr->mode & TIMER_IDLE_FLAG) && tmr->mode != TIMER_MODE_OFF)
-		ets_timer_disarm(&tmr->os);
+		tmr_wheel_del(&wheel, &tmr->node);
 	if(tmr->lua_ref != LUA_NOREF)
 		luaL_unref(L, LUA_REGISTRYINDEX, tmr->lua_ref);
 	tmr->lua_ref = LUA_NOREF;
@@ -255,10 +321,8 @@ static int tmr_interval(lua_State* L){
 	luaL_argcheck(L, (interval > 0 && interval <= MAX_TIMEOUT), 2, MAX_TIMEOUT_ERR_STR);
 	if(tmr->mode != TIMER_MODE_OFF){	
 		tmr->interval = interval;
-		if(!(tmr->mode&TIMER_IDLE_FLAG)){
-			ets_timer_disarm(&tmr->os);
-			ets_timer_arm_new(&tmr->os, tmr->interval, tmr->mode==TIMER_MODE_AUTO, 1);
-		}
+		if(!(tmr->mode&TIMER_IDLE_FLAG))
+			wheel_start(tmr);
 	}
 	return 0;
 }
@@ -319,6 +383,7 @@ inline static uint64_t rtc_timer_update(bool do_calibration){
 
 void rtc_callback(void *arg){
 	rtc_timer_update(true);
+	wheel_now();
 	if(soft_watchdog > 0){
 		soft_watchdog--;
 		if(soft_watchdog == 0)
@@ -348,7 +413,7 @@ static int tmr_create( lua_State *L ) {
 	ud->lua_ref = LUA_NOREF;
 	ud->self_ref = LUA_NOREF;
 	ud->mode = TIMER_MODE_OFF;
-	ets_timer_disarm(&ud->os);
+	tmr_wheel_node_init(&ud->node);
 	return 1;
 }
 
@@ -396,8 +461,12 @@ int luaopen_tmr( lua_State *L ){
 		alarm_timers[i].lua_ref = LUA_NOREF;
 		alarm_timers[i].self_ref = LUA_REFNIL;
 		alarm_timers[i].mode = TIMER_MODE_OFF;
-		ets_timer_disarm(&alarm_timers[i].os);
+		tmr_wheel_node_init(&alarm_timers[i].node);
 	}
+	wheel_us = system_get_time();
+	tmr_wheel_init(&wheel, 0);
+	ets_timer_disarm(&wheel_timer);
+	ets_timer_setfn(&wheel_timer, wheel_callback, NULL);
 	last_rtc_time=system_get_rtc_time(); // Right now is time 0
 	last_rtc_time_us=0;
 
@@ -0,0 +1,144 @@
+/*
+ * Hierarchical timer wheel, see tmr_wheel.h
+ *
+ * A node is on level L when it expires less than 32^(L+1) ticks after now,
+ * in slot (expires >> 5L) & 31. Every 32^L ticks, when the low 5L bits of
+ * the tick are zero, the level L slot of that tick is cascaded: its nodes
+ * are added again, now landing on lower levels. Each slot is a list linked
+ * through pprev, so a node is deleted without knowing its neighbours.
+ */
+
+#include "tmr_wheel.h"
+#include "c_string.h"
+
+#define LEVEL_SHIFT(l)  ((l) * TMR_WHEEL_BITS)
+#define SLOT_MASK       (TMR_WHEEL_SLOTS - 1)
+
+static inline uint32_t rotr (uint32_t x, unsigned n) {
+  return n ? (x >> n) | (x << (32 - n)) : x;
+}
+
+static void slot_link (tmr_wheel_t *w, tmr_wheel_node_t *n) {
+  uint32_t delta = n->expires - w->now;
+  unsigned level, index;
+
+  for (level = 0; level < TMR_WHEEL_LEVELS - 1; level++)
+    if (delta < (1u << LEVEL_SHIFT(level + 1)))
+      break;
+  // Beyond the top level the index aliases, which only cascades it early
+  index = (n->expires >> LEVEL_SHIFT(level)) & SLOT_MASK;
+
+  tmr_wheel_node_t **head = &w->slot[level][index];
+  n->next = *head;
+  if (n->next)
+    n->next->pprev = &n->next;
+  n->pprev = head;
+  *head = n;
+  n->slot = level * TMR_WHEEL_SLOTS + index;
+  w->pending[level] |= 1u << index;
+}
+
+static void slot_unlink (tmr_wheel_t *w, tmr_wheel_node_t *n) {
+  *n->pprev = n->next;
+  if (n->next)
+    n->next->pprev = n->pprev;
+  if (n->slot < TMR_WHEEL_LEVELS * TMR_WHEEL_SLOTS) {
+    unsigned level = n->slot / TMR_WHEEL_SLOTS, index = n->slot % TMR_WHEEL_SLOTS;
+    if (!w->slot[level][index])
+      w->pending[level] &= ~(1u << index);
+  }
+  n->slot = TMR_WHEEL_IDLE;
+}
+
+void tmr_wheel_init (tmr_wheel_t *w, uint32_t now) {
+  c_memset(w, 0, sizeof(*w));
+  w->now = now;
+}
+
+void tmr_wheel_add (tmr_wheel_t *w, tmr_wheel_node_t *n, uint32_t expires) {
+  if (tmr_wheel_pending(n))
+    slot_unlink(w, n);
+  if ((int32_t)(expires - w->now) < 0)
+    expires = w->now;
+  n->expires = expires;
+  slot_link(w, n);
+}
+
+void tmr_wheel_del (tmr_wheel_t *w, tmr_wheel_node_t *n) {
+  if (tmr_wheel_pending(n))
+    slot_unlink(w, n);
+}
+
+bool tmr_wheel_next (const tmr_wheel_t *w, uint32_t *tick) {
+  bool found = false;
+  uint32_t best = 0;
+  unsigned level;
+
+  for (level = 0; level < TMR_WHEEL_LEVELS; level++) {
+    uint32_t bits = w->pending[level];
+    if (!bits)
+      continue;
+    // The first slot of this level that comes round, at or after now
+    unsigned shift = LEVEL_SHIFT(level);
+    uint32_t start = level ? ((w->now + (1u << shift) - 1) >> shift) << shift : w->now;
+    unsigned first = (start >> shift) & SLOT_MASK;
+    uint32_t t = start + ((uint32_t)__builtin_ctz(rotr(bits, first)) << shift);
+    if (!found || (int32_t)(t - best) < 0)
+      best = t;
+    found = true;
+  }
+  if (found)
+    *tick = best;
+  return found;
+}
+
+// Adds the nodes of a slot again, relative to the current tick
+static void cascade (tmr_wheel_t *w, unsigned level, unsigned index) {
+  tmr_wheel_node_t *n = w->slot[level][index];
+
+  w->slot[level][index] = NULL;
+  w->pending[level] &= ~(1u << index);
+  while (n) {
+    tmr_wheel_node_t *next = n->next;
+    slot_link(w, n);
+    n = next;
+  }
+}
+
+void tmr_wheel_run (tmr_wheel_t *w, uint32_t tick, tmr_wheel_fn_t fn) {
+  uint32_t t;
+
+  while ((int32_t)(tick - w->now) >= 0) {
+    if (!tmr_wheel_next(w, &t) || (int32_t)(t - tick) > 0) {
+      w->now = tick + 1;
+      return;
+    }
+    w->now = t;
+
+    unsigned level;
+    for (level = 1; level < TMR_WHEEL_LEVELS; level++) {
+      if (t & ((1u << LEVEL_SHIFT(level)) - 1))
+        break;
+      unsigned index = (t >> LEVEL_SHIFT(level)) & SLOT_MASK;
+      if (w->pending[level] & (1u << index))
+        cascade(w, level, index);
+    }
+
+    // Take the due nodes off the wheel first, nodes added while they run
+    // go to later ticks and nodes deleted meanwhile do not run
+    unsigned index = t & SLOT_MASK;
+    tmr_wheel_node_t *due = w->slot[0][index], *n;
+    w->slot[0][index] = NULL;
+    w->pending[0] &= ~(1u << index);
+    for (n = due; n; n = n->next)
+      n->slot = TMR_WHEEL_DUE;
+    if (due)
+      due->pprev = &due;
+    w->now = t + 1;
+
+    while ((n = due) != NULL) {
+      slot_unlink(w, n);
+      fn(n);
+    }
+  }
+}
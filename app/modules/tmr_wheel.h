@@ -0,0 +1,50 @@
+#ifndef APP_MODULES_TMR_WHEEL_H_
+#define APP_MODULES_TMR_WHEEL_H_
+
+#include "c_types.h"
+
+/*
+ * Hierarchical timer wheel on a tick counter, with constant time add and
+ * delete. Level 0 has a slot per tick for the next 32 ticks, each higher
+ * level a slot per 32 slots of the level below; a timer further away than
+ * the top level reaches is cascaded down again when that level comes round.
+ * The wheel is tickless: tmr_wheel_next() says when it next needs to run,
+ * and tmr_wheel_run() skips the ticks in between. Tick counts wrap, so a
+ * timer may be at most 2^31 - 1 ticks ahead.
+ */
+
+#define TMR_WHEEL_BITS    5
+#define TMR_WHEEL_SLOTS   (1 << TMR_WHEEL_BITS)
+#define TMR_WHEEL_LEVELS  4
+
+typedef struct tmr_wheel_node {
+  struct tmr_wheel_node *next, **pprev;
+  uint32_t expires;   // tick it runs at
+  uint8_t  slot;      // level * TMR_WHEEL_SLOTS + index, or TMR_WHEEL_IDLE
+} tmr_wheel_node_t;
+
+#define TMR_WHEEL_IDLE    0xFF
+#define TMR_WHEEL_DUE     0xFE  // taken off its slot, about to run
+
+typedef struct {
+  uint32_t now;                           // the next tick to run
+  uint32_t pending[TMR_WHEEL_LEVELS];     // bit per non-empty slot
+  tmr_wheel_node_t *slot[TMR_WHEEL_LEVELS][TMR_WHEEL_SLOTS];
+} tmr_wheel_t;
+
+typedef void (*tmr_wheel_fn_t)(tmr_wheel_node_t *node);
+
+void tmr_wheel_init(tmr_wheel_t *w, uint32_t now);
+static inline void tmr_wheel_node_init(tmr_wheel_node_t *n) { n->slot = TMR_WHEEL_IDLE; }
+static inline bool tmr_wheel_pending(const tmr_wheel_node_t *n) { return n->slot != TMR_WHEEL_IDLE; }
+
+// Adds a node to run at a tick, which is no earlier than the next one
+void tmr_wheel_add(tmr_wheel_t *w, tmr_wheel_node_t *n, uint32_t expires);
+// Removes a node if it is pending
+void tmr_wheel_del(tmr_wheel_t *w, tmr_wheel_node_t *n);
+// Gets the tick at which the wheel next has work, false if it is empty
+bool tmr_wheel_next(const tmr_wheel_t *w, uint32_t *tick);
+// Runs all nodes due up to and including a tick, tick by tick
+void tmr_wheel_run(tmr_wheel_t *w, uint32_t tick, tmr_wheel_fn_t fn);
+
+#endif
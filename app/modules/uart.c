@@ -7,8 +7,10 @@
 #include "c_types.h"
 #include "c_string.h"
 #include "rom.h"
+#include "task/task.h"
 
 static int uart_receive_rf = LUA_NOREF;
+static int uart_drain_rf = LUA_NOREF;
 bool run_input = true;
 bool uart_on_data_cb(const char *buf, size_t len){
   if(!buf || len==0)
@@ -24,6 +26,17 @@ bool uart_on_data_cb(const char *buf, size_t len){
   return !run_input;
 }
 
+// Runs the "drain" callback once the buffered output has gone to the UART
+static void uart_drained( task_param_t param, uint8 priority )
+{
+  task_coalesce_take( ( task_coalesce_t * )param, NULL );
+  if( uart_drain_rf == LUA_NOREF )
+    return;
+  lua_State *L = lua_getstate();
+  lua_rawgeti( L, LUA_REGISTRYINDEX, uart_drain_rf );
+  lua_call( L, 0, 0 );
+}
+
 uint16_t need_len = 0;
 int16_t end_char = -1;
 // Lua: uart.on("method", [number/char], function, [run_input])
@@ -80,6 +93,21 @@ static int uart_on( lua_State* L )
     } else {
       lua_pop(L, 1);
     }
+  }else if(sl == 5 && c_strcmp(method, "drain") == 0){
+    static task_handle_t drain_task = 0;
+    if(uart_drain_rf != LUA_NOREF){
+      luaL_unref(L, LUA_REGISTRYINDEX, uart_drain_rf);
+      uart_drain_rf = LUA_NOREF;
+    }
+    if(!lua_isnil(L, -1)){
+      uart_drain_rf = luaL_ref(L, LUA_REGISTRYINDEX);
+      if(!drain_task)
+        drain_task = task_get_id(uart_drained);
+      platform_uart_tx_notify(0, drain_task);
+    } else {
+      lua_pop(L, 1);
+      platform_uart_tx_notify(0, 0);
+    }
   }else{
     lua_pop(L, 1);
     return luaL_error( L, "method not supported" );
@@ -124,12 +152,13 @@ static int uart_alt( lua_State* L )
   return 0;
 }
 
-// Lua: write( id, string1, [string2], ..., [stringn] )
+// Lua: free = write( id, string1, [string2], ..., [stringn] )
+// Returns the room left in the output buffer, for UART 0
 static int uart_write( lua_State* L )
 {
-  int id;
+  int id, free;
   const char* buf;
-  size_t len, i;
+  size_t len;
   int total = lua_gettop( L ), s;
   
   id = luaL_checkinteger( L, 1 );
@@ -147,11 +176,14 @@ static int uart_write( lua_State* L )
     {
       luaL_checktype( L, s, LUA_TSTRING );
       buf = lua_tolstring( L, s, &len );
-      for( i = 0; i < len; i ++ )
-        platform_uart_send( id, buf[ i ] );
+      platform_uart_write( id, ( const uint8_t * )buf, len );
     }
   }
-  return 0;
+  free = platform_uart_tx_free( id );
+  if( free < 0 )
+    return 0;
+  lua_pushinteger( L, free );
+  return 1;
 }
 
 // Module function map
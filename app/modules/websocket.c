@@ -102,6 +102,7 @@ static int websocket_createClient(lua_State *L) {
   data->self_ref = LUA_NOREF; // only set when ws:connect is called
 
   ws_info *ws = (ws_info *) lua_newuserdata(L, sizeof(ws_info));
+  c_memset(ws, 0, sizeof(ws_info));
   ws->connectionState = 0;
   ws->extraHeaders = NULL;
   ws->onConnection = &websocketclient_onConnectionCallback;
@@ -236,6 +237,14 @@ static int websocketclient_config(lua_State *L) {
   }
   lua_pop(L, 1); // pop headers
 
+  lua_getfield(L, 2, "maxmessage");
+  if (!lua_isnil(L, -1)) {
+    int maxMessageSize = luaL_checkinteger(L, -1);
+    luaL_argcheck(L, maxMessageSize > 0, 2, "maxmessage must be positive");
+    ws->maxMessageSize = maxMessageSize;
+  }
+  lua_pop(L, 1); // pop maxmessage
+
   return 0;
 }
 
@@ -263,6 +272,30 @@ static int websocketclient_send(lua_State *L) {
   return 0;
 }
 
+static int websocketclient_stats(lua_State *L) {
+  NODE_DBG("websocketclient_stats is called.\n");
+
+  ws_info *ws = (ws_info *) luaL_checkudata(L, 1, METATABLE_WSCLIENT);
+
+  lua_createtable(L, 0, 7);
+  lua_pushinteger(L, ws->stats.bytesReceived);
+  lua_setfield(L, -2, "rx_bytes");
+  lua_pushinteger(L, ws->stats.bytesSent);
+  lua_setfield(L, -2, "tx_bytes");
+  lua_pushinteger(L, ws->stats.framesReceived);
+  lua_setfield(L, -2, "rx_frames");
+  lua_pushinteger(L, ws->stats.framesSent);
+  lua_setfield(L, -2, "tx_frames");
+  lua_pushinteger(L, ws->stats.messagesReceived);
+  lua_setfield(L, -2, "rx_messages");
+  lua_pushinteger(L, ws->stats.fragmentedMessages);
+  lua_setfield(L, -2, "rx_fragmented");
+  lua_pushinteger(L, ws->stats.largestMessage);
+  lua_setfield(L, -2, "rx_largest");
+
+  return 1;
+}
+
 static int websocketclient_close(lua_State *L) {
   NODE_DBG("websocketclient_close.\n");
   ws_info *ws = (ws_info *) luaL_checkudata(L, 1, METATABLE_WSCLIENT);  
@@ -320,6 +353,7 @@ static const LUA_REG_TYPE websocketclient_map[] =
   { LSTRKEY("connect"), LFUNCVAL(websocketclient_connect) },
   { LSTRKEY("send"), LFUNCVAL(websocketclient_send) },
   { LSTRKEY("close"), LFUNCVAL(websocketclient_close) },
+  { LSTRKEY("stats"), LFUNCVAL(websocketclient_stats) },
   { LSTRKEY("__gc" ), LFUNCVAL(websocketclient_gc) },
   { LSTRKEY("__index"), LROVAL(websocketclient_map) },
   { LNILKEY, LNILVAL }
@@ -121,7 +121,7 @@ static mqtt_message_t* fini_message(mqtt_connection_t* connection, int type, int
 
 void mqtt_msg_init(mqtt_connection_t* connection, uint8_t* buffer, uint16_t buffer_length)
 {
-  c_memset(connection, 0, sizeof(connection));
+  c_memset(connection, 0, sizeof(*connection));
   connection->buffer = buffer;
   connection->buffer_length = buffer_length;
 }
@@ -42,9 +42,9 @@ extern "C" {
 * POSSIBILITY OF SUCH DAMAGE.
 *
 */
-/* 7			6			5			4			3			2			1			0*/
-/*|      --- Message Type----			|  DUP Flag	|	   QoS Level		|	Retain	|
-/*										Remaining Length								 */
+/* 7			6			5			4			3			2			1			0
+ *|      --- Message Type----			|  DUP Flag	|	   QoS Level		|	Retain	|
+ *										Remaining Length								 */
 
 
 enum mqtt_message_type
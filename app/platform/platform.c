@@ -17,6 +17,15 @@
 #ifdef GPIO_INTERRUPT_ENABLE
 static task_handle_t gpio_task_handle;
 
+// Interrupts since the task last took them: a bit per pin in gpio_post,
+// and per pin their number, and the level and time of the last one
+static task_coalesce_t gpio_post;
+static struct {
+  uint32_t count;
+  uint32_t when;
+  uint8_t  level;
+} gpio_intr[NUM_GPIO];
+
 #ifdef GPIO_INTERRUPT_HOOK_ENABLE
 struct gpio_hook_entry {
   platform_hook_function func;
@@ -204,13 +213,17 @@ static void ICACHE_RAM_ATTR platform_gpio_intr_dispatcher (void *dummy){
     if (gpio_status&1) {
       int i = pin_num_inv[j];
       if (pin_int_type[i]) {
-        //disable interrupt
-        gpio_pin_intr_state_set(GPIO_ID_PIN(j), GPIO_PIN_INTR_DISABLE);
+        if (pin_int_type[i] >= GPIO_PIN_INTR_LOLEVEL) {
+          //disable level interrupts, we re-enable them when we execute the callback
+          gpio_pin_intr_state_set(GPIO_ID_PIN(j), GPIO_PIN_INTR_DISABLE);
+        }
         //clear interrupt status
         GPIO_REG_WRITE(GPIO_STATUS_W1TC_ADDRESS, BIT(j));
-        uint32 level = 0x1 & GPIO_INPUT_GET(GPIO_ID_PIN(j));
-	task_post_high (gpio_task_handle, (i<<1) + level);
-	// We re-enable the interrupt when we execute the callback
+        gpio_intr[i].count++;
+        gpio_intr[i].when = system_get_time();
+        gpio_intr[i].level = 0x1 & GPIO_INPUT_GET(GPIO_ID_PIN(j));
+        // Edges until the callback runs are counted into a single task
+        task_post_coalesced(TASK_PRIORITY_HIGH, gpio_task_handle, &gpio_post, BIT(i));
       }
     }
   }
@@ -223,6 +236,23 @@ void platform_gpio_init( task_handle_t gpio_task )
   ETS_GPIO_INTR_ATTACH(platform_gpio_intr_dispatcher, NULL);
 }
 
+/*
+ * Takes the interrupts of a pin since the last call, returning their number
+ * and the level and system_get_time() of the last one.
+ */
+uint32_t platform_gpio_take_intr( unsigned pin, unsigned *level, uint32_t *when )
+{
+  uint32_t count;
+
+  ETS_GPIO_INTR_DISABLE();
+  count = gpio_intr[pin].count;
+  *level = gpio_intr[pin].level;
+  *when = gpio_intr[pin].when;
+  gpio_intr[pin].count = 0;
+  ETS_GPIO_INTR_ENABLE();
+  return count;
+}
+
 #ifdef GPIO_INTERRUPT_HOOK_ENABLE
 /*
  * Register an ISR hook to be called from the GPIO ISR for a given GPIO bitmask.
@@ -424,6 +454,38 @@ void platform_uart_send( unsigned id, u8 data )
   uart_tx_one_char(id, data);
 }
 
+// Output to UART 0 is queued, and only waits while its buffer is full
+void platform_uart_write( unsigned id, const uint8_t *data, size_t len )
+{
+  if( id == 0 )
+  {
+    while( len )
+    {
+      uint16 n = len > 0xFFFF ? 0xFFFF : len;
+      uart0_tx_buffer( ( uint8 * )data, n );
+      data += n;
+      len -= n;
+    }
+    return;
+  }
+  while( len-- )
+    uart_tx_one_char( id, *data++ );
+}
+
+// Room in the output buffer of a UART, -1 if it has none
+int platform_uart_tx_free( unsigned id )
+{
+  return id == 0 ? uart0_tx_free() : -1;
+}
+
+// Posts handle, with a task_coalesce_t * as parameter, whenever the output
+// buffer of a UART has emptied; 0 for none
+void platform_uart_tx_notify( unsigned id, task_handle_t handle )
+{
+  if( id == 0 )
+    uart0_tx_notify( handle );
+}
+
 // ****************************************************************************
 // PWMs
 
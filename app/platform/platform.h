@@ -52,6 +52,7 @@ int platform_gpio_register_intr_hook(uint32_t gpio_bits, platform_hook_function
   platform_gpio_register_intr_hook(0, hook);
 void platform_gpio_intr_init( unsigned pin, GPIO_INT_TYPE type );
 void platform_gpio_init( task_handle_t gpio_task );
+uint32_t platform_gpio_take_intr( unsigned pin, unsigned *level, uint32_t *when );
 // *****************************************************************************
 // Timer subsection
 
@@ -155,6 +156,9 @@ static inline int platform_uart_exists( unsigned id ) { return id < NUM_UART; }
 uint32_t platform_uart_setup( unsigned id, uint32_t baud, int databits, int parity, int stopbits );
 int platform_uart_set_buffer( unsigned id, unsigned size );
 void platform_uart_send( unsigned id, uint8_t data );
+void platform_uart_write( unsigned id, const uint8_t *data, size_t len );
+int platform_uart_tx_free( unsigned id );
+void platform_uart_tx_notify( unsigned id, task_handle_t handle );
 void platform_s_uart_send( unsigned id, uint8_t data );
 int platform_uart_recv( unsigned id, unsigned timer_id, timer_data_type timeout );
 int platform_s_uart_recv( unsigned id, timer_data_type timeout );
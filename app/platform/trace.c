@@ -0,0 +1,59 @@
+/*
+ * The ring of the tracepoints of trace.h, and its dump.
+ *
+ * The dump is text, so that it can be captured from the console with the
+ * rest of the output: a line "TRACE BEGIN records lost MHz", one line
+ * "ccount name arg" per record in hex, and "TRACE END". lost counts the
+ * older records the ring had no room for.
+ */
+
+#include "trace.h"
+
+#if defined(TRACEPOINTS)
+
+#include "c_stdio.h"
+#include "user_interface.h"
+
+trace_record_t trace_ring[TRACE_RING_SIZE];
+uint32_t trace_count;
+bool trace_stopped;
+
+static const char *const trace_names[TRACE_IDS] = {
+  "none",
+  "task", "task_end",
+  "net_recv", "net_recv_end",
+  "net_sent", "net_sent_end",
+  "net_connect", "net_connect_end",
+  "net_disconnect", "net_disconnect_end",
+  "net_reconnect", "net_reconnect_end",
+  "lua_call", "lua_call_end",
+  "gc_step", "gc_step_end",
+  "gc_full", "gc_full_end",
+  "flash_erase", "flash_erase_end",
+  "mark"
+};
+
+void trace_dump (void) {
+  bool stopped = trace_stopped;
+  uint32_t n = trace_count;
+  uint32_t first = n > TRACE_RING_SIZE ? n - TRACE_RING_SIZE : 0;
+  uint32_t i;
+
+  trace_stopped = true;
+  c_printf("TRACE BEGIN %u %u %u\n", (unsigned)(n - first), (unsigned)first,
+           (unsigned)system_get_cpu_freq());
+  for (i = first; i < n; i++) {
+    trace_record_t *r = &trace_ring[i & (TRACE_RING_SIZE - 1)];
+    unsigned id = r->tag & 0xFF;
+    c_printf("%08x %s %x\n", (unsigned)r->ccount, id < TRACE_IDS ? trace_names[id] : "?",
+             (unsigned)(r->tag >> 8));
+    // The console is slow, a full ring takes about a second
+    if ((i & 63) == 63)
+      system_soft_wdt_feed();
+  }
+  c_printf("TRACE END\n");
+  trace_count = 0;
+  trace_stopped = stopped;
+}
+
+#endif
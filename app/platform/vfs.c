@@ -402,6 +402,8 @@ sint32_t vfs_ferrno( int fd )
       return r;
     }
 #endif
+
+    return VFS_RES_ERR;
   }
 }
 
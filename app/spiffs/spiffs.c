@@ -3,6 +3,7 @@
 #include "spiffs.h"
 
 #include "spiffs_nucleus.h"
+#include "trace.h"
 
 spiffs fs;
 
@@ -30,9 +31,12 @@ static s32_t my_spiffs_write(u32_t addr, u32_t size, u8_t *src) {
 static s32_t my_spiffs_erase(u32_t addr, u32_t size) {
   u32_t sect_first = platform_flash_get_sector_of_address(addr);
   u32_t sect_last = sect_first;
-  while( sect_first <= sect_last )
-    if( platform_flash_erase_sector( sect_first ++ ) == PLATFORM_ERR )
+  while( sect_first <= sect_last ) {
+    TRACE(TRACE_FLASH_ERASE, sect_first);
+    if( platform_flash_erase_sector( sect_first ) == PLATFORM_ERR )
       return SPIFFS_ERR_INTERNAL;
+    TRACE(TRACE_FLASH_ERASE_END, sect_first++);
+  }
   return SPIFFS_OK;
 } 
 
@@ -388,6 +392,8 @@ static sint32_t myspiffs_vfs_closedir( const struct vfs_dir *dd ) {
 
   // free descriptor memory
   c_free( (void *)dd );
+
+  return res;
 }
 
 static vfs_item *myspiffs_vfs_readdir( const struct vfs_dir *dd ) {
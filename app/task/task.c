@@ -1,35 +1,124 @@
 /**
   This file encapsulates the SDK-based task handling for the NodeMCU Lua firmware.
+
+  Each priority has its own ring of pending events in front of the SDK queue.
+  Posting adds to the ring and, when none is pending, posts one wake-up event
+  to the SDK queue; each wake-up dispatches one event from the ring and posts
+  the next wake-up while the ring is not empty. A burst of posts, from an
+  interrupt handler say, thus only needs room in the ring, whose length is
+  set per priority, and the SDK queue never holds more than the wake-up.
+
+  The SDK's own post takes and releases the interrupt lock itself, which
+  doesn't nest, so it is only ever called with the lock released.
  */
 #include "task/task.h"
 #include "mem.h"
 #include "c_stdio.h"
+#include "rom.h"
+#include "user_config.h"
+#include "trace.h"
 
 #define TASK_HANDLE_MONIKER 0x68680000
 #define TASK_HANDLE_MASK    0xFFF80000
 #define TASK_HANDLE_UNMASK  (~TASK_HANDLE_MASK)
 #define TASK_HANDLE_SHIFT   2
 #define TASK_HANDLE_ALLOCATION_BRICK 4   // must be a power of 2
-#define TASK_DEFAULT_QUEUE_LEN 8
+#define TASK_DEFAULT_QUEUE_LEN 32
 #define TASK_PRIORITY_MASK  3
 
+/* The wake-up signal has priority bits 3, so it is never a valid handle */
+#define TASK_WAKEUP_SIG     (TASK_HANDLE_MONIKER | TASK_PRIORITY_MASK)
+/* Room in the SDK queue for the wake-up and signals posted to it directly */
+#define TASK_SDK_QUEUE_LEN  4
+
 #define CHECK(p,v,msg) if (!(p)) { NODE_DBG ( msg ); return (v); }
 
+typedef struct {
+  task_handle_t sig;
+  task_param_t  par;
+  uint32        posted;    /* system_get_time() at the post */
+} task_event_t;
+
+typedef struct {
+  os_event_t   *sdk_q;
+  task_event_t *ring;
+  uint16        head;      /* oldest event */
+  bool          wakeup;    /* a wake-up is in the SDK queue */
+  task_queue_stats_t stats;
+} task_queue_t;
+
 /*
  * Private arrays to hold the 3 event task queues and the dispatch callbacks
  */
-LOCAL os_event_t *task_Q[TASK_PRIORITY_COUNT];
+LOCAL task_queue_t task_Q[TASK_PRIORITY_COUNT];
 LOCAL task_callback_t *task_func;
+LOCAL task_stats_t *task_stat;
 LOCAL int task_count;
 
+/* Takes the oldest event of a ring, posting the next wake-up if there are more */
+LOCAL bool task_take (uint8 priority, task_event_t *ev) {
+  task_queue_t *q = &task_Q[priority];
+  bool more;
+
+  ets_intr_lock();
+  if (q->stats.depth == 0) {
+    q->wakeup = false;
+    ets_intr_unlock();
+    return false;
+  }
+  *ev = q->ring[q->head];
+  if (++q->head == q->stats.size)
+    q->head = 0;
+  more = --q->stats.depth != 0;
+  q->wakeup = more;
+  ets_intr_unlock();
+
+  if (more && !system_os_post(priority, TASK_WAKEUP_SIG, priority)) {
+    /* Let the next post try again */
+    ets_intr_lock();
+    q->wakeup = false;
+    ets_intr_unlock();
+  }
+  return true;
+}
+
 LOCAL void task_dispatch (os_event_t *e) {
-  task_handle_t handle = e->sig;
+  task_event_t ev;
+  uint8 priority;
+
+  if (e->sig == TASK_WAKEUP_SIG) {
+    priority = e->par;
+    if (priority > TASK_PRIORITY_HIGH || !task_take(priority, &ev))
+      return;
+  } else {
+    /* Posted to the SDK queue directly */
+    ev.sig = e->sig;
+    ev.par = e->par;
+    ev.posted = system_get_time();
+  }
+
+  task_handle_t handle = ev.sig;
   if ( (handle & TASK_HANDLE_MASK) == TASK_HANDLE_MONIKER) {
     uint16 entry    = (handle & TASK_HANDLE_UNMASK) >> TASK_HANDLE_SHIFT;
-    uint8  priority = handle & TASK_PRIORITY_MASK;
+    priority        = handle & TASK_PRIORITY_MASK;
     if ( priority <= TASK_PRIORITY_HIGH && task_func && entry < task_count ){
+      uint32 start = system_get_time();
+      TRACE(TRACE_TASK, entry + 1);
       /* call the registered task handler with the specified parameter and priority */
-      task_func[entry](e->par, priority);
+      task_func[entry](ev.par, priority);
+      TRACE(TRACE_TASK_END, entry + 1);
+      uint32 run = system_get_time() - start;
+      uint32 latency = start - ev.posted;
+
+      /* The handler may have registered new ones, moving task_stat */
+      task_stats_t *s = &task_stat[entry];
+      s->count++;
+      s->run_us += run;
+      if (run > s->run_max_us)
+        s->run_max_us = run;
+      s->latency_us += latency;
+      if (latency > s->latency_max_us)
+        s->latency_max_us = latency;
       return;
     }
   }
@@ -38,16 +127,23 @@ LOCAL void task_dispatch (os_event_t *e) {
 }
 
 /*
- * Initialise the task handle callback for a given priority.  This doesn't need
- * to be called explicitly as the get_id function will call this lazily.
+ * Initialise the task handle callback for a given priority, with room for qlen
+ * pending events.  This doesn't need to be called explicitly as the get_id
+ * function will call this lazily.
  */
 bool task_init_handler(uint8 priority, uint8 qlen) {
-  if (priority <= TASK_PRIORITY_HIGH && task_Q[priority] == NULL) {
-    task_Q[priority] = (os_event_t *) os_malloc( sizeof(os_event_t)*qlen );
-    os_memset (task_Q[priority], 0, sizeof(os_event_t)*qlen);
-    if (task_Q[priority]) {
-      return system_os_task( task_dispatch, priority, task_Q[priority], qlen );
+  if (priority <= TASK_PRIORITY_HIGH && task_Q[priority].ring == NULL && qlen) {
+    task_queue_t *q = &task_Q[priority];
+    q->sdk_q = (os_event_t *) os_zalloc( sizeof(os_event_t)*TASK_SDK_QUEUE_LEN );
+    q->ring = (task_event_t *) os_zalloc( sizeof(task_event_t)*qlen );
+    if (q->sdk_q && q->ring) {
+      q->stats.size = qlen;
+      return system_os_task( task_dispatch, priority, q->sdk_q, TASK_SDK_QUEUE_LEN );
     }
+    os_free(q->sdk_q);
+    os_free(q->ring);
+    q->sdk_q = NULL;
+    q->ring = NULL;
   }
   return false;
 }
@@ -55,18 +151,131 @@ bool task_init_handler(uint8 priority, uint8 qlen) {
 task_handle_t task_get_id(task_callback_t t) {
   int p = TASK_PRIORITY_COUNT;
   /* Initialise and uninitialised Qs with the default Q len */
-    while(p--) if (!task_Q[p]) {
+    while(p--) if (!task_Q[p].ring) {
     CHECK(task_init_handler( p, TASK_DEFAULT_QUEUE_LEN ), 0, "Task initialisation failed");
   }
 
   if ( (task_count & (TASK_HANDLE_ALLOCATION_BRICK - 1)) == 0 ) {
     /* With a brick size of 4 this branch is taken at 0, 4, 8 ... and the new size is +4 */
-    task_func =(task_callback_t *) os_realloc(task_func,
+    task_callback_t *func = (task_callback_t *) os_realloc(task_func,
                         sizeof(task_callback_t)*(task_count+TASK_HANDLE_ALLOCATION_BRICK));
-    CHECK(task_func, 0 , "Malloc failure in task_get_id");
+    CHECK(func, 0 , "Malloc failure in task_get_id");
+    task_func = func;
+    task_stats_t *stat = (task_stats_t *) os_realloc(task_stat,
+                        sizeof(task_stats_t)*(task_count+TASK_HANDLE_ALLOCATION_BRICK));
+    CHECK(stat, 0 , "Malloc failure in task_get_id");
+    task_stat = stat;
     os_memset (task_func+task_count, 0, sizeof(task_callback_t)*TASK_HANDLE_ALLOCATION_BRICK);
+    os_memset (task_stat+task_count, 0, sizeof(task_stats_t)*TASK_HANDLE_ALLOCATION_BRICK);
   }
 
   task_func[task_count++] = t;
   return TASK_HANDLE_MONIKER + ((task_count-1)  << TASK_HANDLE_SHIFT);
 }
+
+bool ICACHE_RAM_ATTR task_post(uint8 priority, task_handle_t handle, task_param_t param) {
+  task_queue_t *q;
+  bool wake;
+
+  if (priority > TASK_PRIORITY_HIGH || !task_Q[priority].ring)
+    return false;
+  q = &task_Q[priority];
+
+  uint32 now = system_get_time();
+  ets_intr_lock();
+  if (q->stats.depth == q->stats.size) {
+    q->stats.dropped++;
+    ets_intr_unlock();
+    return false;
+  }
+  uint16 tail = q->head + q->stats.depth;
+  if (tail >= q->stats.size)
+    tail -= q->stats.size;
+  q->ring[tail].sig = handle | priority;
+  q->ring[tail].par = param;
+  q->ring[tail].posted = now;
+  q->stats.posted++;
+  if (++q->stats.depth > q->stats.max_depth)
+    q->stats.max_depth = q->stats.depth;
+  wake = !q->wakeup;
+  q->wakeup = true;
+  ets_intr_unlock();
+
+  if (wake && !system_os_post(priority, TASK_WAKEUP_SIG, priority)) {
+    ets_intr_lock();
+    q->wakeup = false;
+    ets_intr_unlock();
+  }
+  return true;
+}
+
+bool ICACHE_RAM_ATTR task_post_coalesced(uint8 priority, task_handle_t handle, task_coalesce_t *c, uint32 bits) {
+  bool post;
+
+  if (priority > TASK_PRIORITY_HIGH)
+    return false;
+  ets_intr_lock();
+  c->bits |= bits;
+  c->count++;
+  post = !c->pending;
+  c->pending = true;
+  if (!post)
+    task_Q[priority].stats.coalesced++;
+  ets_intr_unlock();
+
+  if (post && !task_post(priority, handle, (task_param_t)c)) {
+    ets_intr_lock();
+    c->pending = false;
+    ets_intr_unlock();
+    return false;
+  }
+  return true;
+}
+
+uint32 task_coalesce_take(task_coalesce_t *c, uint32 *count) {
+  uint32 bits;
+
+  ets_intr_lock();
+  bits = c->bits;
+  if (count)
+    *count = c->count;
+  c->bits = 0;
+  c->count = 0;
+  c->pending = false;
+  ets_intr_unlock();
+  return bits;
+}
+
+bool task_queue_stats(uint8 priority, task_queue_stats_t *stats) {
+  if (priority > TASK_PRIORITY_HIGH)
+    return false;
+  ets_intr_lock();
+  *stats = task_Q[priority].stats;
+  ets_intr_unlock();
+  return true;
+}
+
+int task_count_handlers(void) {
+  return task_count;
+}
+
+bool task_handler_stats(int index, task_callback_t *func, task_stats_t *stats) {
+  if (index < 0 || index >= task_count)
+    return false;
+  *func = task_func[index];
+  *stats = task_stat[index];
+  return true;
+}
+
+void task_reset_stats(void) {
+  int p;
+  for (p = 0; p < TASK_PRIORITY_COUNT; p++) {
+    task_queue_t *q = &task_Q[p];
+    ets_intr_lock();
+    q->stats.posted = q->stats.dropped = q->stats.coalesced = 0;
+    q->stats.max_depth = q->stats.depth;
+    ets_intr_unlock();
+  }
+  if (task_stat)
+    os_memset(task_stat, 0, sizeof(task_stats_t)*task_count);
+}
@@ -39,6 +39,7 @@
 // Depends on 'crypto' module for sha1
 #include "../crypto/digests.h"
 #include "../crypto/mech.h"
+#include "../crypto/codec.h"
 
 #define PROTOCOL_SECURE "wss://"
 #define PROTOCOL_INSECURE "ws://"
@@ -62,12 +63,10 @@
 #define WS_FORCE_CLOSE_TIMEOUT_MS 5 * 1000
 #define WS_UNHEALTHY_THRESHOLD 2
 
-#define WS_OPCODE_CONTINUATION 0x0
-#define WS_OPCODE_TEXT 0x1
-#define WS_OPCODE_BINARY 0x2
-#define WS_OPCODE_CLOSE 0x8
-#define WS_OPCODE_PING 0x9
-#define WS_OPCODE_PONG 0xA
+// Frames are sent with a 16 bit length: 2 bytes header, 2 bytes length, 4 bytes mask
+#define WS_SEND_FRAME_OVERHEAD 8
+// Buffers up to this size are kept for reuse between messages
+#define WS_SEND_BUFFER_KEEP 512
 
 header_t DEFAULT_HEADERS[] = {
   {"User-Agent", "ESP8266"},
@@ -86,23 +85,11 @@ static char *cryptoSha1(char *data, unsigned int len) {
   return (char *) digest; // Requires free
 }
 
-static const char *bytes64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
 static char *base64Encode(char *data, unsigned int len) {
-  int blen = (len + 2) / 3 * 4;
+  int blen = CODEC_BASE64_LEN(len);
 
   char *out = (char *) c_zalloc(blen + 1);
-  out[blen] = '\0';
-  int j = 0, i;
-  for (i = 0; i < len; i += 3) {
-    int a = data[i];
-    int b = (i + 1 < len) ? data[i + 1] : 0;
-    int c = (i + 2 < len) ? data[i + 2] : 0;
-    out[j++] = bytes64[a >> 2];
-    out[j++] = bytes64[((a & 3) << 4) | (b >> 4)];
-    out[j++] = (i + 1 < len) ? bytes64[((b & 15) << 2) | (c >> 6)] : 61;
-    out[j++] = (i + 2 < len) ? bytes64[(c & 63)] : 61;
-  }
+  codec_base64_encode(data, len, out);
 
   return out; // Requires free
 }
@@ -165,17 +152,9 @@ skip:;
   return dst;
 }
 
-static void ws_closeSentCallback(void *arg) {
-  NODE_DBG("ws_closeSentCallback \n");
-  struct espconn *conn = (struct espconn *) arg;
-  ws_info *ws = (ws_info *) conn->reverse;
-
-  if (ws == NULL) {
-    NODE_DBG("ws is unexpectly null\n");
-    return;
-  }
-
-  ws->knownFailureCode = -6;
+static void ws_fail(struct espconn *conn, ws_info *ws, int failureCode) {
+  ws->knownFailureCode = failureCode;
+  ws->connectionState = 4; // ignore anything else the server sends
 
   if (ws->isSecure)
     espconn_secure_disconnect(conn);
@@ -183,86 +162,146 @@ static void ws_closeSentCallback(void *arg) {
     espconn_disconnect(conn);
 }
 
-static void ws_sendFrame(struct espconn *conn, int opCode, const char *data, unsigned short len) {
-  NODE_DBG("ws_sendFrame %d %d\n", opCode, len);
-  ws_info *ws = (ws_info *) conn->reverse;
-  
-  if (ws->connectionState == 4) {
-    NODE_DBG("already in closing state\n");
-    return;
-  } else if (ws->connectionState != 3) {
-    NODE_DBG("can't send message while not in a connected state\n");
-    return;
+static bool ws_reserve(char **buf, int *size, int need) {
+  if (*size >= need) {
+    return true;
   }
-
-  char *b = c_zalloc(10 + len); // 10 bytes = worst case scenario for framming
+  char *b = (char *) c_realloc(*buf, need);
   if (b == NULL) {
-    NODE_DBG("Out of memory when receiving message, disconnecting...\n");
-
-    ws->knownFailureCode = -16;
-    if (ws->isSecure)
-      espconn_secure_disconnect(conn);
-    else
-      espconn_disconnect(conn);
-    return;
+    return false;
   }
+  *buf = b;
+  *size = need;
+  return true;
+}
+
+// Writes a masked frame into b, which must have room for len + WS_SEND_FRAME_OVERHEAD bytes
+static int ws_writeFrame(char *b, int opCode, const char *data, unsigned short len) {
+  int bufOffset;
 
   b[0] = 1 << 7; // has fin
   b[0] += opCode;
   b[1] = 1 << 7; // has mask
-  int bufOffset;
   if (len < 126) {
     b[1] += len;
     bufOffset = 2;
-  } else if (len < 0x10000) {
+  } else {
     b[1] += 126;
     b[2] = len >> 8;
     b[3] = len;
     bufOffset = 4;
-  } else {
-    b[1] += 127;
-    b[2] = len >> 24;
-    b[3] = len >> 16;
-    b[4] = len >> 8;
-    b[5] = len;
-    bufOffset = 6;
   }
 
   // Random mask:
-  b[bufOffset] = (char) os_random();
-  b[bufOffset + 1] = (char) os_random();
-  b[bufOffset + 2] = (char) os_random();
-  b[bufOffset + 3] = (char) os_random();
+  uint32_t mask = os_random();
+  memcpy(b + bufOffset, &mask, 4);
   bufOffset += 4;
 
-  // Copy data to buffer
-  memcpy(b + bufOffset, data, len);
+  // Copy data to buffer and apply mask to encode payload in one pass
+  ws_applyMask(b + bufOffset, data, len, (const uint8_t *) (b + bufOffset - 4), 0);
 
-  // Apply mask to encode payload
-  int i;
-  for (i = 0; i < len; i++) {
-    b[bufOffset + i] ^= b[bufOffset - 4 + i % 4]; 
-  }
-  bufOffset += len;
-
-  NODE_DBG("b[0] = %d \n", b[0]);
-  NODE_DBG("b[1] = %d \n", b[1]);
-  NODE_DBG("b[2] = %d \n", b[2]);
-  NODE_DBG("b[3] = %d \n", b[3]);
-  NODE_DBG("b[4] = %d \n", b[4]);
-  NODE_DBG("b[5] = %d \n", b[5]);
-  NODE_DBG("b[6] = %d \n", b[6]);
-  NODE_DBG("b[7] = %d \n", b[7]);
-  NODE_DBG("b[8] = %d \n", b[8]);
-  NODE_DBG("b[9] = %d \n", b[9]);
-
-  NODE_DBG("sending message\n");
+  return bufOffset + len;
+}
+
+static void ws_transmit(struct espconn *conn, ws_info *ws, int len) {
+  NODE_DBG("sending %d bytes\n", len);
+
+  sint8 err;
   if (ws->isSecure)
-    espconn_secure_send(conn, (uint8_t *) b, bufOffset);
+    err = espconn_secure_send(conn, (uint8_t *) ws->sendBuffer, len);
   else
-    espconn_send(conn, (uint8_t *) b, bufOffset);
+    err = espconn_send(conn, (uint8_t *) ws->sendBuffer, len);
 
-  os_free(b);
+  if (err == 0) {
+    ws->sending = true; // espconn keeps pointing into sendBuffer until the sent callback
+    ws->stats.bytesSent += len;
+  } else {
+    NODE_DBG("send failed %d\n", err);
+  }
+}
+
+static void ws_sentCallback(void *arg) {
+  NODE_DBG("ws_sentCallback \n");
+  struct espconn *conn = (struct espconn *) arg;
+  ws_info *ws = (ws_info *) conn->reverse;
+
+  if (ws == NULL) {
+    NODE_DBG("ws is unexpectly null\n");
+    return;
+  }
+
+  ws->sending = false;
+
+  if (ws->queueBufferLen > 0) { // frames were queued meanwhile, send them all at once
+    char *b = ws->sendBuffer;
+    int size = ws->sendBufferSize;
+    int len = ws->queueBufferLen;
+
+    ws->sendBuffer = ws->queueBuffer;
+    ws->sendBufferSize = ws->queueBufferSize;
+    ws->queueBuffer = b;
+    ws->queueBufferSize = size;
+    ws->queueBufferLen = 0;
+
+    ws_transmit(conn, ws, len);
+    return;
+  }
+
+  // Idle: keep small buffers for the next message, return large ones to the heap
+  if (ws->sendBufferSize > WS_SEND_BUFFER_KEEP) {
+    os_free(ws->sendBuffer);
+    ws->sendBuffer = NULL;
+    ws->sendBufferSize = 0;
+  }
+  if (ws->queueBufferSize > WS_SEND_BUFFER_KEEP) {
+    os_free(ws->queueBuffer);
+    ws->queueBuffer = NULL;
+    ws->queueBufferSize = 0;
+  }
+
+  if (ws->closeAfterSend) {
+    ws->closeAfterSend = false;
+    ws->knownFailureCode = -6;
+
+    if (ws->isSecure)
+      espconn_secure_disconnect(conn);
+    else
+      espconn_disconnect(conn);
+  }
+}
+
+static void ws_sendFrame(struct espconn *conn, int opCode, const char *data, unsigned short len) {
+  NODE_DBG("ws_sendFrame %d %d\n", opCode, len);
+  ws_info *ws = (ws_info *) conn->reverse;
+  
+  if (ws->connectionState == 4) {
+    NODE_DBG("already in closing state\n");
+    return;
+  } else if (ws->connectionState != 3) {
+    NODE_DBG("can't send message while not in a connected state\n");
+    return;
+  }
+
+  int frameLen = len + WS_SEND_FRAME_OVERHEAD;
+
+  if (!ws->sending) {
+    if (!ws_reserve(&ws->sendBuffer, &ws->sendBufferSize, frameLen)) {
+      NODE_DBG("Out of memory when sending message, disconnecting...\n");
+      ws_fail(conn, ws, -16);
+      return;
+    }
+    ws->stats.framesSent++;
+    ws_transmit(conn, ws, ws_writeFrame(ws->sendBuffer, opCode, data, len));
+  } else {
+    // The previous send is still in progress, queue the frame behind it
+    if (!ws_reserve(&ws->queueBuffer, &ws->queueBufferSize, ws->queueBufferLen + frameLen)) {
+      NODE_DBG("Out of memory when queueing message, disconnecting...\n");
+      ws_fail(conn, ws, -16);
+      return;
+    }
+    ws->stats.framesSent++;
+    ws->queueBufferLen += ws_writeFrame(ws->queueBuffer + ws->queueBufferLen, opCode, data, len);
+  }
 }
 
 static void ws_sendPingTimeout(void *arg) {
@@ -285,248 +324,171 @@ static void ws_sendPingTimeout(void *arg) {
   ws->unhealthyPoints += 1;
 }
 
-static void ws_receiveCallback(void *arg, char *buf, unsigned short len) {
-  NODE_DBG("ws_receiveCallback %d \n", len);
-  struct espconn *conn = (struct espconn *) arg;
-  ws_info *ws = (ws_info *) conn->reverse;
-
-  ws->unhealthyPoints = 0; // received data, connection is healthy
-  os_timer_disarm(&ws->timeoutTimer); // reset ping check
-  os_timer_arm(&ws->timeoutTimer, WS_PING_INTERVAL_MS, true);
-
+// A frame header has been parsed, check it fits into the message being received
+static bool ws_frameHeader(struct espconn *conn, ws_info *ws) {
+  ws_parser *p = &ws->parser;
 
-  char *b = buf;
-  if (ws->frameBuffer != NULL) { // Append previous frameBuffer with new content
-    NODE_DBG("Appending new frameBuffer to old one \n");
+  ws->stats.framesReceived++;
 
-    ws->frameBuffer = c_realloc(ws->frameBuffer, ws->frameBufferLen + len);
-    if (ws->frameBuffer == NULL) {
-      NODE_DBG("Failed to allocate new framebuffer, disconnecting...\n");
+  if (WS_OPCODE_IS_CONTROL(p->opCode)) {
+    ws->controlBufferLen = 0; // control frames may come between the fragments of a message
+    return true;
+  }
 
-      ws->knownFailureCode = -8;
-      if (ws->isSecure)
-        espconn_secure_disconnect(conn);
-      else
-        espconn_disconnect(conn);
-      return;
+  if (p->opCode == WS_OPCODE_CONTINUATION) {
+    if (ws->payloadOriginalOpCode == 0) {
+      NODE_DBG("Got continuation frame but didn't receive any beforehand, disconnecting...\n");
+      ws_fail(conn, ws, -15);
+      return false;
     }
-    memcpy(ws->frameBuffer + ws->frameBufferLen, b, len);
-
-    ws->frameBufferLen += len;
-
-    len = ws->frameBufferLen;
-    b = ws->frameBuffer;
-    NODE_DBG("New frameBufferLen: %d\n", len);
-  }
-
-  while (b != NULL) { // several frames can be present, b pointer will be moved to the next frame
-    NODE_DBG("b[0] = %d \n", b[0]);
-    NODE_DBG("b[1] = %d \n", b[1]);
-    NODE_DBG("b[2] = %d \n", b[2]);
-    NODE_DBG("b[3] = %d \n", b[3]);
-    NODE_DBG("b[4] = %d \n", b[4]);
-    NODE_DBG("b[5] = %d \n", b[5]);
-    NODE_DBG("b[6] = %d \n", b[6]);
-    NODE_DBG("b[7] = %d \n", b[7]);
-
-    int isFin = b[0] & 0x80 ? 1 : 0;
-    int opCode = b[0] & 0x0f;
-    int hasMask = b[1] & 0x80 ? 1 : 0;
-    uint64_t payloadLength = b[1] & 0x7f;
-    int bufOffset = 2;
-    if (payloadLength == 126) {
-      payloadLength = (b[2] << 8) + b[3];
-      bufOffset = 4;
-    } else if (payloadLength == 127) { // this will clearly not hold in heap, abort??
-      payloadLength = (b[2] << 24) + (b[3] << 16) + (b[4] << 8) + b[5];
-      bufOffset = 6;
+  } else {
+    if (ws->payloadOriginalOpCode != 0) {
+      NODE_DBG("Got new message before the previous one was finished, disconnecting...\n");
+      ws_fail(conn, ws, -15);
+      return false;
+    }
+    ws->payloadBufferLen = 0;
+    if (!p->isFin) {
+      ws->payloadOriginalOpCode = p->opCode;
+      ws->stats.fragmentedMessages++;
     }
+  }
+
+  if (p->payloadLength > ws->maxMessageSize - ws->payloadBufferLen) {
+    NODE_DBG("Message exceeds %d bytes, disconnecting...\n", ws->maxMessageSize);
+    ws_fail(conn, ws, -21);
+    return false;
+  }
+  return true;
+}
 
-    if (hasMask) {
-      int maskOffset = bufOffset;
-      bufOffset += 4;
+// Buffers a piece of payload which can't be delivered straight from the receive buffer
+static bool ws_frameData(struct espconn *conn, ws_info *ws, const char *data, unsigned int len) {
+  ws_parser *p = &ws->parser;
 
-      int i;
-      for (i = 0; i < payloadLength; i++) {
-        b[bufOffset + i] ^= b[maskOffset + i % 4]; // apply mask to decode payload
-      }
-    }
+  if (WS_OPCODE_IS_CONTROL(p->opCode)) { // at most 125 bytes, checked by the parser
+    memcpy(ws->controlBuffer + ws->controlBufferLen, data, len);
+    ws->controlBufferLen += len;
+    return true;
+  }
 
-    if (payloadLength > len - bufOffset) {
-      NODE_DBG("INCOMPLETE Frame \n");
-      if (ws->frameBuffer == NULL) {
-        NODE_DBG("Allocing new frameBuffer \n");
-        ws->frameBuffer = c_zalloc(len);
-        if (ws->frameBuffer == NULL) {
-          NODE_DBG("Failed to allocate framebuffer, disconnecting... \n");
-
-          ws->knownFailureCode = -9;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        memcpy(ws->frameBuffer, b, len);
-        ws->frameBufferLen = len;
-      }
-      break; // since the buffer were already concat'ed, wait for the next receive
+  // Make room for the rest of the frame at once, rather than for each segment
+  if (!ws_reserve(&ws->payloadBuffer, &ws->payloadBufferSize, ws->payloadBufferLen + len + p->remaining)) {
+    NODE_DBG("Failed to allocate payloadBuffer, disconnecting...\n");
+    ws_fail(conn, ws, -8);
+    return false;
+  }
+  memcpy(ws->payloadBuffer + ws->payloadBufferLen, data, len);
+  ws->payloadBufferLen += len;
+  return true;
+}
+
+static void ws_frameEnd(struct espconn *conn, ws_info *ws, char *payload, unsigned int payloadLength) {
+  ws_parser *p = &ws->parser;
+  int opCode = p->opCode;
+
+  if (WS_OPCODE_IS_CONTROL(opCode)) {
+    if (payload == NULL) {
+      payload = ws->controlBuffer;
+      payloadLength = ws->controlBufferLen;
     }
 
-    if (!isFin) {
-      NODE_DBG("PARTIAL frame! Should concat payload and later restore opcode\n");
-      if(ws->payloadBuffer == NULL) {
-        NODE_DBG("Allocing new payloadBuffer \n");
-        ws->payloadBuffer = c_zalloc(payloadLength);
-        if (ws->payloadBuffer == NULL) {
-          NODE_DBG("Failed to allocate payloadBuffer, disconnecting...\n");
-
-          ws->knownFailureCode = -10;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        memcpy(ws->payloadBuffer, b + bufOffset, payloadLength);
-        ws->frameBufferLen = payloadLength;
-        ws->payloadOriginalOpCode = opCode;
-      } else {
-        NODE_DBG("Appending new payloadBuffer to old one \n");
-        ws->payloadBuffer = c_realloc(ws->payloadBuffer, ws->payloadBufferLen + payloadLength);
-        if (ws->payloadBuffer == NULL) {
-          NODE_DBG("Failed to allocate new framebuffer, disconnecting...\n");
-
-          ws->knownFailureCode = -11;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        memcpy(ws->payloadBuffer + ws->payloadBufferLen, b + bufOffset, payloadLength);
+    if (opCode == WS_OPCODE_CLOSE) {
+      if (payloadLength >= 2) {
+        NODE_DBG("Closing due to: %d\n", ((uint8_t) payload[0] << 8) + (uint8_t) payload[1]); // Must not be shown to client as per spec
+      }
 
-        ws->payloadBufferLen += payloadLength;
+      ws_sendFrame(conn, WS_OPCODE_CLOSE, (const char *) payload, (unsigned short) payloadLength);
+      ws->connectionState = 4;
+      ws->closeAfterSend = true;
+      if (!ws->sending) { // nothing in flight to wait for
+        ws_sentCallback(conn);
       }
-    } else {
-      char *payload;
-      if (opCode == WS_OPCODE_CONTINUATION) {
-        NODE_DBG("restoring original opcode\n");
-        if (ws->payloadBuffer == NULL) {
-          NODE_DBG("Got FIN continuation frame but didn't receive any beforehand, disconnecting...\n");
-
-          ws->knownFailureCode = -15;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        // concat buffer with payload
-        payload = c_zalloc(ws->payloadBufferLen + payloadLength);
+    } else if (opCode == WS_OPCODE_PING) {
+      ws_sendFrame(conn, WS_OPCODE_PONG, (const char *) payload, (unsigned short) payloadLength);
+    } else if (opCode == WS_OPCODE_PONG) {
+      // ping alarm was already reset...
+    }
+    return;
+  }
 
-        if (payload == NULL) {
-          NODE_DBG("Failed to allocate new framebuffer, disconnecting...\n");
+  if (!p->isFin) {
+    return; // more fragments to come
+  }
 
-          ws->knownFailureCode = -12;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        memcpy(payload, ws->payloadBuffer, ws->payloadBufferLen);
-        memcpy(payload + ws->payloadBufferLen, b + bufOffset, payloadLength);
+  if (opCode == WS_OPCODE_CONTINUATION) {
+    opCode = ws->payloadOriginalOpCode;
+    ws->payloadOriginalOpCode = 0;
+  }
+  if (payload == NULL) {
+    payload = ws->payloadBuffer;
+    payloadLength = ws->payloadBufferLen;
+  }
 
-        os_free(ws->payloadBuffer); // free previous buffer
-        ws->payloadBuffer = NULL;
+  ws->stats.messagesReceived++;
+  if (payloadLength > ws->stats.largestMessage) {
+    ws->stats.largestMessage = payloadLength;
+  }
 
-        payloadLength += ws->payloadBufferLen;
-        ws->payloadBufferLen = 0;
+  if (ws->onReceive) ws->onReceive(ws, payloadLength, payload, opCode);
 
-        opCode = ws->payloadOriginalOpCode;
-        ws->payloadOriginalOpCode = 0;
-      } else {
-        int extensionDataOffset = 0;
+  ws->payloadBufferLen = 0;
+  if (ws->payloadBufferSize > WS_SEND_BUFFER_KEEP) {
+    os_free(ws->payloadBuffer);
+    ws->payloadBuffer = NULL;
+    ws->payloadBufferSize = 0;
+  }
+}
 
-        if (opCode == WS_OPCODE_CLOSE && payloadLength > 0) {
-          unsigned int reasonCode = b[bufOffset] << 8 + b[bufOffset + 1];
-          NODE_DBG("Closing due to: %d\n", reasonCode); // Must not be shown to client as per spec
-          extensionDataOffset += 2;
-        }
+static void ws_receiveCallback(void *arg, char *buf, unsigned short len) {
+  NODE_DBG("ws_receiveCallback %d \n", len);
+  struct espconn *conn = (struct espconn *) arg;
+  ws_info *ws = (ws_info *) conn->reverse;
 
-        payload = c_zalloc(payloadLength - extensionDataOffset + 1);
-        if (payload == NULL) {
-          NODE_DBG("Failed to allocate payload, disconnecting...\n");
+  if (ws->connectionState != 3) {
+    return; // closing, or dropped because of an error
+  }
 
-          ws->knownFailureCode = -13;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
+  ws->unhealthyPoints = 0; // received data, connection is healthy
+  os_timer_disarm(&ws->timeoutTimer); // reset ping check
+  os_timer_arm(&ws->timeoutTimer, WS_PING_INTERVAL_MS, true);
 
-        memcpy(payload, b + bufOffset + extensionDataOffset, payloadLength - extensionDataOffset);
-        payload[payloadLength - extensionDataOffset] = '\0';
-      }
+  ws->stats.bytesReceived += len;
+
+  char *in = buf;
+  unsigned int inLen = len;
+  int result;
+  do { // several frames can be present, or just a part of one
+    char *data;
+    unsigned int dataLen;
 
-      NODE_DBG("isFin %d \n", isFin);
-      NODE_DBG("opCode %d \n", opCode);
-      NODE_DBG("hasMask %d \n", hasMask);
-      NODE_DBG("payloadLength %d \n", payloadLength);
-      NODE_DBG("len %d \n", len);
-      NODE_DBG("bufOffset %d \n", bufOffset);
-
-      if (opCode == WS_OPCODE_CLOSE) {
-        NODE_DBG("Closing message: %s\n", payload); // Must not be shown to client as per spec
-
-        espconn_regist_sentcb(conn, ws_closeSentCallback);
-        ws_sendFrame(conn, WS_OPCODE_CLOSE, (const char *) (b + bufOffset), (unsigned short) payloadLength);
-        ws->connectionState = 4;
-      } else if (opCode == WS_OPCODE_PING) {
-        ws_sendFrame(conn, WS_OPCODE_PONG, (const char *) (b + bufOffset), (unsigned short) payloadLength);
-      } else if (opCode == WS_OPCODE_PONG) {
-        // ping alarm was already reset...
-      } else {
-        if (ws->onReceive) ws->onReceive(ws, payloadLength, payload, opCode);
+    result = ws_parserNext(&ws->parser, &in, &inLen, &data, &dataLen);
+    if (result == WS_PARSE_ERROR) {
+      NODE_DBG("Invalid frame, disconnecting...\n");
+      ws_fail(conn, ws, -20);
+      return;
+    }
+    if (result == WS_PARSE_HEADER) {
+      if (!ws_frameHeader(conn, ws)) {
+        return;
       }
-      os_free(payload);
+      continue;
     }
 
-    bufOffset += payloadLength;
-    NODE_DBG("bufOffset %d \n", bufOffset);
-    if (bufOffset == len) { // (bufOffset > len) won't happen here because it's being checked earlier
-      b = NULL;
-      if (ws->frameBuffer != NULL) { // the last frame inside buffer was processed
-        os_free(ws->frameBuffer);
-        ws->frameBuffer = NULL;
-        ws->frameBufferLen = 0;
-      }
+    ws_parser *p = &ws->parser;
+    bool isComplete = WS_OPCODE_IS_CONTROL(p->opCode) || (p->isFin && ws->payloadBufferLen == 0);
+    if (result == WS_PARSE_FRAME_END && dataLen == p->payloadLength && isComplete) {
+      // The whole frame arrived in this segment: no need to copy it anywhere
+      ws_frameEnd(conn, ws, data, dataLen);
     } else {
-      len -= bufOffset;
-      b += bufOffset; // move b to next frame
-      if (ws->frameBuffer != NULL) {
-        NODE_DBG("Reallocing frameBuffer to remove consumed frame\n");
-
-        ws->frameBuffer = c_realloc(ws->frameBuffer, ws->frameBufferLen + len);
-        if (ws->frameBuffer == NULL) {
-          NODE_DBG("Failed to allocate new frame buffer, disconnecting...\n");
-
-          ws->knownFailureCode = -14;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        memcpy(ws->frameBuffer + ws->frameBufferLen, b, len);
-
-        ws->frameBufferLen += len;
-        b = ws->frameBuffer;
+      if (dataLen > 0 && !ws_frameData(conn, ws, data, dataLen)) {
+        return;
+      }
+      if (result == WS_PARSE_FRAME_END) {
+        ws_frameEnd(conn, ws, NULL, 0);
       }
     }
-  }
+  } while ((inLen > 0 || result == WS_PARSE_HEADER) && ws->connectionState == 3);
 }
 
 static void ws_initReceiveCallback(void *arg, char *buf, unsigned short len) {
@@ -583,6 +545,7 @@ static void connect_callback(void *arg) {
   ws->connectionState = 3;
 
   espconn_regist_recvcb(conn, ws_initReceiveCallback);
+  espconn_regist_sentcb(conn, ws_sentCallback);
 
   char *key;
   generateSecKeys(&key, &ws->expectedSecKey);
@@ -636,12 +599,19 @@ static void disconnect_callback(void *arg) {
     os_free(ws->expectedSecKey);
   }
 
-  if (ws->frameBuffer != NULL) {
-    os_free(ws->frameBuffer);
-  }
-
   if (ws->payloadBuffer != NULL) {
     os_free(ws->payloadBuffer);
+    ws->payloadBuffer = NULL;
+  }
+
+  if (ws->sendBuffer != NULL) {
+    os_free(ws->sendBuffer);
+    ws->sendBuffer = NULL;
+  }
+
+  if (ws->queueBuffer != NULL) {
+    os_free(ws->queueBuffer);
+    ws->queueBuffer = NULL;
   }
 
   if (conn->proto.tcp != NULL) {
@@ -801,12 +771,24 @@ void ws_connect(ws_info *ws, const char *url) {
   ws->path = c_strdup(path);
   ws->expectedSecKey = NULL;
   ws->knownFailureCode = 0;
-  ws->frameBuffer = NULL;
-  ws->frameBufferLen = 0;
   ws->payloadBuffer = NULL;
   ws->payloadBufferLen = 0;
+  ws->payloadBufferSize = 0;
   ws->payloadOriginalOpCode = 0;
+  ws->controlBufferLen = 0;
+  ws->sendBuffer = NULL;
+  ws->sendBufferSize = 0;
+  ws->queueBuffer = NULL;
+  ws->queueBufferLen = 0;
+  ws->queueBufferSize = 0;
+  ws->sending = false;
+  ws->closeAfterSend = false;
   ws->unhealthyPoints = 0;
+  if (ws->maxMessageSize <= 0) {
+    ws->maxMessageSize = WS_MESSAGE_SIZE_DEFAULT;
+  }
+  memset(&ws->stats, 0, sizeof(ws->stats));
+  ws_parserInit(&ws->parser);
 
   // Prepare espconn
   struct espconn *conn = (struct espconn *) c_zalloc(sizeof(struct espconn));
@@ -32,14 +32,22 @@
 #include "limits.h"
 #include "stdlib.h"
 
+#include "websocketframe.h"
+
 #if defined(USES_SDK_BEFORE_V140)
 #define espconn_send espconn_sent
 #define espconn_secure_send espconn_secure_sent
 #endif
 
+/*
+ * Default limit for a received message, after reassembling its fragments.
+ */
+#define WS_MESSAGE_SIZE_DEFAULT 8192
+
 struct ws_info;
 
 typedef void (*ws_onConnectionCallback)(struct ws_info *wsInfo);
+// message is not null terminated and only valid during the call
 typedef void (*ws_onReceiveCallback)(struct ws_info *wsInfo, int len, char *message, int opCode);
 typedef void (*ws_onFailureCallback)(struct ws_info *wsInfo, int errorCode);
 
@@ -48,6 +56,16 @@ typedef struct {
 	char *value;
 } header_t;
 
+typedef struct {
+  uint32_t bytesReceived;
+  uint32_t bytesSent;
+  uint32_t framesReceived;
+  uint32_t framesSent;
+  uint32_t messagesReceived;
+  uint32_t fragmentedMessages;
+  uint32_t largestMessage;
+} ws_stats;
+
 typedef struct ws_info {
   int connectionState;
 
@@ -62,12 +80,29 @@ typedef struct ws_info {
   void *reservedData;
   int knownFailureCode;
 
-  char *frameBuffer;
-  int frameBufferLen;
+  ws_parser parser;
 
+  // Message being reassembled from fragments, or from a frame split across segments
   char *payloadBuffer;
   int payloadBufferLen;
+  int payloadBufferSize;
   int payloadOriginalOpCode;
+  int maxMessageSize;  // 0 selects WS_MESSAGE_SIZE_DEFAULT
+
+  char controlBuffer[125];
+  int controlBufferLen;
+
+  // Frames handed to espconn must stay untouched until the sent callback,
+  // frames sent meanwhile are collected in queueBuffer
+  char *sendBuffer;
+  int sendBufferSize;
+  char *queueBuffer;
+  int queueBufferLen;
+  int queueBufferSize;
+  bool sending;
+  bool closeAfterSend;
+
+  ws_stats stats;
 
   os_timer_t  timeoutTimer;
   int unhealthyPoints;
@@ -0,0 +1,152 @@
+/* Incremental websocket frame parser
+ *
+ * See websocketframe.h. Frames are parsed as defined by RFC6455 section 5.2;
+ * no extensions are supported, so frames with RSV bits set are rejected.
+ */
+
+#include "c_types.h"
+#include "c_string.h"
+
+#include "websocketframe.h"
+
+enum {
+  WS_STATE_HEADER,
+  WS_STATE_PAYLOAD,
+  WS_STATE_END,    // frame without payload, WS_PARSE_FRAME_END still to be reported
+  WS_STATE_ERROR
+};
+
+typedef uint32_t __attribute__((__may_alias__)) ws_word;
+
+void ws_parserInit(ws_parser *p) {
+  p->state = WS_STATE_HEADER;
+  p->headerLen = 0;
+  p->headerNeed = 2;
+  p->payloadLength = 0;
+  p->remaining = 0;
+}
+
+void ws_applyMask(char *dst, const char *src, unsigned int len, const uint8_t *mask, uint32_t offset) {
+  unsigned int i = 0;
+
+  // Byte by byte until dst is word aligned
+  for (; i < len && ((size_t) (dst + i) & 3); i++) {
+    dst[i] = src[i] ^ mask[(offset + i) & 3];
+  }
+
+  // Then a word at a time, if src happens to be aligned as well
+  if (len - i >= 4 && !((size_t) (src + i) & 3)) {
+    uint8_t rotated[4];
+    ws_word m;
+    int k;
+    for (k = 0; k < 4; k++) {
+      rotated[k] = mask[(offset + i + k) & 3];
+    }
+    c_memcpy(&m, rotated, 4);
+
+    for (; i + 4 <= len; i += 4) {
+      *(ws_word *) (dst + i) = *(const ws_word *) (src + i) ^ m;
+    }
+  }
+
+  for (; i < len; i++) {
+    dst[i] = src[i] ^ mask[(offset + i) & 3];
+  }
+}
+
+static int ws_parseHeader(ws_parser *p) {
+  const uint8_t *h = p->header;
+  uint8_t len7 = h[1] & 0x7f;
+  uint32_t payloadLength = len7;
+  int offset = 2;
+
+  p->isFin = (h[0] & 0x80) != 0;
+  p->opCode = h[0] & 0x0f;
+  p->hasMask = (h[1] & 0x80) != 0;
+
+  if (h[0] & 0x70) {
+    return WS_PARSE_ERROR; // RSV bits without a negotiated extension
+  }
+  if ((p->opCode > WS_OPCODE_BINARY && p->opCode < WS_OPCODE_CLOSE) || p->opCode > WS_OPCODE_PONG) {
+    return WS_PARSE_ERROR; // reserved opcode
+  }
+  if (WS_OPCODE_IS_CONTROL(p->opCode) && (!p->isFin || len7 > 125)) {
+    return WS_PARSE_ERROR; // control frames can't be fragmented nor long
+  }
+
+  if (len7 == 126) {
+    payloadLength = (h[2] << 8) | h[3];
+    offset = 4;
+  } else if (len7 == 127) {
+    if (h[2] | h[3] | h[4] | h[5]) {
+      return WS_PARSE_ERROR; // over 4GB, can't be meant for us
+    }
+    payloadLength = ((uint32_t) h[6] << 24) | ((uint32_t) h[7] << 16) | (h[8] << 8) | h[9];
+    offset = 10;
+  }
+
+  if (p->hasMask) {
+    c_memcpy(p->mask, h + offset, 4);
+  }
+
+  p->payloadLength = payloadLength;
+  p->remaining = payloadLength;
+  p->headerLen = 0;
+  p->headerNeed = 2;
+  p->state = payloadLength ? WS_STATE_PAYLOAD : WS_STATE_END;
+  return WS_PARSE_HEADER;
+}
+
+int ws_parserNext(ws_parser *p, char **in, unsigned int *len, char **data, unsigned int *dataLen) {
+  char *b = *in;
+  unsigned int n = *len;
+
+  *data = NULL;
+  *dataLen = 0;
+
+  switch (p->state) {
+    case WS_STATE_HEADER:
+      while (n > 0 && p->headerLen < p->headerNeed) {
+        p->header[p->headerLen++] = (uint8_t) *b++;
+        n--;
+        if (p->headerLen == 2) { // the second byte tells how long the header is
+          uint8_t len7 = p->header[1] & 0x7f;
+          p->headerNeed = 2 + (len7 == 126 ? 2 : len7 == 127 ? 8 : 0) + ((p->header[1] & 0x80) ? 4 : 0);
+        }
+      }
+      *in = b;
+      *len = n;
+      if (p->headerLen < p->headerNeed) {
+        return WS_PARSE_MORE;
+      }
+      if (ws_parseHeader(p) == WS_PARSE_ERROR) {
+        p->state = WS_STATE_ERROR;
+        return WS_PARSE_ERROR;
+      }
+      return WS_PARSE_HEADER;
+
+    case WS_STATE_PAYLOAD: {
+      unsigned int take = n < p->remaining ? n : p->remaining;
+      if (p->hasMask) {
+        ws_applyMask(b, b, take, p->mask, p->payloadLength - p->remaining);
+      }
+      *data = b;
+      *dataLen = take;
+      *in = b + take;
+      *len = n - take;
+      p->remaining -= take;
+      if (p->remaining) {
+        return WS_PARSE_MORE;
+      }
+      p->state = WS_STATE_HEADER;
+      return WS_PARSE_FRAME_END;
+    }
+
+    case WS_STATE_END:
+      p->state = WS_STATE_HEADER;
+      return WS_PARSE_FRAME_END;
+
+    default:
+      return WS_PARSE_ERROR;
+  }
+}
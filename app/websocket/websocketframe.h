@@ -0,0 +1,63 @@
+/* Incremental websocket frame parser
+ *
+ * Frames are decoded as the bytes arrive; a frame header or payload may be
+ * split across any number of TCP segments. Payload data is never copied:
+ * masked payloads are unmasked in place and handed back as spans pointing
+ * into the input buffer. Nothing in here depends on espconn or Lua.
+ */
+
+#ifndef _WEBSOCKETFRAME_H_
+#define _WEBSOCKETFRAME_H_
+
+#include "c_types.h"
+
+#define WS_OPCODE_CONTINUATION 0x0
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_BINARY 0x2
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xA
+
+#define WS_OPCODE_IS_CONTROL(op) ((op) & 0x8)
+
+// Longest frame header: 2 bytes, 8 bytes extended length, 4 bytes mask
+#define WS_FRAME_HEADER_MAX 14
+
+// Return values of ws_parserNext()
+#define WS_PARSE_MORE 0       // need more input; a payload span may have been returned
+#define WS_PARSE_HEADER 1     // a frame header is complete, see the parser fields
+#define WS_PARSE_FRAME_END 2  // the frame is complete, the last span (if any) is returned
+#define WS_PARSE_ERROR (-1)   // malformed frame, the connection must be dropped
+
+typedef struct {
+  uint8_t state;
+  uint8_t headerLen;
+  uint8_t headerNeed;
+  uint8_t header[WS_FRAME_HEADER_MAX];
+
+  // Current frame, valid from WS_PARSE_HEADER until the next frame starts
+  uint8_t opCode;
+  bool isFin;
+  bool hasMask;
+  uint8_t mask[4];
+  uint32_t payloadLength;
+  uint32_t remaining;  // payload bytes still to come
+} ws_parser;
+
+void ws_parserInit(ws_parser *p);
+
+/*
+ * Parses from *in (of *len bytes), advancing both past the consumed input.
+ * Callers loop while *len > 0 or the last call returned WS_PARSE_HEADER;
+ * a frame without payload reports WS_PARSE_HEADER followed by
+ * WS_PARSE_FRAME_END without consuming further input.
+ */
+int ws_parserNext(ws_parser *p, char **in, unsigned int *len, char **data, unsigned int *dataLen);
+
+/*
+ * XORs len bytes from src with the 4 byte mask into dst, starting at byte
+ * offset of the mask. dst may equal src for unmasking in place.
+ */
+void ws_applyMask(char *dst, const char *src, unsigned int len, const uint8_t *mask, uint32_t offset);
+
+#endif // _WEBSOCKETFRAME_H_
@@ -0,0 +1,22 @@
+-- File writes and reads on SPIFFS, as a logger does: lines appended,
+-- read back and the file removed. On the host it is the flash image.
+
+local NAME = "bench.log"
+local line = string.rep("0123456789", 6)
+
+return {
+  iterations = 20,
+  run = function (i)
+    assert(file.open(NAME, "w"))
+    for j = 1, 50 do
+      file.writeline(j .. ":" .. line)
+    end
+    file.close()
+    assert(file.open(NAME, "r"))
+    local n = 0
+    while file.readline() do n = n + 1 end
+    file.close()
+    assert(n == 50)
+    file.remove(NAME)
+  end,
+}
@@ -0,0 +1,27 @@
+-- JSON round-trips of the messages a sensor node sends and receives
+
+local reading = {
+  id = "node-7f3a", seq = 0, uptime = 123456,
+  sensors = {
+    { name = "temperature", value = 21.5, unit = "C" },
+    { name = "humidity", value = 48, unit = "%" },
+    { name = "pressure", value = 1013.25, unit = "hPa" },
+  },
+  tags = { "garden", "north", "battery" },
+  ok = true,
+}
+local command = '{"cmd":"config","interval":60,"targets":["a","b","c"],' ..
+                '"thresholds":{"low":-5.5,"high":35},"enabled":true,"note":null}'
+
+return {
+  iterations = 2000,
+  run = function (i)
+    reading.seq = i
+    local text = cjson.encode(reading)
+    local back = cjson.decode(text)
+    assert(back.seq == i and #back.sensors == 3)
+    local cmd = cjson.decode(command)
+    cmd.seq = i
+    assert(#cjson.encode(cmd) > 0)
+  end,
+}
@@ -0,0 +1,21 @@
+-- MQTT messages encoded and parsed by app/mqtt, with the payloads built in
+-- Lua as an MQTT client script does. The encoder is reached through the
+-- host module, so this runs on the host only.
+
+if not host then return nil end
+
+local fmt = string.format
+
+return {
+  iterations = 2000,
+  run = function (i)
+    local topic = fmt("sensors/node-%d/temperature", i % 8)
+    local payload = fmt('{"t":%.1f,"seq":%d}', 20 + (i % 50) / 10, i)
+    local msg = host.mqtt_publish(topic, payload, i % 2, 0)
+    local t, data = host.mqtt_parse(msg)
+    assert(t == topic and data == payload)
+    if i % 16 == 0 then
+      host.mqtt_subscribe(fmt("commands/node-%d/#", i % 8), 1)
+    end
+  end,
+}
@@ -0,0 +1,16 @@
+-- Calls into the modules and libraries in ROM tables, whose every lookup
+-- goes through the read-only table search rather than a hash
+
+return {
+  iterations = 2000,
+  run = function (i)
+    local n = 0
+    for j = 1, 10 do
+      n = n + math.floor(math.abs(j - 5.5) * 10) + math.max(j, i % 7) - math.min(j, 3)
+      n = n + string.byte(string.sub("abcdefghij", j, j)) + #string.rep("x", j)
+      n = n + #encoder.toHex(struct.pack("<I2", j)) + #table.concat({ j, j }, ".")
+      n = n + tmr.now() % 2
+    end
+    assert(n > 0)
+  end,
+}
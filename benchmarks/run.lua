@@ -0,0 +1,87 @@
+-- Runs the benchmarks of this directory and prints one JSON object per
+-- benchmark and line:
+--
+--   tools/host/nodemcu benchmarks/run.lua [name ...]
+--
+-- Each benchmark file returns a table with the number of iterations and
+-- the function run(i) to time, or nil when it cannot run on this build.
+-- The fields of a result:
+--   name        the benchmark
+--   iterations  the number of calls of run()
+--   time        seconds for them all
+--   per_op_us   microseconds per call
+--   heap_base   bytes held by Lua before the first call
+--   peak_heap   the most bytes held by Lua while running
+--   heap_after  bytes still held after a full collection at the end
+--   gc_cycles   garbage collections started while running
+--   strings     strings in the string table at the end, before collection
+--   string_slots  the size of the string table hash then
+--
+-- On the device, where the benchmark files are on the flash next to this
+-- one, the time comes from tmr.now(), and peak_heap is there only in a
+-- firmware built with HEAP_TRACE.
+
+local NAMES = { "json", "strings", "statemachine", "mqtt", "rotable", "fileio" }
+
+local clock = host and host.clock or function () return tmr.now() / 1e6 end
+local dir = host and arg and arg[0] and arg[0]:match("^(.*/)") or ""
+
+local function load_bench (name)
+  local path = dir .. name .. ".lua"
+  local chunk, err
+  if host then
+    chunk, err = loadstring(host.readfile(path), "@" .. path)
+  else
+    chunk, err = loadfile(path)
+  end
+  if not chunk then error(err) end
+  return chunk()
+end
+
+local function measure (name)
+  local bench = load_bench(name)
+  if not bench then
+    return { name = name, skipped = true }
+  end
+
+  collectgarbage()
+  node.heapinfo()             -- restarts the peak from here
+  collectgarbage()
+  local before = node.heapinfo()
+  local base, cycles = before.lua.total, before.gccycles
+  before = nil
+
+  local n, run = bench.iterations, bench.run
+  local t = clock()
+  for i = 1, n do run(i) end
+  t = clock() - t
+
+  local h = node.heapinfo()
+  local result = {
+    name = name,
+    iterations = n,
+    time = t,
+    per_op_us = t * 1e6 / n,
+    heap_base = base,
+    peak_heap = h.lua.peak,
+    gc_cycles = h.gccycles - cycles,
+    strings = h.strings.count,
+    string_slots = h.strings.slots,
+  }
+  h, bench, run = nil, nil, nil
+  collectgarbage()
+  result.heap_after = collectgarbage("count") * 1024
+  return result
+end
+
+local names = {}
+for i = 1, arg and #arg or 0 do names[i] = arg[i] end
+if #names == 0 then names = NAMES end
+
+for _, name in ipairs(names) do
+  local ok, result = pcall(measure, name)
+  if not ok then
+    result = { name = name, error = tostring(result) }
+  end
+  print(cjson.encode(result))
+end
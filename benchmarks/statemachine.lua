@@ -0,0 +1,49 @@
+-- A table driven state machine, as a protocol handler keeps one per
+-- connection: states and transitions in tables, events queued as records
+
+local transitions = {
+  idle       = { connect = "connecting" },
+  connecting = { ack = "connected", timeout = "idle" },
+  connected  = { data = "connected", ping = "connected", close = "closing" },
+  closing    = { ack = "idle", timeout = "idle" },
+}
+local script = { "connect", "ack", "data", "data", "ping", "data", "close", "ack",
+                 "connect", "timeout" }
+
+local function new_conn (id)
+  return { id = id, state = "idle", queue = {}, head = 1, stats = {} }
+end
+
+local function post (conn, name, arg)
+  conn.queue[#conn.queue + 1] = { name = name, arg = arg }
+end
+
+local function step (conn)
+  local ev = conn.queue[conn.head]
+  if not ev then return false end
+  conn.queue[conn.head] = nil
+  conn.head = conn.head + 1
+  local nextstate = transitions[conn.state][ev.name]
+  if nextstate then
+    conn.stats[ev.name] = (conn.stats[ev.name] or 0) + 1
+    conn.state = nextstate
+  end
+  return true
+end
+
+return {
+  iterations = 200,
+  run = function ()
+    local conns = {}
+    for id = 1, 16 do conns[id] = new_conn(id) end
+    for _, name in ipairs(script) do
+      for id = 1, #conns do post(conns[id], name, { at = id }) end
+    end
+    local busy = true
+    while busy do
+      busy = false
+      for id = 1, #conns do busy = step(conns[id]) or busy end
+    end
+    assert(conns[1].state == "idle" and conns[16].stats.data == 3)
+  end,
+}
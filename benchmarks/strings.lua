@@ -0,0 +1,23 @@
+-- Building strings the ways scripts do: concatenation, table.concat,
+-- string.format and gsub, making many short lived strings
+
+local fmt, concat, rep = string.format, table.concat, string.rep
+
+return {
+  iterations = 500,
+  run = function (i)
+    local s = ""
+    for j = 1, 20 do
+      s = s .. j .. ","
+    end
+    local parts = {}
+    for j = 1, 40 do
+      parts[j] = fmt("%s=%d;%.2f", "key" .. j, i + j, j / 7)
+    end
+    local line = concat(parts, "&")
+    local escaped = line:gsub("[=;&]", function (c) return fmt("%%%02X", c:byte()) end)
+    local header = "HTTP/1.1 200 OK\r\nContent-Length: " .. #escaped .. "\r\n" ..
+                   rep("X-Pad: 0\r\n", 4) .. "\r\n"
+    assert(#s > 0 and #header + #escaped > #line)
+  end,
+}
@@ -0,0 +1,3 @@
+/* Host stand-ins for the firmware's libc wrappers, see ../Makefile */
+#include <stdint.h>
+#include <stdbool.h>
@@ -0,0 +1,5 @@
+#include <stdlib.h>
+#define c_malloc  malloc
+#define c_zalloc(n) calloc(1, (n))
+#define c_realloc realloc
+#define c_free    free
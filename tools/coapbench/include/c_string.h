@@ -0,0 +1,5 @@
+#include <string.h>
+#define c_memcpy  memcpy
+#define c_memcmp  memcmp
+#define c_memset  memset
+#define c_strlen  strlen
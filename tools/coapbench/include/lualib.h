@@ -0,0 +1 @@
+/* coap.h pulls in the Lua headers, nothing of them is used here */
@@ -0,0 +1,313 @@
+/*
+ * Host benchmark for the CoAP retransmission queue and dedup cache.
+ *
+ * Simulates a burst of confirmable messages: each is sent, acknowledged
+ * after a random delay or retransmitted with exponential back-off until
+ * it times out. The same event sequence is replayed through the timer wheel
+ * of app/coap/node.c and through a sorted list like the one it replaced.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "node.h"
+#include "dedup.h"
+
+#define MAX_RETRANSMIT  4
+#define ROUNDS          20
+
+/* node.c frees the PDU of a node, there is none here */
+void coap_delete_pdu(coap_pdu_t *pdu) { (void)pdu; }
+
+static double now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+typedef struct { coap_tick_t t; coap_tid_t id; } event_t;
+
+static int nmsg = 1000;
+static event_t *sends, *acks;
+static int nacks;
+static unsigned *timeouts;
+
+static int by_time(const void *a, const void *b)
+{
+  const event_t *x = a, *y = b;
+  return (x->t > y->t) - (x->t < y->t);
+}
+
+static void make_events(void)
+{
+  int i;
+  sends = calloc(nmsg, sizeof(event_t));
+  acks = calloc(nmsg, sizeof(event_t));
+  timeouts = calloc(nmsg, sizeof(unsigned));
+  srand(1);
+  for (i = 0; i < nmsg; i++) {
+    sends[i].t = i;                     /* one per ms */
+    sends[i].id = (i * 2654435761u) >> 8;
+    timeouts[i] = 2000 + rand() % 1000; /* ACK_TIMEOUT * (1 .. ACK_RANDOM_FACTOR) */
+    if (rand() % 5) {                   /* 80% are acknowledged */
+      acks[nacks].t = i + 20 + rand() % 6000;
+      acks[nacks].id = sends[i].id;
+      nacks++;
+    }
+  }
+  qsort(acks, nacks, sizeof(event_t), by_time);
+}
+
+typedef struct {
+  double us;
+  int retransmits, timeouts, acked;
+  coap_tick_t late;
+} result_t;
+
+static coap_tick_t next_event(int is, int ia, int have_timer, coap_tick_t timer)
+{
+  coap_tick_t next = (coap_tick_t)-1;
+  if (is < nmsg)
+    next = sends[is].t;
+  if (ia < nacks && acks[ia].t < next)
+    next = acks[ia].t;
+  if (have_timer && timer < next)
+    next = timer;
+  return next;
+}
+
+static void run_wheel(result_t *r)
+{
+  coap_wheel_t wheel;
+  coap_queue_t *node, *next;
+  coap_tick_t now = 0, ms;
+  int is = 0, ia = 0, have;
+  double t0 = now_us();
+
+  memset(&wheel, 0, sizeof(wheel));
+  for (;;) {
+    have = coap_next_timeout(&wheel, now, &ms);
+    if (is >= nmsg && ia >= nacks && !have)
+      break;
+    now = next_event(is, ia, have, now + ms);
+
+    for (; is < nmsg && sends[is].t == now; is++) {
+      node = coap_new_node();
+      node->id = sends[is].id;
+      node->timeout = timeouts[is];
+      node->t = now + node->timeout;
+      coap_insert_node(&wheel, node, now);
+    }
+    for (; ia < nacks && acks[ia].t == now; ia++)
+      r->acked += coap_remove_node(&wheel, acks[ia].id);
+
+    for (node = coap_expired(&wheel, now); node; node = next) {
+      next = node->next;
+      if (now < node->t) {
+        printf("wheel: node fired %u ms early\n", node->t - now);
+        exit(1);
+      }
+      if (now - node->t > r->late)
+        r->late = now - node->t;
+      if (node->retransmit_cnt < MAX_RETRANSMIT) {
+        node->retransmit_cnt++;
+        node->t = now + (node->timeout << node->retransmit_cnt);
+        coap_insert_node(&wheel, node, now);
+        r->retransmits++;
+      } else {
+        coap_delete_node(node);
+        r->timeouts++;
+      }
+    }
+  }
+  r->us = now_us() - t0;
+}
+
+/*
+ * The queue as it was: a list sorted by expiry where each node holds the
+ * delay relative to its predecessor, and the head relative to basetime.
+ */
+typedef struct lnode {
+  struct lnode *next;
+  coap_tick_t t;
+  unsigned timeout;
+  unsigned char retransmit_cnt;
+  coap_tid_t id;
+  coap_tick_t due;
+} lnode_t;
+
+static void list_insert(lnode_t **queue, lnode_t *node)
+{
+  lnode_t *p, *q = *queue;
+  if (!q) {
+    *queue = node;
+    return;
+  }
+  if (node->t < q->t) {
+    node->next = q;
+    *queue = node;
+    q->t -= node->t;
+    return;
+  }
+  do {
+    node->t -= q->t;
+    p = q;
+    q = q->next;
+  } while (q && q->t <= node->t);
+  if (q)
+    q->t -= node->t;
+  node->next = q;
+  p->next = node;
+}
+
+static int list_remove(lnode_t **queue, coap_tid_t id)
+{
+  lnode_t *p = NULL, *q = *queue;
+  while (q && q->id != id) {
+    p = q;
+    q = q->next;
+  }
+  if (!q)
+    return 0;
+  if (p)
+    p->next = q->next;
+  else
+    *queue = q->next;
+  if (q->next)
+    q->next->t += q->t;
+  free(q);
+  return 1;
+}
+
+static void list_update(lnode_t *queue, coap_tick_t *basetime, coap_tick_t now)
+{
+  coap_tick_t diff = now - *basetime;
+  *basetime = now;
+  if (queue)
+    queue->t = queue->t >= diff ? queue->t - diff : 0;
+}
+
+static void run_list(result_t *r)
+{
+  lnode_t *queue = NULL, *node;
+  coap_tick_t now = 0, basetime = 0;
+  int is = 0, ia = 0;
+  double t0 = now_us();
+
+  for (;;) {
+    if (is >= nmsg && ia >= nacks && !queue)
+      break;
+    now = next_event(is, ia, queue != NULL, basetime + (queue ? queue->t : 0));
+
+    for (; is < nmsg && sends[is].t == now; is++) {
+      node = calloc(1, sizeof(*node));
+      node->id = sends[is].id;
+      node->timeout = timeouts[is];
+      list_update(queue, &basetime, now);
+      node->t = node->timeout;
+      node->due = now + node->timeout;
+      list_insert(&queue, node);
+    }
+    for (; ia < nacks && acks[ia].t == now; ia++) {
+      r->acked += list_remove(&queue, acks[ia].id);
+      list_update(queue, &basetime, now);
+    }
+
+    list_update(queue, &basetime, now);
+    while (queue && queue->t == 0) {
+      node = queue;
+      queue = node->next;
+      node->next = NULL;
+      if (now - node->due > r->late)
+        r->late = now - node->due;
+      if (node->retransmit_cnt < MAX_RETRANSMIT) {
+        node->retransmit_cnt++;
+        node->t = node->timeout << node->retransmit_cnt;
+        node->due = now + node->t;
+        list_insert(&queue, node);
+        r->retransmits++;
+      } else {
+        free(node);
+        r->timeouts++;
+      }
+    }
+  }
+  r->us = now_us() - t0;
+}
+
+static void report(const char *name, result_t *best)
+{
+  printf("  %-6s %9.1f us  %5.2f us/message  acked %d, retransmissions %d, timeouts %d, max late %u ms\n",
+         name, best->us, best->us / nmsg, best->acked, best->retransmits, best->timeouts, best->late);
+}
+
+static void bench_queue(void)
+{
+  result_t w, l, r;
+  int i;
+
+  printf("retransmission queue, %d outstanding CON messages, best of %d\n", nmsg, ROUNDS);
+  for (i = 0; i < ROUNDS; i++) {
+    memset(&r, 0, sizeof(r));
+    run_wheel(&r);
+    if (!i || r.us < w.us)
+      w = r;
+    memset(&r, 0, sizeof(r));
+    run_list(&r);
+    if (!i || r.us < l.us)
+      l = r;
+  }
+  report("wheel", &w);
+  report("list", &l);
+  if (w.acked != l.acked || w.timeouts != l.timeouts)
+    printf("  MISMATCH between wheel and list\n");
+}
+
+static void bench_dedup(void)
+{
+  coap_packet_t pkt;
+  uint8_t rsp[64], out[64];
+  int i, hits = 0, dups = 0, n = nmsg * 10;
+  uint16_t recent[4] = { 0 };
+  double t0;
+
+  memset(&pkt, 0, sizeof(pkt));
+  memset(rsp, 0xA5, sizeof(rsp));
+  pkt.hdr.t = COAP_TYPE_CON;
+  srand(2);
+
+  t0 = now_us();
+  for (i = 0; i < n; i++) {
+    uint32_t ip = 0x0A000000 | (i % 16);    /* 16 clients */
+    uint16_t mid = i;
+    if (i > 4 && rand() % 4 == 0) {         /* 25% are retransmissions of a recent request */
+      mid = recent[rand() % 4];
+      ip = 0x0A000000 | (mid % 16);
+      dups++;
+    }
+    pkt.hdr.id[0] = mid >> 8;
+    pkt.hdr.id[1] = mid & 0xFF;
+    if (coap_dedup_lookup(ip, 5683, &pkt, out, sizeof(out), i) != COAP_DEDUP_MISS) {
+      hits++;
+      continue;
+    }
+    coap_dedup_store(ip, 5683, &pkt, rsp, sizeof(rsp), i);
+    recent[i % 4] = mid;
+  }
+  printf("dedup cache, %d requests, %d entries / %d bytes\n", n, COAP_DEDUP_ENTRIES, COAP_DEDUP_MEMORY);
+  printf("  %9.1f us  %5.3f us/request  %d retransmissions, %d replayed\n",
+         now_us() - t0, (now_us() - t0) / n, dups, hits);
+  coap_dedup_clear();
+}
+
+int main(int argc, char **argv)
+{
+  if (argc > 1)
+    nmsg = atoi(argv[1]);
+  make_events();
+  bench_queue();
+  bench_dedup();
+  return 0;
+}
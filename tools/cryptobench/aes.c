@@ -0,0 +1,151 @@
+/*
+ * Host stand-in for the AES-128 routines of the SDK (sdk-aes.h). A plain
+ * byte oriented implementation, enough to run app/crypto/mech.c here.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "sdk-aes.h"
+
+typedef struct {
+  uint8_t rk[176];
+} aes_ctx_t;
+
+static uint8_t sbox[256], inv_sbox[256];
+
+static uint8_t xtime(uint8_t x)
+{
+  return (x << 1) ^ ((x & 0x80) ? 0x1b : 0);
+}
+
+static uint8_t mul(uint8_t a, uint8_t b)
+{
+  uint8_t r = 0;
+  for (; b; b >>= 1, a = xtime(a))
+    if (b & 1)
+      r ^= a;
+  return r;
+}
+
+static void make_sbox(void)
+{
+  int i;
+  if (sbox[0])
+    return;
+  for (i = 0; i < 256; i++) {
+    /* multiplicative inverse by brute force, then the affine map */
+    uint8_t inv = 0, s;
+    int j;
+    for (j = 1; i && j < 256; j++)
+      if (mul(i, j) == 1)
+        inv = j;
+    s = inv ^ (inv << 1 | inv >> 7) ^ (inv << 2 | inv >> 6) ^
+        (inv << 3 | inv >> 5) ^ (inv << 4 | inv >> 4) ^ 0x63;
+    sbox[i] = s;
+    inv_sbox[s] = i;
+  }
+}
+
+static void *init(const char *key, size_t len)
+{
+  aes_ctx_t *ctx;
+  uint8_t rcon = 1;
+  int i;
+
+  if (len != 16 || !(ctx = malloc(sizeof(*ctx))))
+    return NULL;
+  make_sbox();
+  memcpy(ctx->rk, key, 16);
+  for (i = 16; i < 176; i += 4) {
+    uint8_t t[4];
+    memcpy(t, ctx->rk + i - 4, 4);
+    if (i % 16 == 0) {
+      uint8_t u = t[0];
+      t[0] = sbox[t[1]] ^ rcon;
+      t[1] = sbox[t[2]];
+      t[2] = sbox[t[3]];
+      t[3] = sbox[u];
+      rcon = xtime(rcon);
+    }
+    ctx->rk[i] = ctx->rk[i - 16] ^ t[0];
+    ctx->rk[i + 1] = ctx->rk[i - 15] ^ t[1];
+    ctx->rk[i + 2] = ctx->rk[i - 14] ^ t[2];
+    ctx->rk[i + 3] = ctx->rk[i - 13] ^ t[3];
+  }
+  return ctx;
+}
+
+void *aes_encrypt_init(const char *key, size_t len) { return init(key, len); }
+void *aes_decrypt_init(const char *key, size_t len) { return init(key, len); }
+void aes_encrypt_deinit(void *ctx) { free(ctx); }
+void aes_decrypt_deinit(void *ctx) { free(ctx); }
+
+static void add_round_key(uint8_t *s, const uint8_t *rk)
+{
+  int i;
+  for (i = 0; i < 16; i++)
+    s[i] ^= rk[i];
+}
+
+void aes_encrypt(void *ctx, const char *plain, char *crypt)
+{
+  const uint8_t *rk = ((aes_ctx_t *)ctx)->rk;
+  uint8_t s[16], t[16];
+  int round, i, c;
+
+  memcpy(s, plain, 16);
+  add_round_key(s, rk);
+  for (round = 1; round <= 10; round++) {
+    for (i = 0; i < 16; i++)            /* SubBytes and ShiftRows */
+      t[i] = sbox[s[(i + 4 * (i % 4)) % 16]];
+    if (round < 10) {
+      for (c = 0; c < 16; c += 4) {     /* MixColumns */
+        uint8_t a0 = t[c], a1 = t[c + 1], a2 = t[c + 2], a3 = t[c + 3];
+        uint8_t x = a0 ^ a1 ^ a2 ^ a3;
+        t[c] ^= x ^ xtime(a0 ^ a1);
+        t[c + 1] ^= x ^ xtime(a1 ^ a2);
+        t[c + 2] ^= x ^ xtime(a2 ^ a3);
+        t[c + 3] ^= x ^ xtime(a3 ^ a0);
+      }
+    }
+    memcpy(s, t, 16);
+    add_round_key(s, rk + 16 * round);
+  }
+  memcpy(crypt, s, 16);
+}
+
+void aes_decrypt(void *ctx, const char *crypt, char *plain)
+{
+  const uint8_t *rk = ((aes_ctx_t *)ctx)->rk;
+  uint8_t s[16], t[16];
+  int round, i, c;
+
+  memcpy(s, crypt, 16);
+  add_round_key(s, rk + 160);
+  for (round = 9; round >= 0; round--) {
+    for (i = 0; i < 16; i++)            /* InvShiftRows and InvSubBytes */
+      t[(i + 4 * (i % 4)) % 16] = inv_sbox[s[i]];
+    add_round_key(t, rk + 16 * round);
+    if (round > 0) {
+      for (c = 0; c < 16; c += 4) {     /* InvMixColumns */
+        uint8_t u = xtime(xtime(t[c] ^ t[c + 2]));
+        uint8_t v = xtime(xtime(t[c + 1] ^ t[c + 3]));
+        uint8_t a0, a1, a2, a3, x;
+        t[c] ^= u;
+        t[c + 1] ^= v;
+        t[c + 2] ^= u;
+        t[c + 3] ^= v;
+        a0 = t[c], a1 = t[c + 1], a2 = t[c + 2], a3 = t[c + 3];
+        x = a0 ^ a1 ^ a2 ^ a3;
+        t[c] ^= x ^ xtime(a0 ^ a1);
+        t[c + 1] ^= x ^ xtime(a1 ^ a2);
+        t[c + 2] ^= x ^ xtime(a2 ^ a3);
+        t[c + 3] ^= x ^ xtime(a3 ^ a0);
+      }
+    }
+    memcpy(s, t, 16);
+  }
+  memcpy(plain, s, 16);
+}
@@ -0,0 +1,9 @@
+/*
+ * The firmware's user_config.h, with SHA2_ROLLED to build the small
+ * rolled SHA-256 transform for comparison.
+ */
+#include "../../../app/include/user_config.h"
+
+#ifdef SHA2_ROLLED
+#undef SHA2_UNROLL_TRANSFORM
+#endif
@@ -0,0 +1,538 @@
+/*
+ * Known-answer tests and host throughput benchmark for app/crypto.
+ *
+ * The digests are checked against the FIPS 180-2, RFC 1321, RFC 2202 and
+ * RFC 4231 test vectors, then MD5, SHA1, SHA256 and their HMACs are timed
+ * through crypto_hash() and crypto_hmac() on short messages, the size of
+ * a typical MQTT payload, and on long ones, the case of hashing a file.
+ * The streaming ciphers are checked against the NIST SP 800-38A vectors
+ * and timed the way crypto.new_cipher() objects feed them. Last, the
+ * base64 and hex codecs are checked against RFC 4648 and the encoder
+ * module's old code, and both are timed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "digests.h"
+#include "mech.h"
+#include "codec.h"
+#include "oldcodec.h"
+
+typedef struct {
+  const char *mech;
+  const char *msg;
+  int repeat;
+  const char *digest;
+} kat_t;
+
+static const kat_t hash_kats[] = {
+  { "MD5", "", 1, "d41d8cd98f00b204e9800998ecf8427e" },
+  { "MD5", "abc", 1, "900150983cd24fb0d6963f7d28e17f72" },
+  { "MD5", "12345678901234567890123456789012345678901234567890123456789012345678901234567890", 1,
+    "57edf4a22be3c955ac49da2e2107b67a" },
+  { "SHA1", "", 1, "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+  { "SHA1", "abc", 1, "a9993e364706816aba3e25717850c26c9cd0d89d" },
+  { "SHA1", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+    "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+  { "SHA1", "a", 1000000, "34aa973cd4c4daa4f61eeb2bdbad27316534016f" },
+  { "SHA256", "", 1,
+    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+  { "SHA256", "abc", 1,
+    "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+  { "SHA256", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+    "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+  { "SHA256", "a", 1000000,
+    "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+  { "SHA512", "abc", 1,
+    "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+    "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f" },
+};
+
+typedef struct {
+  const char *mech;
+  const char *key;
+  size_t key_len;
+  const char *data;
+  const char *digest;
+} hmac_kat_t;
+
+#define KEY_0B20 "\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b" \
+                 "\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b"
+#define KEY_AA131 \
+  "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa" \
+  "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa" \
+  "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa" \
+  "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa" \
+  "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa" \
+  "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa" \
+  "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa" \
+  "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa" \
+  "\xaa\xaa\xaa"
+
+static const hmac_kat_t hmac_kats[] = {
+  { "MD5", KEY_0B20, 16, "Hi There", "9294727a3638bb1c13f48ef8158bfc9d" },
+  { "MD5", "Jefe", 4, "what do ya want for nothing?",
+    "750c783e6ab0b503eaa86e310a5db738" },
+  { "SHA1", KEY_0B20, 20, "Hi There",
+    "b617318655057264e28bc0b6fb378c8ef146be00" },
+  { "SHA1", KEY_AA131, 80,
+    "Test Using Larger Than Block-Size Key - Hash Key First",
+    "aa4ae5e15272d00e95705637ce8a3b55ed402112" },
+  { "SHA256", KEY_0B20, 20, "Hi There",
+    "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7" },
+  { "SHA256", "Jefe", 4, "what do ya want for nothing?",
+    "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843" },
+  { "SHA256", KEY_AA131, 131,
+    "Test Using Larger Than Block-Size Key - Hash Key First",
+    "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54" },
+};
+
+/* NIST SP 800-38A F.1.1, F.2.1 and F.5.1, AES-128 */
+static const char sp800_key[] = "2b7e151628aed2a6abf7158809cf4f3c";
+static const char sp800_plain[] =
+  "6bc1bee22e409f96e93d7e117393172a" "ae2d8a571e03ac9c9eb76fac45af8e51"
+  "30c81c46a35ce411e5fbc1191a0a52ef" "f69f2445df4f9b17ad2b417be66c3710";
+
+typedef struct {
+  const char *mech;
+  const char *iv;
+  const char *cipher;
+} cipher_kat_t;
+
+static const cipher_kat_t cipher_kats[] = {
+  { "AES-ECB", "",
+    "3ad77bb40d7a3660a89ecaf32466ef97" "f5d3d58503b9699de785895a96fdbaaf"
+    "43b1cd7f598ece23881b00e3ed030688" "7b0c785e27e8ad3f8223207104725dd4" },
+  { "AES-CBC", "000102030405060708090a0b0c0d0e0f",
+    "7649abac8119b246cee98e9b12e9197d" "5086cb9b507219ee95db113a917678b2"
+    "73bed6b8e3c1743b7116e69e22229516" "3ff1caa1681fac09120eca307586e1a7" },
+  { "AES-CTR", "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+    "874d6191b620e3261bef6864990db6ce" "9806f66b7970fdff8617187bb9fffdff"
+    "5ae4df3edbd5d35e5b4f09020db03eab" "1e031dda2fbe03d1792170a0f3009cee" },
+};
+
+static size_t unhex(const char *h, char *out)
+{
+  size_t n = 0;
+  for (; h[0] && h[1]; h += 2) {
+    unsigned b;
+    sscanf(h, "%2x", &b);
+    out[n++] = b;
+  }
+  return n;
+}
+
+static const char *hex(const uint8_t *digest, size_t len)
+{
+  static char buf[2 * 128 + 1];
+  crypto_encode_asciihex((const char *)digest, len, buf);
+  buf[2 * len] = 0;
+  return buf;
+}
+
+static int check(const char *what, const char *mech, const uint8_t *digest,
+                 size_t len, const char *expect)
+{
+  if (strcmp(hex(digest, len), expect) == 0)
+    return 0;
+  printf("FAIL %s %s: %s, expected %s\n", what, mech, hex(digest, len), expect);
+  return 1;
+}
+
+/* Runs data through a cipher in pieces of varying size */
+static int cipher_run(const char *mech, int op, const char *key,
+                      const char *iv, size_t ivlen, int padding,
+                      const char *in, size_t len, char *out)
+{
+  crypto_cipher_t c;
+  size_t pos, step, n = 0;
+  int last;
+
+  if (crypto_cipher_init(&c, mech, op, key, 16, iv, ivlen, padding))
+    return -1;
+  for (pos = 0, step = 1; pos < len; pos += step, step = step * 5 % 37 + 1)
+    n += crypto_cipher_update(&c, in + pos, pos + step > len ? len - pos : step,
+                              out + n);
+  last = crypto_cipher_finalize(&c, out + n);
+  crypto_cipher_free(&c);
+  return last < 0 ? -1 : (int)(n + last);
+}
+
+static int run_cipher_kats(void)
+{
+  char key[16], plain[64], cipher[64], iv[16], out[128], back[128];
+  int fail = 0, n;
+  size_t i, ivlen;
+
+  unhex(sp800_key, key);
+  unhex(sp800_plain, plain);
+  for (i = 0; i < sizeof(cipher_kats) / sizeof(cipher_kats[0]); i++) {
+    const cipher_kat_t *t = &cipher_kats[i];
+    int stream = strcmp(t->mech, "AES-CTR") == 0;
+
+    unhex(t->cipher, cipher);
+    ivlen = unhex(t->iv, iv);
+
+    n = cipher_run(t->mech, OP_ENCRYPT, key, iv, ivlen, CRYPTO_PAD_NONE,
+                   plain, 64, out);
+    fail += check("encrypt", t->mech, (uint8_t *)out, n < 0 ? 0 : n, t->cipher);
+    n = cipher_run(t->mech, OP_DECRYPT, key, iv, ivlen, CRYPTO_PAD_NONE,
+                   cipher, 64, out);
+    fail += check("decrypt", t->mech, (uint8_t *)out, n < 0 ? 0 : n, sp800_plain);
+
+    /* PKCS#7 adds a whole block to the 64 bytes, and removes it again */
+    n = cipher_run(t->mech, OP_ENCRYPT, key, iv, ivlen, CRYPTO_PAD_PKCS7,
+                   plain, 64, out);
+    if (n != (stream ? 64 : 80) || memcmp(out, cipher, 64) != 0) {
+      printf("FAIL pkcs7 %s: %d bytes\n", t->mech, n);
+      fail++;
+    }
+    n = cipher_run(t->mech, OP_DECRYPT, key, iv, ivlen, CRYPTO_PAD_PKCS7,
+                   out, n, back);
+    if (n != 64 || memcmp(back, plain, 64) != 0) {
+      printf("FAIL unpad %s: %d bytes\n", t->mech, n);
+      fail++;
+    }
+  }
+  return fail;
+}
+
+static const struct {
+  const char *raw, *base64;
+} rfc4648[] = {
+  { "", "" }, { "f", "Zg==" }, { "fo", "Zm8=" }, { "foo", "Zm9v" },
+  { "foob", "Zm9vYg==" }, { "fooba", "Zm9vYmE=" }, { "foobar", "Zm9vYmFy" },
+};
+
+/* Rejected by the strict base64 decoder */
+static const char *bad_base64[] = {
+  "Zg", "Zg=", "Z===", "=Zg=", "Zg==Zg==", "Zm9v!", "Zm9vY", "Zm9v Zg==",
+};
+
+static int codec_fail(const char *what, const char *in)
+{
+  printf("FAIL %s \"%s\"\n", what, in);
+  return 1;
+}
+
+/* Decodes in pieces of step characters */
+static long base64_pieces(const char *in, size_t len, size_t step, int flags,
+                          char *out)
+{
+  codec_state_t s;
+  size_t pos;
+  long n = 0;
+
+  codec_init(&s, flags);
+  for (pos = 0; pos < len; pos += step) {
+    sint32_t got = codec_base64_decode_update(&s, in + pos,
+                                              pos + step > len ? len - pos : step,
+                                              out + n);
+    if (got < 0)
+      return -1;
+    n += got;
+  }
+  return codec_base64_decode_end(&s) < 0 ? -1 : n;
+}
+
+static int run_codec_kats(int *count)
+{
+  char buf[1024], out[1024], old[1024];
+  int fail = 0;
+  size_t i, len, step;
+
+  for (i = 0; i < sizeof(rfc4648) / sizeof(rfc4648[0]); i++) {
+    const char *raw = rfc4648[i].raw, *enc = rfc4648[i].base64;
+    size_t rlen = strlen(raw), elen = strlen(enc);
+    codec_state_t s;
+
+    len = codec_base64_encode(raw, rlen, out);
+    if (len != elen || memcmp(out, enc, elen))
+      fail += codec_fail("base64 encode", raw);
+
+    /* A byte at a time, carrying partial groups */
+    codec_init(&s, 0);
+    for (len = 0, step = 0; step < rlen; step++)
+      len += codec_base64_encode_update(&s, raw + step, 1, out + len);
+    len += codec_base64_encode_end(&s, out + len);
+    if (len != elen || memcmp(out, enc, elen))
+      fail += codec_fail("base64 encode pieces", raw);
+
+    for (step = 1; step <= 5; step++)
+      if (base64_pieces(enc, elen, step, 0, out) != (long)rlen ||
+          memcmp(out, raw, rlen))
+        fail += codec_fail("base64 decode pieces", enc);
+
+    memcpy(buf, enc, elen);
+    if (codec_base64_decode(buf, elen, buf) != (sint32_t)rlen ||
+        memcmp(buf, raw, rlen))
+      fail += codec_fail("base64 decode in place", enc);
+
+    len = codec_hex_encode(raw, rlen, buf);
+    if (codec_hex_decode(buf, len, out) != (sint32_t)rlen ||
+        memcmp(out, raw, rlen))
+      fail += codec_fail("hex round trip", raw);
+    *count += 9;
+  }
+
+  for (i = 0; i < sizeof(bad_base64) / sizeof(bad_base64[0]); i++) {
+    if (codec_base64_decode(bad_base64[i], strlen(bad_base64[i]), out) >= 0)
+      fail += codec_fail("base64 accepts", bad_base64[i]);
+    (*count)++;
+  }
+  if (base64_pieces("Zm9v\r\nYm Fy\n", 12, 3, CODEC_SKIP_SPACE, out) != 6 ||
+      memcmp(out, "foobar", 6))
+    fail += codec_fail("base64 skip space", "Zm9v\\r\\nYm Fy\\n");
+  if (codec_hex_decode("0aBc", 4, out) != 2 || memcmp(out, "\x0a\xbc", 2))
+    fail += codec_fail("hex decode", "0aBc");
+  if (codec_hex_decode("abc", 3, out) >= 0 || codec_hex_decode("0g", 2, out) >= 0)
+    fail += codec_fail("hex accepts", "abc, 0g");
+  *count += 3;
+
+  /* Same results as the old code on all byte values and lengths */
+  for (i = 0; i < 256; i++)
+    buf[i] = i * 7 + 3;
+  for (len = 0; len <= 256; len++) {
+    size_t elen = codec_base64_encode(buf, len, out);
+    if (elen != old_base64_encode(buf, len, old) || memcmp(out, old, elen) ||
+        codec_base64_decode(out, elen, out) != old_base64_decode(old, elen, old) ||
+        memcmp(out, old, len) || memcmp(out, buf, len) ||
+        codec_hex_encode(buf, len, out) != old_hex_encode(buf, len, old) ||
+        memcmp(out, old, 2 * len)) {
+      printf("FAIL codec differs from old code at %zu bytes\n", len);
+      fail++;
+      break;
+    }
+  }
+  (*count)++;
+  return fail;
+}
+
+static int run_kats(void)
+{
+  int fail = 0, codec_count = 0;
+  size_t i;
+
+  for (i = 0; i < sizeof(hash_kats) / sizeof(hash_kats[0]); i++) {
+    const kat_t *t = &hash_kats[i];
+    const digest_mech_info_t *mi = crypto_digest_mech(t->mech);
+    uint8_t digest[64];
+    size_t len = strlen(t->msg) * t->repeat;
+    char *msg = malloc(len + 1);
+    int j;
+
+    for (j = 0; j < t->repeat; j++)
+      memcpy(msg + j * strlen(t->msg), t->msg, strlen(t->msg));
+    crypto_hash(mi, msg, len, digest);
+    fail += check("hash", t->mech, digest, mi->digest_size, t->digest);
+
+    /* Unaligned data, fed in pieces across block boundaries */
+    if (len > 1) {
+      uint8_t *ctx = malloc(mi->ctx_size);
+      size_t pos, step;
+      memmove(msg + 1, msg, len);
+      mi->create(ctx);
+      for (pos = 0, step = 1; pos < len; pos += step, step = step * 3 % 97 + 1)
+        mi->update(ctx, (uint8_t *)msg + 1 + pos, pos + step > len ? len - pos : step);
+      mi->finalize(digest, ctx);
+      fail += check("update", t->mech, digest, mi->digest_size, t->digest);
+      free(ctx);
+    }
+    free(msg);
+  }
+
+  for (i = 0; i < sizeof(hmac_kats) / sizeof(hmac_kats[0]); i++) {
+    const hmac_kat_t *t = &hmac_kats[i];
+    const digest_mech_info_t *mi = crypto_digest_mech(t->mech);
+    uint8_t digest[64];
+
+    crypto_hmac(mi, t->data, strlen(t->data), t->key, t->key_len, digest);
+    fail += check("hmac", t->mech, digest, mi->digest_size, t->digest);
+  }
+
+  fail += run_cipher_kats();
+  fail += run_codec_kats(&codec_count);
+
+  printf("%d known-answer tests, %d failed\n",
+         (int)(sizeof(hash_kats) / sizeof(hash_kats[0]) * 2 +
+               sizeof(hmac_kats) / sizeof(hmac_kats[0]) +
+               sizeof(cipher_kats) / sizeof(cipher_kats[0]) * 4 +
+               codec_count), fail);
+  return fail;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* MB/s of crypto_hash, or crypto_hmac when hmac is set, on len bytes */
+static double throughput(const digest_mech_info_t *mi, int hmac, size_t len,
+                         double seconds)
+{
+  static char data[16384];
+  uint8_t digest[64];
+  long n, iter = 16;
+  double t;
+
+  for (;;) {
+    t = now();
+    for (n = 0; n < iter; n++) {
+      if (hmac)
+        crypto_hmac(mi, data, len, "secret key", 10, digest);
+      else
+        crypto_hash(mi, data, len, digest);
+    }
+    t = now() - t;
+    if (t >= seconds)
+      break;
+    iter *= t > 0.01 ? seconds / t + 1 : 10;
+  }
+  return iter * len / t / 1e6;
+}
+
+/* MB/s of a cipher fed in pieces of len bytes */
+static double cipher_throughput(const char *mech, int op, size_t len,
+                                double seconds)
+{
+  static char data[16384], out[16384 + CRYPTO_CIPHER_BLOCK];
+  crypto_cipher_t c;
+  long n, iter = 16;
+  double t;
+
+  crypto_cipher_init(&c, mech, op, "0123456789abcdef", 16, "", 0,
+                     CRYPTO_PAD_NONE);
+  for (;;) {
+    t = now();
+    for (n = 0; n < iter; n++)
+      crypto_cipher_update(&c, data, len, out);
+    t = now() - t;
+    if (t >= seconds)
+      break;
+    iter *= t > 0.01 ? seconds / t + 1 : 10;
+  }
+  crypto_cipher_free(&c);
+  return iter * len / t / 1e6;
+}
+
+typedef long (*codec_fn)(const char *in, size_t len, char *out);
+
+static long new_b64_enc(const char *in, size_t len, char *out)
+{
+  return codec_base64_encode(in, len, out);
+}
+
+static long new_b64_dec(const char *in, size_t len, char *out)
+{
+  return codec_base64_decode(in, len, out);
+}
+
+static long new_hex_enc(const char *in, size_t len, char *out)
+{
+  return codec_hex_encode(in, len, out);
+}
+
+static long new_hex_dec(const char *in, size_t len, char *out)
+{
+  return codec_hex_decode(in, len, out);
+}
+
+static long old_b64_enc(const char *in, size_t len, char *out)
+{
+  return old_base64_encode(in, len, out);
+}
+
+static long old_hex_enc(const char *in, size_t len, char *out)
+{
+  return old_hex_encode(in, len, out);
+}
+
+static const struct {
+  const char *name;
+  codec_fn fn, enc;  /* enc prepares the input of a decoder */
+} codecs[] = {
+  { "b64 enc old", old_b64_enc, NULL },
+  { "b64 enc new", new_b64_enc, NULL },
+  { "b64 dec old", old_base64_decode, new_b64_enc },
+  { "b64 dec new", new_b64_dec, new_b64_enc },
+  { "hex enc old", old_hex_enc, NULL },
+  { "hex enc new", new_hex_enc, NULL },
+  { "hex dec old", old_hex_decode, new_hex_enc },
+  { "hex dec new", new_hex_dec, new_hex_enc },
+};
+
+/* MB/s of a codec, counted in binary bytes, on len of them */
+static double codec_throughput(codec_fn fn, codec_fn enc, size_t len,
+                               double seconds)
+{
+  static char data[16384], in[2 * 16384], out[2 * 16384];
+  size_t inlen = len, i;
+  long n, iter = 16;
+  double t;
+
+  for (i = 0; i < len; i++)
+    data[i] = i * 7 + 3;
+  if (enc)
+    inlen = enc(data, len, in);
+  else
+    memcpy(in, data, len);
+  for (;;) {
+    t = now();
+    for (n = 0; n < iter; n++)
+      fn(in, inlen, out);
+    t = now() - t;
+    if (t >= seconds)
+      break;
+    iter *= t > 0.01 ? seconds / t + 1 : 10;
+  }
+  return iter * len / t / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+  static const char *mechs[] = { "MD5", "SHA1", "SHA256" };
+  static const char *ciphers[] = { "AES-ECB", "AES-CBC", "AES-CTR" };
+  static const size_t sizes[] = { 64, 1024, 16384 };
+  double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+  size_t i, j;
+
+  if (run_kats())
+    return 1;
+
+  printf("\n%-12s", "MB/s");
+  for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+    printf(" %8zu", sizes[j]);
+  printf("\n");
+  for (i = 0; i < 2 * sizeof(mechs) / sizeof(mechs[0]); i++) {
+    int hmac = i >= sizeof(mechs) / sizeof(mechs[0]);
+    const char *mech = mechs[i % (sizeof(mechs) / sizeof(mechs[0]))];
+    const digest_mech_info_t *mi = crypto_digest_mech(mech);
+
+    printf("%s%-*s", hmac ? "HMAC-" : "", hmac ? 7 : 12, mech);
+    for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+      printf(" %8.1f", throughput(mi, hmac, sizes[j], seconds));
+    printf("\n");
+  }
+  for (i = 0; i < 2 * sizeof(ciphers) / sizeof(ciphers[0]); i++) {
+    int op = i % 2 ? OP_DECRYPT : OP_ENCRYPT;
+    const char *mech = ciphers[i / 2];
+
+    printf("%s %-4s", mech, op == OP_ENCRYPT ? "enc" : "dec");
+    for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+      printf(" %8.1f", cipher_throughput(mech, op, sizes[j], seconds));
+    printf("\n");
+  }
+  for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+    printf("%-12s", codecs[i].name);
+    for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+      printf(" %8.1f", codec_throughput(codecs[i].fn, codecs[i].enc, sizes[j],
+                                        seconds));
+    printf("\n");
+  }
+  return 0;
+}
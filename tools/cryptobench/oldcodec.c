@@ -0,0 +1,123 @@
+/*
+ * The byte-at-a-time base64 and hex code the encoder module had before
+ * app/crypto/codec.c, with the Lua allocation and errors taken out, as a
+ * baseline for the codec benchmark.
+ */
+
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+
+#include "oldcodec.h"
+
+#define BASE64_INVALID '\xff'
+#define BASE64_PADDING '='
+#define ISBASE64(c) (unbytes64[c] != BASE64_INVALID)
+
+static const uint8_t b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+size_t old_base64_encode(const char *in, size_t n, char *out)
+{
+  const uint8_t *msg = (const uint8_t *)in;
+  uint8_t *q = (uint8_t *)out;
+  uint8_t bytes64[sizeof(b64)];
+  size_t i;
+
+  memcpy(bytes64, b64, sizeof(b64));
+  for (i = 0; i < n; i += 3) {
+    int a = msg[i];
+    int b = (i + 1 < n) ? msg[i + 1] : 0;
+    int c = (i + 2 < n) ? msg[i + 2] : 0;
+    *q++ = bytes64[a >> 2];
+    *q++ = bytes64[((a & 3) << 4) | (b >> 4)];
+    *q++ = (i + 1 < n) ? bytes64[((b & 15) << 2) | (c >> 6)] : BASE64_PADDING;
+    *q++ = (i + 2 < n) ? bytes64[(c & 63)] : BASE64_PADDING;
+  }
+  return q - (uint8_t *)out;
+}
+
+long old_base64_decode(const char *in, size_t len, char *out)
+{
+  const uint8_t *enc_msg = (const uint8_t *)in, *p;
+  int i, n = len, blocks = (n >> 2), pad = 0;
+  uint8_t unbytes64[UCHAR_MAX + 1], *q = (uint8_t *)out;
+
+  if (!n)
+    return 0;
+  if (n & 3)
+    return -1;
+
+  memset(unbytes64, BASE64_INVALID, sizeof(unbytes64));
+  for (i = 0; i < sizeof(b64) - 1; i++) unbytes64[b64[i]] = i;
+
+  if (enc_msg[n - 1] == BASE64_PADDING) {
+    pad = (enc_msg[n - 2] != BASE64_PADDING) ? 1 : 2;
+    blocks--;
+  }
+
+  for (i = 0; i < n - pad; i++) if (!ISBASE64(enc_msg[i])) return -1;
+  unbytes64[BASE64_PADDING] = 0;
+
+  for (i = 0, p = enc_msg; i < blocks; i++) {
+    uint8_t a = unbytes64[*p++];
+    uint8_t b = unbytes64[*p++];
+    uint8_t c = unbytes64[*p++];
+    uint8_t d = unbytes64[*p++];
+    *q++ = (a << 2) | (b >> 4);
+    *q++ = (b << 4) | (c >> 2);
+    *q++ = (c << 6) | d;
+  }
+
+  if (pad) {
+    uint8_t a = unbytes64[*p++];
+    uint8_t b = unbytes64[*p++];
+    *q++ = (a << 2) | (b >> 4);
+    if (pad == 1) *q++ = (b << 4) | (unbytes64[*p] >> 2);
+  }
+  return q - (uint8_t *)out;
+}
+
+static inline uint8_t to_hex_nibble(uint8_t b) {
+  return b + (b < 10 ? '0' : 'a' - 10);
+}
+
+size_t old_hex_encode(const char *in, size_t len, char *out)
+{
+  const uint8_t *msg = (const uint8_t *)in;
+  int i, n = len;
+  uint8_t *q = (uint8_t *)out;
+
+  for (i = 0; i < n; i++) {
+    *q++ = to_hex_nibble(msg[i] >> 4);
+    *q++ = to_hex_nibble(msg[i] & 0xf);
+  }
+  return 2 * n;
+}
+
+long old_hex_decode(const char *in, size_t len, char *out)
+{
+  int i, n = len;
+  const uint8_t *p = (const uint8_t *)in;
+  uint8_t b, c = 0, *q = (uint8_t *)out;
+
+  if (n & 1)
+    return -1;
+
+  for (i = 0; i < n; i++) {
+    if (*p >= '0' && *p <= '9') {
+      b = *p++ - '0';
+    } else if (*p >= 'a' && *p <= 'f') {
+      b = *p++ - ('a' - 10);
+    } else if (*p >= 'A' && *p <= 'F') {
+      b = *p++ - ('A' - 10);
+    } else {
+      return -1;
+    }
+    if ((i & 1) == 0) {
+      c = b << 4;
+    } else {
+      *q++ = c + b;
+    }
+  }
+  return n >> 1;
+}
@@ -0,0 +1,11 @@
+#ifndef _OLDCODEC_H_
+#define _OLDCODEC_H_
+
+#include <stddef.h>
+
+size_t old_base64_encode(const char *in, size_t len, char *out);
+long old_base64_decode(const char *in, size_t len, char *out);
+size_t old_hex_encode(const char *in, size_t len, char *out);
+long old_hex_decode(const char *in, size_t len, char *out);
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ * Host stand-ins for the MD5 and SHA-1 routines in the ESP8266 ROM, with
+ * the context layouts of rom.h. Plain rolled implementations; they only
+ * let the crypto_hash/crypto_hmac code paths run on the host.
+ */
+
+#include <string.h>
+
+#include "rom.h"
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+typedef void (*block_fn)(uint32_t *state, const uint8_t *block);
+
+/* The buffering and padding are the same for both, only the byte order
+   of the bit count differs */
+static void update(uint32_t *state, uint32_t *count, uint8_t *buffer,
+                   block_fn transform, const uint8_t *data, unsigned int len)
+{
+  unsigned int used = (count[0] >> 3) & 63;
+
+  if ((count[0] += len << 3) < (len << 3))
+    count[1]++;
+  count[1] += len >> 29;
+
+  if (used) {
+    unsigned int n = 64 - used < len ? 64 - used : len;
+    memcpy(buffer + used, data, n);
+    data += n;
+    len -= n;
+    if (used + n < 64)
+      return;
+    transform(state, buffer);
+  }
+  for (; len >= 64; data += 64, len -= 64)
+    transform(state, data);
+  memcpy(buffer, data, len);
+}
+
+static void final(uint32_t *state, uint32_t *count, uint8_t *buffer,
+                  block_fn transform, int big_endian)
+{
+  uint8_t bits[8];
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    uint32_t w = count[i < 4 ? big_endian : !big_endian];
+    bits[i] = w >> (big_endian ? 24 - 8 * (i & 3) : 8 * (i & 3));
+  }
+  update(state, count, buffer, transform, (const uint8_t *)"\x80", 1);
+  while (((count[0] >> 3) & 63) != 56)
+    update(state, count, buffer, transform, (const uint8_t *)"", 1);
+  update(state, count, buffer, transform, bits, 8);
+}
+
+
+static void md5_transform(uint32_t *state, const uint8_t *block)
+{
+  static const uint8_t r[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+  };
+  static const uint32_t k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+    0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+    0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+    0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+    0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+  };
+  uint32_t w[16], a = state[0], b = state[1], c = state[2], d = state[3];
+  int i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = block[4*i] | block[4*i+1] << 8 | block[4*i+2] << 16 |
+           (uint32_t)block[4*i+3] << 24;
+  for (i = 0; i < 64; i++) {
+    uint32_t f, t;
+    int g;
+    if (i < 16)      { f = (b & c) | (~b & d); g = i; }
+    else if (i < 32) { f = (d & b) | (~d & c); g = (5 * i + 1) & 15; }
+    else if (i < 48) { f = b ^ c ^ d;          g = (3 * i + 5) & 15; }
+    else             { f = c ^ (b | ~d);       g = (7 * i) & 15; }
+    t = d;
+    d = c;
+    c = b;
+    b += ROL(a + f + k[i] + w[g], r[i]);
+    a = t;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+}
+
+void MD5Init(MD5_CTX *ctx)
+{
+  static const uint32_t iv[4] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+  };
+  memset(ctx, 0, sizeof(*ctx));
+  memcpy(ctx->state, iv, sizeof(iv));
+}
+
+void MD5Update(MD5_CTX *ctx, const unsigned char *data, unsigned int len)
+{
+  update(ctx->state, ctx->count, ctx->buffer, md5_transform, data, len);
+}
+
+void MD5Final(unsigned char digest[MD5_DIGEST_LENGTH], MD5_CTX *ctx)
+{
+  int i;
+  final(ctx->state, ctx->count, ctx->buffer, md5_transform, 0);
+  for (i = 0; i < MD5_DIGEST_LENGTH; i++)
+    digest[i] = ctx->state[i >> 2] >> (8 * (i & 3));
+}
+
+
+void SHA1Transform(uint32_t state[5], const uint8_t block[64])
+{
+  uint32_t w[80], a = state[0], b = state[1], c = state[2], d = state[3],
+           e = state[4];
+  int i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = (uint32_t)block[4*i] << 24 | block[4*i+1] << 16 |
+           block[4*i+2] << 8 | block[4*i+3];
+  for (; i < 80; i++)
+    w[i] = ROL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+  for (i = 0; i < 80; i++) {
+    uint32_t f, t;
+    if (i < 20)      f = ((b & c) | (~b & d)) + 0x5a827999;
+    else if (i < 40) f = (b ^ c ^ d) + 0x6ed9eba1;
+    else if (i < 60) f = ((b & c) | (b & d) | (c & d)) + 0x8f1bbcdc;
+    else             f = (b ^ c ^ d) + 0xca62c1d6;
+    t = ROL(a, 5) + f + e + w[i];
+    e = d;
+    d = c;
+    c = ROL(b, 30);
+    b = a;
+    a = t;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+static void sha1_transform(uint32_t *state, const uint8_t *block)
+{
+  SHA1Transform(state, block);
+}
+
+void SHA1Init(SHA1_CTX *ctx)
+{
+  static const uint32_t iv[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+  };
+  memset(ctx, 0, sizeof(*ctx));
+  memcpy(ctx->state, iv, sizeof(iv));
+}
+
+void SHA1Update(SHA1_CTX *ctx, const uint8_t *data, unsigned int len)
+{
+  update(ctx->state, ctx->count, ctx->buffer, sha1_transform, data, len);
+}
+
+void SHA1Final(uint8_t digest[SHA1_DIGEST_LENGTH], SHA1_CTX *ctx)
+{
+  int i;
+  final(ctx->state, ctx->count, ctx->buffer, sha1_transform, 1);
+  for (i = 0; i < SHA1_DIGEST_LENGTH; i++)
+    digest[i] = ctx->state[i >> 2] >> (24 - 8 * (i & 3));
+}
@@ -0,0 +1,119 @@
+-- Tests of the async module on the host's SDK timers and tasks
+--
+--   ./nodemcu async_test.lua
+--
+-- The coroutines run from the timers and tasks after the script returns;
+-- a last timer checks the order they ran in and exits with the number of
+-- failures.
+
+local failures = 0
+local function check(cond, what)
+  if not cond then
+    failures = failures + 1
+    print("FAIL " .. what)
+  end
+end
+
+local trace = {}
+local function log(s) trace[#trace + 1] = s end
+
+-- async.run() runs the function up to its first wait and returns
+local started = false
+local co = async.run(function(a, b)
+  started = (a == 1 and b == "two")
+  async.yield()
+  log("run")
+end, 1, "two")
+check(started and type(co) == "thread", "run starts at once with its arguments")
+check(coroutine.status(co) == "suspended", "run returns at the first wait")
+
+-- Sleeps end in the order of their times, not of their start
+for _, ms in ipairs({ 30, 10, 20 }) do
+  async.run(function()
+    local t0 = tmr.now()
+    async.sleep(ms)
+    local waited = (tmr.now() - t0) / 1000
+    check(waited >= ms - 1, "sleep(" .. ms .. ") waited " .. waited .. " ms")
+    log("sleep" .. ms)
+  end)
+end
+
+-- Yields take turns with the tasks posted before them
+for _, name in ipairs({ "a", "b" }) do
+  async.run(function()
+    for i = 1, 3 do
+      log(name .. i)
+      async.yield()
+    end
+  end)
+end
+
+-- Calls of a callback before its waits are queued in order, nils kept
+async.run(function()
+  local cb = async.callback()
+  cb(1, nil, 3)
+  cb()
+  cb("x")
+  local a, b, c = async.wait(cb)
+  check(a == 1 and b == nil and c == 3, "first queued call")
+  check(select("#", async.wait(cb)) == 0, "second queued call has no arguments")
+  check(async.wait(cb) == "x", "third queued call")
+  -- Waiting first, resumed by a timer with its argument
+  tmr.create():alarm(5, tmr.ALARM_SINGLE, cb)
+  local t = async.wait(cb)
+  check(type(t) == "userdata", "resumed by the timer with the timer object")
+  log("callback")
+end)
+
+-- Errors before the first wait are raised in the caller of async.run()
+local ok, err = pcall(async.run, function() error("early") end)
+check(not ok and err:find("early"), "error before the first wait: " .. tostring(err))
+
+-- After that, in whatever resumed the coroutine
+local resume
+async.run(function()
+  resume = async.callback()
+  async.wait(resume)
+  error("late")
+end)
+ok, err = pcall(resume)
+check(not ok and err:find("late"), "error after a wait: " .. tostring(err))
+
+-- Misuse
+ok, err = pcall(async.wait, print)
+check(not ok and err:find("not in a coroutine"), "wait outside a coroutine")
+ok, err = pcall(async.callback)
+check(not ok and err:find("not in a coroutine"), "callback outside a coroutine")
+local other
+async.run(function() other = async.callback() async.wait(other) end)
+async.run(function()
+  local ok, err = pcall(async.wait, other)
+  check(not ok and err:find("another coroutine"), "wait for the callback of another coroutine")
+  ok, err = pcall(async.sleep, 0)
+  check(not ok and err:find("invalid time"), "sleep(0)")
+  ok, err = pcall(async.wait, function() end)
+  check(not ok and err:find("not an async callback"), "wait for a plain function")
+end)
+other()
+
+-- Cancelling: a coroutine whose callback is dropped is collected with it
+local weak = setmetatable({}, { __mode = "k" })
+do
+  local cancelled = async.run(function()
+    local cb = async.callback()
+    async.wait(cb)
+    log("never")
+  end)
+  weak[cancelled] = true
+end
+collectgarbage()
+check(next(weak) == nil, "coroutine without a callback left collected")
+
+-- Once everything above has run
+tmr.create():alarm(100, tmr.ALARM_SINGLE, function()
+  local got = table.concat(trace, " ")
+  local expect = "a1 b1 run a2 b2 a3 b3 callback sleep10 sleep20 sleep30"
+  check(got == expect, "order\n  got    " .. got .. "\n  expect " .. expect)
+  print(failures .. " failures")
+  host.exit(failures == 0 and 0 or 1)
+end)
@@ -0,0 +1,20 @@
+/*
+ * The parts of platform.c that main.c drives: the flash image and the
+ * event loop standing in for the SDK's scheduler.
+ */
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include "c_types.h"
+
+/* Maps a flash image file of size bytes, created erased if it does not
+   exist; with no name the flash is in memory only */
+bool host_flash_open(const char *name, uint32_t size);
+void host_flash_close(void);
+
+/* Runs posted tasks, timers and connections until none is left that could
+   make more work: no task is queued, no one-shot timer armed and no
+   connection open. Repeating timers alone do not keep it running. */
+void host_run(void);
+
+#endif
@@ -0,0 +1,10 @@
+/*
+ * Host stand-in for app/libc/c_stddef.h; the device header hardwires the
+ * 32 bit size_t and ptrdiff_t.
+ */
+#ifndef __c_stddef_h
+#define __c_stddef_h
+
+#include <stddef.h>
+
+#endif
@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for app/libc/c_stdint.h. nodemcu_spiffs.h declares the
+ * 32 bit intptr_t of the device, which would clash with the host's, so the
+ * name is moved aside to a type of its own.
+ */
+#ifndef __c_stdint_h
+#define __c_stdint_h
+
+#include <stdint.h>
+#include "c_types.h"
+
+typedef uint32_t nodemcu_intptr_t;
+#define intptr_t nodemcu_intptr_t
+
+#endif
@@ -0,0 +1,24 @@
+/*
+ * Host stand-in for app/libc/c_stdio.h
+ */
+#ifndef _C_STDIO_H_
+#define _C_STDIO_H_
+
+#include <stdio.h>
+#include "c_stddef.h"
+#include "osapi.h"
+
+#define c_stdin   stdin
+#define c_stdout  stdout
+#define c_stderr  stderr
+
+extern void output_redirect(const char *str);
+#define c_puts output_redirect
+
+#define c_sprintf  sprintf
+#define c_vsprintf vsprintf
+#define c_printf   printf
+
+extern void dbg_printf(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
+
+#endif /* _C_STDIO_H_ */
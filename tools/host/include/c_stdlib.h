@@ -0,0 +1,34 @@
+/*
+ * Host stand-in for app/libc/c_stdlib.h
+ */
+#ifndef _C_STDLIB_H_
+#define _C_STDLIB_H_
+
+#include <stdlib.h>
+#include "c_stddef.h"
+#include "mem.h"
+#include "user_config.h"
+
+#ifdef HEAP_TRACE
+#define c_free(p)       lheap_trace_free(p)
+#define c_malloc(s)     lheap_trace_malloc((s), 0, __FILE__, __LINE__)
+#define c_zalloc(s)     lheap_trace_malloc((s), 1, __FILE__, __LINE__)
+#define c_realloc(p, s) lheap_trace_realloc((p), (s), __FILE__, __LINE__)
+void *lheap_trace_malloc(size_t size, int zero, const char *file, unsigned line);
+void *lheap_trace_realloc(void *p, size_t size, const char *file, unsigned line);
+void lheap_trace_free(void *p);
+#else
+#define c_free    os_free
+#define c_malloc  os_malloc
+#define c_zalloc  os_zalloc
+#define c_realloc os_realloc
+#endif
+
+#define c_abs     abs
+#define c_atoi    atoi
+#define c_strtol  strtol
+#define c_strtoul strtoul
+#define c_strtod  strtod
+#define c_getenv  getenv
+
+#endif /* _C_STDLIB_H_ */
@@ -0,0 +1,58 @@
+/*
+ * Host stand-in for the SDK's c_types.h, built on the system headers.
+ */
+#ifndef _C_TYPES_H_
+#define _C_TYPES_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef uint8_t  uint8;
+typedef uint8_t  u8;
+typedef int8_t   sint8;
+typedef int8_t   int8;
+typedef int8_t   s8;
+typedef uint16_t uint16;
+typedef uint16_t u16;
+typedef int16_t  sint16;
+typedef int16_t  s16;
+typedef uint32_t uint32;
+typedef uint32_t u32;
+typedef int32_t  sint32;
+typedef int32_t  s32;
+typedef int32_t  int32;
+typedef int16_t  int16;
+typedef uint64_t uint64;
+typedef uint64_t u64;
+typedef int64_t  sint64;
+typedef int64_t  s64;
+typedef int8_t   sint8_t;
+typedef int16_t  sint16_t;
+typedef int32_t  sint32_t;
+typedef int64_t  sint64_t;
+typedef float    real32;
+typedef double   real64;
+
+typedef enum {
+  OK = 0,
+  FAIL,
+  PENDING,
+  BUSY,
+  CANCEL
+} STATUS;
+
+#define __le16      u16
+#define BOOL        bool
+#define TRUE        true
+#define FALSE       false
+
+#define LOCAL       static
+#define BIT(nr)     (1UL << (nr))
+
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RODATA_ATTR
+#define STORE_ATTR  __attribute__((aligned(4)))
+#define SHMEM_ATTR
+
+#endif /* _C_TYPES_H_ */
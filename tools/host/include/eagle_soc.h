@@ -0,0 +1,10 @@
+/*
+ * Host stand-in for the SDK's eagle_soc.h; there are no registers on the
+ * host, the driver headers only need it to be there.
+ */
+#ifndef _EAGLE_SOC_H_
+#define _EAGLE_SOC_H_
+
+#include "c_types.h"
+
+#endif /* _EAGLE_SOC_H_ */
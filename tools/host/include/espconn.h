@@ -0,0 +1,12 @@
+/*
+ * The firmware's espconn.h, which expects ip_addr_t and err_t to have been
+ * declared by the SDK headers before it.
+ */
+#ifndef _HOST_ESPCONN_H_
+#define _HOST_ESPCONN_H_
+
+#include "lwip/ip_addr.h"
+#include "lwip/err.h"
+#include "lwip/app/espconn.h"
+
+#endif
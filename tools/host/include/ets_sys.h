@@ -0,0 +1,38 @@
+/*
+ * Host stand-in for the SDK's ets_sys.h
+ */
+#ifndef _ETS_SYS_H_
+#define _ETS_SYS_H_
+
+#include <stdio.h>
+#include "c_types.h"
+
+typedef uint32_t ETSSignal;
+typedef uint32_t ETSParam;
+
+typedef struct ETSEventTag {
+  ETSSignal sig;
+  ETSParam  par;
+} ETSEvent;
+
+typedef void (*ETSTask)(ETSEvent *e);
+
+typedef void ETSTimerFunc(void *timer_arg);
+
+/* As the SDK's, timer_expire is in microseconds of the host clock here */
+typedef struct _ETSTIMER_ {
+  struct _ETSTIMER_ *timer_next;
+  uint32_t          timer_expire;
+  uint32_t          timer_period;
+  ETSTimerFunc      *timer_func;
+  void              *timer_arg;
+} ETSTimer;
+
+#define ets_sprintf  sprintf
+#define ets_vsprintf vsprintf
+#define ets_printf   printf
+
+#define ETS_INTR_LOCK()
+#define ETS_INTR_UNLOCK()
+
+#endif /* _ETS_SYS_H_ */
@@ -0,0 +1,14 @@
+/*
+ * Host stand-in for the SDK's mem.h, on top of the C library heap.
+ */
+#ifndef _MEM_H_
+#define _MEM_H_
+
+#include <stdlib.h>
+
+#define os_malloc(s)     malloc(s)
+#define os_zalloc(s)     calloc(1, (s))
+#define os_realloc(p, s) realloc((p), (s))
+#define os_free(p)       free(p)
+
+#endif /* _MEM_H_ */
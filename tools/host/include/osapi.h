@@ -0,0 +1,42 @@
+/*
+ * Host stand-in for the SDK's osapi.h
+ */
+#ifndef _OSAPI_H_
+#define _OSAPI_H_
+
+#include <stdio.h>
+#include <string.h>
+#include "c_types.h"
+#include "ets_sys.h"
+#include "os_type.h"
+
+#define os_memcmp   memcmp
+#define os_memcpy   memcpy
+#define os_memmove  memmove
+#define os_memset   memset
+#define os_strcat   strcat
+#define os_strchr   strchr
+#define os_strcmp   strcmp
+#define os_strcpy   strcpy
+#define os_strlen   strlen
+#define os_strncmp  strncmp
+#define os_strncpy  strncpy
+#define os_strstr   strstr
+#define os_sprintf  sprintf
+#define os_snprintf snprintf
+#define os_printf   printf
+#define os_delay_us(us) ((void)(us))
+
+unsigned long os_random(void);
+
+/* The SDK timers run from the event loop in platform.c */
+void ets_timer_arm_new(ETSTimer *ptimer, int time, int repeat_flag, int isMstimer);
+void ets_timer_disarm(ETSTimer *ptimer);
+void ets_timer_setfn(ETSTimer *ptimer, ETSTimerFunc *pfunction, void *parg);
+
+#define os_timer_arm(t, ms, repeat)    ets_timer_arm_new(t, ms, repeat, 1)
+#define os_timer_arm_us(t, us, repeat) ets_timer_arm_new(t, us, repeat, 0)
+#define os_timer_disarm  ets_timer_disarm
+#define os_timer_setfn   ets_timer_setfn
+
+#endif /* _OSAPI_H_ */
@@ -0,0 +1,32 @@
+/*
+ * Host stand-in for the SDK's user_interface.h
+ */
+#ifndef __USER_INTERFACE_H__
+#define __USER_INTERFACE_H__
+
+#include "c_types.h"
+#include "os_type.h"
+#include "lwip/ip_addr.h"
+#include "lwip/err.h"
+
+enum {
+  USER_TASK_PRIO_0 = 0,
+  USER_TASK_PRIO_1,
+  USER_TASK_PRIO_2,
+  USER_TASK_PRIO_MAX
+};
+
+uint32 system_get_time(void);
+uint32 system_get_free_heap_size(void);
+uint32 system_get_chip_id(void);
+uint32 system_get_rtc_time(void);
+uint32 system_rtc_clock_cali_proc(void);
+void system_restart(void);
+void system_soft_wdt_feed(void);
+void system_timer_reinit(void);
+uint8 system_get_cpu_freq(void);
+
+bool system_os_task(os_task_t task, uint8 prio, os_event_t *queue, uint8 qlen);
+bool system_os_post(uint8 prio, os_signal_t sig, os_param_t par);
+
+#endif /* __USER_INTERFACE_H__ */
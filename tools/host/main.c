@@ -0,0 +1,325 @@
+/*
+ * Runs NodeMCU Lua scripts on the host.
+ *
+ *   nodemcu [-f image] [-s size] [script.lua [args]]
+ *
+ * The Lua core and the modules are the firmware sources, built against the
+ * stand-in SDK headers in include/. The file system is SPIFFS on a flash
+ * image, kept in the file given with -f, else only in memory for the run.
+ * The script is a file of the host, the arguments after its name are
+ * passed in the global table arg, as with the standard lua interpreter;
+ * without one init.lua of the flash is run, as on the device. Then the
+ * tasks, timers and connections the script started run until none is left.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "module.h"
+#include "lrodefs.h"
+#include "lheap.h"
+#include "mqtt_msg.h"
+#include "user_interface.h"
+#include "vfs.h"
+#include "host.h"
+#include "trace.h"
+
+#define FLASH_DEFAULT_SIZE (512 * 1024)
+
+// The line the interpreter reads, which the coap module may post to it
+static char line_buffer[LUA_MAXINPUT];
+lua_Load gLoad = { .line = line_buffer, .len = LUA_MAXINPUT };
+
+// Lua: host.clock() returns a monotonic time in seconds
+static int host_clock(lua_State *L)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  lua_pushnumber(L, ts.tv_sec + ts.tv_nsec / 1e9);
+  return 1;
+}
+
+// Pushes the content of a host file, false if it cannot be opened
+static bool push_file(lua_State *L, const char *name)
+{
+  FILE *fp = fopen(name, "rb");
+  luaL_Buffer b;
+  size_t n;
+
+  if (!fp)
+    return false;
+  luaL_buffinit(L, &b);
+  do {
+    char *p = luaL_prepbuffer(&b);
+    n = fread(p, 1, LUAL_BUFFERSIZE, fp);
+    luaL_addsize(&b, n);
+  } while (n == LUAL_BUFFERSIZE);
+  fclose(fp);
+  luaL_pushresult(&b);
+  return true;
+}
+
+// Lua: host.readfile(name) returns the content of a host file
+static int host_readfile(lua_State *L)
+{
+  const char *name = luaL_checkstring(L, 1);
+
+  if (!push_file(L, name))
+    return luaL_error(L, "cannot open %s", name);
+  return 1;
+}
+
+// Lua: host.exit([code]) ends the run, with the flash image saved
+static int host_exit(lua_State *L)
+{
+  int code = luaL_optint(L, 1, 0);
+
+  fflush(stdout);
+  host_flash_close();
+  exit(code);
+  return 0;
+}
+
+// The MQTT encoder as the mqtt module drives it, without the connection
+#define MQTT_BUF_SIZE 1024
+static mqtt_connection_t mqtt_conn;   // keeps the message ids going
+static uint8_t mqtt_buf[MQTT_BUF_SIZE];
+
+static int push_mqtt_message(lua_State *L, mqtt_message_t *msg)
+{
+  if (msg->length == 0)
+    return luaL_error(L, "message too long");
+  lua_pushlstring(L, (const char *)msg->data, msg->length);
+  return 1;
+}
+
+// Lua: host.mqtt_publish(topic, data[, qos[, retain]]) returns the PUBLISH
+static int host_mqtt_publish(lua_State *L)
+{
+  const char *topic = luaL_checkstring(L, 1);
+  size_t len;
+  const char *data = luaL_checklstring(L, 2, &len);
+  int qos = luaL_optint(L, 3, 0);
+  int retain = luaL_optint(L, 4, 0);
+  uint16_t id;
+
+  mqtt_msg_init(&mqtt_conn, mqtt_buf, MQTT_BUF_SIZE);
+  return push_mqtt_message(L, mqtt_msg_publish(&mqtt_conn, topic, data, len, qos, retain, &id));
+}
+
+// Lua: host.mqtt_subscribe(topic[, qos]) returns the SUBSCRIBE
+static int host_mqtt_subscribe(lua_State *L)
+{
+  const char *topic = luaL_checkstring(L, 1);
+  int qos = luaL_optint(L, 2, 0);
+  uint16_t id;
+
+  mqtt_msg_init(&mqtt_conn, mqtt_buf, MQTT_BUF_SIZE);
+  return push_mqtt_message(L, mqtt_msg_subscribe(&mqtt_conn, topic, qos, &id));
+}
+
+// Lua: topic, data = host.mqtt_parse(msg) of a PUBLISH, as mqtt receives it
+static int host_mqtt_parse(lua_State *L)
+{
+  size_t len;
+  uint8_t *msg = (uint8_t *)luaL_checklstring(L, 1, &len);
+  uint16_t topic_len = len, data_len = len;
+  const char *topic, *data;
+
+  if (len > 0xFFFF || mqtt_get_type(msg) != MQTT_MSG_TYPE_PUBLISH)
+    return luaL_error(L, "not a PUBLISH");
+  topic = mqtt_get_publish_topic(msg, &topic_len);
+  data = mqtt_get_publish_data(msg, &data_len);
+  if (!topic)
+    return luaL_error(L, "truncated PUBLISH");
+  lua_pushlstring(L, topic, topic_len);
+  if (data)
+    lua_pushlstring(L, data, data_len);
+  else
+    lua_pushliteral(L, "");
+  return 2;
+}
+
+static const LUA_REG_TYPE host_map[] = {
+  { LSTRKEY( "clock" ),          LFUNCVAL( host_clock ) },
+  { LSTRKEY( "exit" ),           LFUNCVAL( host_exit ) },
+  { LSTRKEY( "mqtt_parse" ),     LFUNCVAL( host_mqtt_parse ) },
+  { LSTRKEY( "mqtt_publish" ),   LFUNCVAL( host_mqtt_publish ) },
+  { LSTRKEY( "mqtt_subscribe" ), LFUNCVAL( host_mqtt_subscribe ) },
+  { LSTRKEY( "readfile" ),       LFUNCVAL( host_readfile ) },
+  { LNILKEY, LNILVAL }
+};
+
+NODEMCU_MODULE(HOST, "host", host_map, NULL);
+
+// Lua: node.heap(), as on the device
+static int node_heap(lua_State *L)
+{
+  lua_pushinteger(L, system_get_free_heap_size());
+  return 1;
+}
+
+// Lua: node.trace.dump(), mark([arg]), stop() and start(), as on the device
+static int node_trace_dump(lua_State *L)
+{
+  trace_dump();
+  return 0;
+}
+
+static int node_trace_mark(lua_State *L)
+{
+  TRACE(TRACE_MARK, luaL_optinteger(L, 1, 0));
+  return 0;
+}
+
+static int node_trace_stop(lua_State *L)
+{
+  trace_stopped = true;
+  return 0;
+}
+
+static int node_trace_start(lua_State *L)
+{
+  trace_stopped = false;
+  return 0;
+}
+
+static const LUA_REG_TYPE node_trace_map[] = {
+  { LSTRKEY( "dump" ),  LFUNCVAL( node_trace_dump ) },
+  { LSTRKEY( "mark" ),  LFUNCVAL( node_trace_mark ) },
+  { LSTRKEY( "start" ), LFUNCVAL( node_trace_start ) },
+  { LSTRKEY( "stop" ),  LFUNCVAL( node_trace_stop ) },
+  { LNILKEY, LNILVAL }
+};
+
+// The parts of the node module that make sense on the host
+static const LUA_REG_TYPE node_map[] = {
+  { LSTRKEY( "heap" ),     LFUNCVAL( node_heap ) },
+  { LSTRKEY( "heapinfo" ), LFUNCVAL( lheap_info ) },
+  { LSTRKEY( "trace" ),    LROVAL( node_trace_map ) },
+  { LNILKEY, LNILVAL }
+};
+
+NODEMCU_MODULE(NODE, "node", node_map, NULL);
+
+static int traceback(lua_State *L)
+{
+  lua_getfield(L, LUA_GLOBALSINDEX, "debug");
+  lua_getfield(L, -1, "traceback");
+  lua_pushvalue(L, 1);
+  lua_pushinteger(L, 2);
+  lua_call(L, 2, 1);
+  return 1;
+}
+
+// On the device the watchdog resets it after a panic, here the run ends
+static int panic(lua_State *L)
+{
+  fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(L, -1));
+  host_flash_close();
+  exit(1);
+  return 0;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-f image] [-s size] [script.lua [args]]\n", name);
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  const char *image = NULL, *script;
+  uint32_t size = FLASH_DEFAULT_SIZE;
+  lua_State *L;
+  int i, opt, status;
+
+  while ((opt = getopt(argc, argv, "+f:s:")) != -1) {
+    switch (opt) {
+    case 'f':
+      image = optarg;
+      break;
+    case 's':
+      size = strtoul(optarg, NULL, 0);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  // arg[-1] stays the program, as with the standard interpreter
+  argv[optind - 1] = argv[0];
+  argv += optind - 1;
+  argc -= optind - 1;
+  script = argc > 1 ? argv[1] : NULL;
+
+  if (!host_flash_open(image, size))
+    return 1;
+  // As user_main.c does at boot, where a flash in memory is always new
+  if (!vfs_mount("/FLASH", 0)) {
+    if (image)
+      fprintf(stderr, "Formatting file system. Please wait...\n");
+    if (!vfs_format()) {
+      fprintf(stderr, "unable to format the file system\n");
+      return 1;
+    }
+  }
+
+  // As the firmware, so lua_getstate() finds it from callbacks
+  L = lua_open();
+  if (!L) {
+    fprintf(stderr, "%s: cannot create state\n", argv[0]);
+    return 1;
+  }
+  lua_atpanic(L, panic);
+  luaL_openlibs(L);
+  gLoad.L = L;
+
+  lua_createtable(L, argc > 2 ? argc - 2 : 0, 1);
+  for (i = 0; i < argc; i++) {
+    lua_pushstring(L, argv[i]);
+    lua_rawseti(L, -2, i - 1);
+  }
+  lua_setglobal(L, "arg");
+
+  lua_pushcfunction(L, traceback);
+  if (script) {
+    if (push_file(L, script)) {
+      size_t len;
+      const char *chunk = lua_tolstring(L, -1, &len);
+      // A #! line is skipped, its newline kept for the line numbers
+      if (len && *chunk == '#')
+        for (; len && *chunk != '\n'; len--)
+          chunk++;
+      lua_pushfstring(L, "@%s", script);
+      status = luaL_loadbuffer(L, chunk, len, lua_tostring(L, -1));
+      lua_replace(L, -3);
+      lua_pop(L, 1);
+    } else {
+      lua_pushfstring(L, "cannot open %s", script);
+      status = LUA_ERRFILE;
+    }
+  } else {
+    status = luaL_loadfsfile(L, "init.lua");
+    if (status == LUA_ERRFILE) {
+      // Nothing to run, as on a device without init.lua
+      lua_pop(L, 1);
+      lua_pushnil(L);
+      status = 0;
+    }
+  }
+  if (!status && !lua_isnil(L, -1))
+    status = lua_pcall(L, 0, 0, -2);
+  if (status)
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+  else
+    host_run();
+
+  lua_close(L);
+  host_flash_close();
+  return status ? 1 : 0;
+}
@@ -0,0 +1,711 @@
+/*
+ * POSIX stand-ins for the SDK and platform functions used by the Lua core
+ * and the modules linked into the host build.
+ *
+ * host_run() takes the place of the SDK's scheduler: it dispatches the
+ * posted tasks, fires the SDK timers on the monotonic clock and waits in
+ * select() for the UDP sockets behind espconn. All of it runs on the one
+ * thread, so interrupts are never locked out; only the hardware timer
+ * interrupts, from a signal handler.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "c_types.h"
+#include "os_type.h"
+#include "osapi.h"
+#include "user_interface.h"
+#include "user_config.h"
+#include "platform.h"
+#include "hw_timer.h"
+#include "espconn.h"
+#include "host.h"
+#include "trace.h"
+
+void output_redirect(const char *str)
+{
+  fputs(str, stdout);
+}
+
+void dbg_printf(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+}
+
+/*
+ * The C library heap grows as needed, so its own free space means nothing.
+ * The host has a heap of HOST_HEAP_SIZE bytes instead, of which what is
+ * allocated, in the arena or mapped, is taken, so node.heap() falls and
+ * rises with use as on the device.
+ */
+#ifndef HOST_HEAP_SIZE
+#define HOST_HEAP_SIZE (32 * 1024 * 1024)
+#endif
+
+uint32 system_get_free_heap_size(void)
+{
+  struct mallinfo2 mi = mallinfo2();
+  size_t used = mi.uordblks + mi.hblkhd;
+  return used < HOST_HEAP_SIZE ? (uint32)(HOST_HEAP_SIZE - used) : 0;
+}
+
+unsigned long os_random(void)
+{
+  return (unsigned long)random();
+}
+
+/* Flash is ordinary memory here */
+uint8_t byte_of_aligned_array(const uint8_t *aligned_array, uint32_t index)
+{
+  return aligned_array[index];
+}
+
+uint16_t word_of_aligned_array(const uint16_t *aligned_array, uint32_t index)
+{
+  return aligned_array[index];
+}
+
+size_t c_strlcpy(char *dst, const char *src, size_t siz)
+{
+  size_t len = strlen(src);
+  if (siz) {
+    size_t n = len < siz - 1 ? len : siz - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return len;
+}
+
+size_t c_strlcat(char *dst, const char *src, size_t siz)
+{
+  size_t dlen = strnlen(dst, siz);
+  if (dlen == siz)
+    return siz + strlen(src);
+  return dlen + c_strlcpy(dst + dlen, src, siz - dlen);
+}
+
+/* ---------------------------------------------------------------------------
+ * The hardware timer, as an interval timer on the process CPU time. The
+ * callback runs in the SIGPROF handler, much as in an interrupt.
+ */
+
+static os_param_t hw_timer_owner;
+static void (*hw_timer_func)(os_param_t);
+static os_param_t hw_timer_arg;
+static bool hw_timer_autoload;
+
+static void hw_timer_signal(int sig)
+{
+  (void)sig;
+  if (hw_timer_func)
+    hw_timer_func(hw_timer_arg);
+}
+
+bool platform_hw_timer_init(os_param_t owner, FRC1_TIMER_SOURCE_TYPE source_type, bool autoload)
+{
+  (void)source_type;
+  if (hw_timer_owner && hw_timer_owner != owner)
+    return false;
+  hw_timer_owner = owner;
+  hw_timer_autoload = autoload;
+  signal(SIGPROF, hw_timer_signal);
+  return true;
+}
+
+bool platform_hw_timer_set_func(os_param_t owner, void (*func)(os_param_t), os_param_t arg)
+{
+  if (owner != hw_timer_owner)
+    return false;
+  hw_timer_func = func;
+  hw_timer_arg = arg;
+  return true;
+}
+
+bool platform_hw_timer_arm_us(os_param_t owner, uint32_t microseconds)
+{
+  struct itimerval it = { { 0, 0 }, { microseconds / 1000000, microseconds % 1000000 } };
+
+  if (owner != hw_timer_owner)
+    return false;
+  if (hw_timer_autoload)
+    it.it_interval = it.it_value;
+  return setitimer(ITIMER_PROF, &it, NULL) == 0;
+}
+
+bool platform_hw_timer_close(os_param_t owner)
+{
+  struct itimerval it = { { 0, 0 }, { 0, 0 } };
+
+  if (owner != hw_timer_owner)
+    return false;
+  setitimer(ITIMER_PROF, &it, NULL);
+  hw_timer_func = NULL;
+  hw_timer_owner = 0;
+  return true;
+}
+
+/* ---------------------------------------------------------------------------
+ * The system clock, in microseconds since the start as on the device, so
+ * that it wraps after 71 minutes there too
+ */
+
+static uint64_t clock_start;
+
+static uint64_t clock_us(void)
+{
+  struct timespec ts;
+  uint64_t us;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  if (!clock_start)
+    clock_start = us;
+  return us - clock_start;
+}
+
+uint32 system_get_time(void)
+{
+  return (uint32)clock_us();
+}
+
+/* The RTC ticks at 1 us, which a calibration of 1.0 in 12 bit fixed point says */
+uint32 system_get_rtc_time(void)
+{
+  return system_get_time();
+}
+
+uint32 system_rtc_clock_cali_proc(void)
+{
+  return 1 << 12;
+}
+
+void system_timer_reinit(void)
+{
+}
+
+/* The CPU cycle counter, at the 80 MHz system_get_cpu_freq() reports */
+unsigned int xthal_get_ccount(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned int)((uint64_t)ts.tv_sec * 80000000 + ts.tv_nsec * 2 / 25);
+}
+
+uint8 system_get_cpu_freq(void)
+{
+  return 80;
+}
+
+void system_soft_wdt_feed(void)
+{
+}
+
+uint32 system_get_chip_id(void)
+{
+  return 0x00c0ffee;
+}
+
+/* There is nothing to restart into; the flash image is kept */
+void system_restart(void)
+{
+  fprintf(stderr, "system_restart()\n");
+  host_flash_close();
+  exit(1);
+}
+
+void ets_intr_lock(void)
+{
+}
+
+void ets_intr_unlock(void)
+{
+}
+
+/* ---------------------------------------------------------------------------
+ * The SDK task queues, highest priority first. As on the device, a post
+ * fails when the queue is full.
+ */
+
+#define SDK_PRIORITIES 3
+
+static struct {
+  os_task_t task;
+  os_event_t *queue;
+  uint8 qlen, head, count;
+} sdk_task[SDK_PRIORITIES];
+
+bool system_os_task(os_task_t task, uint8 prio, os_event_t *queue, uint8 qlen)
+{
+  if (prio >= SDK_PRIORITIES || !qlen)
+    return false;
+  sdk_task[prio].task = task;
+  sdk_task[prio].queue = queue;
+  sdk_task[prio].qlen = qlen;
+  sdk_task[prio].head = sdk_task[prio].count = 0;
+  return true;
+}
+
+bool system_os_post(uint8 prio, os_signal_t sig, os_param_t par)
+{
+  if (prio >= SDK_PRIORITIES || !sdk_task[prio].task || sdk_task[prio].count == sdk_task[prio].qlen)
+    return false;
+  os_event_t *e = &sdk_task[prio].queue[(sdk_task[prio].head + sdk_task[prio].count) % sdk_task[prio].qlen];
+  e->sig = sig;
+  e->par = par;
+  sdk_task[prio].count++;
+  return true;
+}
+
+/* Dispatches the oldest event of the highest priority, false if there is none */
+static bool task_dispatch_one(void)
+{
+  int p;
+
+  for (p = SDK_PRIORITIES - 1; p >= 0 && !sdk_task[p].count; p--)
+    ;
+  if (p < 0)
+    return false;
+  os_event_t e = sdk_task[p].queue[sdk_task[p].head];
+  sdk_task[p].head = (sdk_task[p].head + 1) % sdk_task[p].qlen;
+  sdk_task[p].count--;
+  sdk_task[p].task(&e);
+  return true;
+}
+
+static bool task_pending(void)
+{
+  int p;
+  for (p = 0; p < SDK_PRIORITIES; p++)
+    if (sdk_task[p].count)
+      return true;
+  return false;
+}
+
+/* ---------------------------------------------------------------------------
+ * The SDK timers, on a list in the order they expire. timer_expire is the
+ * system_get_time() to fire at, timer_period 0 for a one-shot timer.
+ */
+
+static ETSTimer *timer_list;
+
+static void timer_unlink(ETSTimer *t)
+{
+  ETSTimer **pp;
+  for (pp = &timer_list; *pp; pp = &(*pp)->timer_next)
+    if (*pp == t) {
+      *pp = t->timer_next;
+      break;
+    }
+  t->timer_next = NULL;
+}
+
+static void timer_link(ETSTimer *t)
+{
+  ETSTimer **pp = &timer_list;
+  while (*pp && (int32_t)((*pp)->timer_expire - t->timer_expire) <= 0)
+    pp = &(*pp)->timer_next;
+  t->timer_next = *pp;
+  *pp = t;
+}
+
+void ets_timer_setfn(ETSTimer *ptimer, ETSTimerFunc *pfunction, void *parg)
+{
+  ptimer->timer_func = pfunction;
+  ptimer->timer_arg = parg;
+}
+
+void ets_timer_disarm(ETSTimer *ptimer)
+{
+  timer_unlink(ptimer);
+}
+
+void ets_timer_arm_new(ETSTimer *ptimer, int time, int repeat_flag, int isMstimer)
+{
+  uint32 us = isMstimer ? (uint32)time * 1000 : (uint32)time;
+
+  timer_unlink(ptimer);
+  ptimer->timer_expire = system_get_time() + us;
+  ptimer->timer_period = repeat_flag ? (us ? us : 1) : 0;
+  timer_link(ptimer);
+}
+
+/* Fires the timers that are due */
+static void timers_run(void)
+{
+  uint32 now = system_get_time();
+  ETSTimer *t;
+
+  while ((t = timer_list) && (int32_t)(t->timer_expire - now) <= 0) {
+    timer_list = t->timer_next;
+    t->timer_next = NULL;
+    if (t->timer_period) {
+      /* Keeps the phase, but skips periods it is too late for */
+      t->timer_expire += t->timer_period;
+      if ((int32_t)(t->timer_expire - now) < 0)
+        t->timer_expire = now;
+      timer_link(t);
+    }
+    if (t->timer_func)
+      t->timer_func(t->timer_arg);
+  }
+}
+
+static bool timer_oneshot_armed(void)
+{
+  ETSTimer *t;
+  for (t = timer_list; t; t = t->timer_next)
+    if (!t->timer_period)
+      return true;
+  return false;
+}
+
+/* ---------------------------------------------------------------------------
+ * espconn over UDP sockets on the loopback interface. Received datagrams
+ * go to the receive callback from host_run(), as do the sent callbacks.
+ */
+
+#define HOST_CONNS 8
+
+static struct {
+  struct espconn *conn;
+  int fd;
+  remot_info from;   /* the sender of the last datagram */
+  bool sent;         /* the sent callback is due */
+} conns[HOST_CONNS];
+
+static int conn_find(const struct espconn *conn)
+{
+  int i;
+  for (i = 0; i < HOST_CONNS; i++)
+    if (conns[i].conn == conn)
+      return i;
+  return -1;
+}
+
+static void conn_addr(struct sockaddr_in *sa, const uint8 *ip, int port)
+{
+  memset(sa, 0, sizeof(*sa));
+  sa->sin_family = AF_INET;
+  sa->sin_port = htons(port);
+  if (ip)
+    memcpy(&sa->sin_addr.s_addr, ip, 4);
+  else
+    sa->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+sint8 espconn_create(struct espconn *espconn)
+{
+  struct sockaddr_in sa;
+  socklen_t len = sizeof(sa);
+  int i, fd;
+
+  if (!espconn || espconn->type != ESPCONN_UDP || !espconn->proto.udp)
+    return ESPCONN_ARG;
+  if (conn_find(espconn) >= 0)
+    return ESPCONN_ISCONN;
+  if ((i = conn_find(NULL)) < 0)
+    return ESPCONN_MAXNUM;
+  if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    return ESPCONN_MEM;
+  conn_addr(&sa, NULL, espconn->proto.udp->local_port);
+  if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+    close(fd);
+    return ESPCONN_ISCONN;
+  }
+  getsockname(fd, (struct sockaddr *)&sa, &len);
+  espconn->proto.udp->local_port = ntohs(sa.sin_port);
+  memset(&conns[i], 0, sizeof(conns[i]));
+  conns[i].conn = espconn;
+  conns[i].fd = fd;
+  return ESPCONN_OK;
+}
+
+sint8 espconn_delete(struct espconn *espconn)
+{
+  int i = conn_find(espconn);
+
+  if (!espconn || i < 0)
+    return ESPCONN_ARG;
+  close(conns[i].fd);
+  conns[i].conn = NULL;
+  return ESPCONN_OK;
+}
+
+sint8 espconn_sent(struct espconn *espconn, uint8 *psent, uint16 length)
+{
+  struct sockaddr_in sa;
+  int i = conn_find(espconn);
+
+  if (!espconn || i < 0)
+    return ESPCONN_ARG;
+  conn_addr(&sa, espconn->proto.udp->remote_ip, espconn->proto.udp->remote_port);
+  if (sendto(conns[i].fd, psent, length, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    return ESPCONN_IF;
+  conns[i].sent = true;
+  return ESPCONN_OK;
+}
+
+sint8 espconn_get_connection_info(struct espconn *pespconn, remot_info **pcon_info, uint8 typeflags)
+{
+  int i = conn_find(pespconn);
+
+  (void)typeflags;
+  if (!pespconn || i < 0)
+    return ESPCONN_ARG;
+  *pcon_info = &conns[i].from;
+  return ESPCONN_OK;
+}
+
+sint8 espconn_regist_recvcb(struct espconn *espconn, espconn_recv_callback recv_cb)
+{
+  espconn->recv_callback = recv_cb;
+  return ESPCONN_OK;
+}
+
+sint8 espconn_regist_sentcb(struct espconn *espconn, espconn_sent_callback sent_cb)
+{
+  espconn->sent_callback = sent_cb;
+  return ESPCONN_OK;
+}
+
+/* A local port that is free now */
+uint32 espconn_port(void)
+{
+  struct sockaddr_in sa;
+  socklen_t len = sizeof(sa);
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  uint32 port = 0;
+
+  conn_addr(&sa, NULL, 0);
+  if (fd >= 0 && bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0 &&
+      getsockname(fd, (struct sockaddr *)&sa, &len) == 0)
+    port = ntohs(sa.sin_port);
+  if (fd >= 0)
+    close(fd);
+  return port;
+}
+
+u32_t ipaddr_addr(const char *cp)
+{
+  struct in_addr a;
+  return inet_aton(cp, &a) ? a.s_addr : IPADDR_NONE;
+}
+
+static bool conn_open(void)
+{
+  int i;
+  for (i = 0; i < HOST_CONNS; i++)
+    if (conns[i].conn)
+      return true;
+  return false;
+}
+
+/* Waits up to wait_us, forever if it is negative, for datagrams, and
+   passes them to the receive callbacks; then calls the sent callbacks */
+static void conns_poll(int64_t wait_us)
+{
+  static char buf[2048];
+  struct timeval tv, *ptv = NULL;
+  fd_set fds;
+  int i, maxfd = -1;
+
+  FD_ZERO(&fds);
+  for (i = 0; i < HOST_CONNS; i++)
+    if (conns[i].conn) {
+      FD_SET(conns[i].fd, &fds);
+      if (conns[i].fd > maxfd)
+        maxfd = conns[i].fd;
+    }
+  if (wait_us >= 0) {
+    tv.tv_sec = wait_us / 1000000;
+    tv.tv_usec = wait_us % 1000000;
+    ptv = &tv;
+  }
+  /* The hardware timer signal cuts the wait short, which does no harm */
+  if (select(maxfd + 1, &fds, NULL, NULL, ptv) <= 0)
+    FD_ZERO(&fds);
+
+  for (i = 0; i < HOST_CONNS; i++) {
+    struct sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+    struct espconn *conn = conns[i].conn;
+    ssize_t n;
+
+    if (!conn || !FD_ISSET(conns[i].fd, &fds))
+      continue;
+    n = recvfrom(conns[i].fd, buf, sizeof(buf), 0, (struct sockaddr *)&sa, &len);
+    if (n < 0)
+      continue;
+    conns[i].from.state = ESPCONN_READ;
+    conns[i].from.remote_port = ntohs(sa.sin_port);
+    memcpy(conns[i].from.remote_ip, &sa.sin_addr.s_addr, 4);
+    if (conn->recv_callback) {
+      TRACE(TRACE_NET_RECV, n);
+      conn->recv_callback(conn, buf, n);
+      TRACE(TRACE_NET_RECV_END, n);
+    }
+  }
+
+  for (i = 0; i < HOST_CONNS; i++) {
+    struct espconn *conn = conns[i].conn;
+    if (conn && conns[i].sent) {
+      conns[i].sent = false;
+      if (conn->sent_callback) {
+        TRACE(TRACE_NET_SENT, 0);
+        conn->sent_callback(conn);
+        TRACE(TRACE_NET_SENT_END, 0);
+      }
+    }
+  }
+}
+
+/* ---------------------------------------------------------------------------
+ * The flash, a file mapped into memory. Writes can only clear bits, as on
+ * NOR flash, so SPIFFS has to erase sectors first as it does on the device.
+ * The image holds the file system only, from address 0, which is where
+ * spiffsimg puts it.
+ */
+
+static uint8_t *flash;
+static uint32_t flash_size;
+
+bool host_flash_open(const char *name, uint32_t size)
+{
+  struct stat st;
+  int fd = -1;
+
+  if (name) {
+    if ((fd = open(name, O_RDWR | O_CREAT, 0664)) < 0 || fstat(fd, &st) < 0) {
+      perror(name);
+      return false;
+    }
+    if (st.st_size)
+      size = st.st_size;
+  }
+  size &= ~(SPI_FLASH_SEC_SIZE - 1);
+  if (!size || (fd >= 0 && !st.st_size && ftruncate(fd, size) < 0)) {
+    fprintf(stderr, "%s: bad flash size\n", name ? name : "flash");
+    return false;
+  }
+  flash = mmap(NULL, size, PROT_READ | PROT_WRITE,
+               fd >= 0 ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS, fd, 0);
+  if (fd >= 0)
+    close(fd);
+  if (flash == MAP_FAILED) {
+    perror("mmap");
+    flash = NULL;
+    return false;
+  }
+  /* A new image starts erased */
+  if (fd < 0 || !st.st_size)
+    memset(flash, 0xff, size);
+  flash_size = size;
+  return true;
+}
+
+void host_flash_close(void)
+{
+  if (flash) {
+    msync(flash, flash_size, MS_SYNC);
+    munmap(flash, flash_size);
+    flash = NULL;
+  }
+}
+
+/* The last sectors hold the SDK's parameters, which are not in the image */
+uint16_t flash_safe_get_sec_num(void)
+{
+  return flash_size / SPI_FLASH_SEC_SIZE + SYS_PARAM_SEC_NUM;
+}
+
+uint32_t platform_flash_get_first_free_block_address(uint32_t *psect)
+{
+  if (psect)
+    *psect = 0;
+  return 0;
+}
+
+uint32_t platform_flash_get_sector_of_address(uint32_t addr)
+{
+  return addr / SPI_FLASH_SEC_SIZE;
+}
+
+uint32_t platform_flash_get_num_sectors(void)
+{
+  return flash_size / SPI_FLASH_SEC_SIZE;
+}
+
+int platform_flash_erase_sector(uint32_t sector_id)
+{
+  if (sector_id >= flash_size / SPI_FLASH_SEC_SIZE)
+    return PLATFORM_ERR;
+  memset(flash + sector_id * SPI_FLASH_SEC_SIZE, 0xff, SPI_FLASH_SEC_SIZE);
+  return PLATFORM_OK;
+}
+
+uint32_t platform_flash_write(const void *from, uint32_t toaddr, uint32_t size)
+{
+  const uint8_t *src = from;
+  uint32_t i;
+
+  if (toaddr >= flash_size || size > flash_size - toaddr)
+    return 0;
+  for (i = 0; i < size; i++)
+    flash[toaddr + i] &= src[i];
+  return size;
+}
+
+uint32_t platform_flash_read(void *to, uint32_t fromaddr, uint32_t size)
+{
+  if (fromaddr >= flash_size || size > flash_size - fromaddr)
+    return 0;
+  memcpy(to, flash + fromaddr, size);
+  return size;
+}
+
+/* ---------------------------------------------------------------------------
+ * The scheduler
+ */
+
+void host_run(void)
+{
+  for (;;) {
+    timers_run();
+    if (task_dispatch_one()) {
+      /* Timers and datagrams are not kept waiting behind a long queue */
+      if (conn_open())
+        conns_poll(0);
+      continue;
+    }
+    if (!timer_oneshot_armed() && !conn_open())
+      return;
+
+    int64_t wait = -1;
+    if (timer_list) {
+      wait = (int32_t)(timer_list->timer_expire - system_get_time());
+      if (wait < 0)
+        wait = 0;
+    }
+    conns_poll(wait);
+  }
+}
@@ -0,0 +1,34 @@
+-- Runs a script under the sampling Lua profiler and prints the folded
+-- stacks, one "frame;frame;... count" line per distinct stack, as taken
+-- by flamegraph.pl (https://github.com/brendangregg/FlameGraph).
+--
+--   ./nodemcu profile.lua script.lua [args] > out.folded
+--   flamegraph.pl out.folded > out.svg
+--
+-- On the device: PROFILE = "script.lua" dofile("profile.lua"), then copy
+-- the printed lines off the console.
+
+local script = arg and arg[1] or PROFILE
+assert(script, "no script to profile")
+if arg then
+  -- The profiled script sees its own arguments
+  local args = {}
+  for i = 0, #arg - 1 do args[i] = arg[i + 1] end
+  arg = args
+end
+
+-- On the host the script is a file of the host, not of the flash
+local run = host and assert(loadstring(host.readfile(script), "@" .. script))
+            or function() return dofile(script) end
+
+perf.luastart(1000, 16, 256)
+local ok, err = pcall(run)
+local total, stacks, dropped = perf.luastop()
+if not ok then print("# " .. tostring(err) .. ", profile of the run so far") end
+
+for stack, count in pairs(stacks) do
+  print(stack .. " " .. count)
+end
+if dropped > 0 then
+  print("# " .. dropped .. " of " .. total .. " samples dropped, more stacks are needed")
+end
@@ -0,0 +1,79 @@
+-- struct.pack/unpack on typical sensor protocol frames
+--
+-- Each frame is unpacked with a format string, with a compiled layout
+-- (struct.compile), and, for frames in a larger buffer, at an offset
+-- instead of cutting them out with string.sub. Rates are operations per
+-- second.
+--
+--   ./nodemcu struct_bench.lua
+--
+-- On the device: dofile("struct_bench.lua")
+
+local gettime = host and host.clock or function () return tmr.now() / 1e6 end
+
+-- Runs of at least `seconds`, as many as needed to measure
+local function rate(func, seconds)
+    local iter = 1
+    func()
+    while true do
+        local t = gettime()
+        for _ = 1, iter do func() end
+        t = gettime() - t
+        if t >= seconds then
+            return iter / t
+        end
+        iter = iter * (t > 0.01 and math.ceil(seconds / t) or 10)
+    end
+end
+
+local seconds = host and 0.2 or 1
+
+local frames = {
+    -- Modbus RTU read holding registers response: address, function,
+    -- byte count, 8 registers, CRC
+    { name = "modbus read", fmt = ">BBBHHHHHHHH<H",
+      values = { 17, 3, 16, 1, 2, 3, 4, 500, 600, 700, 800, 0x1234 } },
+    -- Modbus TCP header with a write single register request
+    { name = "modbus tcp", fmt = ">HHHBBHH",
+      values = { 1, 0, 6, 1, 6, 40001, 1234 } },
+    -- BLE advertising data: flags AD structure, then manufacturer data
+    -- with company id, temperature, humidity, battery and counter
+    { name = "ble adv", fmt = "<BBBBBHhHBI4",
+      values = { 2, 1, 6, 13, 0xff, 0x0499, -215, 4120, 87, 123456 } },
+    -- iBeacon: prefix, 16 byte UUID, major, minor, tx power
+    { name = "ibeacon", fmt = ">c9c16HHb",
+      values = { "\2\1\6\26\255\76\0\2\21", ("\170"):rep(16), 1, 2, -59 } },
+}
+
+print(("%-12s %10s %10s %10s %10s %10s"):format("frame", "pack",
+    "unpack", "compiled", "sub", "offset"))
+
+for _, f in ipairs(frames) do
+    local fmt, layout = f.fmt, struct.compile(f.fmt)
+    local v = f.values
+    local frame = struct.pack(fmt, unpack(v))
+    assert(frame == layout:pack(unpack(v)))
+
+    -- 32 frames back to back, as read from a UART or a file
+    local buffer = frame:rep(32)
+    local n = #frame
+
+    local r = {
+        rate(function () struct.pack(fmt, unpack(v)) end, seconds),
+        rate(function () struct.unpack(fmt, frame) end, seconds),
+        rate(function () layout:unpack(frame) end, seconds),
+        rate(function ()
+            for i = 1, #buffer, n do
+                struct.unpack(fmt, buffer:sub(i, i + n - 1))
+            end
+        end, seconds) * 32,
+        rate(function ()
+            local pos = 1
+            for _ = 1, 32 do
+                pos = select(-1, layout:unpack(buffer, pos))
+            end
+        end, seconds) * 32,
+    }
+    print(("%-12s %10.0f %10.0f %10.0f %10.0f %10.0f"):format(f.name,
+        r[1], r[2], r[3], r[4], r[5]))
+end
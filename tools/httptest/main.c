@@ -0,0 +1,341 @@
+/*
+ * Host tests and benchmark for the request parser and router of the httpd
+ * module, app/http/httpserver.c and httpchunked.c.
+ *
+ * A stub transport stands in for the tcp_pcb: it hands a raw byte stream
+ * to the parser in segments of a chosen size, the way lwIP delivers pbufs,
+ * and drives it as conn_input() in app/modules/httpd.c does, resetting the
+ * parser after each request so pipelined ones follow. Each request is
+ * routed through a table like the one httpd builds with srv:route() and
+ * answered with httpd_format_head(), and the outcome is logged as text
+ * for the tests to compare.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "httpserver.h"
+
+typedef struct {
+  uint8_t method;
+  bool prefix;
+  const char *path;            // as given to srv:route(), '*' at the end
+} route_t;
+
+static const route_t routes[] = {
+  { HTTPD_METHOD_GET,     false, "/" },
+  { HTTPD_METHOD_GET,     false, "/status" },
+  { HTTPD_METHOD_POST,    false, "/status" },
+  { HTTPD_METHOD_PUT,     true,  "/api/*" },
+  { HTTPD_METHOD_UNKNOWN, true,  "/api/*" },
+  { HTTPD_METHOD_GET,     true,  "/static/*" },
+  { HTTPD_METHOD_GET,     false, "/static/old" },  // never reached: first match wins
+};
+#define NROUTES (sizeof(routes) / sizeof(routes[0]))
+
+typedef struct {
+  httpd_parser_t parser;
+  char log[4096];              // one line per request, see on_headers()
+  size_t log_len;
+  char body[64];                // the start of the body, however it was split
+  size_t body_len;
+  int requests;
+  char head[256];              // last response head
+} conn_t;
+
+static int failures;
+static bool quiet;             // no logging, for the benchmark
+
+#define EXPECT(cond, ...) do { \
+    if (!(cond)) { printf("FAIL %s:%d: ", __func__, __LINE__); \
+                   printf(__VA_ARGS__); printf("\n"); failures++; } \
+  } while (0)
+
+static void log_add (conn_t *c, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void log_add (conn_t *c, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  c->log_len += vsnprintf(c->log + c->log_len, sizeof(c->log) - c->log_len, fmt, ap);
+  va_end(ap);
+  if (c->log_len >= sizeof(c->log))
+    c->log_len = sizeof(c->log) - 1;
+}
+
+static int find_route (const httpd_parser_t *p) {
+  unsigned i;
+  for (i = 0; i < NROUTES; i++) {
+    size_t len = strlen(routes[i].path) - routes[i].prefix;
+    if (httpd_route_match(p, routes[i].method, routes[i].prefix, routes[i].path, len))
+      return i;
+  }
+  return -1;
+}
+
+static int on_headers (httpd_parser_t *p, void *arg) {
+  conn_t *c = arg;
+  int r = find_route(p);
+
+  httpd_format_head(c->head, sizeof(c->head), r < 0 ? 404 : 200, r < 0 ? 0 : -1,
+                    (p->flags & HTTPD_REQ_KEEPALIVE) != 0, (p->flags & HTTPD_REQ_HTTP11) != 0);
+  c->body_len = 0;
+  if (!quiet) {
+    log_add(c, "%s %.*s", httpd_method_name(p->method), p->path_len, p->path);
+    if (p->query)
+      log_add(c, "?%.*s", p->query_len, p->query);
+    log_add(c, " route %d%s%s", r, p->flags & HTTPD_REQ_KEEPALIVE ? " keepalive" : "",
+         p->flags & HTTPD_REQ_CHUNKED ? " chunked" : "");
+  }
+  return 0;
+}
+
+static int on_body (httpd_parser_t *p, const char *data, size_t len, void *arg) {
+  conn_t *c = arg;
+  if (c->body_len < sizeof(c->body))
+    memcpy(c->body + c->body_len, data,
+           len < sizeof(c->body) - c->body_len ? len : sizeof(c->body) - c->body_len);
+  c->body_len += len;
+  return 0;
+}
+
+static int on_complete (httpd_parser_t *p, void *arg) {
+  conn_t *c = arg;
+  c->requests++;
+  if (!quiet)
+    log_add(c, " body %u [%.*s]\n", (unsigned)c->body_len,
+            (int)(c->body_len < sizeof(c->body) ? c->body_len : sizeof(c->body)), c->body);
+  return 0;
+}
+
+static const httpd_parser_cbs_t cbs = { on_headers, on_body, on_complete };
+
+// Feeds len bytes in segments of seg bytes, as conn_input() does.
+// Returns false at the first parse error, which is logged.
+static bool transport (conn_t *c, const char *data, size_t len, size_t seg) {
+  while (len) {
+    size_t n = len < seg ? len : seg;
+    const char *s = data;
+    size_t left = n;
+
+    while (left) {
+      int used;
+      if (httpd_parser_done(&c->parser))
+        httpd_parser_reset(&c->parser);
+      used = httpd_parser_feed(&c->parser, s, left, &cbs, c);
+      if (used < 0) {
+        if (!quiet)
+          log_add(c, "%serror %u\n", c->log_len && c->log[c->log_len - 1] != '\n' ? " " : "",
+                  c->parser.status);
+        httpd_parser_reset(&c->parser);
+        return false;
+      }
+      s += used;
+      left -= used;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+// Runs a byte stream through a new connection in segments of every size
+// from 1 byte up, expecting the same log each time
+static void check (const char *name, const char *stream, const char *expect) {
+  size_t len = strlen(stream), seg;
+
+  for (seg = 1; seg <= len; seg = seg < 16 ? seg + 1 : seg * 2) {
+    conn_t c;
+    memset(&c, 0, sizeof(c));
+    httpd_parser_init(&c.parser);
+    transport(&c, stream, len, seg);
+    c.log[c.log_len] = 0;
+    EXPECT(strcmp(c.log, expect) == 0, "%s in %u byte segments:\n%s---- expected\n%s", name,
+           (unsigned)seg, c.log, expect);
+    httpd_parser_free(&c.parser);
+    if (strcmp(c.log, expect))
+      break;
+  }
+}
+
+static void test_requests (void) {
+  check("get",
+        "GET / HTTP/1.1\r\nHost: esp\r\n\r\n",
+        "GET / route 0 keepalive body 0 []\n");
+  check("query and http/1.0",
+        "GET /status?verbose=1&x HTTP/1.0\r\n\r\n",
+        "GET /status?verbose=1&x route 1 body 0 []\n");
+  check("keep-alive on http/1.0, close on 1.1",
+        "GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n"
+        "GET / HTTP/1.1\r\nConnection: TE, close\r\n\r\n",
+        "GET / route 0 keepalive body 0 []\nGET / route 0 body 0 []\n");
+  check("leading empty lines and bare LF",
+        "\r\n\nGET /status HTTP/1.1\nHost: x\n\n",
+        "GET /status route 1 keepalive body 0 []\n");
+  check("content-length body",
+        "POST /status HTTP/1.1\r\nContent-Length: 11\r\n\r\nhello world",
+        "POST /status route 2 keepalive body 11 [hello world]\n");
+  check("empty body",
+        "POST /status HTTP/1.1\r\nContent-Length: 0\r\n\r\n",
+        "POST /status route 2 keepalive body 0 []\n");
+  check("chunked body with extension and trailer",
+        "PUT /api/x HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5;name=v\r\nhello\r\n1\r\n \r\nA\r\n0123456789\r\n0\r\nX-Sum: 1\r\n\r\n",
+        "PUT /api/x route 3 keepalive chunked body 16 [hello 0123456789]\n");
+  check("pipelined",
+        "GET /status HTTP/1.1\r\n\r\n"
+        "POST /status HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc"
+        "DELETE /api/v1/x HTTP/1.1\r\n\r\n",
+        "GET /status route 1 keepalive body 0 []\n"
+        "POST /status route 2 keepalive body 3 [abc]\n"
+        "DELETE /api/v1/x route 4 keepalive body 0 []\n");
+}
+
+static void test_routes (void) {
+  check("head takes get routes",
+        "HEAD /static/app.js HTTP/1.1\r\n\r\n",
+        "HEAD /static/app.js route 5 keepalive body 0 []\n");
+  check("exact paths only match exactly",
+        "GET /statusx HTTP/1.1\r\n\r\nGET /stat HTTP/1.1\r\n\r\nPUT /status HTTP/1.1\r\n\r\n",
+        "GET /statusx route -1 keepalive body 0 []\n"
+        "GET /stat route -1 keepalive body 0 []\n"
+        "PUT /status route -1 keepalive body 0 []\n");
+  check("prefix covers its own path, query not part of it",
+        "GET /api/ HTTP/1.1\r\n\r\nGET /api HTTP/1.1\r\n\r\nGET /api/?a=/b HTTP/1.1\r\n\r\n",
+        "GET /api/ route 4 keepalive body 0 []\n"
+        "GET /api route -1 keepalive body 0 []\n"
+        "GET /api/?a=/b route 4 keepalive body 0 []\n");
+  check("first match wins",
+        "GET /static/old HTTP/1.1\r\n\r\nPUT /api/a HTTP/1.1\r\n\r\nOPTIONS /api/a HTTP/1.1\r\n\r\n",
+        "GET /static/old route 5 keepalive body 0 []\n"
+        "PUT /api/a route 3 keepalive body 0 []\n"
+        "OPTIONS /api/a route 4 keepalive body 0 []\n");
+}
+
+static void test_errors (void) {
+  char big[HTTPD_HEADER_MAX + 64];
+
+  check("unknown method", "BREW /pot HTTP/1.1\r\n\r\n", "error 501\n");
+  check("no version", "GET /\r\n\r\n", "error 400\n");
+  check("http/2", "GET / HTTP/2.0\r\n\r\n", "error 505\n");
+  check("field without colon", "GET / HTTP/1.1\r\nHost\r\n\r\n", "error 400\n");
+  check("bad content-length", "POST / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n", "error 400\n");
+  check("huge content-length", "POST / HTTP/1.1\r\nContent-Length: 99999999999\r\n\r\n",
+        "error 400\n");
+  check("length and chunked",
+        "POST / HTTP/1.1\r\nContent-Length: 1\r\nTransfer-Encoding: chunked\r\n\r\n",
+        "error 400\n");
+  check("unknown coding", "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n", "error 501\n");
+  check("bad chunk size",
+        "PUT /api/x HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n",
+        "PUT /api/x route 3 keepalive chunked error 400\n");
+  check("error after a good request",
+        "GET / HTTP/1.1\r\n\r\nGET / HTTP/1.1\r\nBad\r\n\r\n",
+        "GET / route 0 keepalive body 0 []\nerror 400\n");
+
+  // A header block over HTTPD_HEADER_MAX is refused, one just below it not
+  memset(big, 0, sizeof(big));
+  strcpy(big, "GET / HTTP/1.1\r\nX-Pad: ");
+  memset(big + strlen(big), 'a', HTTPD_HEADER_MAX - strlen(big) - 5);
+  strcat(big, "\r\n\r\n");
+  check("largest header", big, "GET / route 0 keepalive body 0 []\n");
+  strcpy(big + strlen(big) - 4, "aa\r\n\r\n");
+  check("header too large", big, "error 431\n");
+}
+
+static void test_fields (void) {
+  static const char req[] =
+    "GET / HTTP/1.1\r\nHost:  esp \r\nACCEPT-Encoding:\tgzip, br\r\nX-Empty:\r\n\r\n";
+  httpd_parser_t p;
+  const char *pos = NULL, *name, *value;
+  int n = 0;
+
+  httpd_parser_init(&p);
+  EXPECT(httpd_parser_feed(&p, req, sizeof(req) - 1, &cbs, &(conn_t){ .log_len = 0 }) ==
+         sizeof(req) - 1, "request not taken whole");
+  EXPECT(httpd_parser_done(&p), "not done");
+  while (httpd_header_next(&p, &pos, &name, &value))
+    n++;
+  EXPECT(n == 3, "%d fields", n);
+  EXPECT(strcmp(httpd_header_get(&p, "host"), "esp") == 0, "host is '%s'", httpd_header_get(&p, "host"));
+  EXPECT(strcmp(httpd_header_get(&p, "accept-encoding"), "gzip, br") == 0, "accept-encoding");
+  EXPECT(strcmp(httpd_header_get(&p, "x-empty"), "") == 0, "x-empty");
+  EXPECT(httpd_header_get(&p, "Host") == NULL, "names are matched lower case");
+  httpd_parser_free(&p);
+}
+
+static void test_format (void) {
+  char buf[128];
+  size_t n;
+
+  n = httpd_format_head(buf, sizeof(buf), 200, 5, true, true);
+  buf[n] = 0;
+  EXPECT(strcmp(buf, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nConnection: keep-alive\r\n") == 0,
+         "head %s", buf);
+  n = httpd_format_head(buf, sizeof(buf), 404, -1, false, true);
+  buf[n] = 0;
+  EXPECT(strcmp(buf, "HTTP/1.1 404 Not Found\r\nTransfer-Encoding: chunked\r\n"
+                     "Connection: close\r\n") == 0, "head %s", buf);
+  EXPECT(httpd_format_head(buf, 20, 200, 5, true, true) == 0, "head fits in 20 bytes");
+  n = httpd_format_chunk_size(buf, 0x1a2b);
+  EXPECT(n == 6 && memcmp(buf, "1a2b\r\n", 6) == 0, "chunk size");
+}
+
+// Requests per second through the parser and router, for a browser-like
+// GET and a small POST, in TCP segments of 536 bytes and in single bytes
+static void benchmark (void) {
+  static const char *const reqs[] = {
+    "GET /static/app.js?v=3 HTTP/1.1\r\nHost: 192.168.4.1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/119.0\r\n"
+    "Accept: */*\r\nAccept-Language: en-US,en;q=0.5\r\nAccept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\nReferer: http://192.168.4.1/\r\n\r\n",
+    "POST /status HTTP/1.1\r\nHost: 192.168.4.1\r\nContent-Type: application/json\r\n"
+    "Content-Length: 27\r\n\r\n{\"led\":true,\"brightness\":7}",
+  };
+  static const size_t segs[] = { 536, 1 };
+  char stream[16384];
+  unsigned r, s;
+
+  quiet = true;
+  for (r = 0; r < 2; r++) {
+    size_t len = 0, one = strlen(reqs[r]);
+    int per_stream = 0;
+    while (len + one < sizeof(stream)) {
+      memcpy(stream + len, reqs[r], one);
+      len += one;
+      per_stream++;
+    }
+    for (s = 0; s < 2; s++) {
+      conn_t c;
+      clock_t start, t;
+      int rounds = 0;
+
+      memset(&c, 0, sizeof(c));
+      httpd_parser_init(&c.parser);
+      start = clock();
+      do {
+        EXPECT(transport(&c, stream, len, segs[s]), "benchmark request failed");
+        rounds++;
+      } while ((t = clock() - start) < CLOCKS_PER_SEC / 4);
+      EXPECT(c.requests == rounds * per_stream, "%d requests, not %d", c.requests,
+             rounds * per_stream);
+      printf("%-4s %3u byte request in %3u byte segments: %8.0f requests/s\n",
+             r ? "POST" : "GET", (unsigned)one, (unsigned)segs[s],
+             c.requests / ((double)t / CLOCKS_PER_SEC));
+      httpd_parser_free(&c.parser);
+    }
+  }
+  quiet = false;
+}
+
+int main (void) {
+  test_requests();
+  test_routes();
+  test_errors();
+  test_fields();
+  test_format();
+  benchmark();
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
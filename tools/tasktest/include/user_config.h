@@ -0,0 +1,7 @@
+/*
+ * The firmware's user_config.h, with the IRAM placement dropped for the host.
+ */
+#include "../../../app/include/user_config.h"
+
+#undef ICACHE_RAM_ATTR
+#define ICACHE_RAM_ATTR
@@ -0,0 +1,301 @@
+/*
+ * Host tests for app/task/task.c on a stub of the SDK task queues.
+ *
+ * system_os_post() fails when a queue is full, as on the device, and
+ * run() dispatches the highest priority event first. The clock is
+ * simulated: handlers advance it, so latencies and run times are exact.
+ * The interrupt lock checks that it is never nested and that the SDK is
+ * never entered with it held, since ets_post() takes it itself.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "task/task.h"
+#include "rom.h"
+
+#define SDK_PRIORITIES 3
+#define SDK_MAX_QLEN   64
+
+static struct {
+  os_task_t task;
+  os_event_t *queue;
+  int qlen, head, count, max_count;
+} sdk[SDK_PRIORITIES];
+
+static uint32 clock_us;
+static int locked, lock_errors;
+
+void ets_intr_lock(void)
+{
+  if (locked++)
+    lock_errors++;
+}
+
+void ets_intr_unlock(void)
+{
+  if (--locked)
+    lock_errors++;
+}
+
+uint32 system_get_time(void)
+{
+  return clock_us;
+}
+
+bool system_os_task(os_task_t task, uint8 prio, os_event_t *queue, uint8 qlen)
+{
+  if (prio >= SDK_PRIORITIES || qlen > SDK_MAX_QLEN)
+    return false;
+  sdk[prio].task = task;
+  sdk[prio].queue = queue;
+  sdk[prio].qlen = qlen;
+  return true;
+}
+
+bool system_os_post(uint8 prio, os_signal_t sig, os_param_t par)
+{
+  if (locked)
+    lock_errors++;
+  if (prio >= SDK_PRIORITIES || !sdk[prio].task || sdk[prio].count == sdk[prio].qlen)
+    return false;
+  os_event_t *e = &sdk[prio].queue[(sdk[prio].head + sdk[prio].count) % sdk[prio].qlen];
+  e->sig = sig;
+  e->par = par;
+  if (++sdk[prio].count > sdk[prio].max_count)
+    sdk[prio].max_count = sdk[prio].count;
+  return true;
+}
+
+/* Dispatches events until all queues are empty, returns how many */
+static int run(void)
+{
+  int n = 0, p;
+
+  for (;;) {
+    for (p = SDK_PRIORITIES - 1; p >= 0 && !sdk[p].count; p--)
+      ;
+    if (p < 0)
+      return n;
+    os_event_t e = sdk[p].queue[sdk[p].head];
+    sdk[p].head = (sdk[p].head + 1) % sdk[p].qlen;
+    sdk[p].count--;
+    sdk[p].task(&e);
+    n++;
+  }
+}
+
+/* What the handlers saw */
+static struct {
+  int tag;
+  uint8 prio;
+} seen[256];
+static int nseen;
+static uint32 handler_cost;
+
+static void record(task_param_t param, uint8 prio)
+{
+  if (nseen < 256) {
+    seen[nseen].tag = param;
+    seen[nseen].prio = prio;
+    nseen++;
+  }
+  clock_us += handler_cost;
+}
+
+/* Posts the next tag from inside a handler, as a chain of tasks would */
+static task_handle_t chain_handle;
+static void chain(task_param_t param, uint8 prio)
+{
+  record(param, prio);
+  if (param > 1)
+    task_post_low(chain_handle, param - 1);
+}
+
+static int failures;
+
+#define EXPECT(cond, ...) do { \
+    if (!(cond)) { printf("FAIL %s:%d: ", __func__, __LINE__); \
+                   printf(__VA_ARGS__); printf("\n"); failures++; } \
+  } while (0)
+
+static void reset(void)
+{
+  run();
+  nseen = 0;
+  handler_cost = 0;
+  task_reset_stats();
+}
+
+static task_handle_t handle;
+
+/* A burst four times the old SDK queue length arrives intact and in order */
+static void test_burst(void)
+{
+  task_queue_stats_t qs;
+  int i, ok = 0;
+
+  reset();
+  for (i = 0; i < 32; i++)
+    ok += task_post_high(handle, i);
+  EXPECT(ok == 32, "%d of 32 posts accepted", ok);
+  EXPECT(!task_post_high(handle, 99), "post to a full queue accepted");
+  task_queue_stats(TASK_PRIORITY_HIGH, &qs);
+  EXPECT(qs.posted == 32 && qs.dropped == 1 && qs.depth == 32 && qs.max_depth == 32 &&
+         qs.size == 32, "posted %u dropped %u depth %u max %u size %u",
+         qs.posted, qs.dropped, qs.depth, qs.max_depth, qs.size);
+  EXPECT(sdk[TASK_PRIORITY_HIGH].count == 1, "%d events in the SDK queue",
+         sdk[TASK_PRIORITY_HIGH].count);
+
+  EXPECT(run() == 32, "dispatch count");
+  for (i = 0; i < 32; i++)
+    EXPECT(seen[i].tag == i && seen[i].prio == TASK_PRIORITY_HIGH,
+           "event %d was %d at %d", i, seen[i].tag, seen[i].prio);
+  task_queue_stats(TASK_PRIORITY_HIGH, &qs);
+  EXPECT(qs.depth == 0 && qs.max_depth == 32, "depth %u max %u", qs.depth, qs.max_depth);
+}
+
+/* Higher priorities first, first in first out within one */
+static void test_priorities(void)
+{
+  static const int expect[] = { 2, 5, 1, 4, 0, 3 };
+  int i;
+
+  reset();
+  for (i = 0; i < 6; i++)
+    task_post(i % 3, handle, i);
+  run();
+  EXPECT(nseen == 6, "%d events", nseen);
+  for (i = 0; i < 6; i++)
+    EXPECT(seen[i].tag == expect[i] && seen[i].prio == expect[i] % 3,
+           "event %d was %d", i, seen[i].tag);
+}
+
+/* Handlers posting more work, and posts that interleave with dispatch */
+static void test_chain(void)
+{
+  task_queue_stats_t qs;
+
+  reset();
+  task_post_low(chain_handle, 100);
+  EXPECT(run() == 100, "chain dispatched %d", nseen);
+  EXPECT(seen[99].tag == 1, "chain ended at %d", seen[99].tag);
+  task_queue_stats(TASK_PRIORITY_LOW, &qs);
+  EXPECT(qs.posted == 100 && qs.max_depth == 1, "posted %u max %u", qs.posted, qs.max_depth);
+}
+
+/* Latency and run time per handler, on the simulated clock */
+static void test_timing(void)
+{
+  task_callback_t func;
+  task_stats_t ts;
+  int i;
+
+  reset();
+  handler_cost = 100;
+  for (i = 0; i < 5; i++)
+    task_post_medium(handle, i);
+  run();
+  task_handler_stats(0, &func, &ts);
+  EXPECT(func == record, "handler 0 is not record()");
+  EXPECT(ts.count == 5 && ts.run_us == 500 && ts.run_max_us == 100 &&
+         ts.latency_us == 0 + 100 + 200 + 300 + 400 && ts.latency_max_us == 400,
+         "count %u run %llu max %u latency %llu max %u", ts.count,
+         (unsigned long long)ts.run_us, ts.run_max_us,
+         (unsigned long long)ts.latency_us, ts.latency_max_us);
+
+  task_reset_stats();
+  task_handler_stats(0, &func, &ts);
+  EXPECT(ts.count == 0 && ts.latency_max_us == 0, "not reset");
+}
+
+/* Signals posted to the SDK queue directly still work, and a wake-up that
+ * found the SDK queue full is posted again by the next task_post() */
+static void test_direct(void)
+{
+  int i;
+
+  reset();
+  system_os_post(TASK_PRIORITY_LOW, handle | TASK_PRIORITY_LOW, 7);
+  system_os_post(TASK_PRIORITY_LOW, 2, 0);  /* invalid, ignored */
+  run();
+  EXPECT(nseen == 1 && seen[0].tag == 7, "direct post seen %d", nseen);
+
+  reset();
+  for (i = 0; i < sdk[TASK_PRIORITY_LOW].qlen; i++)
+    system_os_post(TASK_PRIORITY_LOW, 2, 0);
+  EXPECT(task_post_low(handle, 1), "post refused with the SDK queue full");
+  run();
+  EXPECT(nseen == 0, "dispatched without a wake-up");
+  task_post_low(handle, 2);
+  run();
+  EXPECT(nseen == 2 && seen[0].tag == 1 && seen[1].tag == 2, "lost after a failed wake-up");
+}
+
+/* Takes what a coalescing post accumulated, as an interrupt's task would */
+static task_handle_t coalesce_handle;
+static uint32 coalesce_bits, coalesce_count;
+static void coalesce(task_param_t param, uint8 prio)
+{
+  coalesce_bits = task_coalesce_take((task_coalesce_t *)param, &coalesce_count);
+  record(coalesce_bits, prio);
+}
+
+/* Many posts before the handler runs give one event with all their bits */
+static void test_coalesce(void)
+{
+  static task_coalesce_t c;
+  task_queue_stats_t qs;
+  int i, ok = 0;
+
+  reset();
+  for (i = 0; i < 100; i++)
+    ok += task_post_coalesced(TASK_PRIORITY_HIGH, coalesce_handle, &c, 1 << (i % 5));
+  EXPECT(ok == 100, "%d of 100 posts accepted", ok);
+  task_queue_stats(TASK_PRIORITY_HIGH, &qs);
+  EXPECT(qs.posted == 1 && qs.coalesced == 99 && qs.depth == 1,
+         "posted %u coalesced %u depth %u", qs.posted, qs.coalesced, qs.depth);
+  EXPECT(run() == 1, "more than one dispatch");
+  EXPECT(coalesce_bits == 0x1f && coalesce_count == 100, "bits %x count %u",
+         coalesce_bits, coalesce_count);
+
+  /* Once taken, the next post queues an event again */
+  task_post_coalesced(TASK_PRIORITY_HIGH, coalesce_handle, &c, 0x100);
+  EXPECT(run() == 1 && coalesce_bits == 0x100 && coalesce_count == 1,
+         "after take: bits %x count %u", coalesce_bits, coalesce_count);
+
+  /* A post refused by a full queue keeps the bits for the next one */
+  reset();
+  for (i = 0; i < 32; i++)
+    task_post_high(handle, i);
+  EXPECT(!task_post_coalesced(TASK_PRIORITY_HIGH, coalesce_handle, &c, 2),
+         "post to a full queue accepted");
+  run();
+  nseen = 0;
+  task_post_coalesced(TASK_PRIORITY_HIGH, coalesce_handle, &c, 4);
+  EXPECT(run() == 1 && coalesce_bits == 6 && coalesce_count == 2,
+         "after a drop: bits %x count %u", coalesce_bits, coalesce_count);
+}
+
+int main(void)
+{
+  handle = task_get_id(record);
+  chain_handle = task_get_id(chain);
+  coalesce_handle = task_get_id(coalesce);
+  EXPECT(handle && chain_handle && coalesce_handle, "task_get_id failed");
+  EXPECT(task_count_handlers() == 3, "%d handlers", task_count_handlers());
+
+  test_burst();
+  test_priorities();
+  test_chain();
+  test_timing();
+  test_direct();
+  test_coalesce();
+
+  EXPECT(lock_errors == 0, "%d nested locks or SDK calls under the lock", lock_errors);
+  EXPECT(sdk[0].max_count <= 4 && sdk[1].max_count <= 1 && sdk[2].max_count <= 1,
+         "SDK queues reached %d %d %d", sdk[0].max_count, sdk[1].max_count, sdk[2].max_count);
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
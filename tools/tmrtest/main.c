@@ -0,0 +1,221 @@
+/*
+ * Host tests for the timer wheel in app/modules/tmr_wheel.c, which runs
+ * the alarms of the tmr module.
+ *
+ * The tests drive the wheel as tmr.c does: ask tmr_wheel_next() when it
+ * next has work and call tmr_wheel_run() then, or later to simulate an
+ * SDK timer delayed by other work. Each timer checks that it runs at its
+ * tick, or as soon after it as the wheel was run, and in order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tmr_wheel.h"
+
+#define NTIMERS 2000
+
+typedef struct {
+  tmr_wheel_node_t node;       // first, tmr.c casts the same way
+  uint32_t due;                // tick it should run at
+  uint32_t interval;           // repeating if not 0
+  int runs;
+  bool deleted;
+} test_timer_t;
+
+static tmr_wheel_t wheel;
+static test_timer_t timers[NTIMERS];
+static uint32_t clock_tick;    // the tick the wheel is run at
+static uint32_t last_due;      // of the last timer run, for the order
+static uint32_t max_late;      // that the wheel is run after a tick
+static int failures, runs, order_errors, time_errors;
+
+#define EXPECT(cond, ...) do { \
+    if (!(cond)) { printf("FAIL %s:%d: ", __func__, __LINE__); \
+                   printf(__VA_ARGS__); printf("\n"); failures++; } \
+  } while (0)
+
+// Deterministic, so a failure can be rerun
+static uint32_t rnd_state = 12345;
+static uint32_t rnd (uint32_t n) {
+  rnd_state = rnd_state * 1103515245 + 12345;
+  return ((rnd_state >> 8) ^ (rnd_state << 7)) % n;
+}
+
+static void expired (tmr_wheel_node_t *node) {
+  test_timer_t *t = (test_timer_t *)node;
+
+  runs++;
+  t->runs++;
+  if (t->deleted || (int32_t)(clock_tick - t->due) < 0 || clock_tick - t->due > max_late ||
+      node->expires != t->due)
+    time_errors++;
+  if ((int32_t)(t->due - last_due) < 0)
+    order_errors++;
+  last_due = t->due;
+
+  if (t->interval) {
+    // As tmr.c: the next period from this expiry, skipping missed ones
+    uint32_t expires = node->expires + t->interval;
+    uint32_t late = wheel.now - expires;
+    if ((int32_t)late > 0)
+      expires += (late / t->interval + 1) * t->interval;
+    t->due = expires;
+    tmr_wheel_add(&wheel, node, expires);
+  }
+}
+
+static void start (uint32_t now) {
+  int i;
+
+  memset(timers, 0, sizeof(timers));
+  for (i = 0; i < NTIMERS; i++)
+    tmr_wheel_node_init(&timers[i].node);
+  tmr_wheel_init(&wheel, now);
+  clock_tick = now;
+  last_due = now;
+  runs = order_errors = time_errors = 0;
+}
+
+static void add (test_timer_t *t, uint32_t delay) {
+  t->due = wheel.now + delay;
+  tmr_wheel_add(&wheel, &t->node, t->due);
+}
+
+/*
+ * Runs the wheel until it is empty or the clock passes until, each time
+ * at its next tick plus a random lateness of up to late ticks
+ */
+static void drive (uint32_t until, uint32_t late) {
+  uint32_t next;
+
+  max_late = late;
+  while (tmr_wheel_next(&wheel, &next) && (int32_t)(next - until) <= 0) {
+    EXPECT((int32_t)(next - wheel.now) >= 0, "next %u before now %u", next, wheel.now);
+    clock_tick = next + (late ? rnd(late + 1) : 0);
+    tmr_wheel_run(&wheel, clock_tick, expired);
+  }
+}
+
+// One-shot timers from one tick to beyond the top level, all on time
+static void test_order (uint32_t now) {
+  int i;
+
+  start(now);
+  for (i = 0; i < NTIMERS; i++)
+    add(&timers[i], 1 + (i < NTIMERS / 2 ? rnd(2000) : rnd(1u << 27)));
+  drive(now + (1u << 28), 0);
+  EXPECT(runs == NTIMERS, "%d of %d ran", runs, NTIMERS);
+  EXPECT(time_errors == 0 && order_errors == 0, "%d off time, %d out of order",
+         time_errors, order_errors);
+  for (i = 0; i < 4; i++)
+    EXPECT(wheel.pending[i] == 0, "level %d not empty", i);
+}
+
+// Deleted and restarted timers, and the wheel run late under load
+static void test_delete_late (void) {
+  int i, expect = 0;
+
+  start(1000);
+  for (i = 0; i < NTIMERS; i++)
+    add(&timers[i], 1 + rnd(100000));
+  for (i = 0; i < NTIMERS; i += 3) {
+    tmr_wheel_del(&wheel, &timers[i].node);
+    timers[i].deleted = true;
+    EXPECT(!tmr_wheel_pending(&timers[i].node), "deleted timer pending");
+  }
+  for (i = 1; i < NTIMERS; i += 3)
+    add(&timers[i], 1 + rnd(100000));   // restarted
+  for (i = 0; i < NTIMERS; i++)
+    expect += !timers[i].deleted;
+
+  drive(1u << 30, 50);
+  EXPECT(runs == expect, "%d of %d ran", runs, expect);
+  EXPECT(time_errors == 0 && order_errors == 0, "%d off time, %d out of order",
+         time_errors, order_errors);
+}
+
+// Repeating timers keep their phase however late the wheel runs
+static void test_drift (void) {
+  static const uint32_t intervals[] = { 1, 7, 10, 33, 100, 1000, 1500, 60000 };
+  const int n = sizeof(intervals) / sizeof(intervals[0]);
+  uint32_t end = 10 * 60 * 1000;
+  int i;
+
+  start(0);
+  for (i = 0; i < n; i++) {
+    timers[i].interval = intervals[i];
+    add(&timers[i], intervals[i]);
+  }
+  // Busy: the wheel runs up to 25 ticks late, so the short ones skip
+  drive(end, 25);
+  EXPECT(time_errors == 0, "%d off time", time_errors);
+  for (i = 0; i < n; i++) {
+    EXPECT(timers[i].due % intervals[i] == 0, "interval %u drifted to phase %u",
+           intervals[i], timers[i].due % intervals[i]);
+    if (intervals[i] > 25)
+      EXPECT((uint32_t)timers[i].runs == end / intervals[i], "interval %u ran %d times",
+             intervals[i], timers[i].runs);
+  }
+}
+
+// Expiring timers that delete or restart others due at the same tick
+static bool deleted_one;
+static void deleter (tmr_wheel_node_t *node) {
+  int i;
+
+  runs++;
+  for (i = 0; i < 3 && !deleted_one; i++)
+    if (tmr_wheel_pending(&timers[i].node) && &timers[i].node != node) {
+      tmr_wheel_del(&wheel, &timers[i].node);
+      deleted_one = true;
+    }
+  tmr_wheel_add(&wheel, node, wheel.now - 5);   // in the past: next tick
+}
+
+static void test_callbacks (void) {
+  uint32_t next;
+
+  start(500);
+  add(&timers[0], 10);
+  add(&timers[1], 10);
+  add(&timers[2], 10);
+  tmr_wheel_run(&wheel, 510, deleter);
+  EXPECT(deleted_one && runs == 2, "%d ran with one deleted", runs);
+  EXPECT(tmr_wheel_next(&wheel, &next) && next == 511, "re-added for %u", next);
+  tmr_wheel_run(&wheel, 511, deleter);
+  EXPECT(runs == 4, "%d ran after the restart", runs);
+}
+
+// Adding and deleting take constant time, whatever the number of timers
+static void bench (void) {
+  const int rounds = 2000;
+  clock_t c;
+  int i, r;
+
+  start(0);
+  for (i = 0; i < NTIMERS; i++)
+    add(&timers[i], 1 + rnd(1u << 24));
+  c = clock();
+  for (r = 0; r < rounds; r++)
+    for (i = 0; i < NTIMERS; i++) {
+      tmr_wheel_del(&wheel, &timers[i].node);
+      tmr_wheel_add(&wheel, &timers[i].node, timers[i].due + r);
+    }
+  c = clock() - c;
+  printf("add and delete with %d timers: %.0f ns\n", NTIMERS,
+         (double)c / CLOCKS_PER_SEC * 1e9 / ((double)rounds * NTIMERS));
+}
+
+int main (void) {
+  test_order(0);
+  test_order(0xFFFFF000);   // the tick count wraps meanwhile
+  test_delete_late();
+  test_drift();
+  test_callbacks();
+  bench();
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,161 @@
+#!/usr/bin/env python
+#
+# Turns the output of node.trace.dump() into a timeline.
+#
+#   trace_decode.py [--chrome out.json] [console.log ...]
+#
+# Reads a console log, or standard input, and prints each dump found in it
+# as one line per tracepoint: the time in microseconds from the first one,
+# the time since the previous one, and the event, indented by nesting, with
+# the duration of the spans that ended. --chrome also writes the spans in
+# the trace event format of chrome://tracing and https://ui.perfetto.dev.
+#
+# The firmware records the CPU cycle count, which wraps every 53 seconds at
+# 80 MHz, so records further apart than that come out too close together.
+
+from __future__ import print_function
+
+import argparse
+import json
+import sys
+
+GC_STATES = ['pause', 'propagate', 'sweepstring', 'sweep', 'finalize']
+
+
+def describe(name, arg):
+    """The argument of a record, as a reader wants it"""
+    base = name[:-4] if name.endswith('_end') else name
+    if base == 'lua_call':
+        depth, low = arg >> 16, arg & 0xFFFF
+        if name.endswith('_end'):
+            return 'depth %d%s' % (depth, ' status %d' % low if low else '')
+        return 'depth %d %s' % (depth, 'line %d' % low if low else 'C function')
+    if base in ('gc_step', 'gc_full'):
+        return GC_STATES[arg] if arg < len(GC_STATES) else str(arg)
+    if base == 'task':
+        return 'handler %d' % arg
+    if base == 'net_recv':
+        return '%d bytes' % arg
+    if base == 'net_reconnect':
+        return 'error %d' % (arg - (1 << 24) if arg & (1 << 23) else arg)
+    if base == 'flash_erase':
+        return 'sector %d' % arg
+    return str(arg) if arg else ''
+
+
+def read_dumps(lines):
+    """Yields the dumps in the console output as (MHz, lost, records)"""
+    records = None
+    for line in lines:
+        fields = line.split()
+        if fields[:2] == ['TRACE', 'BEGIN'] and len(fields) == 5:
+            mhz, lost = int(fields[4]) or 80, int(fields[3])
+            records = []
+        elif fields == ['TRACE', 'END'] and records is not None:
+            yield mhz, lost, records
+            records = None
+        elif records is not None and len(fields) == 3:
+            try:
+                records.append((int(fields[0], 16), fields[1], int(fields[2], 16)))
+            except ValueError:
+                pass   # other output in between
+
+
+def timeline(mhz, records):
+    """The records with their time in us from the first, unwrapping the counter"""
+    events = []
+    t, last = 0, None
+    for ccount, name, arg in records:
+        if last is not None:
+            t += ((ccount - last) & 0xFFFFFFFF) / float(mhz)
+        last = ccount
+        events.append((t, name, arg))
+    return events
+
+
+def pair(events):
+    """Matches the ends to their starts: returns the index of the start of
+    each end, and of each start the index of its end"""
+    start_of, end_of = {}, {}
+    stack = []
+    for i, (t, name, arg) in enumerate(events):
+        if not name.endswith('_end'):
+            if name != 'mark':
+                stack.append(i)
+            continue
+        base = name[:-4]
+        depth = arg >> 16 if base == 'lua_call' else None
+        for j in range(len(stack) - 1, -1, -1):
+            s = stack[j]
+            if events[s][1] != base:
+                continue
+            # A Lua error skips the ends of the calls inside a pcall
+            if depth is not None and events[s][2] >> 16 > depth:
+                continue
+            start_of[i], end_of[s] = s, i
+            del stack[j:]
+            break
+    return start_of, end_of
+
+
+def print_timeline(mhz, lost, events, out):
+    start_of, end_of = pair(events)
+    print('%d records at %d MHz%s' %
+          (len(events), mhz, ', %d older ones lost' % lost if lost else ''), file=out)
+    level, prev = 0, 0.0
+    for i, (t, name, arg) in enumerate(events):
+        if i in start_of:
+            level = max(level - 1, 0)
+        text = '%12.1f %+10.1f  %s%s %s' % (t, t - prev, '  ' * level, name, describe(name, arg))
+        if i in start_of:
+            text += '  (%.1f us)' % (t - events[start_of[i]][0])
+        print(text.rstrip(), file=out)
+        if not name.endswith('_end') and name != 'mark':
+            level += 1
+        prev = t
+
+
+def chrome_events(pid, events):
+    start_of, end_of = pair(events)
+    result = []
+    for i, (t, name, arg) in enumerate(events):
+        if name.endswith('_end'):
+            continue
+        event = {'name': name, 'ts': t, 'pid': pid, 'tid': 0,
+                 'args': {'arg': describe(name, arg)}}
+        if name == 'mark' or i not in end_of:
+            event.update(ph='i', s='t')
+        else:
+            event.update(ph='X', dur=events[end_of[i]][0] - t)
+        result.append(event)
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode node.trace.dump() output')
+    parser.add_argument('logs', nargs='*', help='console output, else standard input')
+    parser.add_argument('--chrome', metavar='FILE', help='write a chrome://tracing file')
+    args = parser.parse_args()
+
+    lines = []
+    for name in args.logs:
+        with open(name) as f:
+            lines.extend(f)
+    if not args.logs:
+        lines = sys.stdin
+
+    chrome = []
+    for n, (mhz, lost, records) in enumerate(read_dumps(lines)):
+        events = timeline(mhz, records)
+        if n:
+            print()
+        print_timeline(mhz, lost, events, sys.stdout)
+        chrome.extend(chrome_events(n + 1, events))
+
+    if args.chrome:
+        with open(args.chrome, 'w') as f:
+            json.dump({'traceEvents': chrome, 'displayTimeUnit': 'ns'}, f)
+
+
+if __name__ == '__main__':
+    main()
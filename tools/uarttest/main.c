@@ -0,0 +1,193 @@
+/*
+ * Host tests for the byte ring in app/driver/uart_ring.c, which queues the
+ * output of UART0 for its TX interrupt.
+ *
+ * The writer puts a numbered byte stream in pieces of random sizes and the
+ * reader takes it the way uart0_tx_fill() does, peeking the contiguous runs
+ * and skipping what a FIFO of random room took. Every byte must come out
+ * once and in order, and the counts must agree with what was put and taken.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "driver/uart_ring.h"
+
+#define MAX_SIZE 4096
+
+static int failures;
+
+#define EXPECT(cond, ...) do { \
+    if (!(cond)) { printf("FAIL %s:%d: ", __func__, __LINE__); \
+                   printf(__VA_ARGS__); printf("\n"); failures++; } \
+  } while (0)
+
+// Deterministic, so a failure can be rerun
+static uint32_t rnd_state = 12345;
+static uint32_t rnd (uint32_t n) {
+  rnd_state = rnd_state * 1103515245 + 12345;
+  return ((rnd_state >> 8) ^ (rnd_state << 7)) % n;
+}
+
+static uint8_t stream_byte (uint32_t i) {
+  return (uint8_t)(i ^ i >> 8 ^ i >> 16);
+}
+
+// Takes up to room bytes as the interrupt would, checking them against
+// the stream from *taken on; returns how many it took
+static uint16_t take (uart_ring_t *r, uint16_t room, uint32_t *taken) {
+  const uint8_t *data;
+  uint16_t n, i, total = 0;
+
+  while (room && (n = uart_ring_peek(r, &data)) != 0) {
+    if (n > room)
+      n = room;
+    EXPECT(data >= r->buf && data + n <= r->buf + r->mask + 1, "run outside the buffer");
+    for (i = 0; i < n; i++)
+      if (data[i] != stream_byte(*taken + i)) {
+        EXPECT(0, "byte %u is %02x, not %02x", (unsigned)(*taken + i), data[i],
+               stream_byte(*taken + i));
+        break;
+      }
+    uart_ring_skip(r, n);
+    *taken += n;
+    total += n;
+    room -= n;
+  }
+  return total;
+}
+
+static void test_edges (void) {
+  static uint8_t buf[16], in[32];
+  uart_ring_t r = UART_RING_INIT(buf, sizeof(buf));
+  const uint8_t *data;
+  uint32_t taken = 0, i;
+
+  for (i = 0; i < sizeof(in); i++)
+    in[i] = stream_byte(i);
+  EXPECT(uart_ring_used(&r) == 0 && uart_ring_free(&r) == 16, "not empty at first");
+  EXPECT(uart_ring_peek(&r, &data) == 0, "peek of an empty ring");
+  EXPECT(uart_ring_put(&r, in, 0) == 0, "put of nothing");
+
+  // Fills up entirely, no byte kept free, and a put beyond is cut short
+  EXPECT(uart_ring_put(&r, in, 20) == 16, "put into an empty ring");
+  EXPECT(uart_ring_free(&r) == 0 && uart_ring_used(&r) == 16, "not full");
+  EXPECT(uart_ring_put(&r, in + 16, 1) == 0, "put into a full ring");
+
+  // Taking a few makes room for as many, which wrap around to the start
+  EXPECT(take(&r, 5, &taken) == 5, "take of 5");
+  EXPECT(uart_ring_put(&r, in + 16, 8) == 5, "put after a take");
+  EXPECT(uart_ring_peek(&r, &data) == 11 && data == buf + 5, "first run");
+  EXPECT(take(&r, 11, &taken) == 11, "take of the first run");
+  EXPECT(uart_ring_peek(&r, &data) == 5 && data == buf, "second run");
+  EXPECT(take(&r, 100, &taken) == 5, "take of the rest");
+  EXPECT(uart_ring_used(&r) == 0 && taken == 21, "not empty at the end");
+}
+
+// The counters wrap at 2^16, which must not show in used and free
+static void test_wrap (void) {
+  static uint8_t buf[64], in[64];
+  uart_ring_t r = UART_RING_INIT(buf, sizeof(buf));
+  uint32_t put = 0xFFF0, taken = 0xFFF0, i;
+
+  r.head = r.tail = (uint16_t)put;
+  for (i = 0; i < 40; i++) {
+    uint16_t j, n = 1 + rnd(sizeof(in));
+    for (j = 0; j < n; j++)
+      in[j] = stream_byte(put + j);
+    n = uart_ring_put(&r, in, n);
+    put += n;
+    EXPECT(uart_ring_used(&r) == put - taken, "used %u, not %u", uart_ring_used(&r),
+           (unsigned)(put - taken));
+    EXPECT(uart_ring_used(&r) + uart_ring_free(&r) == sizeof(buf), "used and free");
+    take(&r, rnd(80), &taken);
+  }
+  EXPECT(put > 0x10000 && r.head == (uint16_t)put, "head did not wrap");
+}
+
+// Random interleavings of puts and takes, for sizes from 1 up
+static void test_random (void) {
+  static uint8_t buf[MAX_SIZE], in[MAX_SIZE * 2];
+  unsigned size;
+
+  for (size = 1; size <= MAX_SIZE; size *= 2) {
+    uart_ring_t r = UART_RING_INIT(buf, size);
+    uint32_t put = 0, taken = 0;
+    int i;
+
+    memset(buf, 0xEE, sizeof(buf));
+    for (i = 0; i < 20000; i++) {
+      if (rnd(2)) {
+        uint16_t j, n = rnd(size * 2 + 1), free = uart_ring_free(&r);
+        for (j = 0; j < n; j++)
+          in[j] = stream_byte(put + j);
+        j = uart_ring_put(&r, in, n);
+        EXPECT(j == (n < free ? n : free), "size %u: put %u of %u with %u free", size, j, n, free);
+        put += j;
+      } else {
+        take(&r, rnd(130), &taken);
+      }
+      if (uart_ring_used(&r) != (uint16_t)(put - taken)) {
+        EXPECT(0, "size %u: used %u, not %u", size, uart_ring_used(&r), (unsigned)(put - taken));
+        break;
+      }
+    }
+    take(&r, 0xFFFF, &taken);
+    EXPECT(taken == put, "size %u: %u put, %u taken", size, (unsigned)put, (unsigned)taken);
+    // Nothing was written outside the ring
+    for (i = size; i < MAX_SIZE; i++)
+      if (buf[i] != 0xEE) {
+        EXPECT(0, "size %u: byte %d past the end written", size, i);
+        break;
+      }
+  }
+}
+
+// A writer and a reader in two threads, as task and interrupt on the chip
+#define THREAD_BYTES 2000000
+
+static uart_ring_t shared;
+
+static void *reader (void *arg) {
+  uint32_t *taken = arg;
+
+  // Gives way when there is nothing to take, for hosts with one CPU
+  while (*taken < THREAD_BYTES)
+    if (take(&shared, 1 + (*taken & 127), taken) == 0)
+      sched_yield();
+  return NULL;
+}
+
+static void test_threads (void) {
+  static uint8_t buf[512], in[300];
+  pthread_t thread;
+  uint32_t put = 0, taken = 0;
+
+  shared = (uart_ring_t)UART_RING_INIT(buf, sizeof(buf));
+  pthread_create(&thread, NULL, reader, &taken);
+  while (put < THREAD_BYTES) {
+    uint16_t j, n = 1 + put % sizeof(in);
+    if (n > THREAD_BYTES - put)
+      n = THREAD_BYTES - put;
+    for (j = 0; j < n; j++)
+      in[j] = stream_byte(put + j);
+    j = uart_ring_put(&shared, in, n);
+    if (j == 0)
+      sched_yield();
+    put += j;
+  }
+  pthread_join(thread, NULL);
+  EXPECT(taken == put, "%u put, %u taken", (unsigned)put, (unsigned)taken);
+}
+
+int main (void) {
+  test_edges();
+  test_wrap();
+  test_random();
+  test_threads();
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,355 @@
+/*
+ * Host tests and benchmark for the websocket frame parser in
+ * app/websocket/websocketframe.c.
+ *
+ * Frames are encoded here, masked or not, and fed to the parser in
+ * segments of every size from one byte up, the way espconn delivers them.
+ * receive() drives the parser as ws_receiveCallback() in websocketclient.c
+ * does and reassembles fragmented messages, so each stream must give back
+ * the same messages, control frames in between, whatever the split.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "websocketframe.h"
+
+#define MAX_STREAM (70000 * 3)
+
+typedef struct {
+  ws_parser parser;
+  uint8_t opCode;              // of the message being reassembled
+  char *message;
+  size_t messageLen, messageCap;
+  int messages, controls, frames;
+  char log[1024];              // "opcode:length" per message or control frame
+  size_t logLen;
+  bool error;
+} receiver_t;
+
+static int failures;
+static bool quiet;             // no reassembly or logging, for the benchmark
+
+#define EXPECT(cond, ...) do { \
+    if (!(cond)) { printf("FAIL %s:%d: ", __func__, __LINE__); \
+                   printf(__VA_ARGS__); printf("\n"); failures++; } \
+  } while (0)
+
+// Deterministic, so a failure can be rerun
+static uint32_t rnd_state = 12345;
+static uint32_t rnd (uint32_t n) {
+  rnd_state = rnd_state * 1103515245 + 12345;
+  return ((rnd_state >> 8) ^ (rnd_state << 7)) % n;
+}
+
+static char payload_byte (size_t i) {
+  return (char)(i * 7 + (i >> 8));
+}
+
+// Appends a frame with len bytes of the test payload from offset on,
+// masked with a random key if masked; returns the new stream length
+static size_t encode (char *out, size_t pos, uint8_t first, bool masked, size_t len, size_t offset) {
+  uint8_t *h = (uint8_t *)out + pos, mask[4];
+  size_t i, n = 2;
+
+  h[0] = first;
+  if (len < 126) {
+    h[1] = len;
+  } else if (len < 65536) {
+    h[1] = 126;
+    h[2] = len >> 8;
+    h[3] = len;
+    n = 4;
+  } else {
+    h[1] = 127;
+    memset(h + 2, 0, 4);
+    h[6] = len >> 24;
+    h[7] = len >> 16;
+    h[8] = len >> 8;
+    h[9] = len;
+    n = 10;
+  }
+  if (masked) {
+    h[1] |= 0x80;
+    for (i = 0; i < 4; i++)
+      h[n++] = mask[i] = rnd(256);
+  }
+  for (i = 0; i < len; i++)
+    out[pos + n + i] = payload_byte(offset + i) ^ (masked ? mask[i & 3] : 0);
+  return pos + n + len;
+}
+
+static void log_add (receiver_t *r, uint8_t opCode, size_t len) {
+  r->logLen += snprintf(r->log + r->logLen, sizeof(r->log) - r->logLen, "%s%x:%u",
+                        r->logLen ? " " : "", opCode, (unsigned)len);
+  if (r->logLen >= sizeof(r->log))
+    r->logLen = sizeof(r->log) - 1;
+}
+
+static void append (receiver_t *r, const char *data, size_t len) {
+  size_t i;
+  if (r->messageLen + len > r->messageCap) {
+    r->messageCap = (r->messageLen + len) * 2;
+    r->message = realloc(r->message, r->messageCap);
+  }
+  memcpy(r->message + r->messageLen, data, len);
+  // Check the unmasked payload against what was encoded
+  for (i = 0; i < len; i++)
+    if (data[i] != payload_byte(r->messageLen + i)) {
+      EXPECT(0, "byte %u of a message wrong", (unsigned)(r->messageLen + i));
+      break;
+    }
+  r->messageLen += len;
+}
+
+// One received segment, parsed as ws_receiveCallback() does
+static void receive (receiver_t *r, char *in, unsigned int inLen) {
+  char *data;
+  unsigned int dataLen;
+  int result;
+
+  do {
+    result = ws_parserNext(&r->parser, &in, &inLen, &data, &dataLen);
+    if (result == WS_PARSE_ERROR) {
+      r->error = true;
+      return;
+    }
+    if (result == WS_PARSE_HEADER) {
+      ws_parser *p = &r->parser;
+      r->frames++;
+      if (!quiet && !WS_OPCODE_IS_CONTROL(p->opCode)) {
+        // A continuation needs a message to continue, a new one none
+        if ((p->opCode == WS_OPCODE_CONTINUATION) != (r->opCode != 0)) {
+          r->error = true;
+          return;
+        }
+        if (p->opCode != WS_OPCODE_CONTINUATION) {
+          r->opCode = p->opCode;
+          r->messageLen = 0;
+        }
+      }
+      continue;
+    }
+    if (quiet)
+      continue;
+
+    ws_parser *p = &r->parser;
+    if (WS_OPCODE_IS_CONTROL(p->opCode)) {
+      // Control payloads are short and come whole, from the same test data
+      if (result == WS_PARSE_FRAME_END) {
+        r->controls++;
+        log_add(r, p->opCode, p->payloadLength);
+      }
+      continue;
+    }
+    append(r, data, dataLen);
+    if (result == WS_PARSE_FRAME_END && p->isFin) {
+      r->messages++;
+      log_add(r, r->opCode, r->messageLen);
+      r->opCode = 0;
+    }
+  } while (inLen > 0 || result == WS_PARSE_HEADER);
+}
+
+// Feeds a stream in segments of every size from 1 byte up, expecting the
+// same log, and an error or none, each time. The parser unmasks in place,
+// so each run gets a fresh copy.
+static void check (const char *name, const char *stream, size_t len, const char *expect,
+                   bool error) {
+  static char copy[MAX_STREAM];
+  size_t seg;
+
+  for (seg = 1; seg <= len; seg = seg < 32 ? seg + 1 : seg * 3 / 2) {
+    receiver_t r;
+    size_t pos;
+
+    memset(&r, 0, sizeof(r));
+    ws_parserInit(&r.parser);
+    memcpy(copy, stream, len);
+    for (pos = 0; pos < len && !r.error; pos += seg)
+      receive(&r, copy + pos, len - pos < seg ? len - pos : seg);
+    r.log[r.logLen] = 0;
+    EXPECT(strcmp(r.log, expect) == 0 && r.error == error, "%s in %u byte segments: '%s'%s",
+           name, (unsigned)seg, r.log, r.error ? " error" : "");
+    free(r.message);
+    if (strcmp(r.log, expect) || r.error != error)
+      break;
+  }
+}
+
+// Payload lengths at the edges of the 7 bit, 16 bit and 64 bit encodings
+static void test_lengths (void) {
+  static char stream[MAX_STREAM];
+  static const size_t lengths[] = { 0, 1, 125, 126, 127, 65535, 65536, 65537 };
+  char expect[32];
+  unsigned i, masked;
+
+  for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    for (masked = 0; masked < 2; masked++) {
+      size_t len = encode(stream, 0, 0x82, masked, lengths[i], 0);
+      size_t header = len - lengths[i];
+      EXPECT(header == (lengths[i] < 126 ? 2 : lengths[i] < 65536 ? 4 : 10) + 4 * masked,
+             "%u byte header for %u bytes", (unsigned)header, (unsigned)lengths[i]);
+      snprintf(expect, sizeof(expect), "2:%u", (unsigned)lengths[i]);
+      // The long ones take too long byte by byte, so split only their header
+      if (lengths[i] > 1000) {
+        receiver_t r;
+        size_t pos;
+        memset(&r, 0, sizeof(r));
+        ws_parserInit(&r.parser);
+        for (pos = 0; pos < header; pos++)
+          receive(&r, stream + pos, 1);
+        receive(&r, stream + header, len - header - 1);
+        receive(&r, stream + len - 1, 1);
+        r.log[r.logLen] = 0;
+        EXPECT(strcmp(r.log, expect) == 0 && !r.error, "%u bytes, masked %u: '%s'",
+               (unsigned)lengths[i], masked, r.log);
+        free(r.message);
+      } else {
+        check("length", stream, len, expect, false);
+      }
+    }
+}
+
+// Messages in several frames, with control frames in between
+static void test_fragments (void) {
+  static char stream[4096];
+  size_t len;
+
+  len = encode(stream, 0, 0x01, true, 10, 0);          // text, not final
+  len = encode(stream, len, 0x00, true, 300, 10);      // continuation
+  len = encode(stream, len, 0x89, true, 4, 0);         // ping in between
+  len = encode(stream, len, 0x00, true, 0, 310);       // empty continuation
+  len = encode(stream, len, 0x80, true, 5, 310);       // final continuation
+  len = encode(stream, len, 0x82, false, 200, 0);      // a whole binary message
+  len = encode(stream, len, 0x02, false, 1, 0);        // binary in two frames
+  len = encode(stream, len, 0x8A, false, 0, 0);        // pong in between
+  len = encode(stream, len, 0x80, false, 127, 1);
+  len = encode(stream, len, 0x88, true, 2, 0);         // close
+  check("fragments", stream, len, "9:4 1:315 2:200 a:0 2:128 8:2", false);
+
+  // A continuation without a message, and a message inside another
+  len = encode(stream, 0, 0x80, false, 3, 0);
+  check("stray continuation", stream, len, "", true);
+  len = encode(stream, 0, 0x01, false, 3, 0);
+  len = encode(stream, len, 0x81, false, 3, 0);
+  check("nested message", stream, len, "", true);
+}
+
+// Masks at every byte offset and buffer alignment, against a plain XOR
+static void test_mask (void) {
+  static const uint8_t mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+  char src[80], dst[80], ref[80];
+  unsigned off, align, len, i;
+
+  for (off = 0; off < 8; off++)
+    for (align = 0; align < 4; align++)
+      for (len = 0; len < 64; len++) {
+        for (i = 0; i < len; i++) {
+          src[align + i] = rnd(256);
+          ref[i] = src[align + i] ^ mask[(off + i) & 3];
+        }
+        ws_applyMask(dst + (3 - align), src + align, len, mask, off);
+        EXPECT(memcmp(dst + (3 - align), ref, len) == 0, "offset %u, alignment %u, %u bytes",
+               off, align, len);
+        ws_applyMask(src + align, src + align, len, mask, off);
+        EXPECT(memcmp(src + align, ref, len) == 0, "in place: offset %u, alignment %u, %u bytes",
+               off, align, len);
+      }
+}
+
+// Headers cut short, and headers no frame may have
+static void test_headers (void) {
+  static const struct {
+    const char *name;
+    const char *bytes;
+    size_t len;
+  } bad[] = {
+    { "rsv bits",               "\xc1\x00", 2 },
+    { "reserved opcode",        "\x83\x00", 2 },
+    { "reserved control",       "\x8b\x00", 2 },
+    { "fragmented ping",        "\x09\x00", 2 },
+    { "long ping",              "\x89\x7e\x00\x7e", 4 },
+    { "over 4 GB",              "\x82\x7f\x00\x00\x00\x01\x00\x00\x00\x00", 10 },
+  };
+  static char stream[64];
+  unsigned i;
+  size_t len, cut;
+
+  for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    memcpy(stream, bad[i].bytes, bad[i].len);
+    check(bad[i].name, stream, bad[i].len, "", true);
+  }
+
+  // A header cut anywhere reports nothing and wants more
+  for (len = 0; len < 3; len++) {
+    size_t sizes[] = { 3, 200, 70000 };
+    static char frame[70100], copy[70100];
+    size_t n = encode(frame, 0, 0x81, true, sizes[len], 0);
+    size_t header = n - sizes[len];
+    for (cut = 0; cut < header; cut++) {
+      receiver_t r;
+      memset(&r, 0, sizeof(r));
+      ws_parserInit(&r.parser);
+      memcpy(copy, frame, n);
+      if (cut)
+        receive(&r, copy, cut);
+      EXPECT(r.frames == 0 && !r.error && r.logLen == 0, "%u byte header cut at %u",
+             (unsigned)header, (unsigned)cut);
+      // The rest completes it
+      receive(&r, copy + cut, n - cut);
+      EXPECT(r.messages == 1 && r.messageLen == sizes[len], "%u byte header cut at %u",
+             (unsigned)header, (unsigned)cut);
+      free(r.message);
+    }
+  }
+}
+
+// Megabytes per second through the parser, for masked and unmasked
+// messages in 1460 byte TCP segments
+static void benchmark (void) {
+  static char stream[1 << 20], copy[1 << 20];
+  static const size_t sizes[] = { 16, 1024, 65536 };
+  unsigned s, masked;
+
+  quiet = true;
+  for (s = 0; s < 3; s++)
+    for (masked = 0; masked < 2; masked++) {
+      size_t len = 0, pos;
+      int frames = 0, rounds = 0;
+      receiver_t r;
+      clock_t start, t;
+
+      while (len + sizes[s] + 14 <= sizeof(stream)) {
+        len = encode(stream, len, 0x82, masked, sizes[s], 0);
+        frames++;
+      }
+      memset(&r, 0, sizeof(r));
+      ws_parserInit(&r.parser);
+      start = clock();
+      do {
+        // Unmasking is in place: parse a copy, as from a fresh segment
+        memcpy(copy, stream, len);
+        for (pos = 0; pos < len; pos += 1460)
+          receive(&r, copy + pos, len - pos < 1460 ? len - pos : 1460);
+        rounds++;
+      } while ((t = clock() - start) < CLOCKS_PER_SEC / 4);
+      EXPECT(!r.error && r.frames == frames * rounds, "%d frames, not %d", r.frames,
+             frames * rounds);
+      printf("%5u byte %-8s frames: %7.1f MB/s\n", (unsigned)sizes[s],
+             masked ? "masked" : "unmasked", (double)len * rounds / 1e6 / ((double)t / CLOCKS_PER_SEC));
+    }
+  quiet = false;
+}
+
+int main (void) {
+  test_lengths();
+  test_fragments();
+  test_mask();
+  test_headers();
+  benchmark();
+  printf("%d failures\n", failures);
+  return failures != 0;
+}